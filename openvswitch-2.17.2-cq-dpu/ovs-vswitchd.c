@@ -26,13 +26,16 @@
 #endif
 
 #include "bridge.h"
+#include "cmap.h"
 #include "command-line.h"
 #include "compiler.h"
+#include "coverage.h"
 #include "daemon.h"
 #include "dirs.h"
 #include "dpif.h"
 #include "dummy.h"
 #include "fatal-signal.h"
+#include "hash.h"
 #include "memory.h"
 #include "netdev.h"
 #include "openflow/openflow.h"
@@ -40,6 +43,8 @@
 #include "ovs-rcu.h"
 #include "ovs-router.h"
 #include "ovs-thread.h"
+#include "packets.h"
+#include "openvswitch/dynamic-string.h"
 #include "openvswitch/poll-loop.h"
 #include "simap.h"
 #include "stream-ssl.h"
@@ -55,17 +60,28 @@
 #include "lib/dns-resolve.h"
 
 #include <time.h>
+#include <fcntl.h>
+#include <sys/mman.h>
 #include <rte_malloc.h>
 #include <rte_mempool.h>
+#include <rte_memzone.h>
+#include <rte_pause.h>
+#include "seq.h"
 #include "../lib/dpif-netdev.h"
 #include <unistd.h>
 
 VLOG_DEFINE_THIS_MODULE(vswitchd);
 
+COVERAGE_DEFINE(hopa_cp_out_ring_drop);
+
 /* --mlockall: If set, locks all process memory into physical RAM, preventing
  * the kernel from paging any of its memory to disk. */
 static bool want_mlockall;
 
+/* --hopa-cp-external: If set, the HOPA CP resources are only exported, the
+ * CP itself runs as a DPDK secondary process (repath_cp's hopa_cp -o). */
+static bool hopa_cp_external;
+
 static unixctl_cb_func ovs_vswitchd_exit;
 
 static char *parse_options(int argc, char *argv[], char **unixctl_path);
@@ -80,14 +96,39 @@ struct ovs_vswitchd_exit_args {
 
 #define IPV4_ADDR(a, b, c, d) (((a & 0xff) << 24) | ((b & 0xff) << 16) | ((c & 0xff) << 8) | (d & 0xff))
 
-#define NUM_MBUFS (8191)
-#define MBUF_CACHE_SIZE (512)
+/* control packet pool: HOPA CP packets are < 80 bytes */
+#define HOPA_CP_NUM_MBUFS (1023)                         /* 2^n - 1 */
+#define HOPA_CP_MBUF_CACHE_SIZE (NETDEV_MAX_BURST)       /* CP packets move in bursts */
+#define HOPA_CP_MBUF_DATA_ROOM (RTE_PKTMBUF_HEADROOM + 128)
+
 #define RX_RING_SIZE (1024)
 #define TX_RING_SIZE (1024)
 
 /* Number of paths */
 #define PATH_NB (4)
 
+/* peers: remote hosts probed by the CP, see hopa/peer-* */
+#define HOPA_PEERS_FILE "hopa-peers.conf"  /* in ovs_sysconfdir(), "ip mac" per line */
+#define PROBE_PERIOD_MS (2000)             /* per peer */
+#define PROBE_TICK_MS (1)                  /* retry delay when out of tokens */
+#define PROBE_BW_KBPS (1000)               /* aggregate probe bandwidth over all peers */
+#define PROBE_BURST_ROUNDS (8)             /* token bucket depth, in probe rounds */
+/* one probe per path */
+#define PROBE_ROUND_BITS (PATH_NB * 8 * (sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv4_hdr) + sizeof(struct rte_udp_hdr) + sizeof(struct hopa_cp_hdr)))
+
+/* path state snapshot for warm restart, see hopa_snap_* */
+#define HOPA_SNAP_FILE "hopa-paths.snap"   /* in ovs_rundir() */
+#define HOPA_SNAP_MAGIC (0x48505331)       /* "HPS1" */
+#define HOPA_SNAP_MAX_PEERS (1024)
+#define HOPA_SNAP_PERIOD_MS (1000)
+#define HOPA_SNAP_MAX_AGE_MS (30 * 1000)   /* older path state is not restored */
+
+/* adaptive idle: busy poll -> rte_pause -> block on hopa_cp_in_seq */
+#define IDLE_SPIN_POLLS (256)    /* empty polls still busy polling */
+#define IDLE_PAUSE_POLLS (4096)  /* empty polls backing off with rte_pause */
+#define IDLE_PAUSE_MAX (512)     /* max rte_pause per empty poll */
+#define IDLE_TIMER_MS (100)      /* safety wake-up while blocked */
+
 /* MAC addr */
 #define SRC_MAC                            \
     {                                      \
@@ -108,26 +149,86 @@ struct ovs_vswitchd_exit_args {
 
 bool hopa_cp_has_init = false;
 
-pthread_t hopa_cp_thread_send;
+/* high-water mark of hopa_cp_mp mbufs in use, see memory/show */
+atomic_uint hopa_cp_mp_in_use_hwm = ATOMIC_VAR_INIT(0);
+
 pthread_t hopa_cp_thread_progress;
 
-uint64_t all_paths_delay_list[PATH_NB] = {0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF};
+/* Remote host and its path state.  Readers (the CP threads) walk hopa_peers
+ * under RCU, writers (unixctl) hold hopa_peers_mutex. */
+struct hopa_peer {
+    struct cmap_node node;       /* In hopa_peers, by hash_int(ip). */
+    ovs_be32 ip;
+    struct eth_addr mac;
+    uint64_t all_paths_delay_list[PATH_NB]; /* Written by hopa_cp_progress. */
+    uint8_t best_path_id;
+    long long int next_probe;    /* msec, used by hopa_cp_probe_build only. */
+    long long int updated;       /* Wall msec of the last path state change. */
+    unsigned int gen;            /* Last peer file load that listed it. */
+    bool learned;                /* Added by hopa_cp_progress, not listed. */
+};
+
+static struct cmap hopa_peers = CMAP_INITIALIZER;
+static struct ovs_mutex hopa_peers_mutex = OVS_MUTEX_INITIALIZER;
+static unsigned int hopa_peers_gen OVS_GUARDED_BY(hopa_peers_mutex);
+
+/* Path state snapshot, a fixed size file mapped shared: written in place by
+ * hopa_cp_progress, it survives a vswitchd restart in the page cache.  Only
+ * for the same build, the layout is not meant to be portable. */
+struct hopa_snap_peer {
+    ovs_be32 ip;
+    struct eth_addr mac;
+    uint8_t best_path_id;
+    bool learned;
+    long long int updated;
+    uint64_t all_paths_delay_list[PATH_NB];
+};
+
+struct hopa_snap {
+    uint32_t magic;
+    uint32_t path_nb;
+    uint32_t seq;                /* Odd while being written. */
+    uint32_t n_peers;
+    struct hopa_snap_peer peers[HOPA_SNAP_MAX_PEERS];
+};
+
+static struct hopa_snap *hopa_snap;  /* NULL if the file is unavailable. */
 
-time_t start_time;
+/* Exported to an external CP, NULL if the memzone could not be reserved. */
+static struct hopa_cp_export *hopa_cp_export;
+BUILD_ASSERT_DECL(PATH_NB == HOPA_CP_EXPORT_PATH_NB);
 
-static void hopa_cp_init(void);
-static void *hopa_cp_send(void* arg);
+static hopa_cp_init_func hopa_cp_init;
+static void hopa_cp_out_enqueue(enum hopa_cp_producer producer, struct rte_mbuf **mbufs, unsigned int n);
+static unsigned int hopa_cp_in_dequeue(struct hopa_cp_msg **msgs, unsigned int n);
+static bool hopa_cp_in_pending(void);
+static struct rte_mbuf *hopa_cp_mbuf_alloc(void);
+static void hopa_cp_mbuf_init(struct rte_mempool *mp, void *opaque, void *obj, unsigned int idx);
+static hopa_cp_probe_func hopa_cp_probe_build;
 static void *hopa_cp_progress(void* arg);
 
+/* peers */
+static struct hopa_peer *hopa_peer_find(ovs_be32 ip);
+static struct hopa_peer *hopa_peer_add(ovs_be32 ip, struct eth_addr mac, bool learned);
+static void hopa_peer_del(struct hopa_peer *peer);
+static int hopa_peer_load(const char *file, struct ds *err);
+static void hopa_snap_open(void);
+static void hopa_snap_write(void);
+static unixctl_cb_func hopa_unixctl_peer_load;
+static unixctl_cb_func hopa_unixctl_peer_add;
+static unixctl_cb_func hopa_unixctl_peer_del;
+static unixctl_cb_func hopa_unixctl_peer_show;
+static unixctl_cb_func hopa_unixctl_export_show;
+
 /* encode packet */
-static struct rte_mbuf *encode_probe_pkt(uint8_t path_id);
-static struct rte_mbuf *encode_repath_pkt(uint8_t repath_id);
+static struct rte_mbuf *encode_probe_pkt(const struct hopa_peer *peer, uint8_t path_id);
+static struct rte_mbuf *encode_repath_pkt(const struct hopa_peer *peer, uint8_t repath_id);
 
 /* packet progress */
-static void hopa_cp_probe_pkt_progress(struct hopa_cp_hdr *hopa_cp_hdr);
-static void hopa_cp_repath_pkt_progress(struct hopa_cp_hdr *hopa_cp_hdr);
-static void hopa_cp_repath_ack_pkt_progress(struct hopa_cp_hdr *hopa_cp_hdr);
-static void hopa_dp_ts_pkt_progress(struct hopa_dp_hdr *hopa_dp_hdr);
+static void hopa_cp_probe_pkt_progress(struct hopa_peer *peer, struct hopa_cp_hdr *hopa_cp_hdr);
+static void hopa_cp_repath_pkt_progress(struct hopa_peer *peer, struct hopa_cp_hdr *hopa_cp_hdr);
+static void hopa_cp_repath_ack_pkt_progress(struct hopa_peer *peer, struct hopa_cp_hdr *hopa_cp_hdr);
+static void hopa_dp_ts_pkt_progress(struct hopa_peer *peer, struct hopa_dp_hdr *hopa_dp_hdr);
 
 /* utils */
 static uint8_t get_min_delay_path_id(uint64_t *all_paths_delay_list, uint8_t length);
@@ -174,11 +275,10 @@ main(int argc, char *argv[])
     unixctl_command_register("exit", "[--cleanup]", 0, 1,
                              ovs_vswitchd_exit, &exit_args);
 
+    hopa_cp_init_register(hopa_cp_init);
     bridge_init(remote);
     free(remote);
 
-    start_time = time(NULL); // HOPA
-
     exiting = false;
     cleanup = false;
     while (!exiting) {
@@ -189,6 +289,13 @@ main(int argc, char *argv[])
 
             simap_init(&usage);
             bridge_get_memory_usage(&usage);
+            if (hopa_cp_mp) {
+                unsigned int hwm;
+
+                atomic_read_relaxed(&hopa_cp_mp_in_use_hwm, &hwm);
+                simap_increase(&usage, "hopa_cp_mbufs", HOPA_CP_NUM_MBUFS);
+                simap_increase(&usage, "hopa_cp_mbufs_hwm", hwm);
+            }
             memory_report(&usage);
             simap_destroy(&usage);
         }
@@ -196,8 +303,6 @@ main(int argc, char *argv[])
         unixctl_server_run(unixctl);
         netdev_run();
 
-        hopa_cp_init(); // HOPA_CP Init. Only once! delay 1s!
-
         memory_wait();
         bridge_wait();
         unixctl_server_wait(unixctl);
@@ -227,6 +332,7 @@ parse_options(int argc, char *argv[], char **unixctl_pathp)
     enum {
         OPT_PEER_CA_CERT = UCHAR_MAX + 1,
         OPT_MLOCKALL,
+        OPT_HOPA_CP_EXTERNAL,
         OPT_UNIXCTL,
         VLOG_OPTION_ENUMS,
         OPT_BOOTSTRAP_CA_CERT,
@@ -242,6 +348,7 @@ parse_options(int argc, char *argv[], char **unixctl_pathp)
         {"help",        no_argument, NULL, 'h'},
         {"version",     no_argument, NULL, 'V'},
         {"mlockall",    no_argument, NULL, OPT_MLOCKALL},
+        {"hopa-cp-external", no_argument, NULL, OPT_HOPA_CP_EXTERNAL},
         {"unixctl",     required_argument, NULL, OPT_UNIXCTL},
         DAEMON_LONG_OPTIONS,
         VLOG_LONG_OPTIONS,
@@ -278,6 +385,10 @@ parse_options(int argc, char *argv[], char **unixctl_pathp)
             want_mlockall = true;
             break;
 
+        case OPT_HOPA_CP_EXTERNAL:
+            hopa_cp_external = true;
+            break;
+
         case OPT_UNIXCTL:
             *unixctl_pathp = optarg;
             break;
@@ -356,6 +467,7 @@ usage(void)
           );
     printf("\nOther options:\n"
            "  --unixctl=SOCKET          override default control socket name\n"
+           "  --hopa-cp-external        leave the HOPA CP to a secondary process\n"
            "  -h, --help                display this help message\n"
            "  -V, --version             display version information\n");
     exit(EXIT_SUCCESS);
@@ -371,96 +483,245 @@ ovs_vswitchd_exit(struct unixctl_conn *conn, int argc,
     unixctl_command_reply(conn, NULL);
 }
 
-static void hopa_cp_init(void){
+/* Called by the netdev datapath once its first DPDK port is up, on the main
+ * thread, with the NUMA node of the CP egress port. */
+static void hopa_cp_init(int numa_id){
 
     if(hopa_cp_has_init)
         return;
 
-    if((time(NULL) - start_time) < 1)
-        return;
-
-    /* Creates a new mempool in memory to hold the mbufs. */
-	hopa_cp_mp = rte_pktmbuf_pool_create("HOPA_CP_MP", NUM_MBUFS, MBUF_CACHE_SIZE, 0, RTE_MBUF_DEFAULT_BUF_SIZE, 0);
+    /* Small data room pool on the NUMA node of the CP egress port. */
+    int socket_id = numa_id != NETDEV_NUMA_UNSPEC ? numa_id : SOCKET_ID_ANY;
+
+	/* CP mbufs are sent as dp_packets by the PMD transmit lane. */
+	/* No per-lcore cache with an external CP: its lcore ids are its own
+	 * and may be those of our PMDs. */
+	hopa_cp_mp = rte_pktmbuf_pool_create(HOPA_CP_MP_NAME, HOPA_CP_NUM_MBUFS, hopa_cp_external ? 0 : HOPA_CP_MBUF_CACHE_SIZE,
+                                         sizeof(struct dp_packet) - sizeof(struct rte_mbuf),
+                                         HOPA_CP_MBUF_DATA_ROOM, socket_id);
+    if (hopa_cp_mp)
+        rte_mempool_obj_iter(hopa_cp_mp, hopa_cp_mbuf_init, NULL);
     
     if (hopa_cp_mp == NULL)
 		VLOG_ERR("Cannot create hopa_cp_mp");
     else
-        VLOG_INFO("hopa_cp_mp success");
-    
-    m_hopa_cp_in_out_ring = rte_malloc("in_out ring", sizeof(struct hopa_cp_in_out_ring), 0);
-	memset(m_hopa_cp_in_out_ring, 0, sizeof(struct hopa_cp_in_out_ring));
+        VLOG_INFO("hopa_cp_mp success, %d mbufs x %d B on socket %d", HOPA_CP_NUM_MBUFS, HOPA_CP_MBUF_DATA_ROOM, socket_id);
     
-    m_hopa_cp_in_out_ring->hopa_cp_in_ring = rte_ring_create("hopa_cp in ring", RX_RING_SIZE, 0, RING_F_SP_ENQ | RING_F_SC_DEQ);
-	m_hopa_cp_in_out_ring->hopa_cp_out_ring = rte_ring_create("hopa_cp out ring", TX_RING_SIZE, 0, RING_F_SP_ENQ | RING_F_SC_DEQ);
-
-    if(m_hopa_cp_in_out_ring != NULL)
-        if((m_hopa_cp_in_out_ring->hopa_cp_in_ring == NULL) || (m_hopa_cp_in_out_ring->hopa_cp_out_ring== NULL))
-            VLOG_ERR("Cannot create m_hopa_cp_in_out_ring");
-        else
-            VLOG_INFO("m_hopa_cp_in_out_ring success");
+    /* Rings are published through m_hopa_cp_in_out_ring only once complete,
+     * the PMDs test that pointer alone. */
+    struct hopa_cp_in_out_ring *r = rte_zmalloc("in_out ring", sizeof(struct hopa_cp_in_out_ring), 0);
+    bool ok = r != NULL;
+    char name[RTE_RING_NAMESIZE];
+
+    for (int i = 0; ok && i < HOPA_CP_IN_RINGS; i++)
+    {
+        snprintf(name, sizeof name, HOPA_CP_IN_RING_FMT, i);
+        r->hopa_cp_in_rings[i] = rte_ring_create(name, RX_RING_SIZE, socket_id, RING_F_SP_ENQ | RING_F_SC_DEQ);
+        ok = r->hopa_cp_in_rings[i] != NULL;
+    }
+    for (int i = 0; ok && i < HOPA_CP_TX_N; i++)
+    {
+        snprintf(name, sizeof name, HOPA_CP_OUT_RING_FMT, i);
+        r->hopa_cp_out_rings[i] = rte_ring_create(name, TX_RING_SIZE, socket_id, RING_F_SP_ENQ | RING_F_SC_DEQ);
+        ok = r->hopa_cp_out_rings[i] != NULL;
+    }
+
+    if (!ok)
+    {
+        VLOG_ERR("Cannot create m_hopa_cp_in_out_ring, HOPA CP disabled");
+        hopa_cp_has_init = true;
+        return;
+    }
+
+    r->hopa_cp_in_seq = seq_create();
+    atomic_init(&r->hopa_cp_in_sleeping, false);
+    atomic_init(&r->hopa_cp_in_rings_busy, 0);
+    atomic_init(&r->hopa_cp_in_rings_used, 0);
+    atomic_thread_fence(memory_order_release);
+    m_hopa_cp_in_out_ring = r;
+    VLOG_INFO("m_hopa_cp_in_out_ring success, %d in rings, %d out rings", HOPA_CP_IN_RINGS, HOPA_CP_TX_N);
+
+    /* Everything a secondary process needs beyond the names: it builds the
+     * same packets as hopa_cp_progress would. */
+    const struct rte_memzone *mz = rte_memzone_reserve(HOPA_CP_EXPORT_MZ, sizeof(struct hopa_cp_export), socket_id, 0);
+    if (mz)
+    {
+        struct hopa_cp_export *x = mz->addr;
+
+        memset(x, 0, sizeof *x);
+        x->magic = HOPA_CP_EXPORT_MAGIC;
+        x->version = HOPA_CP_EXPORT_VERSION;
+        x->n_in_rings = HOPA_CP_IN_RINGS;
+        x->out_ring = HOPA_CP_TX_PROGRESS;
+        x->src_ip = htonl(SRC_IP);
+        x->src_mac = (struct rte_ether_addr){SRC_MAC};
+        x->src_port = SRC_PORT;
+        x->dst_port = DST_PORT;
+        hopa_cp_export = x;
+    }
     else
-         VLOG_INFO("m_hopa_cp_in_out_ring NULL");
+        VLOG_WARN("Cannot reserve memzone %s, no external HOPA CP can attach", HOPA_CP_EXPORT_MZ);
+
+    if (hopa_cp_external)
+    {
+        unixctl_command_register("hopa/peer-show", "", 0, 0, hopa_unixctl_export_show, NULL);
+        VLOG_INFO("HOPA CP left to a secondary process attaching to %s", HOPA_CP_EXPORT_MZ);
+        hopa_cp_has_init = true;
+        return;
+    }
+
+    /* Peers from the peer file, or the compiled-in DST peer. */
+    char *peers_file = xasprintf("%s/%s", ovs_sysconfdir(), HOPA_PEERS_FILE);
+    struct ds err = DS_EMPTY_INITIALIZER;
+    if (hopa_peer_load(peers_file, &err) < 0)
+    {
+        VLOG_INFO("%s, using the default peer", ds_cstr(&err));
+        ovs_mutex_lock(&hopa_peers_mutex);
+        hopa_peer_add(htonl(DST_IP), (struct eth_addr){ { DST_MAC } }, false);
+        ovs_mutex_unlock(&hopa_peers_mutex);
+    }
+    ds_destroy(&err);
+    free(peers_file);
+
+    /* Last known path state, so traffic keeps its paths across a restart. */
+    hopa_snap_open();
+
+    unixctl_command_register("hopa/peer-load", "[file]", 0, 1, hopa_unixctl_peer_load, NULL);
+    unixctl_command_register("hopa/peer-add", "ip mac", 2, 2, hopa_unixctl_peer_add, NULL);
+    unixctl_command_register("hopa/peer-del", "ip", 1, 1, hopa_unixctl_peer_del, NULL);
+    unixctl_command_register("hopa/peer-show", "", 0, 0, hopa_unixctl_peer_show, NULL);
 
-    pthread_create(&hopa_cp_thread_send, NULL, hopa_cp_send, NULL);
     pthread_create(&hopa_cp_thread_progress, NULL, hopa_cp_progress, NULL);
+    hopa_cp_probe_register(hopa_cp_probe_build);
 
     VLOG_INFO("hopa_cp_thread create, rte_socket_id_hopa = %d",rte_socket_id());
 
     hopa_cp_has_init = true;
 }
 
-static void *
-hopa_cp_send(void* arg)
+/* Probe every peer once per PROBE_PERIOD_MS, bounded by a token bucket of
+ * PROBE_BW_KBPS over all peers: with many peers the period stretches
+ * instead of the probe load growing.  Runs in the PMD owning the CP
+ * transmit lane, see hopa_cp_probe_register(). */
+static unsigned int
+hopa_cp_probe_build(long long int now, struct rte_mbuf **mbufs, unsigned int n,
+                    long long int *next)
 {
-    VLOG_INFO("hopa_cp_thread_send start");
-    (void *)arg;
-
-    unsigned i;
-    struct rte_mbuf *mbufs[PATH_NB];
-
-    while (1)
+    static uint64_t tokens = PROBE_ROUND_BITS * PROBE_BURST_ROUNDS;
+    static long long int last;
+    long long int now_ms = now / 1000;
+    long long int due = now_ms + PROBE_PERIOD_MS;
+    struct hopa_peer *peer;
+    unsigned int cnt = 0;
+    unsigned int i;
+
+    if (last)
+        tokens = MIN(PROBE_ROUND_BITS * PROBE_BURST_ROUNDS, tokens + (now_ms - last) * PROBE_BW_KBPS);
+    last = now_ms;
+
+    CMAP_FOR_EACH (peer, node, &hopa_peers)
     {
-        // mbuf = encode_udp_pkt(DST_PORT);
-        for (i = 0; i < PATH_NB; i++)
-            mbufs[i] = encode_probe_pkt(i);
+        /* Learned peers are senders probing us, as in repath_cp. */
+        if (peer->learned)
+            continue;
+        if (now_ms < peer->next_probe)
+        {
+            due = MIN(due, peer->next_probe);
+            continue;
+        }
+        if (tokens < PROBE_ROUND_BITS)
+        {
+            due = now_ms + PROBE_TICK_MS;
+            break;
+        }
+        if (cnt + PATH_NB > n)
+        {
+            due = now_ms;
+            break;
+        }
 
-        int count = rte_ring_mp_enqueue_burst(m_hopa_cp_in_out_ring->hopa_cp_out_ring, (void **)&mbufs, PATH_NB, NULL);
-        VLOG_INFO("rte_ring_mp_enqueue_burst count:[%d]", count);
+        for (i = 0; i < PATH_NB; i++)
+            if ((mbufs[cnt] = encode_probe_pkt(peer, i)) != NULL)
+                cnt++;
 
-        sleep(2);
+        peer->next_probe = now_ms + PROBE_PERIOD_MS;
+        tokens -= PROBE_ROUND_BITS;
     }
 
-    return 0;
+    *next = due * 1000;
+    return cnt;
 }
 
 static void *
 hopa_cp_progress(void* arg)
 {
-    struct hopa_cp_hdr *hopa_cp_hdrs[32];
+    struct hopa_cp_msg *hopa_cp_msgs[32];
+    struct hopa_peer *peer;
 	uint16_t nb_rx;
 	uint16_t i;
+    uint32_t empty_polls = 0;
+    uint32_t pause;
+    uint64_t seqno;
+    long long int next_snap = time_msec() + HOPA_SNAP_PERIOD_MS;
 
     VLOG_INFO("hopa_cp_thread_progress start");
+    ovsrcu_quiesce_end();
     while (1)
 	{
-        nb_rx = rte_ring_mc_dequeue_burst(m_hopa_cp_in_out_ring->hopa_cp_in_ring, (void **)hopa_cp_hdrs, 32, NULL);
+        nb_rx = hopa_cp_in_dequeue(hopa_cp_msgs, 32);
+
+        /* Control traffic is a few packets per second: back off with
+         * rte_pause, then block until the PMD changes hopa_cp_in_seq. */
+        if (nb_rx)
+            empty_polls = 0;
+        else if (++empty_polls > IDLE_SPIN_POLLS + IDLE_PAUSE_POLLS)
+        {
+            seqno = seq_read(m_hopa_cp_in_out_ring->hopa_cp_in_seq);
+            atomic_store(&m_hopa_cp_in_out_ring->hopa_cp_in_sleeping, true);
+            if (!hopa_cp_in_pending())
+            {
+                seq_wait(m_hopa_cp_in_out_ring->hopa_cp_in_seq, seqno);
+                poll_timer_wait(IDLE_TIMER_MS);
+                poll_block();
+            }
+            atomic_store(&m_hopa_cp_in_out_ring->hopa_cp_in_sleeping, false);
+        }
+        else if (empty_polls > IDLE_SPIN_POLLS)
+        {
+            pause = MIN(empty_polls - IDLE_SPIN_POLLS, IDLE_PAUSE_MAX);
+            while (pause--)
+                rte_pause();
+        }
+
         for (i = 0; i < nb_rx; i++)
         {
-            if (hopa_cp_hdrs[i]->flag == HOPA_CP)
+            /* Unknown senders are learned, so a receiver needs no peer list. */
+            peer = hopa_peer_find(hopa_cp_msgs[i]->src_ip);
+            if (!peer)
+            {
+                struct eth_addr mac;
+
+                memcpy(mac.ea, hopa_cp_msgs[i]->src_mac.addr_bytes, ETH_ADDR_LEN);
+                ovs_mutex_lock(&hopa_peers_mutex);
+                peer = hopa_peer_add(hopa_cp_msgs[i]->src_ip, mac, true);
+                ovs_mutex_unlock(&hopa_peers_mutex);
+            }
+
+            if (peer && hopa_cp_msgs[i]->hdr.flag == HOPA_CP)
 			{
-                switch (hopa_cp_hdrs[i]->cp_flag)
+                switch (hopa_cp_msgs[i]->hdr.cp_flag)
                 {
                     case PROBE:
-                        hopa_cp_probe_pkt_progress(hopa_cp_hdrs[i]);  // receiver
+                        hopa_cp_probe_pkt_progress(peer, &hopa_cp_msgs[i]->hdr);  // receiver
                         break;
 
                     case REPATH:
-                        hopa_cp_repath_pkt_progress(hopa_cp_hdrs[i]);  // sender
+                        hopa_cp_repath_pkt_progress(peer, &hopa_cp_msgs[i]->hdr);  // sender
                         VLOG_INFO("repath");
                         break;
 
                     case REPATH_ACK:
-                        hopa_cp_repath_ack_pkt_progress(hopa_cp_hdrs[i]);  // receiver
+                        hopa_cp_repath_ack_pkt_progress(peer, &hopa_cp_msgs[i]->hdr);  // receiver
                         VLOG_INFO("repath_ack");
                         break;
                     
@@ -469,43 +730,127 @@ hopa_cp_progress(void* arg)
                 }
             }
 
-            rte_free(hopa_cp_hdrs[i]);
+            rte_free(hopa_cp_msgs[i]);
         }
+
+        if (time_msec() >= next_snap)
+        {
+            hopa_snap_write();
+            next_snap = time_msec() + HOPA_SNAP_PERIOD_MS;
+        }
+
+        if (nb_rx)
+            ovsrcu_quiesce();
     }
 
     return 0;
 }
 
-static struct rte_mbuf *encode_probe_pkt(uint8_t path_id)
+/* Round-robin fan-in over the PMD in rings up to the highest one ever
+ * claimed, released ones included.  Only hopa_cp_progress consumes them. */
+static unsigned int
+hopa_cp_in_dequeue(struct hopa_cp_msg **msgs, unsigned int n)
 {
-	struct rte_mbuf *mbuf;
-    struct rte_ether_hdr *eth_hdr;
-	struct rte_ipv4_hdr *ipv4_hdr;
-	struct rte_udp_hdr *udp_hdr;
-	struct hopa_cp_hdr *hopa_cp_hdr;
-    struct timespec ts;
-	uint64_t sender_ts;
+    static unsigned int next;
+    unsigned int used, nb = 0;
+
+    atomic_read(&m_hopa_cp_in_out_ring->hopa_cp_in_rings_used, &used);
+    used = MIN(used, HOPA_CP_IN_RINGS);
+
+    for (unsigned int i = 0; i < used && nb < n; i++)
+    {
+        next = (next + 1) % used;
+        nb += rte_ring_sc_dequeue_burst(m_hopa_cp_in_out_ring->hopa_cp_in_rings[next], (void **)&msgs[nb], n - nb, NULL);
+    }
+
+    return nb;
+}
+
+static bool
+hopa_cp_in_pending(void)
+{
+    unsigned int used;
+
+    atomic_read(&m_hopa_cp_in_out_ring->hopa_cp_in_rings_used, &used);
+    for (unsigned int i = 0; i < MIN(used, HOPA_CP_IN_RINGS); i++)
+        if (!rte_ring_empty(m_hopa_cp_in_out_ring->hopa_cp_in_rings[i]))
+            return true;
+
+    return false;
+}
+
+/* Hand CP packets to the datapath through the producer's own SPSC ring;
+ * what does not fit is freed instead of leaked. */
+static void
+hopa_cp_out_enqueue(enum hopa_cp_producer producer, struct rte_mbuf **mbufs, unsigned int n)
+{
+    unsigned int count;
+
+    count = rte_ring_sp_enqueue_burst(m_hopa_cp_in_out_ring->hopa_cp_out_rings[producer], (void **)mbufs, n, NULL);
+    if (OVS_UNLIKELY(count < n))
+    {
+        COVERAGE_ADD(hopa_cp_out_ring_drop, n - count);
+        rte_pktmbuf_free_bulk(&mbufs[count], n - count);
+    }
+
+    VLOG_DBG("hopa_cp_out_enqueue count:[%u]", count);
+}
+
+static void
+hopa_cp_mbuf_init(struct rte_mempool *mp OVS_UNUSED, void *opaque OVS_UNUSED,
+                  void *obj, unsigned int idx OVS_UNUSED)
+{
+    dp_packet_init_dpdk((struct dp_packet *) obj);
+}
+
+static struct rte_mbuf *
+hopa_cp_mbuf_alloc(void)
+{
+    static struct vlog_rate_limit rl = VLOG_RATE_LIMIT_INIT(1, 5);
+    struct rte_mbuf *mbuf;
+    unsigned int in_use, hwm;
 
     if (hopa_cp_mp == NULL)
 	{
-		VLOG_INFO("hopa_cp_mp null");
+		VLOG_WARN_RL(&rl, "hopa_cp_mp null");
 		return NULL;
 	}
 
 	mbuf = rte_pktmbuf_alloc(hopa_cp_mp);
-
 	if (!mbuf){
-		VLOG_INFO("Error with rte_pktmbuf_alloc()");
+		VLOG_WARN_RL(&rl, "Error with rte_pktmbuf_alloc()");
         return NULL;
     }
 
+    in_use = rte_mempool_in_use_count(hopa_cp_mp);
+    atomic_read_relaxed(&hopa_cp_mp_in_use_hwm, &hwm);
+    if (in_use > hwm)
+        atomic_store_relaxed(&hopa_cp_mp_in_use_hwm, in_use);
+
+    return mbuf;
+}
+
+static struct rte_mbuf *encode_probe_pkt(const struct hopa_peer *peer, uint8_t path_id)
+{
+	struct rte_mbuf *mbuf;
+    struct rte_ether_hdr *eth_hdr;
+	struct rte_ipv4_hdr *ipv4_hdr;
+	struct rte_udp_hdr *udp_hdr;
+	struct hopa_cp_hdr *hopa_cp_hdr;
+    struct timespec ts;
+	uint64_t sender_ts;
+
+	mbuf = hopa_cp_mbuf_alloc();
+	if (!mbuf)
+        return NULL;
+
     //mbuf->pkt_len = sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv4_hdr) + sizeof(struct rte_udp_hdr) + sizeof(struct hopa_cp_hdr);
     //mbuf->data_len = sizeof(struct hopa_cp_hdr);
 
     /*  ETH  */
     eth_hdr = (struct rte_ether_hdr *)rte_pktmbuf_append(mbuf, sizeof(struct rte_ether_hdr));
 	eth_hdr->src_addr = (struct rte_ether_addr){SRC_MAC};
-	eth_hdr->dst_addr = (struct rte_ether_addr){DST_MAC};
+	memcpy(eth_hdr->dst_addr.addr_bytes, peer->mac.ea, ETH_ADDR_LEN);
 	eth_hdr->ether_type = rte_cpu_to_be_16(RTE_ETHER_TYPE_IPV4);
 
     /*  IPv4  */
@@ -518,7 +863,7 @@ static struct rte_mbuf *encode_probe_pkt(uint8_t path_id)
 	ipv4_hdr->time_to_live = 64;
 	ipv4_hdr->next_proto_id = IPPROTO_UDP;
 	ipv4_hdr->src_addr = rte_cpu_to_be_32(SRC_IP);
-	ipv4_hdr->dst_addr = rte_cpu_to_be_32(DST_IP);
+	ipv4_hdr->dst_addr = peer->ip;
 	ipv4_hdr->hdr_checksum = rte_ipv4_cksum(ipv4_hdr);
 
     /*  UDP  */
@@ -540,12 +885,10 @@ static struct rte_mbuf *encode_probe_pkt(uint8_t path_id)
     sender_ts = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
 	hopa_cp_hdr->ts = rte_cpu_to_be_64(sender_ts);
 
-    VLOG_INFO("current ts (ns) : [%" PRIu64 "]", sender_ts);
-
 	return mbuf;
 }
 
-static struct rte_mbuf *encode_repath_pkt(uint8_t repath_id)
+static struct rte_mbuf *encode_repath_pkt(const struct hopa_peer *peer, uint8_t repath_id)
 {
 	struct rte_mbuf *mbuf;
     struct rte_ether_hdr *eth_hdr;
@@ -555,18 +898,9 @@ static struct rte_mbuf *encode_repath_pkt(uint8_t repath_id)
     struct timespec ts;
 	uint64_t sender_ts;
 
-    if (hopa_cp_mp == NULL)
-	{
-		VLOG_INFO("hopa_cp_mp null");
-		return NULL;
-	}
-
-	mbuf = rte_pktmbuf_alloc(hopa_cp_mp);
-
-	if (!mbuf){
-		VLOG_INFO("Error with rte_pktmbuf_alloc()");
+	mbuf = hopa_cp_mbuf_alloc();
+	if (!mbuf)
         return NULL;
-    }
 
     //mbuf->pkt_len = sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv4_hdr) + sizeof(struct rte_udp_hdr) + sizeof(struct hopa_cp_hdr);
     //mbuf->data_len = sizeof(struct hopa_cp_hdr);
@@ -574,7 +908,7 @@ static struct rte_mbuf *encode_repath_pkt(uint8_t repath_id)
     /*  ETH  */
     eth_hdr = (struct rte_ether_hdr *)rte_pktmbuf_append(mbuf, sizeof(struct rte_ether_hdr));
 	eth_hdr->src_addr = (struct rte_ether_addr){SRC_MAC};
-	eth_hdr->dst_addr = (struct rte_ether_addr){DST_MAC};
+	memcpy(eth_hdr->dst_addr.addr_bytes, peer->mac.ea, ETH_ADDR_LEN);
 	eth_hdr->ether_type = rte_cpu_to_be_16(RTE_ETHER_TYPE_IPV4);
 
     /*  IPv4  */
@@ -587,7 +921,7 @@ static struct rte_mbuf *encode_repath_pkt(uint8_t repath_id)
 	ipv4_hdr->time_to_live = 64;
 	ipv4_hdr->next_proto_id = IPPROTO_UDP;
 	ipv4_hdr->src_addr = rte_cpu_to_be_32(SRC_IP);
-	ipv4_hdr->dst_addr = rte_cpu_to_be_32(DST_IP);
+	ipv4_hdr->dst_addr = peer->ip;
 	ipv4_hdr->hdr_checksum = rte_ipv4_cksum(ipv4_hdr);
 
     /*  UDP  */
@@ -612,58 +946,394 @@ static struct rte_mbuf *encode_repath_pkt(uint8_t repath_id)
 	return mbuf;
 }
 
-static void hopa_cp_probe_pkt_progress(struct hopa_cp_hdr *hopa_cp_hdr)
+static void hopa_cp_probe_pkt_progress(struct hopa_peer *peer, struct hopa_cp_hdr *hopa_cp_hdr)
 {
+    static struct vlog_rate_limit rl = VLOG_RATE_LIMIT_INIT(5, 20);
     uint64_t sender_ts;
 	uint64_t receiver_ts;
     uint8_t path_id = hopa_cp_hdr->probe_path_id;
+    if (path_id >= PATH_NB)
+        return;
     sender_ts = rte_be_to_cpu_64(hopa_cp_hdr->ts);
     struct timespec ts;
     clock_gettime(0, &ts);
     receiver_ts = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
 
-	all_paths_delay_list[path_id] = 1000000000 + receiver_ts - sender_ts;
+	peer->all_paths_delay_list[path_id] = 1000000000 + receiver_ts - sender_ts;
 
-    VLOG_INFO("path id : [%d] , receiver_ts : [%" PRIu64 "], sender_ts : [%" PRIu64 "], delay : [%" PRIu64 "]", path_id, receiver_ts, sender_ts, all_paths_delay_list[path_id]);
+    VLOG_DBG_RL(&rl, "peer "IP_FMT" path id : [%d] , receiver_ts : [%" PRIu64 "], sender_ts : [%" PRIu64 "], delay : [%" PRIu64 "]", IP_ARGS(peer->ip), path_id, receiver_ts, sender_ts, peer->all_paths_delay_list[path_id]);
 
-    best_path_id = get_min_delay_path_id(all_paths_delay_list, PATH_NB);
+    peer->best_path_id = get_min_delay_path_id(peer->all_paths_delay_list, PATH_NB);
+    peer->updated = time_wall_msec();
 
-	VLOG_INFO("opt_path_id : [%d]", best_path_id);
+	VLOG_DBG_RL(&rl, "peer "IP_FMT" opt_path_id : [%d]", IP_ARGS(peer->ip), peer->best_path_id);
 }
 
-static void hopa_cp_repath_pkt_progress(struct hopa_cp_hdr *hopa_cp_hdr)
+static void hopa_cp_repath_pkt_progress(struct hopa_peer *peer, struct hopa_cp_hdr *hopa_cp_hdr)
 {
 
-    best_path_id = hopa_cp_hdr->repath_id;
+    peer->best_path_id = hopa_cp_hdr->repath_id;
+    peer->updated = time_wall_msec();
     // 1、触发换路(通知数据面 DP)  TODO
 
     // 2、回复repath_ack
 	/*
     struct rte_mbuf *repath_ack_mbuf;
 	repath_ack_mbuf = encode_repath_ack_pkt();
-	rte_ring_mp_enqueue_burst(m_hopa_cp_in_out_ring->hopa_cp_out_ring, (void **)&repath_ack_mbuf, 1, NULL);
+	hopa_cp_out_enqueue(HOPA_CP_TX_PROGRESS, &repath_ack_mbuf, 1);
     */
 	// 3、启动定时器  TODO   发端初始化ACK定时器
 	// rte_timer_reset(&retran_timer, rte_get_timer_hz() * 2, SINGLE, rte_lcore_id(), timer_cb, NULL);
 }
 
-static void hopa_cp_repath_ack_pkt_progress(struct hopa_cp_hdr *hopa_cp_hdr)
+static void hopa_cp_repath_ack_pkt_progress(struct hopa_peer *peer OVS_UNUSED, struct hopa_cp_hdr *hopa_cp_hdr)
 {
 	// TODO   收到ack, 确认上一个repath已经收到, 停止定时器
 	// rte_timer_stop(&retran_timer);
 }
 
-static void hopa_dp_ts_pkt_progress(struct hopa_dp_hdr *hopa_dp_hdr)
+static void hopa_dp_ts_pkt_progress(struct hopa_peer *peer, struct hopa_dp_hdr *hopa_dp_hdr)
 {
 	bool is_repath = 1;
 	if (is_repath)
 	{
 		struct rte_mbuf *repath_mbuf;
-		repath_mbuf = encode_repath_pkt((uint8_t)best_path_id);
-		rte_ring_mp_enqueue_burst(m_hopa_cp_in_out_ring->hopa_cp_out_ring, (void **)&repath_mbuf, 1, NULL);
+		repath_mbuf = encode_repath_pkt(peer, peer->best_path_id);
+		if (repath_mbuf)
+			hopa_cp_out_enqueue(HOPA_CP_TX_PROGRESS, &repath_mbuf, 1);
 	}
 }
 
+static struct hopa_peer *
+hopa_peer_find(ovs_be32 ip)
+{
+    struct hopa_peer *peer;
+
+    CMAP_FOR_EACH_WITH_HASH (peer, node, hash_int(ntohl(ip), 0), &hopa_peers)
+    {
+        if (peer->ip == ip)
+            return peer;
+    }
+
+    return NULL;
+}
+
+/* Adds 'ip', or updates its MAC when already known.  Path state of a known
+ * peer is kept, a learned one becomes listed unless 'learned'. */
+static struct hopa_peer *
+hopa_peer_add(ovs_be32 ip, struct eth_addr mac, bool learned)
+    OVS_REQUIRES(hopa_peers_mutex)
+{
+    struct hopa_peer *peer = hopa_peer_find(ip);
+
+    if (peer)
+    {
+        peer->mac = mac;
+        peer->gen = hopa_peers_gen;
+        peer->learned &= learned;
+        return peer;
+    }
+
+    peer = xzalloc(sizeof *peer);
+    peer->ip = ip;
+    peer->mac = mac;
+    peer->gen = hopa_peers_gen;
+    peer->learned = learned;
+    for (int i = 0; i < PATH_NB; i++)
+        peer->all_paths_delay_list[i] = 0xFFFFFFFF;
+    cmap_insert(&hopa_peers, &peer->node, hash_int(ntohl(ip), 0));
+
+    VLOG_INFO("hopa peer "IP_FMT" "ETH_ADDR_FMT" added", IP_ARGS(ip), ETH_ADDR_ARGS(mac));
+
+    return peer;
+}
+
+static void
+hopa_peer_del(struct hopa_peer *peer)
+    OVS_REQUIRES(hopa_peers_mutex)
+{
+    VLOG_INFO("hopa peer "IP_FMT" removed", IP_ARGS(peer->ip));
+
+    cmap_remove(&hopa_peers, &peer->node, hash_int(ntohl(peer->ip), 0));
+    ovsrcu_postpone(free, peer);
+}
+
+/* Replaces the peer set with 'file' ("ip mac" per line, '#' comments).
+ * Peers listed before and after keep their path state. */
+static int
+hopa_peer_load(const char *file, struct ds *err)
+{
+    struct hopa_peer *peer;
+    char line[256];
+    int n = 0;
+
+    FILE *stream = fopen(file, "r");
+    if (!stream)
+    {
+        ds_put_format(err, "%s: %s", file, ovs_strerror(errno));
+        return -1;
+    }
+
+    ovs_mutex_lock(&hopa_peers_mutex);
+    hopa_peers_gen++;
+    while (fgets(line, sizeof line, stream))
+    {
+        ovs_be32 ip;
+        struct eth_addr mac;
+
+        if (line[0] == '#' || line[0] == '\n')
+            continue;
+        if (!ovs_scan(line, IP_SCAN_FMT" "ETH_ADDR_SCAN_FMT, IP_SCAN_ARGS(&ip), ETH_ADDR_SCAN_ARGS(mac)))
+        {
+            VLOG_WARN("%s: bad peer line: %s", file, line);
+            continue;
+        }
+
+        peer = hopa_peer_add(ip, mac, false);
+        n++;
+    }
+    fclose(stream);
+
+    /* Learned peers are not in the file, keep them. */
+    CMAP_FOR_EACH (peer, node, &hopa_peers)
+    {
+        if (!peer->learned && peer->gen != hopa_peers_gen)
+            hopa_peer_del(peer);
+    }
+    ovs_mutex_unlock(&hopa_peers_mutex);
+
+    VLOG_INFO("%s: %d hopa peers", file, n);
+
+    return n;
+}
+
+/* Maps the snapshot file, creating it if needed, and restores the path state
+ * of its peers that are younger than HOPA_SNAP_MAX_AGE_MS.  Peers no longer
+ * listed are not brought back, learned ones are. */
+static void
+hopa_snap_open(void)
+{
+    char *file = xasprintf("%s/%s", ovs_rundir(), HOPA_SNAP_FILE);
+    long long int now = time_wall_msec();
+    struct hopa_snap *snap;
+    struct hopa_peer *peer;
+    int n = 0;
+
+    int fd = open(file, O_RDWR | O_CREAT, 0600);
+    if (fd < 0 || ftruncate(fd, sizeof *snap) < 0)
+    {
+        VLOG_WARN("%s: %s, path state is not kept across restarts", file, ovs_strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        free(file);
+        return;
+    }
+    snap = mmap(NULL, sizeof *snap, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (snap == MAP_FAILED)
+    {
+        VLOG_WARN("%s: mmap failed: %s", file, ovs_strerror(errno));
+        free(file);
+        return;
+    }
+
+    /* A fresh file is all zeros, a torn one has an odd seq. */
+    if (snap->magic == HOPA_SNAP_MAGIC && snap->path_nb == PATH_NB && !(snap->seq & 1))
+    {
+        ovs_mutex_lock(&hopa_peers_mutex);
+        for (uint32_t i = 0; i < MIN(snap->n_peers, HOPA_SNAP_MAX_PEERS); i++)
+        {
+            struct hopa_snap_peer *sp = &snap->peers[i];
+
+            if (now - sp->updated > HOPA_SNAP_MAX_AGE_MS || sp->best_path_id >= PATH_NB)
+                continue;
+            peer = hopa_peer_find(sp->ip);
+            if (!peer && sp->learned)
+            {
+                peer = hopa_peer_add(sp->ip, sp->mac, true);
+            }
+            if (!peer)
+                continue;
+
+            memcpy(peer->all_paths_delay_list, sp->all_paths_delay_list, sizeof peer->all_paths_delay_list);
+            peer->best_path_id = sp->best_path_id;
+            peer->updated = sp->updated;
+            n++;
+        }
+        ovs_mutex_unlock(&hopa_peers_mutex);
+    }
+    else
+    {
+        memset(snap, 0, sizeof *snap);
+        snap->magic = HOPA_SNAP_MAGIC;
+        snap->path_nb = PATH_NB;
+    }
+
+    VLOG_INFO("%s: path state of %d hopa peers restored", file, n);
+    hopa_snap = snap;
+    free(file);
+}
+
+/* Copies the path state of every peer into the snapshot.  hopa_cp_progress
+ * only, the thread that writes that state. */
+static void
+hopa_snap_write(void)
+{
+    struct hopa_peer *peer;
+    uint32_t n = 0;
+
+    if (!hopa_snap)
+        return;
+
+    hopa_snap->seq++;
+    atomic_thread_fence(memory_order_release);
+    CMAP_FOR_EACH (peer, node, &hopa_peers)
+    {
+        if (n == HOPA_SNAP_MAX_PEERS)
+        {
+            VLOG_WARN_ONCE("more than %d hopa peers, the snapshot keeps the first ones", HOPA_SNAP_MAX_PEERS);
+            break;
+        }
+        if (!peer->updated)
+            continue;
+
+        struct hopa_snap_peer *sp = &hopa_snap->peers[n++];
+        sp->ip = peer->ip;
+        sp->mac = peer->mac;
+        sp->best_path_id = peer->best_path_id;
+        sp->learned = peer->learned;
+        sp->updated = peer->updated;
+        memcpy(sp->all_paths_delay_list, peer->all_paths_delay_list, sizeof sp->all_paths_delay_list);
+    }
+    hopa_snap->n_peers = n;
+    atomic_thread_fence(memory_order_release);
+    hopa_snap->seq++;
+}
+
+static void
+hopa_unixctl_peer_load(struct unixctl_conn *conn, int argc,
+                       const char *argv[], void *aux OVS_UNUSED)
+{
+    char *file = argc > 1 ? xstrdup(argv[1])
+                          : xasprintf("%s/%s", ovs_sysconfdir(), HOPA_PEERS_FILE);
+    struct ds reply = DS_EMPTY_INITIALIZER;
+    int n = hopa_peer_load(file, &reply);
+
+    if (n < 0)
+        unixctl_command_reply_error(conn, ds_cstr(&reply));
+    else
+    {
+        ds_put_format(&reply, "%d peers", n);
+        unixctl_command_reply(conn, ds_cstr(&reply));
+    }
+    ds_destroy(&reply);
+    free(file);
+}
+
+static void
+hopa_unixctl_peer_add(struct unixctl_conn *conn, int argc OVS_UNUSED,
+                      const char *argv[], void *aux OVS_UNUSED)
+{
+    ovs_be32 ip;
+    struct eth_addr mac;
+
+    if (!ip_parse(argv[1], &ip) || !eth_addr_from_string(argv[2], &mac))
+    {
+        unixctl_command_reply_error(conn, "bad ip or mac");
+        return;
+    }
+
+    ovs_mutex_lock(&hopa_peers_mutex);
+    hopa_peer_add(ip, mac, false);
+    ovs_mutex_unlock(&hopa_peers_mutex);
+    unixctl_command_reply(conn, NULL);
+}
+
+static void
+hopa_unixctl_peer_del(struct unixctl_conn *conn, int argc OVS_UNUSED,
+                      const char *argv[], void *aux OVS_UNUSED)
+{
+    struct hopa_peer *peer;
+    ovs_be32 ip;
+
+    if (!ip_parse(argv[1], &ip))
+    {
+        unixctl_command_reply_error(conn, "bad ip");
+        return;
+    }
+
+    ovs_mutex_lock(&hopa_peers_mutex);
+    peer = hopa_peer_find(ip);
+    if (peer)
+        hopa_peer_del(peer);
+    ovs_mutex_unlock(&hopa_peers_mutex);
+
+    if (peer)
+        unixctl_command_reply(conn, NULL);
+    else
+        unixctl_command_reply_error(conn, "no such peer");
+}
+
+static void
+hopa_unixctl_peer_show(struct unixctl_conn *conn, int argc OVS_UNUSED,
+                       const char *argv[] OVS_UNUSED, void *aux OVS_UNUSED)
+{
+    struct ds reply = DS_EMPTY_INITIALIZER;
+    struct hopa_peer *peer;
+
+    CMAP_FOR_EACH (peer, node, &hopa_peers)
+    {
+        ds_put_format(&reply, IP_FMT" "ETH_ADDR_FMT"%s best path %d, delay (ns):",
+                      IP_ARGS(peer->ip), ETH_ADDR_ARGS(peer->mac),
+                      peer->learned ? " (learned)" : "", peer->best_path_id);
+        for (int i = 0; i < PATH_NB; i++)
+            if (peer->all_paths_delay_list[i] == 0xFFFFFFFF)
+                ds_put_cstr(&reply, " -");
+            else
+                ds_put_format(&reply, " %"PRIu64, peer->all_paths_delay_list[i] - 1000000000);
+        ds_put_char(&reply, '\n');
+    }
+    unixctl_command_reply(conn, ds_cstr(&reply));
+    ds_destroy(&reply);
+}
+
+/* hopa/peer-show with --hopa-cp-external: the path state the external CP
+ * publishes in the export memzone. */
+static void
+hopa_unixctl_export_show(struct unixctl_conn *conn, int argc OVS_UNUSED,
+                         const char *argv[] OVS_UNUSED, void *aux OVS_UNUSED)
+{
+    struct ds reply = DS_EMPTY_INITIALIZER;
+    struct hopa_cp_export *x = hopa_cp_export;
+
+    if (!x)
+    {
+        unixctl_command_reply_error(conn, "no export memzone");
+        return;
+    }
+    if (!x->cp_pid || kill(x->cp_pid, 0) < 0)
+        ds_put_cstr(&reply, "no external CP attached\n");
+    else
+        ds_put_format(&reply, "external CP pid %"PRId32"\n", x->cp_pid);
+
+    for (uint32_t i = 0; i < MIN(x->n_peers, HOPA_CP_EXPORT_MAX_PEERS); i++)
+    {
+        struct hopa_cp_export_peer *xp = &x->peers[i];
+
+        if (!xp->ip)
+            continue;
+        ds_put_format(&reply, IP_FMT" best path %d, delay (ns):", IP_ARGS(xp->ip), xp->best_path_id);
+        for (int j = 0; j < PATH_NB; j++)
+            if (xp->all_paths_delay_list[j] == 0xFFFFFFFF)
+                ds_put_cstr(&reply, " -");
+            else
+                ds_put_format(&reply, " %"PRIu64, xp->all_paths_delay_list[j] - 1000000000);
+        ds_put_char(&reply, '\n');
+    }
+    unixctl_command_reply(conn, ds_cstr(&reply));
+    ds_destroy(&reply);
+}
+
 static uint8_t get_min_delay_path_id(uint64_t *all_paths_delay_list, uint8_t length)
 {
 	uint8_t path_id = 0;
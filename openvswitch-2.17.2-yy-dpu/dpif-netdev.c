@@ -102,6 +102,10 @@ VLOG_DEFINE_THIS_MODULE(dpif_netdev);
 #define MAX_RECIRC_DEPTH 6
 DEFINE_STATIC_PER_THREAD_DATA(uint32_t, recirc_depth, 0)
 
+/* HOPA CP in ring of this thread, -1 until its first HOPA packet. */
+DEFINE_STATIC_PER_THREAD_DATA(int, hopa_cp_in_ring_id, -1)
+static void hopa_cp_in_ring_release(void);
+
 /* Use instant packet send by default. */
 #define DEFAULT_TX_FLUSH_INTERVAL 0
 
@@ -120,6 +124,7 @@ COVERAGE_DEFINE(datapath_drop_invalid_port);
 COVERAGE_DEFINE(datapath_drop_invalid_bond);
 COVERAGE_DEFINE(datapath_drop_invalid_tnl_port);
 COVERAGE_DEFINE(datapath_drop_rx_invalid_packet);
+COVERAGE_DEFINE(hopa_cp_in_ring_drop);
 #ifdef ALLOW_EXPERIMENTAL_API /* Packet restoration API required. */
 COVERAGE_DEFINE(datapath_drop_hw_miss_recover);
 #endif
@@ -169,6 +174,10 @@ static struct odp_support dp_netdev_support = {
 /* Time in microseconds to try RCU quiescing. */
 #define PMD_RCU_QUIESCE_INTERVAL 10000LL
 
+/* Time in microseconds a pmd not building the HOPA CP probes waits before
+ * checking again whether it has become the owner. */
+#define PMD_HOPA_CP_PROBE_RECHECK 100000LL
+
 struct dpcls {
     struct cmap_node node;      /* Within dp_netdev_pmd_thread.classifiers */
     odp_port_t in_port;
@@ -314,6 +323,18 @@ struct dp_netdev {
     /* Cpu mask for pin of pmd threads. */
     char *pmd_cmask;
 
+    /* PMD threads per numa node when 'pmd_cmask' is unset. */
+    int pmd_n_threads;
+
+    /* HOPA CP transmit lane egress, other_config:hopa-cp-tx-port or else
+     * HOPA_CP_TX_PORT_DEFAULT.  The port number is resolved from the name in
+     * reconfigure_datapath(). */
+    char *hopa_cp_tx_port_name;
+    atomic_uint32_t hopa_cp_tx_port;   /* odp_port_t, ODPP_NONE if unset. */
+    atomic_uint hopa_cp_probe_core;    /* Pmd building the probes, polls the
+                                        * egress if any.  OVS_CORE_UNSPEC if
+                                        * none. */
+
     uint64_t last_tnl_conf_seq;
 
     struct conntrack *conntrack;
@@ -1843,6 +1864,10 @@ create_dp_netdev(const char *name, const struct dpif_class *class,
 
     atomic_init(&dp->emc_insert_min, DEFAULT_EM_FLOW_INSERT_MIN);
     atomic_init(&dp->tx_flush_interval, DEFAULT_TX_FLUSH_INTERVAL);
+    dp->pmd_n_threads = NR_PMD_THREADS;
+    dp->hopa_cp_tx_port_name = xstrdup(HOPA_CP_TX_PORT_DEFAULT);
+    atomic_init(&dp->hopa_cp_tx_port, odp_to_u32(ODPP_NONE));
+    atomic_init(&dp->hopa_cp_probe_core, OVS_CORE_UNSPEC);
 
     cmap_init(&dp->poll_threads);
     dp->pmd_rxq_assign_type = SCHED_CYCLES;
@@ -1978,6 +2003,7 @@ dp_netdev_free(struct dp_netdev *dp)
     dp_netdev_meter_destroy(dp);
 
     free(dp->pmd_cmask);
+    free(dp->hopa_cp_tx_port_name);
     free(CONST_CAST(char *, dp->name));
     free(dp);
 }
@@ -4765,6 +4791,18 @@ set_pmd_auto_lb(struct dp_netdev *dp, bool state, bool always_log)
     }
 }
 
+/* other_config:n-rxq-default, shared by all datapaths like the DPDK ports. */
+static atomic_int default_n_rxq = ATOMIC_VAR_INIT(NR_QUEUE);
+
+int
+dpif_netdev_default_n_rxq(void)
+{
+    int n_rxq;
+
+    atomic_read_relaxed(&default_n_rxq, &n_rxq);
+    return n_rxq;
+}
+
 /* Applies datapath configuration from the database. Some of the changes are
  * actually applied in dpif_netdev_run(). */
 static int
@@ -4800,6 +4838,31 @@ dpif_netdev_set_config(struct dpif *dpif, const struct smap *other_config)
         dp_netdev_request_reconfigure(dp);
     }
 
+    int pmd_n_threads = MAX(smap_get_int(other_config, "pmd-n-threads",
+                                         NR_PMD_THREADS), 1);
+    if (dp->pmd_n_threads != pmd_n_threads) {
+        dp->pmd_n_threads = pmd_n_threads;
+        VLOG_INFO("PMD threads per numa node without pmd-cpu-mask: %d",
+                  pmd_n_threads);
+        dp_netdev_request_reconfigure(dp);
+    }
+
+    const char *hopa_cp_tx_port = smap_get_def(other_config, "hopa-cp-tx-port",
+                                               HOPA_CP_TX_PORT_DEFAULT);
+    if (!nullable_string_is_equal(dp->hopa_cp_tx_port_name, hopa_cp_tx_port)) {
+        free(dp->hopa_cp_tx_port_name);
+        dp->hopa_cp_tx_port_name = nullable_xstrdup(hopa_cp_tx_port);
+        dp_netdev_request_reconfigure(dp);
+    }
+
+    /* Ports already up are reconfigured, new ones start with it. */
+    int n_rxq = MAX(smap_get_int(other_config, "n-rxq-default", NR_QUEUE), 1);
+    if (n_rxq != dpif_netdev_default_n_rxq()) {
+        atomic_store_relaxed(&default_n_rxq, n_rxq);
+        VLOG_INFO("Default number of rx queues set to %d", n_rxq);
+        netdev_dpdk_default_n_rxq_update();
+    }
+
     atomic_read_relaxed(&dp->emc_insert_min, &cur_min);
     if (insert_prob <= UINT32_MAX) {
         insert_min = insert_prob == 0 ? 0 : UINT32_MAX / insert_prob;
@@ -5275,15 +5338,127 @@ dp_netdev_pmd_flush_output_on_port(struct dp_netdev_pmd_thread *pmd,
     return output_cnt;
 }
 
+static struct tx_port *pmd_send_port_cache_lookup(
+    const struct dp_netdev_pmd_thread *pmd, odp_port_t port_no);
+
+/* Probe builder installed by the HOPA CP, NULL until then. */
+static ATOMIC(hopa_cp_probe_func *) hopa_cp_probe_cb;
+
+/* HOPA CP initialization, main thread only.  NULL once called. */
+static hopa_cp_init_func *hopa_cp_init_cb;
+
+/* Sends the 'n' CP packets in 'mbufs' through 'p' right away. */
+static int
+dp_netdev_pmd_hopa_cp_output(struct dp_netdev_pmd_thread *pmd,
+                             struct tx_port *p, struct rte_mbuf **mbufs,
+                             int n)
+{
+    int output_cnt = 0;
+
+    if (!n) {
+        return 0;
+    }
+
+    /* Own batch: netdev-dpdk wants a single packet source per batch. */
+    if (!dp_packet_batch_is_empty(&p->output_pkts)) {
+        output_cnt += dp_netdev_pmd_flush_output_on_port(pmd, p);
+    }
+    pmd->n_output_batches++;
+    for (int i = 0; i < n; i++) {
+        struct dp_packet *packet = (struct dp_packet *) mbufs[i];
+
+        dp_packet_reset_cutlen(packet);
+        packet->packet_type = htonl(PT_ETH);
+        pkt_metadata_init(&packet->md, ODPP_NONE);
+        p->output_pkts_rxqs[i] = NULL;
+        dp_packet_batch_add(&p->output_pkts, packet);
+    }
+
+    return output_cnt + dp_netdev_pmd_flush_output_on_port(pmd, p);
+}
+
+/* HOPA CP transmit lane: CP packets are built by the CP threads and go to
+ * the output batch of the egress port as they are, without classification.
+ * Sent right away to keep probe timing, one thread drains at a time since
+ * the CP out rings are single consumer. */
+static int
+dp_netdev_pmd_hopa_cp_tx(struct dp_netdev_pmd_thread *pmd)
+{
+    static atomic_flag hopa_cp_tx_busy = ATOMIC_FLAG_INIT;
+    struct rte_mbuf *mbufs[NETDEV_MAX_BURST];
+    struct tx_port *p;
+    uint32_t port_no;
+    bool pending = false;
+    int n;
+
+    if (!m_hopa_cp_in_out_ring) {
+        return 0;
+    }
+    for (int i = 0; i < HOPA_CP_TX_N; i++) {
+        pending |= !rte_ring_empty(m_hopa_cp_in_out_ring->hopa_cp_out_rings[i]);
+    }
+    if (!pending) {
+        return 0;
+    }
+
+    atomic_read_relaxed(&pmd->dp->hopa_cp_tx_port, &port_no);
+    p = pmd_send_port_cache_lookup(pmd, u32_to_odp(port_no));
+    if (!p || atomic_flag_test_and_set(&hopa_cp_tx_busy)) {
+        return 0;
+    }
+    n = hopa_cp_out_dequeue(mbufs, NETDEV_MAX_BURST);
+    atomic_flag_clear(&hopa_cp_tx_busy);
+
+    return dp_netdev_pmd_hopa_cp_output(pmd, p, mbufs, n);
+}
+
+/* Builds and sends the HOPA CP probes that are due, if this pmd owns them.
+ * Returns the number of packets sent and sets '*next' to when to call again,
+ * so the pmd main loop only compares times in between. */
+static int
+dp_netdev_pmd_hopa_cp_probe(struct dp_netdev_pmd_thread *pmd,
+                            long long int *next)
+{
+    static atomic_flag hopa_cp_probe_busy = ATOMIC_FLAG_INIT;
+    struct rte_mbuf *mbufs[NETDEV_MAX_BURST];
+    hopa_cp_probe_func *cb;
+    struct tx_port *p;
+    unsigned int core_id;
+    uint32_t port_no;
+    int n;
+
+    *next = pmd->ctx.now + PMD_HOPA_CP_PROBE_RECHECK;
+
+    atomic_read_relaxed(&hopa_cp_probe_cb, &cb);
+    atomic_read_relaxed(&pmd->dp->hopa_cp_probe_core, &core_id);
+    if (!cb || core_id != pmd->core_id) {
+        return 0;
+    }
+
+    atomic_read_relaxed(&pmd->dp->hopa_cp_tx_port, &port_no);
+    p = pmd_send_port_cache_lookup(pmd, u32_to_odp(port_no));
+    /* The owner moves on reconfiguration, the old one may not have noticed
+     * yet: the probe state behind 'cb' is not to be shared. */
+    if (!p || atomic_flag_test_and_set(&hopa_cp_probe_busy)) {
+        return 0;
+    }
+    n = cb(pmd->ctx.now, mbufs, NETDEV_MAX_BURST, next);
+    atomic_flag_clear(&hopa_cp_probe_busy);
+
+    return dp_netdev_pmd_hopa_cp_output(pmd, p, mbufs, n);
+}
+
 static int
 dp_netdev_pmd_flush_output_packets(struct dp_netdev_pmd_thread *pmd,
                                    bool force)
 {
     struct tx_port *p;
-    int output_cnt = 0;
+    int output_cnt;
+
+    output_cnt = dp_netdev_pmd_hopa_cp_tx(pmd);
 
     if (!pmd->n_output_batches) {
-        return 0;
+        return output_cnt;
     }
 
     HMAP_FOR_EACH (p, node, &pmd->send_port_cache) {
@@ -6265,13 +6440,13 @@ reconfigure_pmd_threads(struct dp_netdev *dp)
 
     /* The pmd threads should be started only if there's a pmd port in the
      * datapath.  If the user didn't provide any "pmd-cpu-mask", we start
-     * NR_PMD_THREADS per numa node. */
+     * 'pmd_n_threads' (other_config:pmd-n-threads) per numa node. */
     if (!has_pmd_port(dp)) {
         pmd_cores = ovs_numa_dump_n_cores_per_numa(0);
     } else if (dp->pmd_cmask && dp->pmd_cmask[0]) {
         pmd_cores = ovs_numa_dump_cores_with_cmask(dp->pmd_cmask);
     } else {
-        pmd_cores = ovs_numa_dump_n_cores_per_numa(NR_PMD_THREADS);
+        pmd_cores = ovs_numa_dump_n_cores_per_numa(dp->pmd_n_threads);
     }
 
     /* We need to adjust 'static_tx_qid's only if we're reducing number of
@@ -6560,6 +6735,66 @@ reconfigure_datapath(struct dp_netdev *dp)
         ovs_mutex_unlock(&pmd->port_mutex);
     }
 
+    /* Resolve the HOPA CP egress, the port may have come or gone. */
+    odp_port_t hopa_cp_tx_port = ODPP_NONE;
+    if (dp->hopa_cp_tx_port_name && dp->hopa_cp_tx_port_name[0]) {
+        if (!get_port_by_name(dp, dp->hopa_cp_tx_port_name, &port)) {
+            hopa_cp_tx_port = port->port_no;
+        } else {
+            VLOG_WARN("hopa-cp-tx-port %s: no such port, HOPA CP packets "
+                      "are not sent", dp->hopa_cp_tx_port_name);
+        }
+    }
+    atomic_store_relaxed(&dp->hopa_cp_tx_port, odp_to_u32(hopa_cp_tx_port));
+
+    /* The probes are built by the pmd polling the egress, so their tx time
+     * reflects its load, or else by any pmd that sends. */
+    unsigned int hopa_cp_probe_core = OVS_CORE_UNSPEC;
+    if (hopa_cp_tx_port != ODPP_NONE) {
+        struct dp_netdev_rxq *q = &port->rxqs[0];
+
+        if (port->n_rxq && q->pmd && q->pmd->core_id != NON_PMD_CORE_ID) {
+            hopa_cp_probe_core = q->pmd->core_id;
+        } else {
+            CMAP_FOR_EACH (pmd, node, &dp->poll_threads) {
+                if (pmd->core_id != NON_PMD_CORE_ID
+                    && hmap_count(&pmd->poll_list)) {
+                    hopa_cp_probe_core = pmd->core_id;
+                    break;
+                }
+            }
+        }
+        if (hopa_cp_probe_core == OVS_CORE_UNSPEC) {
+            VLOG_WARN("no pmd polls a port, HOPA CP probes are not sent");
+        }
+    } else {
+        VLOG_INFO("no HOPA CP egress, HOPA CP probes are not sent");
+    }
+    atomic_store_relaxed(&dp->hopa_cp_probe_core, hopa_cp_probe_core);
+
+    /* Bring the CP up with the first DPDK port, the pool goes on the NUMA
+     * node of the egress if it is known by then. */
+    if (hopa_cp_init_cb) {
+        struct dp_netdev_port *dpdk_port = NULL, *p;
+
+        if (hopa_cp_tx_port != ODPP_NONE && netdev_is_pmd(port->netdev)) {
+            dpdk_port = port;
+        } else {
+            HMAP_FOR_EACH (p, node, &dp->ports) {
+                if (netdev_is_pmd(p->netdev)) {
+                    dpdk_port = p;
+                    break;
+                }
+            }
+        }
+        if (dpdk_port) {
+            hopa_cp_init_func *cb = hopa_cp_init_cb;
+
+            hopa_cp_init_cb = NULL;
+            cb(netdev_get_numa_id(dpdk_port->netdev));
+        }
+    }
+
     /* Reload affected pmd threads. */
     reload_affected_pmds(dp);
 
@@ -6870,6 +7105,7 @@ pmd_thread_main(void *f_)
     int poll_cnt;
     int i;
     int process_packets = 0;
+    long long int hopa_cp_next_probe = 0;
 
     poll_list = NULL;
 
@@ -6961,6 +7197,11 @@ reload:
             tx_packets = dp_netdev_pmd_flush_output_packets(pmd, false);
         }
 
+        if (OVS_UNLIKELY(pmd->ctx.now >= hopa_cp_next_probe)) {
+            tx_packets += dp_netdev_pmd_hopa_cp_probe(pmd,
+                                                      &hopa_cp_next_probe);
+        }
+
         /* Do RCU synchronization at fixed interval.  This ensures that
          * synchronization would not be delayed long even at high load of
          * packet processing. */
@@ -7021,6 +7262,7 @@ reload:
     }
 
     pmd_free_static_tx_qid(pmd);
+    hopa_cp_in_ring_release();
     dfc_cache_uninit(&pmd->flow_cache);
     free(poll_list);
     pmd_free_cached_ports(pmd);
@@ -8513,58 +8755,215 @@ dp_netdev_input(struct dp_netdev_pmd_thread *pmd,
     return 0;
 }
 
+/* Lowest free in ring for the calling thread, HOPA_CP_IN_RINGS if all are
+ * owned.  The consumer polls up to the highest ring ever owned, so what a
+ * thread left in its ring when it exited is still drained. */
+static int
+hopa_cp_in_ring_claim(void)
+{
+    struct hopa_cp_in_out_ring *r = m_hopa_cp_in_out_ring;
+    unsigned int busy, used;
+    int id;
+
+    atomic_read(&r->hopa_cp_in_rings_busy, &busy);
+    do {
+        if (busy == (1u << HOPA_CP_IN_RINGS) - 1) {
+            VLOG_WARN_ONCE("more than %d threads receive HOPA packets, "
+                           "dropping the extra", HOPA_CP_IN_RINGS);
+            return HOPA_CP_IN_RINGS;
+        }
+        id = rightmost_1bit_idx(~busy);
+    } while (!atomic_compare_exchange_weak(&r->hopa_cp_in_rings_busy, &busy,
+                                           busy | (1u << id)));
+
+    atomic_read(&r->hopa_cp_in_rings_used, &used);
+    while (used <= (unsigned int) id
+           && !atomic_compare_exchange_weak(&r->hopa_cp_in_rings_used,
+                                            &used, id + 1)) {
+        continue;
+    }
+
+    return id;
+}
+
+/* Gives the calling thread's in ring back, from the PMD exit path, so
+ * recreated PMDs do not run out of rings. */
 static void
-dp_netdev_recirculate(struct dp_netdev_pmd_thread *pmd,
-                      struct dp_packet_batch *packets)
+hopa_cp_in_ring_release(void)
+{
+    int *id = hopa_cp_in_ring_id_get();
+    unsigned int busy;
+
+    if (*id >= 0 && *id < HOPA_CP_IN_RINGS) {
+        atomic_and(&m_hopa_cp_in_out_ring->hopa_cp_in_rings_busy,
+                   ~(1u << *id), &busy);
+    }
+    *id = -1;
+}
+
+/* SPSC in ring of the calling thread, claimed on first use.  A thread that
+ * found none left keeps HOPA_CP_IN_RINGS as its id and gets NULL. */
+static struct rte_ring *
+hopa_cp_in_ring(void)
+{
+    int *id = hopa_cp_in_ring_id_get();
+
+    if (OVS_UNLIKELY(*id < 0)) {
+        *id = hopa_cp_in_ring_claim();
+    }
+    if (OVS_UNLIKELY(*id == HOPA_CP_IN_RINGS)) {
+        return NULL;
+    }
+
+    return m_hopa_cp_in_out_ring->hopa_cp_in_rings[*id];
+}
+
+void
+hopa_cp_probe_register(hopa_cp_probe_func *cb)
+{
+    atomic_store_relaxed(&hopa_cp_probe_cb, cb);
+}
+
+void
+hopa_cp_init_register(hopa_cp_init_func *cb)
+{
+    hopa_cp_init_cb = cb;
+}
+
+unsigned int
+hopa_cp_out_dequeue(struct rte_mbuf **mbufs, unsigned int n)
 {
-    if ((m_hopa_cp_in_out_ring != NULL) && (m_hopa_cp_in_out_ring->hopa_cp_in_ring != NULL)){
-        // HOPA CP receive
-        struct rte_ether_hdr *eth_hdr;
-        struct rte_ipv4_hdr *ipv4_hdr;
-        struct rte_udp_hdr *udp_hdr;
-        // struct hopa_cp_hdr *hopa_cp_hdr;
-        int cp_nb = 0;
-        for (int i = 0; i < packets->count; i++)
+    struct hopa_cp_in_out_ring *r = m_hopa_cp_in_out_ring;
+    unsigned int nb = 0;
+
+    if (!r) {
+        return 0;
+    }
+
+    for (int i = 0; i < HOPA_CP_TX_N && nb < n; i++) {
+        struct rte_ring *ring = r->hopa_cp_out_rings[r->hopa_cp_out_next];
+
+        r->hopa_cp_out_next = (r->hopa_cp_out_next + 1) % HOPA_CP_TX_N;
+        nb += rte_ring_sc_dequeue_burst(ring, (void **)&mbufs[nb], n - nb, NULL);
+    }
+
+    return nb;
+}
+
+/* Copies the HOPA CP packets among 'pkts' into this thread's in ring.  With
+ * 'steal', HOPA packets are also freed and removed from 'pkts', the others
+ * keep their order.  Returns the number of packets left in 'pkts'. */
+int
+hopa_cp_sniff(struct rte_mbuf **pkts, int n, bool steal)
+{
+    if (m_hopa_cp_in_out_ring == NULL)
+        return n;
+
+    // HOPA CP receive
+    struct hopa_cp_msg *hopa_cp_recv_cp_msg[NETDEV_MAX_BURST];
+    struct rte_ether_hdr *eth_hdr;
+    struct rte_ipv4_hdr *ipv4_hdr;
+    struct rte_udp_hdr *udp_hdr;
+    // struct hopa_cp_hdr *hopa_cp_hdr;
+    int cp_nb = 0;
+    int left = 0;
+    for (int i = 0; i < n; i++)
+    {
+        struct rte_mbuf *pkt = pkts[i];
+        bool is_hopa = false;
+
+        eth_hdr = rte_pktmbuf_mtod_offset(pkt, struct rte_ether_hdr *, 0);
+        // VLOG_INFO("eth_hdr->ether_type : [%" PRIu16 "]", rte_cpu_to_be_16(eth_hdr->ether_type));
+
+        /* A CP packet is a single segment of exactly HOPA_CP_PKT_LEN. */
+        if (pkt->data_len >= HOPA_CP_PKT_LEN
+            && eth_hdr->ether_type == rte_cpu_to_be_16(RTE_ETHER_TYPE_IPV4))
         {
-            struct rte_mbuf pkt = packets->packets[i]->mbuf;
-                    
-            eth_hdr = rte_pktmbuf_mtod_offset(&pkt, struct rte_ether_hdr *, 0);
-            //VLOG_INFO("eth_hdr->ether_type : [%" PRIu16 "]", rte_cpu_to_be_16(eth_hdr->ether_type));
+            ipv4_hdr = rte_pktmbuf_mtod_offset(pkt, struct rte_ipv4_hdr *, sizeof(struct rte_ether_hdr));
+            //VLOG_INFO("ipv4_hdr->next_proto_id : [%d]", ipv4_hdr->next_proto_id);
 
-            if(eth_hdr->ether_type == rte_cpu_to_be_16(RTE_ETHER_TYPE_IPV4))
+            if (ipv4_hdr->version_ihl == RTE_IPV4_VHL_DEF && ipv4_hdr->next_proto_id == IPPROTO_UDP)
             {
-                ipv4_hdr = rte_pktmbuf_mtod_offset(&pkt, struct rte_ipv4_hdr *, sizeof(struct rte_ether_hdr));
-                //VLOG_INFO("ipv4_hdr->next_proto_id : [%d]", ipv4_hdr->next_proto_id);
+                udp_hdr = (struct rte_udp_hdr *)(ipv4_hdr + 1);
+
+                //VLOG_INFO("udp_hdr->dgram_len : [%" PRIu16 "]", rte_be_to_cpu_16(udp_hdr->dgram_len));
+                //VLOG_INFO("udp_hdr->src_port : [%" PRIu16 "]", rte_be_to_cpu_16(udp_hdr->src_port));
+                is_hopa =
+                    (rte_be_to_cpu_16(udp_hdr->dgram_len) == (sizeof(struct rte_udp_hdr) + sizeof(struct hopa_cp_hdr)))
+                    & (rte_be_to_cpu_16(udp_hdr->src_port) == HOPA_CP_UDP_SRC_PORT)
+                    & (pkt->pkt_len == HOPA_CP_PKT_LEN);
+            }
+        }
+
+        if (!is_hopa) // not HOPA
+        {
+            pkts[left++] = pkt;
+            continue;
+        }
 
-                if (ipv4_hdr->next_proto_id == IPPROTO_UDP)
-                {
-                    udp_hdr = (struct rte_udp_hdr *)(ipv4_hdr + 1);
+        //VLOG_INFO("received hopa_cp repath");
+        VLOG_DBG("pkt.pkt_len : [%" PRIu32 "] , pkt.data_len : [%" PRIu16 "]", pkt->pkt_len, pkt->data_len);
 
-                    //VLOG_INFO("udp_hdr->dgram_len : [%" PRIu16 "]", rte_be_to_cpu_16(udp_hdr->dgram_len));
-                    //VLOG_INFO("udp_hdr->src_port : [%" PRIu16 "]", rte_be_to_cpu_16(udp_hdr->src_port));
-                    if (
-                        (rte_be_to_cpu_16(udp_hdr->dgram_len) == (sizeof(struct rte_udp_hdr) + sizeof(struct hopa_cp_hdr))) 
-                        & (rte_be_to_cpu_16(udp_hdr->src_port) == 4444)
-                        & (pkt.pkt_len == sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv4_hdr) + sizeof(struct rte_udp_hdr) + sizeof(struct hopa_cp_hdr))
-                        ) // HOPA
-                    {
-                        //VLOG_INFO("received hopa_cp");
-                        VLOG_INFO("pkt.pkt_len : [%" PRIu32 "] , pkt.data_len : [%" PRIu16 "]", pkt.pkt_len, pkt.data_len);
+        hopa_cp_recv_cp_msg[cp_nb] = rte_malloc("hopa_cp_msg", sizeof(struct hopa_cp_msg), 0);
+        if (OVS_UNLIKELY(!hopa_cp_recv_cp_msg[cp_nb])) {
+            COVERAGE_INC(hopa_cp_in_ring_drop);
+        }
+        else
+        {
+            // hopa_cp_hdr = (struct hopa_cp_hdr *)(udp_hdr + 1);
 
-                        hopa_cp_recv_cp_hdr[cp_nb] = rte_malloc("hopa_cp_hdr", sizeof(struct hopa_cp_hdr), 0);
+            hopa_cp_recv_cp_msg[cp_nb]->src_ip = ipv4_hdr->src_addr;
+            rte_ether_addr_copy(&eth_hdr->src_addr, &hopa_cp_recv_cp_msg[cp_nb]->src_mac);
+            rte_memcpy(&hopa_cp_recv_cp_msg[cp_nb]->hdr, udp_hdr + 1, sizeof(struct hopa_cp_hdr));
 
-                        // hopa_cp_hdr = (struct hopa_cp_hdr *)(udp_hdr + 1);
+            cp_nb++;
+        }
 
-                        rte_memcpy(hopa_cp_recv_cp_hdr[cp_nb], udp_hdr + 1, sizeof(struct hopa_cp_hdr));
+        if (steal)
+            rte_pktmbuf_free(pkt);
+        else
+            pkts[left++] = pkt;
+    }
 
-                        cp_nb++;
-                    }
-                }
-            }
+    if(cp_nb)
+    {
+        struct rte_ring *ring = hopa_cp_in_ring();
+        bool sleeping;
+        int enq_nb = 0;
+
+        if (OVS_LIKELY(ring))
+            enq_nb = rte_ring_sp_enqueue_burst(ring, (void **)hopa_cp_recv_cp_msg, cp_nb, NULL);
+        if (OVS_UNLIKELY(enq_nb < cp_nb)) {
+            COVERAGE_ADD(hopa_cp_in_ring_drop, cp_nb - enq_nb);
+            for (int i = enq_nb; i < cp_nb; i++)
+                rte_free(hopa_cp_recv_cp_msg[i]);
         }
 
-        if(cp_nb)
-            rte_ring_sp_enqueue_burst(m_hopa_cp_in_out_ring->hopa_cp_in_ring, (void **)hopa_cp_recv_cp_hdr, cp_nb, NULL);
+        /* Only pay for seq_change() when the CP thread went idle. */
+        atomic_thread_fence(memory_order_seq_cst);
+        atomic_read(&m_hopa_cp_in_out_ring->hopa_cp_in_sleeping, &sleeping);
+        if (sleeping)
+            seq_change(m_hopa_cp_in_out_ring->hopa_cp_in_seq);
+    }
+
+    return left;
+}
+
+static void
+dp_netdev_recirculate(struct dp_netdev_pmd_thread *pmd,
+                      struct dp_packet_batch *packets)
+{
+    /* Ports steering HOPA packets away (options:hopa-cp-steer) never hand
+     * them to the datapath, this only catches the other ports. */
+    if (m_hopa_cp_in_out_ring != NULL)
+    {
+        struct rte_mbuf *mbufs[NETDEV_MAX_BURST];
+        struct dp_packet *packet;
+
+        DP_PACKET_BATCH_FOR_EACH (i, packet, packets) {
+            mbufs[i] = &packet->mbuf;
+        }
+        hopa_cp_sniff(mbufs, dp_packet_batch_size(packets), false);
     }
     
     dp_netdev_input__(pmd, packets, true, 0);
@@ -24,6 +24,7 @@
 #include "openvswitch/types.h"
 #include "dp-packet.h"
 #include "packets.h"
+#include "ovs-atomic.h"
 
 #include <rte_ring.h>
 #include <rte_mempool.h>
@@ -81,25 +82,121 @@ struct hopa_dp_hdr
     rte_be64_t ts;     /**< timestamp */
 };
 
+/* HOPA CP header handed to the CP threads, with the peer that sent it */
+struct hopa_cp_msg
+{
+    rte_be32_t src_ip;
+    struct rte_ether_addr src_mac;
+    struct hopa_cp_hdr hdr;
+};
+
+struct seq;
+
+/* One SPSC in ring per PMD (the non-PMD threads claim theirs the same way),
+ * PMDs claim a ring on their first HOPA packet and give it back on exit. */
+#define HOPA_CP_IN_RINGS (16)
+
+/* CP threads producing CP packets, one SPSC out ring each.  Probes do not
+ * go through a ring, the PMD owning the transmit lane builds them. */
+enum hopa_cp_producer
+{
+    HOPA_CP_TX_PROGRESS, /* hopa_cp_progress */
+    HOPA_CP_TX_N
+};
+
 struct hopa_cp_in_out_ring
 {
-    struct rte_ring *hopa_cp_in_ring;
-    struct rte_ring *hopa_cp_out_ring;
+    struct rte_ring *hopa_cp_in_rings[HOPA_CP_IN_RINGS];
+    atomic_uint hopa_cp_in_rings_busy;         /* bit i -> ring i owned */
+    atomic_uint hopa_cp_in_rings_used;         /* highest ring ever owned + 1 */
+    struct rte_ring *hopa_cp_out_rings[HOPA_CP_TX_N];
+    unsigned int hopa_cp_out_next;             /* fan-in cursor, consumer only */
+    struct seq *hopa_cp_in_seq;        /* changed to wake an idle hopa_cp_progress */
+    atomic_bool hopa_cp_in_sleeping;   /* hopa_cp_progress is (about to be) blocked */
 };
 
 struct hopa_cp_in_out_ring *m_hopa_cp_in_out_ring;
 
-struct rte_mbuf *hopa_cp_send_mbuf[32];
-struct hopa_cp_hdr *hopa_cp_recv_cp_hdr[32];
+/* Names a secondary DPDK process looks the CP resources up by, see
+ * ovs-vswitchd --hopa-cp-external and repath_cp/include/hopa_ovs.h. */
+#define HOPA_CP_MP_NAME "HOPA_CP_MP"
+#define HOPA_CP_IN_RING_FMT "hopa_cp in %d"
+#define HOPA_CP_OUT_RING_FMT "hopa_cp out %d"
+#define HOPA_CP_EXPORT_MZ "hopa_cp_export"
+#define HOPA_CP_EXPORT_MAGIC (0x48435058)   /* "HCPX" */
+#define HOPA_CP_EXPORT_VERSION (1)
+#define HOPA_CP_EXPORT_MAX_PEERS (1024)
+#define HOPA_CP_EXPORT_PATH_NB (4)
+
+/* Path state of one peer, as published by the external CP. */
+struct hopa_cp_export_peer
+{
+    rte_be32_t ip;
+    uint8_t best_path_id;
+    uint8_t pad[3];
+    uint64_t all_paths_delay_list[HOPA_CP_EXPORT_PATH_NB];
+};
+
+/* Memzone HOPA_CP_EXPORT_MZ, filled by ovs-vswitchd before anything is
+ * enqueued.  Plain C types only, hopa_ovs.h mirrors it. */
+struct hopa_cp_export
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t n_in_rings;       /* HOPA_CP_IN_RINGS */
+    uint32_t out_ring;         /* out ring the external CP produces into */
+    rte_be32_t src_ip;         /* local end of the CP packets */
+    struct rte_ether_addr src_mac;
+    uint16_t src_port;         /* host order */
+    uint16_t dst_port;         /* host order, plus the path id */
+    volatile int32_t cp_pid;   /* attached external CP, 0 if none */
+    volatile uint32_t n_peers;
+    struct hopa_cp_export_peer peers[HOPA_CP_EXPORT_MAX_PEERS];
+};
+
+/* CP egress when other_config:hopa-cp-tx-port is not set, "" disables it. */
+#define HOPA_CP_TX_PORT_DEFAULT "pf1hpf"
+
+/* UDP source port of every HOPA CP packet. */
+#define HOPA_CP_UDP_SRC_PORT (4444)
+#define HOPA_CP_PKT_LEN (sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv4_hdr) + sizeof(struct rte_udp_hdr) + sizeof(struct hopa_cp_hdr))
 
-/* 最优路径ID */
-uint8_t best_path_id; 
+/* Hands the HOPA CP packets among 'pkts' to the CP, see dpif-netdev.c. */
+int hopa_cp_sniff(struct rte_mbuf **pkts, int n, bool steal);
+
+/* Round-robin fan-in over the out rings, single consumer only: the PMD
+ * transmit lane (other_config:hopa-cp-tx-port) serializes its callers. */
+unsigned int hopa_cp_out_dequeue(struct rte_mbuf **mbufs, unsigned int n);
+
+/* Builds the probes due at 'now' (usec) into 'mbufs', at most 'n', returns
+ * how many and sets '*next' to when it wants to be called again.  Called by
+ * one PMD at a time, the one owning the transmit lane. */
+typedef unsigned int hopa_cp_probe_func(long long int now,
+                                        struct rte_mbuf **mbufs,
+                                        unsigned int n, long long int *next);
+void hopa_cp_probe_register(hopa_cp_probe_func *cb);
+
+/* Creates the CP resources on NUMA node 'numa_id' (NETDEV_NUMA_UNSPEC if
+ * unknown).  Called once, on the main thread, by the first netdev datapath
+ * reconfiguration that has a DPDK port up, so the CP is ready before any
+ * CP packet can arrive. */
+typedef void hopa_cp_init_func(int numa_id);
+void hopa_cp_init_register(hopa_cp_init_func *cb);
 
 /* HOPA CP end */
 
+/* Defaults only: other_config:n-rxq-default and other_config:pmd-n-threads
+ * override them at runtime. */
 #define NR_QUEUE   1
 #define NR_PMD_THREADS 1
 
+/* Rx queues of a DPDK port without options:n_rxq. */
+int dpif_netdev_default_n_rxq(void);
+
+/* Moves the DPDK ports without options:n_rxq to a changed
+ * dpif_netdev_default_n_rxq(), see netdev-dpdk.c. */
+void netdev_dpdk_default_n_rxq_update(void);
+
 #ifdef  __cplusplus
 }
 #endif
@@ -491,6 +491,8 @@ struct netdev_dpdk {
         int requested_mtu;
         int requested_n_txq;
         int requested_n_rxq;
+        bool n_rxq_default;         /* No options:n_rxq, see
+                                     * netdev_dpdk_default_n_rxq_update(). */
         int requested_rxq_size;
         int requested_txq_size;
 
@@ -519,6 +521,15 @@ struct netdev_dpdk {
 
         /* VF configuration. */
         struct eth_addr requested_hwaddr;
+
+        /* HOPA CP steering, options:hopa-cp-steer.  An rte_flow rule moves
+         * HOPA CP packets to rx queue 'hopa_cp_qid', which the datapath does
+         * not poll.  When the driver rejects the rule 'hopa_cp_qid' is -1 and
+         * rxq_recv() classifies in software instead. */
+        bool requested_hopa_cp_steer;
+        bool hopa_cp_steer;
+        int hopa_cp_qid;
+        struct rte_flow *hopa_cp_flow;
     );
 
     PADDED_MEMBERS(CACHE_LINE_SIZE,
@@ -664,7 +675,8 @@ dpdk_calculate_mbufs(struct netdev_dpdk *dev, int mtu, bool per_port_mp)
          * + <packets in the pmd threads>
          * + <additional memory for corner cases>
          */
-        n_mbufs = dev->requested_n_rxq * dev->requested_rxq_size
+        n_mbufs = (dev->requested_n_rxq + dev->requested_hopa_cp_steer)
+                  * dev->requested_rxq_size
                   + dev->requested_n_txq * dev->requested_txq_size
                   + MIN(RTE_MAX_LCORE, dev->requested_n_rxq) * NETDEV_MAX_BURST
                   + MIN_NB_MBUF;
@@ -1066,6 +1078,15 @@ dpdk_eth_dev_port_config(struct netdev_dpdk *dev, int n_rxq, int n_txq)
             continue;
         }
 
+        /* The last queue is kept for HOPA CP packets, needs one for data. */
+        if (dev->hopa_cp_qid >= 0) {
+            if (n_rxq < 2) {
+                dev->hopa_cp_qid = -1;
+            } else {
+                dev->hopa_cp_qid = --n_rxq;
+            }
+        }
+
         dev->up.n_rxq = n_rxq;
         dev->up.n_txq = n_txq;
 
@@ -1075,6 +1096,94 @@ dpdk_eth_dev_port_config(struct netdev_dpdk *dev, int n_rxq, int n_txq)
     return diag;
 }
 
+/* Keeps RSS off the HOPA CP queue: spread the redirection table over the
+ * 'n_rxq' data queues only. */
+static int
+netdev_dpdk_hopa_cp_reta(struct netdev_dpdk *dev, int n_rxq)
+{
+    struct rte_eth_rss_reta_entry64 reta[ETH_RSS_RETA_SIZE_512
+                                         / RTE_RETA_GROUP_SIZE];
+    struct rte_eth_dev_info info;
+    struct rte_eth_conf conf;
+
+    if (rte_eth_dev_conf_get(dev->port_id, &conf)
+        || conf.rxmode.mq_mode != ETH_MQ_RX_RSS) {
+        /* No RSS, data only lands in queue 0. */
+        return 0;
+    }
+
+    rte_eth_dev_info_get(dev->port_id, &info);
+    if (!info.reta_size || info.reta_size > ETH_RSS_RETA_SIZE_512) {
+        return -ENOTSUP;
+    }
+
+    memset(reta, 0, sizeof reta);
+    for (int i = 0; i < info.reta_size; i++) {
+        reta[i / RTE_RETA_GROUP_SIZE].mask |= UINT64_C(1) << (i % RTE_RETA_GROUP_SIZE);
+        reta[i / RTE_RETA_GROUP_SIZE].reta[i % RTE_RETA_GROUP_SIZE] = i % n_rxq;
+    }
+
+    return rte_eth_dev_rss_reta_update(dev->port_id, reta, info.reta_size);
+}
+
+/* Installs the rule moving HOPA CP packets (UDP source port
+ * HOPA_CP_UDP_SRC_PORT) to 'hopa_cp_qid'. */
+static int
+netdev_dpdk_hopa_cp_flow_create(struct netdev_dpdk *dev)
+    OVS_REQUIRES(dev->mutex)
+{
+    const struct rte_flow_attr attr = { .ingress = 1 };
+    const struct rte_flow_item_udp udp_spec = {
+        .hdr.src_port = RTE_BE16(HOPA_CP_UDP_SRC_PORT),
+    };
+    const struct rte_flow_item_udp udp_mask = {
+        .hdr.src_port = RTE_BE16(0xffff),
+    };
+    const struct rte_flow_item items[] = {
+        { .type = RTE_FLOW_ITEM_TYPE_ETH },
+        { .type = RTE_FLOW_ITEM_TYPE_IPV4 },
+        { .type = RTE_FLOW_ITEM_TYPE_UDP, .spec = &udp_spec, .mask = &udp_mask },
+        { .type = RTE_FLOW_ITEM_TYPE_END },
+    };
+    const struct rte_flow_action_queue queue = { .index = dev->hopa_cp_qid };
+    const struct rte_flow_action actions[] = {
+        { .type = RTE_FLOW_ACTION_TYPE_QUEUE, .conf = &queue },
+        { .type = RTE_FLOW_ACTION_TYPE_END },
+    };
+    struct rte_flow_error error;
+    int err;
+
+    err = netdev_dpdk_hopa_cp_reta(dev, dev->up.n_rxq);
+    if (err) {
+        VLOG_INFO("%s: cannot keep RSS off the HOPA CP queue: %s",
+                  dev->up.name, rte_strerror(-err));
+        return err;
+    }
+
+    memset(&error, 0, sizeof error);
+    dev->hopa_cp_flow = netdev_dpdk_rte_flow_create(&dev->up, &attr, items,
+                                                    actions, &error);
+    if (!dev->hopa_cp_flow) {
+        VLOG_INFO("%s: HOPA CP steering rule rejected: %s",
+                  dev->up.name, error.message ? error.message : "unknown");
+        return -ENOTSUP;
+    }
+
+    return 0;
+}
+
+static void
+netdev_dpdk_hopa_cp_flow_destroy(struct netdev_dpdk *dev)
+    OVS_REQUIRES(dev->mutex)
+{
+    struct rte_flow_error error;
+
+    if (dev->hopa_cp_flow) {
+        netdev_dpdk_rte_flow_destroy(&dev->up, dev->hopa_cp_flow, &error);
+        dev->hopa_cp_flow = NULL;
+    }
+}
+
 static void
 dpdk_eth_flow_ctrl_setup(struct netdev_dpdk *dev) OVS_REQUIRES(dev->mutex)
 {
@@ -1141,9 +1250,12 @@ dpdk_eth_dev_init(struct netdev_dpdk *dev)
         }
     }
 
-    n_rxq = MIN(info.max_rx_queues, dev->up.n_rxq);
+    /* One more rx queue when steering HOPA CP packets in hardware. */
+    dev->hopa_cp_qid = dev->hopa_cp_steer ? 0 : -1;
+    n_rxq = MIN(info.max_rx_queues, dev->up.n_rxq + dev->hopa_cp_steer);
     n_txq = MIN(info.max_tx_queues, dev->up.n_txq);
 
+retry:
     diag = dpdk_eth_dev_port_config(dev, n_rxq, n_txq);
     if (diag) {
         VLOG_ERR("Interface %s(rxq:%d txq:%d lsc interrupt mode:%s) "
@@ -1162,6 +1274,19 @@ dpdk_eth_dev_init(struct netdev_dpdk *dev)
     }
     dev->started = true;
 
+    if (dev->hopa_cp_qid >= 0 && netdev_dpdk_hopa_cp_flow_create(dev)) {
+        /* Give the queue back to the datapath, classify in software. */
+        VLOG_INFO("%s: HOPA CP packets classified in software", dev->up.name);
+        rte_eth_dev_stop(dev->port_id);
+        dev->started = false;
+        dev->hopa_cp_qid = -1;
+        n_rxq = dev->up.n_rxq;
+        goto retry;
+    } else if (dev->hopa_cp_qid >= 0) {
+        VLOG_INFO("%s: HOPA CP packets steered to rxq %d", dev->up.name,
+                  dev->hopa_cp_qid);
+    }
+
     netdev_dpdk_configure_xstats(dev);
 
     rte_eth_promiscuous_enable(dev->port_id);
@@ -1253,8 +1378,10 @@ common_construct(struct netdev *netdev, dpdk_port_t port_no,
 
     netdev->n_rxq = 0;
     netdev->n_txq = 0;
-    dev->requested_n_rxq = NR_QUEUE;
-    dev->requested_n_txq = NR_QUEUE;
+    dev->requested_n_rxq = dpif_netdev_default_n_rxq();
+    dev->requested_n_txq = dpif_netdev_default_n_rxq();
+    dev->n_rxq_default = true;
+    dev->hopa_cp_qid = -1;
     dev->requested_rxq_size = NIC_PORT_DEFAULT_RXQ_SIZE;
     dev->requested_txq_size = NIC_PORT_DEFAULT_TXQ_SIZE;
 
@@ -1704,6 +1831,14 @@ netdev_dpdk_get_config(const struct netdev *netdev, struct smap *args)
         }
         smap_add(args, "lsc_interrupt_mode",
                  dev->lsc_interrupt_mode ? "true" : "false");
+        if (dev->hopa_cp_steer) {
+            if (dev->hopa_cp_qid >= 0) {
+                smap_add_format(args, "hopa_cp_steer", "rxq %d",
+                                dev->hopa_cp_qid);
+            } else {
+                smap_add(args, "hopa_cp_steer", "software");
+            }
+        }
 
         if (dpdk_port_is_representor(dev)) {
             smap_add_format(args, "dpdk-vf-mac", ETH_ADDR_FMT,
@@ -1851,13 +1986,33 @@ dpdk_set_rxq_config(struct netdev_dpdk *dev, const struct smap *args)
 {
     int new_n_rxq;
 
-    new_n_rxq = MAX(smap_get_int(args, "n_rxq", NR_QUEUE), 1);
+    dev->n_rxq_default = !smap_get(args, "n_rxq");
+    new_n_rxq = MAX(smap_get_int(args, "n_rxq", dpif_netdev_default_n_rxq()), 1);
     if (new_n_rxq != dev->requested_n_rxq) {
         dev->requested_n_rxq = new_n_rxq;
         netdev_request_reconfigure(&dev->up);
     }
 }
 
+void
+netdev_dpdk_default_n_rxq_update(void)
+{
+    int n_rxq = dpif_netdev_default_n_rxq();
+    struct netdev_dpdk *dev;
+
+    ovs_mutex_lock(&dpdk_mutex);
+    LIST_FOR_EACH (dev, list_node, &dpdk_list) {
+        ovs_mutex_lock(&dev->mutex);
+        if (dev->type == DPDK_DEV_ETH && dev->n_rxq_default
+            && dev->requested_n_rxq != n_rxq) {
+            dev->requested_n_rxq = n_rxq;
+            netdev_request_reconfigure(&dev->up);
+        }
+        ovs_mutex_unlock(&dev->mutex);
+    }
+    ovs_mutex_unlock(&dpdk_mutex);
+}
+
 static void
 dpdk_process_queue_size(struct netdev *netdev, const struct smap *args,
                         const char *flag, int default_size, int *new_size)
@@ -1986,6 +2141,12 @@ netdev_dpdk_set_config(struct netdev *netdev, const struct smap *args,
         netdev_request_reconfigure(netdev);
     }
 
+    bool hopa_cp_steer = smap_get_bool(args, "hopa-cp-steer", false);
+    if (dev->requested_hopa_cp_steer != hopa_cp_steer) {
+        dev->requested_hopa_cp_steer = hopa_cp_steer;
+        netdev_request_reconfigure(netdev);
+    }
+
     rx_fc_en = smap_get_bool(args, "rx-flow-ctrl", false);
     tx_fc_en = smap_get_bool(args, "tx-flow-ctrl", false);
     autoneg = smap_get_bool(args, "flow-ctrl-autoneg", false);
@@ -2441,50 +2602,30 @@ netdev_dpdk_rxq_recv(struct netdev_rxq *rxq, struct dp_packet_batch *batch,
     struct netdev_rxq_dpdk *rx = netdev_rxq_dpdk_cast(rxq);
     struct netdev_dpdk *dev = netdev_dpdk_cast(rxq->netdev);
     struct ingress_policer *policer = netdev_dpdk_get_ingress_policer(dev);
-    int nb_rx;
+    struct rte_mbuf **pkts = (struct rte_mbuf **) batch->packets;
+    int nb_rx = 0;
     int dropped = 0;
 
     if (OVS_UNLIKELY(!(dev->flags & NETDEV_UP))) {
         return EAGAIN;
     }
 
-    /*nb_rx = rte_eth_rx_burst(rx->port_id, rxq->queue_id,
-                             (struct rte_mbuf **) batch->packets,
-                             NETDEV_MAX_BURST);*/
-                            
-    // HOPA CP
-    if(strcmp(rxq->netdev->name,"pf1hpf"))
-    {
-        nb_rx = rte_eth_rx_burst(rx->port_id, rxq->queue_id,
-                                (struct rte_mbuf **) batch->packets,
-                                NETDEV_MAX_BURST);
-    }
-    else // pf1hpf
-    {
-        int nb_cp;
-        if ((m_hopa_cp_in_out_ring != NULL) && (m_hopa_cp_in_out_ring->hopa_cp_out_ring != NULL))
-            nb_cp = rte_ring_count(m_hopa_cp_in_out_ring->hopa_cp_out_ring);
-        else
-            nb_cp = 0;
-            
-        if (!nb_cp)
-            nb_rx = rte_eth_rx_burst(rx->port_id, rxq->queue_id,
-                                (struct rte_mbuf **) batch->packets,
-                                NETDEV_MAX_BURST);
-        else
-        {
-            nb_rx = rte_eth_rx_burst(rx->port_id, rxq->queue_id,
-                                (struct rte_mbuf **) batch->packets,
-                                NETDEV_MAX_BURST - nb_cp);
+    /* HOPA CP packets never reach the datapath on a steering port: rxq 0
+     * drains the CP queue first, or every queue classifies in software.
+     * What the CP queue holds that is not HOPA after all, the rule being
+     * broader than the check, goes through the datapath ahead of rxq 0's
+     * own burst. */
+    if (dev->hopa_cp_steer && dev->hopa_cp_qid >= 0 && rxq->queue_id == 0) {
+        nb_rx = rte_eth_rx_burst(rx->port_id, dev->hopa_cp_qid, pkts,
+                                 NETDEV_MAX_BURST);
+        nb_rx = hopa_cp_sniff(pkts, nb_rx, true);
+    }
 
-            rte_ring_sc_dequeue_burst(m_hopa_cp_in_out_ring->hopa_cp_out_ring, (void **)hopa_cp_send_mbuf, nb_cp, NULL);
+    nb_rx += rte_eth_rx_burst(rx->port_id, rxq->queue_id, pkts + nb_rx,
+                              NETDEV_MAX_BURST - nb_rx);
 
-            for (int i = 0; i < nb_cp; i++)
-                batch->packets[i + nb_rx]->mbuf = *hopa_cp_send_mbuf[i];
-            nb_rx = nb_rx + nb_cp;
-            
-            VLOG_INFO("nb_cp : [%d]",nb_cp);
-        }
+    if (dev->hopa_cp_steer && dev->hopa_cp_qid < 0) {
+        nb_rx = hopa_cp_sniff(pkts, nb_rx, true);
     }
 
     if (!nb_rx) {
@@ -4120,7 +4261,7 @@ destroy_connection(int vid)
     LIST_FOR_EACH (dev, list_node, &dpdk_list) {
         ovs_mutex_lock(&dev->mutex);
         if (nullable_string_is_equal(ifname, dev->vhost_id)) {
-            uint32_t qp_num = NR_QUEUE;
+            uint32_t qp_num = dpif_netdev_default_n_rxq();
 
             if (netdev_dpdk_get_vid(dev) >= 0) {
                 VLOG_ERR("Connection on socket '%s' destroyed while vhost "
@@ -4925,6 +5066,7 @@ netdev_dpdk_reconfigure(struct netdev *netdev)
         && netdev->n_rxq == dev->requested_n_rxq
         && dev->mtu == dev->requested_mtu
         && dev->lsc_interrupt_mode == dev->requested_lsc_interrupt_mode
+        && dev->hopa_cp_steer == dev->requested_hopa_cp_steer
         && dev->rxq_size == dev->requested_rxq_size
         && dev->txq_size == dev->requested_txq_size
         && eth_addr_equals(dev->hwaddr, dev->requested_hwaddr)
@@ -4935,6 +5077,8 @@ netdev_dpdk_reconfigure(struct netdev *netdev)
         goto out;
     }
 
+    netdev_dpdk_hopa_cp_flow_destroy(dev);
+
     if (dev->reset_needed) {
         rte_eth_dev_reset(dev->port_id);
         if_notifier_manual_report();
@@ -4951,6 +5095,7 @@ netdev_dpdk_reconfigure(struct netdev *netdev)
     }
 
     dev->lsc_interrupt_mode = dev->requested_lsc_interrupt_mode;
+    dev->hopa_cp_steer = dev->requested_hopa_cp_steer;
 
     netdev->n_txq = dev->requested_n_txq;
     netdev->n_rxq = dev->requested_n_rxq;
@@ -6,13 +6,33 @@
 #include <rte_lcore.h>
 #include <rte_ring.h>
 #include <rte_mbuf.h>
+#include <rte_mbuf_dyn.h>
 #include <rte_malloc.h>
 #include <rte_timer.h>
+#include <rte_hash.h>
+#include <rte_jhash.h>
+#include <rte_spinlock.h>
+#include <sys/stat.h>
+#include <limits.h>
+#include <rte_interrupts.h>
+#include <rte_pause.h>
+#include <sys/eventfd.h>
+#include <poll.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <time.h>
+#include <errno.h>
+
+#include "hopa_proto.h"
+#include "hopa_select.h"
+#include "hopa_seq.h"
+#include "hopa_train.h"
+#include "hopa_policy.h"
+#include "hopa_int.h"
 
 #define IPV4_ADDR(a, b, c, d) (((a & 0xff) << 24) | ((b & 0xff) << 16) | ((c & 0xff) << 8) | (d & 0xff))
+#define IPV4_FMT "%u.%u.%u.%u"
+#define IPV4_ARGS(ip) (((ip) >> 24) & 0xff), (((ip) >> 16) & 0xff), (((ip) >> 8) & 0xff), ((ip) & 0xff)
 
 #define PRINT_IP_ADDR(ip_addr) printf("IP: %d.%d.%d.%d\n",           \
                                       (int)((ip_addr) >> 24) & 0xFF, \
@@ -24,10 +44,27 @@
 
 #define RX_RING_SIZE (1024)
 #define TX_RING_SIZE (1024)
-#define NUM_MBUFS (8191)
 #define MBUF_CACHE_SIZE (250)
 #define BURST_SIZE (32)
 
+/* control packet pool: HOPA CP packets are < 80 bytes */
+#define DEF_CP_POOL (1)
+#define CP_NUM_MBUFS (1023)                /* 2^n - 1 */
+#define CP_MBUF_CACHE_SIZE (BURST_SIZE)    /* probes/repaths are allocated and freed in bursts */
+#define CP_MBUF_DATA_ROOM (RTE_PKTMBUF_HEADROOM + 128)
+
+/* adaptive idle: busy poll -> rte_pause -> sleep on an event */
+#define IDLE_SPIN_POLLS (256)    /* empty polls still busy polling */
+#define IDLE_PAUSE_POLLS (4096)  /* empty polls backing off with rte_pause */
+#define IDLE_PAUSE_MAX (512)     /* max rte_pause per empty poll */
+#define IDLE_NAP_US (50)         /* rx wait without rx interrupt */
+#define IDLE_TIMER_MS (10)       /* max sleep, keeps rte_timer_manage running */
+
+/* tx stage */
+#define TX_FLUSH_US (100)        /* max time a probe waits in the tx buffer */
+#define TX_RETRY_BUDGET (4)      /* tx_burst retries before dropping */
+#define STATS_PERIOD_S (10)
+
 /* HOPA param */
 
 #define DEF_SENDER (1)
@@ -48,12 +85,35 @@
 #define SRC_IP IPV4_ADDR(192, 168, 200, 2)
 #define DST_IP IPV4_ADDR(192, 168, 200, 1)
 
-/* Number of paths */
-#define PATH_NB (4)
+/* -e : ECMP fabric, the path is picked by a solved source port */
+#define ECMP_SPORT_LO (49152)
+#define ECMP_SPORT_HI (65535)
+
+/* Multi-peer : remote hosts probed by this CP */
+#define MAX_PEERS (1024)
+#define PROBE_PERIOD_MS (2000)      /* per peer, for test. PROBE_GAP once tuned */
+#define PROBE_TICK_US (1000)        /* probe scheduler granularity */
+#define DEF_PROBE_BW_KBPS (1000)    /* aggregate probe bandwidth over all peers */
+#define PROBE_BURST_ROUNDS (8)      /* token bucket depth, in probe rounds */
+#define PEER_RELOAD_S (1)           /* peer file mtime check */
 
-/* UDP port and path */
-#define SRC_PORT (1234)
-#define DST_PORT_PATH_1 (5678)
+/* -P : path policy per VNI and DSCP, see hopa_policy.h */
+#define POLICY_MAX_RULES (1024)     /* lines of the policy file */
+
+/* -F : BFD-like path liveness, hellos every interval on every path */
+#define DEF_LIVE_MULT (3)           /* hellos missed before a path is down */
+#define LIVE_LOSS_MAX (16)          /* lost in the window before a path is down */
+#define LIVE_BURST (4 * BURST_SIZE) /* hellos per tick */
+#define LIVE_ALL ((1 << PATH_NB) - 1)
+
+/* -T : probe trains, path bandwidth from their dispersion */
+#define DEF_TRAIN_LEN (16)          /* packets per train */
+#define DEF_TRAIN_FRAME (1024)      /* bytes per packet, Ethernet header included */
+#define TRAIN_PERIOD_MS (10000)     /* per peer and path, longer when -T runs dry */
+#define TRAIN_BURST (2)             /* token bucket depth, in trains */
+
+/* receiver -> sender : what the receiver measures of every path */
+#define REPORT_PERIOD_MS (500)      /* per peer, at most */
 
 /* P0 port id */
 #define PORT_P0 (0)
@@ -61,29 +121,106 @@
 /* 预设比例 r */
 #define R (0.7)
 
-enum hopa_module
+/* eventfd wake-up for a ring whose consumer may be asleep */
+struct hopa_ring_event
 {
-    HOPA_CP,
-    HOPA_DP
+    int efd;
+    volatile uint8_t sleeping; /* consumer is (about to be) blocked on efd */
 };
 
-enum hopa_cp_flag
+struct hopa_in_out_ring
 {
-    PROBE,
-    REPATH,
-    REPATH_ACK
+    struct rte_ring *hopa_in_ring;
+    struct rte_ring *hopa_out_ring;      /* probes, buffered */
+    struct rte_ring *hopa_out_prio_ring; /* repath / repath_ack, sent first */
+    struct hopa_ring_event in_ev;
+    struct hopa_ring_event out_ev;       /* shared by both out rings */
 };
 
-struct hopa_in_out_ring
+/* tx stage counters */
+struct hopa_tx_stats
 {
-    struct rte_ring *hopa_in_ring;
-    struct rte_ring *hopa_out_ring;
+    uint64_t rx_pkts;
+    uint64_t tx_pkts;
+    uint64_t tx_prio_pkts;
+    uint64_t tx_retries;
+    uint64_t tx_drops;       /* retry budget exhausted */
+    uint64_t in_ring_drops;  /* rx mbufs dropped, in ring full */
+    uint64_t out_ring_drops; /* CP mbufs dropped, out ring full */
+};
+
+/* best path decisions over all peers, by reason */
+struct hopa_select_stats
+{
+    uint64_t decisions[HOPA_SELECT_REASON_MAX];
+};
+
+/* path failures detected by -F */
+struct hopa_live_stats
+{
+    uint64_t downs;
+    uint64_t ups;
+    uint64_t failovers;     /* downs that moved opt_path_id */
+    uint64_t detect_us_sum; /* last hello -> detection */
+    uint64_t detect_us_max;
+    uint64_t publish_us_max; /* detection -> path table and repath out */
+};
+
+/* probe trains of -T */
+struct hopa_train_stats
+{
+    uint64_t tx_trains;
+    uint64_t tx_drops;     /* trains not sent whole, pool or ring full */
+    uint64_t rx_trains;    /* estimated */
+    uint64_t short_trains; /* too many packets lost to estimate */
+    uint64_t collapsed_trains; /* packets on the same rx stamp */
+};
+
+/* INT stripped at rx by -I */
+struct hopa_int_stats
+{
+    uint64_t rx_pkts;  /* with INT-MD */
+    uint64_t bad;      /* INT DSCP, not INT-MD we read */
+};
+
+/* polling loop idle state */
+struct hopa_idle
+{
+    uint32_t empty_polls; /* consecutive polls without work */
+    uint64_t sleeps;      /* times the loop blocked */
 };
 
 /* HOPA cli parameters */
 struct hopa_param
 {
     int is_sender; /* 1 -> sender. 0 -> receiver. */
+    int rx_intr;   /* 1 -> idle main loop sleeps on Rx interrupt. */
+    int cp_pool;   /* 1 -> CP packets from a small data room pool. 0 -> from the rx pool. */
+    uint32_t probe_bw_kbps; /* aggregate probe bandwidth */
+    const char *peer_file;  /* NULL -> the compiled-in DST peer */
+    int ovs;       /* 1 -> secondary process CP of ovs-vswitchd --hopa-cp-external */
+    const char *paths_shm;  /* shared memory path table for other processes */
+    int graph;     /* 1 -> main lcore runs the rte_graph pipeline */
+    const char *ecmp_spec;  /* fabric ECMP hash, NULL -> paths by dst port only */
+    uint32_t discover_pps;  /* path discovery probe rate, 0 -> no discovery */
+    const char *select_spec; /* best path hysteresis / damping, NULL -> defaults */
+    const char *select_log;  /* decision log, CSV, NULL -> none */
+    uint32_t live_us;       /* hello interval, 0 -> no liveness */
+    uint32_t live_mult;     /* detection multiplier */
+    uint32_t train_kbps;    /* probe train bandwidth, 0 -> no trains */
+    uint32_t train_len;     /* packets per train */
+    uint32_t train_frame;   /* bytes per train packet */
+    const char *policy_file; /* path policy, NULL -> none published */
+    int int_dscp;           /* DSCP of INT packets, -1 -> no INT */
+    int log_level;          /* enum hopa_log_level */
+};
+
+/* mempool occupancy */
+struct hopa_pool_stats
+{
+    struct rte_mempool *mp;
+    unsigned int size;
+    unsigned int in_use_hwm; /* high-water mark of mbufs in use */
 };
 
 /* current path */
@@ -112,26 +249,70 @@ struct cur_path_info
     uint64_t delta_t;
 };
 
-/* HOPA CP Header */
-struct hopa_cp_hdr
+/* BFD-like liveness of one path */
+struct hopa_live
+{
+    uint64_t tx_seq;      /* sender : last hello seq */
+    uint64_t last_rx_tsc; /* receiver : last hello, 0 -> none yet */
+    struct hopa_seq seq;  /* receiver : hello loss window */
+    uint8_t up;
+};
+
+/* remote host and its path state */
+struct hopa_peer
+{
+    uint32_t ip; /* host order, hash key */
+    struct rte_ether_addr mac;
+    uint8_t active;
+    uint8_t learned; /* learned from probes, not in the peer file */
+    uint8_t opt_path_id;
+    struct hopa_select select; /* opt_path_id decision state */
+    uint32_t gen; /* peer file generation that last listed it */
+
+    uint64_t all_paths_delay_list[PATH_NB];
+    struct cur_path_info path_info;
+
+    uint64_t probe_tx_seq[PATH_NB];        /* sender : last probe seq */
+    struct hopa_seq probe_seq[PATH_NB];    /* receiver : probe loss / reordering */
+
+    uint16_t ecmp_sport[PATH_NB]; /* by path, 0 -> SRC_PORT */
+    uint8_t alias_mask;           /* bit i -> path i shares another's, from discovery */
+
+    struct hopa_live live[PATH_NB];
+    uint8_t live_mask;    /* bit i -> path i up; the sender takes it from repath */
+    uint64_t next_live_tsc;
+
+    uint64_t train_tx_seq[PATH_NB];          /* sender : last train id */
+    uint8_t train_path;                      /* sender : next path to train */
+    uint64_t next_train_tsc;
+    struct hopa_train_est train[PATH_NB];    /* receiver : bandwidth estimates */
+    struct hopa_int_est int_est[PATH_NB];    /* receiver : switch telemetry, -I */
+    uint64_t report_tsc;                     /* receiver : last REPORT sent */
+    uint8_t reported;                        /* sender : report[] is the receiver's */
+    struct hopa_paths_quality report[PATH_NB];
+
+    uint64_t next_probe_tsc;
+    uint64_t removed_tsc; /* slot reusable one second after removal */
+} __rte_cache_aligned;
+
+/* one line of the policy file */
+struct hopa_policy_rule
 {
-    uint8_t flag;      /**< HOPA flag. 0 -> control plane . 1 -> data plane */
-    uint8_t cp_flag;   /**< CP flag. 0 -> perbe. 1 -> repath. 2 -> repath_ack. */
-    rte_be64_t ts;     /**< timestamp */
-    uint8_t repath_id; /**< repath id */
-    rte_be64_t seq;
-    rte_be64_t ack;
-    uint8_t rsvd; /**< reserved field */
+    uint32_t vni;
+    uint8_t any_vni;
+    uint64_t dscp_mask;
+    struct hopa_policy policy;
 };
 
-/* HOPA DP Header */
-struct hopa_dp_hdr
+/* peer table: ip -> slot, hot-updated from the peer file */
+struct hopa_peer_table
 {
-    uint8_t flag;      /**< HOPA flag. 0 -> control plane . 1 -> data plane */
-    rte_be64_t ts;     /**< timestamp */
-    uint8_t rsvd;      /**< reserved field */
-    rte_be32_t seq_nb; /**< timestamp */
-    uint8_t seg_end;   /**< reserved field */
+    struct rte_hash *hash;
+    struct hopa_peer *peers; /* MAX_PEERS slots */
+    rte_spinlock_t lock;     /* writers: peer file reload and learning */
+    uint32_t gen;
+    char file[PATH_MAX];
+    time_t mtime;
 };
 
 /* Function definition */
@@ -139,27 +320,91 @@ struct hopa_dp_hdr
 static void parse_args(struct hopa_param *user_param, int argc, char *argv[]);
 static void usage();
 static void print_hopa_param(struct hopa_param *user_param);
-static inline int port_init(uint16_t port, struct rte_mempool *mbuf_pool);
+static inline int port_init(uint16_t port, struct rte_mempool *mbuf_pool, int rx_intr);
+static struct rte_mempool *pool_create(const char *name, unsigned int n, unsigned int cache_size, uint16_t data_room, int socket_id, struct hopa_pool_stats *stats);
+static void pool_watch(struct hopa_pool_stats *stats);
+
+/* adaptive idle */
+static bool hopa_idle_poll(struct hopa_idle *idle, uint16_t nb_work);
+static int hopa_ring_event_init(struct hopa_ring_event *ev);
+static unsigned int hopa_ring_enqueue(struct rte_ring *ring, struct hopa_ring_event *ev, struct rte_mbuf **mbufs, unsigned int n, uint64_t *drops);
+static void hopa_ring_wait(struct rte_ring *ring, struct hopa_ring_event *ev, int timeout_us);
+static void hopa_main_sleep(struct hopa_in_out_ring *in_out_ring, int rx_intr);
+
+/* tx stage */
+static uint16_t hopa_tx_burst(uint16_t port, uint16_t queue, struct rte_mbuf **pkts, uint16_t nb_pkts);
+static uint16_t hopa_tx_retry(uint16_t port, uint16_t queue, struct rte_mbuf **pkts, uint16_t sent, uint16_t nb_pkts);
+static void hopa_tx_buffer_err_cb(struct rte_mbuf **unsent, uint16_t count, void *userdata);
+static void print_tx_stats(void);
+static void print_pool_stats(void);
+static void print_select_stats(void);
+static void print_live_stats(void);
+static void print_train_stats(void);
+static void print_int_stats(void);
+
+/* peer table */
+static void peer_table_init(const char *file, bool def_peer);
+static int peer_parse_line(const char *line, uint32_t *ip, struct rte_ether_addr *mac);
+static struct hopa_peer *peer_lookup(uint32_t ip);
+static struct hopa_peer *peer_add(uint32_t ip, const struct rte_ether_addr *mac, uint8_t learned);
+static void peer_del(struct hopa_peer *peer);
+static int peer_table_load(void);
+static void peer_table_watch(void);
+static struct hopa_peer *peer_from_pkt(struct rte_mbuf *mbuf, bool learn);
+static void peer_ecmp_solve(struct hopa_peer *peer);
+static bool peer_select_path(struct hopa_peer *peer);
+static uint16_t peer_src_port(const struct hopa_peer *peer, uint16_t dst_port);
+static bool hopa_is_cp_udp(const struct rte_udp_hdr *udp_hdr, uint32_t len);
+
+/* path table for other processes */
+static void paths_init(const char *name);
+static int64_t peer_delay_ns(const struct hopa_peer *peer, int i);
+static void peer_quality(const struct hopa_peer *peer, int i, struct hopa_paths_quality *q);
+static void paths_publish(const struct hopa_peer *peer);
+
+/* path policy for other processes */
+static void policy_init(const char *paths_name, const char *file);
+static int policy_parse_set(const char *spec, unsigned int max, uint64_t *mask);
+static int policy_parse_line(const char *line, struct hopa_policy_rule *rule);
+static int policy_load(void);
+static void policy_watch(void);
 
 /* encode packet */
-static void fill_eth_header(struct rte_ether_hdr *eth_hdr);
-static void fill_ipv4_header(struct rte_ipv4_hdr *ipv4_hdr);
-static void fill_udp_header(struct rte_ipv4_hdr *ipv4_hdr, struct rte_udp_hdr *udp_hdr, uint16_t dst_port);
-static struct rte_mbuf *encode_udp_pkt(uint16_t dst_port);
-static struct rte_mbuf *encode_probe_pkt(uint8_t path_id);
-static struct rte_mbuf *encode_repath_pkt(uint8_t repath_id);
-static struct rte_mbuf *encode_repath_ack_pkt();
+static void fill_eth_header(struct rte_ether_hdr *eth_hdr, const struct hopa_peer *peer);
+static void fill_ipv4_header(struct rte_ipv4_hdr *ipv4_hdr, const struct hopa_peer *peer);
+static void fill_udp_header(struct rte_ipv4_hdr *ipv4_hdr, struct rte_udp_hdr *udp_hdr, uint16_t src_port, uint16_t dst_port);
+static struct rte_mbuf *encode_udp_pkt(const struct hopa_peer *peer, uint16_t dst_port);
+static struct rte_mbuf *encode_probe_pkt(struct hopa_peer *peer, uint8_t path_id);
+static struct rte_mbuf *encode_repath_pkt(const struct hopa_peer *peer, uint8_t repath_id);
+static struct rte_mbuf *encode_repath_ack_pkt(const struct hopa_peer *peer);
+static struct rte_mbuf *encode_report_pkt(const struct hopa_peer *peer);
+static struct rte_mbuf *encode_live_pkt(struct hopa_peer *peer, uint8_t path_id);
+static struct rte_mbuf *encode_train_pkt(const struct hopa_peer *peer, uint8_t path_id, uint64_t id, uint8_t idx);
 
 /* packet progress */
 static void hopa_cp_probe_pkt_progress(struct rte_mbuf *hopa_cp_mbuf);
-static void hopa_cp_repath_pkt_progress(struct rte_mbuf *hopa_cp_mbuf);
+static struct rte_mbuf *hopa_cp_repath_pkt_progress(struct rte_mbuf *hopa_cp_mbuf);
 static void hopa_cp_repath_ack_pkt_progress(struct rte_mbuf *hopa_cp_mbuf);
-static void hopa_dp_ts_pkt_progress(struct rte_mbuf *hopa_cp_mbuf);
+static struct rte_mbuf *hopa_dp_ts_pkt_progress(struct rte_mbuf *hopa_cp_mbuf);
+static void hopa_live_pkt_progress(struct rte_mbuf *hopa_cp_mbuf);
+static void hopa_train_pkt_progress(struct rte_mbuf *hopa_cp_mbuf);
+static void hopa_report_pkt_progress(struct rte_mbuf *hopa_cp_mbuf);
 
-/*  */
-static bool one_path_check();
+/* path liveness */
+static void peer_live_set(struct hopa_peer *peer, uint8_t path_id, bool up, uint64_t now, const char *why);
+static void hopa_live_check(uint64_t now);
+
+/* probe trains */
+static unsigned int train_run(uint64_t now, struct rte_mbuf **mbufs);
+static void hopa_rx_stamp(struct rte_mbuf **mbufs, uint16_t n);
+static void train_ts_clock(uint16_t port);
 
-static uint8_t get_min_delay_path_id(uint64_t *all_paths_delay_list, int length);
+/* switch telemetry */
+static void hopa_int_strip(struct rte_mbuf **mbufs, uint16_t n);
+static void peer_int_update(struct hopa_peer *peer, uint8_t path_id, struct rte_mbuf *mbuf);
+
+/*  */
+static bool one_path_check(struct cur_path_info *cur_path_info);
 
 /* timer */
 static void timer_cb(__rte_unused struct rte_timer *timer, __rte_unused void *arg);
@@ -0,0 +1,78 @@
+#include <rte_icmp.h>
+
+/*
+ * ECMP path discovery, hopa_cp -D <pps>.
+ *
+ * A flow is (source port, path port): DISCOVER_PORTS source ports from
+ * ECMP_SPORT_LO towards each DST_PORT_PATH_1 + k. Every flow is traced
+ * Paris style, the 5-tuple stays fixed and only the TTL changes:
+ *
+ *   TTL 1 .. DISCOVER_MAX_TTL -> ICMP time exceeded, router of that hop
+ *   TTL 64                    -> DISCOVER_ECHO from the peer, RTT
+ *
+ * The TTL rides in the IP id, which routers quote back. Flows with the same
+ * routers on the hops both answered share a path; flows without any router
+ * answer are told apart by RTT. The first flow of a new cluster towards
+ * path port k becomes ecmp_sport[k], so probes and repaths follow it.
+ *
+ * Every DISCOVER_VERIFY_S the chosen flows alone are traced again; any
+ * change, or a path that stopped answering, starts a full sweep.
+ */
+
+#define DISCOVER_PORTS (16)                            /* source ports per path port */
+#define DISCOVER_FLOWS (PATH_NB * DISCOVER_PORTS)
+#define DISCOVER_MAX_TTL (8)                           /* hops traced */
+#define DISCOVER_TTLS (DISCOVER_MAX_TTL + 1)           /* + the end to end probe */
+#define DISCOVER_ECHO_TTL (64)
+#define DISCOVER_MAX_PATHS (16)                        /* clusters kept per peer */
+#define DISCOVER_NO_FLOW (0xFFFF)
+#define DISCOVER_WAIT_MS (500)                         /* late answers after the last probe */
+#define DISCOVER_VERIFY_S (30)
+#define DISCOVER_RTT_TOL_NS (20000)                    /* same path when no router answers */
+#define DISCOVER_BURST (32)                            /* token bucket depth, in probes */
+#define DISCOVER_ICMP_TIME_EXCEEDED (11)
+#define DISCOVER_SPORT(flow) (ECMP_SPORT_LO + (flow) % DISCOVER_PORTS)
+#define DISCOVER_DPORT(flow) (DST_PORT_PATH_1 + (flow) / DISCOVER_PORTS)
+
+enum hopa_discover_state
+{
+    DISCOVER_SWEEP,  /* sending, cursor over flows x TTLs */
+    DISCOVER_WAIT,   /* all sent, collecting answers */
+    DISCOVER_DONE    /* paths chosen, verify at deadline */
+};
+
+/* what came back for one flow */
+struct hopa_discover_flow
+{
+    uint32_t hops[DISCOVER_MAX_TTL]; /* router of TTL i + 1, host order, 0 -> silent */
+    uint64_t rtt_ns;                 /* min echo RTT, 0 -> no echo */
+};
+
+/* per peer slot, discover_table[MAX_PEERS] */
+struct hopa_discover
+{
+    uint32_t ip;        /* peer it belongs to, other -> stale slot */
+    uint8_t state;
+    uint8_t verify;     /* sweeping the chosen flows only */
+    uint8_t n_paths;
+    uint16_t cursor;    /* next probe, flow index x DISCOVER_TTLS + TTL index */
+    uint64_t deadline_tsc;
+
+    uint16_t chosen[PATH_NB];                   /* flow of each path port */
+    struct hopa_discover_flow saved[PATH_NB];   /* their answers when chosen */
+    struct hopa_discover_flow flows[DISCOVER_FLOWS];
+};
+
+/* Function definition */
+static void discover_init(uint32_t pps);
+static void discover_reset(struct hopa_discover *disc, uint32_t ip);
+static struct rte_mbuf *encode_discover_pkt(const struct hopa_peer *peer, uint16_t flow, uint8_t ttl);
+static unsigned int discover_step(struct hopa_peer *peer, struct hopa_discover *disc, uint64_t now, unsigned int budget, struct rte_mbuf **mbufs);
+static unsigned int discover_run(uint64_t now, unsigned int budget, struct rte_mbuf **mbufs);
+static bool discover_answered(const struct hopa_discover_flow *f);
+static bool discover_same_path(const struct hopa_discover_flow *a, const struct hopa_discover_flow *b);
+static void discover_cluster(struct hopa_peer *peer, struct hopa_discover *disc);
+static bool discover_verify(struct hopa_discover *disc);
+static void discover_icmp(struct rte_mbuf *mbuf);
+static void discover_echo(struct rte_mbuf *mbuf);
+static struct rte_mbuf *hopa_discover_pkt_progress(struct rte_mbuf *mbuf);
@@ -0,0 +1,194 @@
+#ifndef HOPA_DUP_H
+#define HOPA_DUP_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "hopa_paths.h"
+
+/*
+ * Redundant dual-path sending of latency-critical flows.
+ *
+ * The sender datapath picks the flows of a DSCP class, sends every packet of
+ * them on the two best live paths of the peer (hopa_dup_paths) and numbers
+ * both copies alike in hopa_dp_hdr.seq_nb (hopa_dup_next_seq). The receiver
+ * datapath delivers the first copy and drops the second (hopa_dup_check):
+ * the packet sees the lower of the two path latencies, for twice the bytes.
+ *
+ * Flows are hashed into HOPA_DUP_FLOWS slots on both ends by the key of the
+ * inner flow, never the path port that differs between the two copies.
+ *
+ *   sender   : seq_nb runs per slot, so a flow keeps increasing numbers
+ *              whoever else shared its slot.
+ *   receiver : per slot, the key and a 64 bit window of the seqs delivered
+ *              below the highest one. A seq behind the window is delivered
+ *              (counted stale): a duplicate may get through, a packet is
+ *              never dropped for lack of state. Neither is one of a flow
+ *              that evicted another from its slot.
+ *
+ * seq_nb is 32 bit and compared modulo 2^32; seq 0 is "not numbered" and
+ * always delivered.
+ *
+ * No DPDK here.
+ */
+
+#define HOPA_DUP_WINDOW (64)
+#define HOPA_DUP_FLOWS (4096)        /* slots, power of 2 */
+#define HOPA_DUP_RESTART (1U << 16)  /* this far behind -> the sender restarted */
+
+enum hopa_dup_result
+{
+    HOPA_DUP_FIRST, /* deliver */
+    HOPA_DUP_COPY,  /* already delivered, drop */
+    HOPA_DUP_STALE  /* behind the window, delivered */
+};
+
+/* sender side */
+struct hopa_dup_tx
+{
+    uint32_t seq[HOPA_DUP_FLOWS];
+};
+
+struct hopa_dup_flow
+{
+    uint32_t key;  /* 0 -> empty */
+    uint32_t top;  /* highest seq */
+    uint64_t bits; /* bit i -> seq top - i delivered */
+};
+
+/* receiver side */
+struct hopa_dup_rx
+{
+    struct hopa_dup_flow flows[HOPA_DUP_FLOWS];
+    uint64_t first;
+    uint64_t copies;
+    uint64_t stale;
+    uint64_t evicted; /* slot taken over by another flow */
+};
+
+/* Key of a flow, never 0. */
+static inline uint32_t hopa_dup_flow_key(uint32_t src_ip, uint32_t dst_ip, uint16_t src_port, uint16_t dst_port, uint8_t proto)
+{
+    uint64_t h;
+
+    h = ((uint64_t)src_ip << 32 | dst_ip) * 0x9E3779B97F4A7C15ULL;
+    h ^= ((uint64_t)src_port << 24 | (uint64_t)dst_port << 8 | proto) * 0xC2B2AE3D27D4EB4FULL;
+    h ^= h >> 29;
+
+    return (uint32_t)(h >> 32) | 1;
+}
+
+/* Spec "<dscp>[,<dscp>...]" into a class mask; 0, or -1 on a bad spec. */
+static inline int hopa_dup_class_parse(uint64_t *mask, const char *spec)
+{
+    const char *p = spec;
+    unsigned long dscp;
+    char *end;
+
+    *mask = 0;
+    for (;;)
+    {
+        dscp = strtoul(p, &end, 10);
+        if (end == p || dscp > 63)
+            return -1;
+        *mask |= 1ULL << dscp;
+        if (*end == '\0')
+            return 0;
+        if (*end != ',')
+            return -1;
+        p = end + 1;
+    }
+}
+
+/* Is a packet with this IPv4 TOS / IPv6 traffic class in the class? */
+static inline int hopa_dup_match(uint64_t mask, uint8_t tos)
+{
+    return (mask >> (tos >> 2)) & 1;
+}
+
+/*
+ * The two paths to send a packet on: best_path_id (or the live path of
+ * lowest delay if it is down) and the live path of lowest delay after it.
+ * 2, or 1 when there is no second live path with a delay.
+ */
+static inline int hopa_dup_paths(const struct hopa_paths_info *info, uint8_t path[2])
+{
+    int n = 1;
+    uint8_t i;
+
+    path[0] = info->best_path_id;
+    if (!hopa_paths_live(info, path[0]))
+        for (i = 0; i < HOPA_PATHS_PATH_NB; i++)
+            if (hopa_paths_live(info, i) && (!hopa_paths_live(info, path[0]) || info->delay_ns[i] < info->delay_ns[path[0]]))
+                path[0] = i;
+
+    for (i = 0; i < HOPA_PATHS_PATH_NB; i++)
+    {
+        if (i == path[0] || !hopa_paths_live(info, i) || info->delay_ns[i] == HOPA_PATHS_DELAY_NONE)
+            continue;
+        if (n == 1 || info->delay_ns[i] < info->delay_ns[path[1]])
+        {
+            path[1] = i;
+            n = 2;
+        }
+    }
+
+    return n;
+}
+
+/* seq_nb of the next packet of flow 'key', both copies carry it. */
+static inline uint32_t hopa_dup_next_seq(struct hopa_dup_tx *tx, uint32_t key)
+{
+    uint32_t *seq = &tx->seq[key & (HOPA_DUP_FLOWS - 1)];
+
+    if (++*seq == 0)
+        ++*seq;
+
+    return *seq;
+}
+
+static inline enum hopa_dup_result hopa_dup_check(struct hopa_dup_rx *rx, uint32_t key, uint32_t seq)
+{
+    struct hopa_dup_flow *f = &rx->flows[key & (HOPA_DUP_FLOWS - 1)];
+    uint32_t back;
+
+    if (seq == 0)
+    {
+        rx->first++;
+        return HOPA_DUP_FIRST;
+    }
+
+    back = f->top - seq;
+    if (f->key != key || (back != 0 && back < (1U << 31) && back >= HOPA_DUP_RESTART))
+    {
+        if (f->key != 0 && f->key != key)
+            rx->evicted++;
+        *f = (struct hopa_dup_flow){.key = key, .top = seq, .bits = 1};
+    }
+    else if (back >= (1U << 31))
+    {
+        /* ahead of top */
+        back = seq - f->top;
+        f->bits = back < HOPA_DUP_WINDOW ? f->bits << back | 1 : 1;
+        f->top = seq;
+    }
+    else if (back >= HOPA_DUP_WINDOW)
+    {
+        rx->stale++;
+        return HOPA_DUP_STALE;
+    }
+    else
+    {
+        if ((f->bits >> back) & 1)
+        {
+            rx->copies++;
+            return HOPA_DUP_COPY;
+        }
+        f->bits |= 1ULL << back;
+    }
+    rx->first++;
+
+    return HOPA_DUP_FIRST;
+}
+
+#endif /* HOPA_DUP_H */
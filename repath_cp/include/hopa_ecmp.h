@@ -0,0 +1,229 @@
+#ifndef HOPA_ECMP_H
+#define HOPA_ECMP_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * ECMP hash inversion: UDP source ports that land on a given ECMP member.
+ *
+ * The switch hashes the 5-tuple with a CRC and picks member hash % n. A CRC
+ * over a fixed-length message is affine over GF(2), so with the source port
+ * as the only variable:
+ *
+ *   crc(tuple(sport)) = crc(tuple(0)) ^ lin[sport]
+ *   lin[sport] = crc(zeros with sport) ^ crc(zeros)
+ *
+ * lin[] depends only on the hash function, not on the addresses. It is
+ * built once (256 KB). Solving a (src, dst, dport) then costs one CRC plus
+ * an XOR per candidate port, which the compiler vectorizes, instead of one
+ * CRC per candidate.
+ *
+ * Hash spec "<crc>[:<seed>[:<members>]]". crc is crc16 | crc16_ccitt |
+ * crc32 | crc32c. The seed is the CRC init value, the default is the
+ * catalogue's. Tuple layout is HOPA_ECMP_OFF_*, all fields in network order.
+ *
+ * No DPDK here: hopa_cp solves online, the hopa_ecmp tool offline.
+ */
+
+#define HOPA_ECMP_MAX_MEMBERS (64)
+#define HOPA_ECMP_BLOCK (64) /* candidate ports per vector pass */
+
+/* hashed tuple, as the switch field list orders it */
+#define HOPA_ECMP_OFF_SRC_IP (0)
+#define HOPA_ECMP_OFF_DST_IP (4)
+#define HOPA_ECMP_OFF_PROTO (8)
+#define HOPA_ECMP_OFF_SPORT (9)
+#define HOPA_ECMP_OFF_DPORT (11)
+#define HOPA_ECMP_TUPLE_LEN (13)
+
+/* CRC model, Rocksoft style; refout == refin */
+struct hopa_ecmp_crc
+{
+    const char *name;
+    uint8_t width;
+    uint8_t refin;
+    uint32_t poly;
+    uint32_t init;
+    uint32_t xorout;
+};
+
+static const struct hopa_ecmp_crc hopa_ecmp_crcs[] = {
+    {"crc16", 16, 1, 0x8005, 0x0000, 0x0000},           /* CRC-16/ARC */
+    {"crc16_ccitt", 16, 0, 0x1021, 0xFFFF, 0x0000},     /* CRC-16/CCITT-FALSE */
+    {"crc32", 32, 1, 0x04C11DB7, 0xFFFFFFFF, 0xFFFFFFFF},
+    {"crc32c", 32, 1, 0x1EDC6F41, 0xFFFFFFFF, 0xFFFFFFFF},
+};
+
+struct hopa_ecmp
+{
+    struct hopa_ecmp_crc crc; /* init is the seed */
+    uint32_t n_members;
+    uint32_t *lin;            /* 65536, lin[sport] */
+};
+
+static inline uint32_t hopa_ecmp_reflect(uint32_t v, int width)
+{
+    uint32_t r = 0;
+
+    for (int i = 0; i < width; i++, v >>= 1)
+        r = (r << 1) | (v & 1);
+
+    return r;
+}
+
+static inline uint32_t hopa_ecmp_crc(const struct hopa_ecmp_crc *c, const uint8_t *buf, size_t len)
+{
+    const uint32_t mask = c->width == 32 ? 0xFFFFFFFF : (1u << c->width) - 1;
+    uint32_t crc;
+
+    if (c->refin)
+    {
+        const uint32_t poly = hopa_ecmp_reflect(c->poly, c->width);
+
+        crc = hopa_ecmp_reflect(c->init, c->width);
+        for (size_t i = 0; i < len; i++)
+        {
+            crc ^= buf[i];
+            for (int b = 0; b < 8; b++)
+                crc = (crc & 1) ? (crc >> 1) ^ poly : crc >> 1;
+        }
+    }
+    else
+    {
+        const uint32_t top = 1u << (c->width - 1);
+
+        crc = c->init;
+        for (size_t i = 0; i < len; i++)
+        {
+            crc ^= (uint32_t)buf[i] << (c->width - 8);
+            for (int b = 0; b < 8; b++)
+                crc = ((crc & top) ? (crc << 1) ^ c->poly : crc << 1) & mask;
+        }
+    }
+
+    return (crc ^ c->xorout) & mask;
+}
+
+/* addresses and ports in host order */
+static inline void hopa_ecmp_tuple(uint8_t *t, uint32_t src, uint32_t dst, uint8_t proto, uint16_t sport, uint16_t dport)
+{
+    t[HOPA_ECMP_OFF_SRC_IP + 0] = src >> 24;
+    t[HOPA_ECMP_OFF_SRC_IP + 1] = src >> 16;
+    t[HOPA_ECMP_OFF_SRC_IP + 2] = src >> 8;
+    t[HOPA_ECMP_OFF_SRC_IP + 3] = src;
+    t[HOPA_ECMP_OFF_DST_IP + 0] = dst >> 24;
+    t[HOPA_ECMP_OFF_DST_IP + 1] = dst >> 16;
+    t[HOPA_ECMP_OFF_DST_IP + 2] = dst >> 8;
+    t[HOPA_ECMP_OFF_DST_IP + 3] = dst;
+    t[HOPA_ECMP_OFF_PROTO] = proto;
+    t[HOPA_ECMP_OFF_SPORT + 0] = sport >> 8;
+    t[HOPA_ECMP_OFF_SPORT + 1] = sport;
+    t[HOPA_ECMP_OFF_DPORT + 0] = dport >> 8;
+    t[HOPA_ECMP_OFF_DPORT + 1] = dport;
+}
+
+/* Member the switch picks for this tuple, by direct CRC. */
+static inline uint32_t hopa_ecmp_member(const struct hopa_ecmp *e, uint32_t src, uint32_t dst, uint8_t proto, uint16_t sport, uint16_t dport)
+{
+    uint8_t t[HOPA_ECMP_TUPLE_LEN];
+
+    hopa_ecmp_tuple(t, src, dst, proto, sport, dport);
+    return hopa_ecmp_crc(&e->crc, t, sizeof(t)) % e->n_members;
+}
+
+/* Parse a hash spec and build lin[]: 0, or -1 on a bad spec / no memory. */
+static inline int hopa_ecmp_init(struct hopa_ecmp *e, const char *spec, uint32_t def_members)
+{
+    const struct hopa_ecmp_crc *c = NULL;
+    uint8_t zero[HOPA_ECMP_TUPLE_LEN] = {0};
+    uint8_t t[HOPA_ECMP_TUPLE_LEN] = {0};
+    const char *sep = strchr(spec, ':');
+    size_t len = sep ? (size_t)(sep - spec) : strlen(spec);
+    uint32_t crc0;
+    char *end;
+
+    memset(e, 0, sizeof(*e));
+    for (size_t i = 0; i < sizeof(hopa_ecmp_crcs) / sizeof(hopa_ecmp_crcs[0]); i++)
+        if (strlen(hopa_ecmp_crcs[i].name) == len && strncmp(spec, hopa_ecmp_crcs[i].name, len) == 0)
+            c = &hopa_ecmp_crcs[i];
+    if (c == NULL)
+        return -1;
+    e->crc = *c;
+    e->n_members = def_members;
+
+    if (sep != NULL)
+    {
+        e->crc.init = strtoul(sep + 1, &end, 0);
+        if (end == sep + 1 || (*end != '\0' && *end != ':'))
+            return -1;
+        if (*end == ':')
+            e->n_members = strtoul(end + 1, &end, 0);
+        if (*end != '\0')
+            return -1;
+    }
+    if (e->n_members == 0 || e->n_members > HOPA_ECMP_MAX_MEMBERS)
+        return -1;
+
+    e->lin = malloc(65536 * sizeof(*e->lin));
+    if (e->lin == NULL)
+        return -1;
+
+    crc0 = hopa_ecmp_crc(&e->crc, zero, sizeof(zero));
+    for (uint32_t sport = 0; sport < 65536; sport++)
+    {
+        t[HOPA_ECMP_OFF_SPORT + 0] = sport >> 8;
+        t[HOPA_ECMP_OFF_SPORT + 1] = sport;
+        e->lin[sport] = hopa_ecmp_crc(&e->crc, t, sizeof(t)) ^ crc0;
+    }
+
+    return 0;
+}
+
+static inline void hopa_ecmp_fini(struct hopa_ecmp *e)
+{
+    free(e->lin);
+    e->lin = NULL;
+}
+
+/*
+ * First source port in [lo, hi] landing on each member, into ports[n_members]
+ * (0 -> none in range). Returns the number of members covered.
+ */
+static inline uint32_t hopa_ecmp_solve(const struct hopa_ecmp *e, uint32_t src, uint32_t dst, uint8_t proto, uint16_t dport,
+                                       uint16_t lo, uint16_t hi, uint16_t *ports)
+{
+    uint8_t t[HOPA_ECMP_TUPLE_LEN];
+    uint32_t h[HOPA_ECMP_BLOCK];
+    uint32_t h0, found = 0;
+
+    hopa_ecmp_tuple(t, src, dst, proto, 0, dport);
+    h0 = hopa_ecmp_crc(&e->crc, t, sizeof(t));
+    memset(ports, 0, e->n_members * sizeof(*ports));
+
+    for (uint32_t base = lo; base <= hi && found < e->n_members; base += HOPA_ECMP_BLOCK)
+    {
+        uint32_t n = hi - base + 1 < HOPA_ECMP_BLOCK ? hi - base + 1 : HOPA_ECMP_BLOCK;
+        const uint32_t *lin = &e->lin[base];
+
+        /* the vector pass */
+        for (uint32_t i = 0; i < n; i++)
+            h[i] = h0 ^ lin[i];
+
+        for (uint32_t i = 0; i < n && found < e->n_members; i++)
+        {
+            uint32_t m = h[i] % e->n_members;
+
+            if (ports[m] == 0 && base + i != 0)
+            {
+                ports[m] = base + i;
+                found++;
+            }
+        }
+    }
+
+    return found;
+}
+
+#endif /* HOPA_ECMP_H */
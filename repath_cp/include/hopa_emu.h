@@ -0,0 +1,238 @@
+#ifndef HOPA_EMU_H
+#define HOPA_EMU_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <rte_eal.h>
+#include <rte_ethdev.h>
+#include <rte_cycles.h>
+#include <rte_lcore.h>
+#include <rte_mbuf.h>
+#include <rte_ip.h>
+#include <rte_udp.h>
+#include <rte_malloc.h>
+#include <rte_random.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "hopa_proto.h"
+#include "hopa_dup.h"
+#include "hopa_policy.h"
+
+/*
+ * HOPA multipath fabric emulator.
+ *
+ * Two DPDK ports (memif / net_ring vdevs) are bridged through N emulated
+ * paths. A packet is mapped onto a path by its UDP destination port
+ * (DST_PORT_PATH_1 + path_id), held for the path delay, and released in
+ * due-time order, so the sender and receiver CP run on one machine.
+ *
+ *   hopa_cp -s 1  <--memif id 0-->  hopa_emu  <--memif id 1-->  hopa_cp -s 0
+ *
+ * With -R / -Q the emulator also stands in for the sender and receiver
+ * datapaths of a latency-critical DSCP class (hopa_dup.h): packets of the
+ * class towards the receiver go on the two best paths (-R) or the best one
+ * (-Q), numbered in a hopa_dp_hdr, deduplicated on release, and their
+ * latency is reported per scenario. -G generates such packets in the
+ * emulator itself.
+ */
+
+/* DPDK param */
+
+#define EMU_RX_RING_SIZE (1024)
+#define EMU_TX_RING_SIZE (1024)
+#define EMU_NUM_MBUFS (16383)
+#define EMU_MBUF_CACHE_SIZE (250)
+#define EMU_BURST_SIZE (32)
+
+/* max packets held inside the fabric at once */
+#define EMU_MAX_INFLIGHT (8192)
+
+/* EMU param */
+
+#define EMU_MAX_PATHS (16)
+#define EMU_DEF_PATH_NB (PATH_NB)
+#define EMU_DEF_BASE_PORT (DST_PORT_PATH_1)
+#define EMU_DEF_DELAY_US (50)
+#define EMU_DEF_RATE_MBPS (10000)
+#define EMU_DEF_QLIMIT_KB (512)
+
+#define EMU_DEF_WARMUP_S (5)
+#define EMU_DEF_DURATION_S (10)
+
+/* incast cross traffic, in percent of the path rate */
+#define EMU_INCAST_LOAD (150)
+/* slow drift, extra one-way delay added per second */
+#define EMU_DRIFT_US_PER_S (20)
+
+/* latency histogram, 1 us bins, the last one open ended */
+#define EMU_LAT_BINS (20000)
+
+/* -G generator: flows, frame size, sent and consumed by the emulator */
+#define EMU_GEN_FLOWS (8)
+#define EMU_GEN_PKT_LEN (128)
+#define EMU_GEN_SPORT (5000)
+/* path table -m retried this often until the sender CP created it */
+#define EMU_PATHS_RETRY_NS (NS_PER_S)
+#define EMU_VXLAN_PORT (4789)
+#define EMU_VXLAN_HDR_LEN (8)
+/* -I: INT switches of the fabric, sender leaf -> path spine -> receiver leaf */
+#define EMU_INT_HOPS (3)
+#define EMU_INT_HOP_NS (1000)      /* switch latency without queueing */
+#define EMU_INT_NODE_LEAF (1)      /* sender leaf, the receiver leaf is the next */
+#define EMU_INT_NODE_SPINE (100)   /* + path id */
+
+/* port 0 faces the sender, port 1 the receiver */
+#define EMU_PORT_SENDER (0)
+#define EMU_PORT_RECEIVER (1)
+#define EMU_PORT_NB (2)
+
+enum emu_scenario
+{
+    EMU_SCN_NONE,
+    EMU_SCN_INCAST,
+    EMU_SCN_PATH_FAIL,
+    EMU_SCN_DRIFT
+};
+
+/* one emulated path */
+struct emu_path
+{
+    /* model, programmable from the cli */
+    uint64_t delay_ns;   /**< base one-way delay */
+    uint64_t jitter_ns;  /**< uniform jitter added on top of delay */
+    uint64_t rate_bps;   /**< bottleneck rate, 0 -> unlimited */
+    uint64_t qlimit;     /**< bottleneck queue limit (bytes) */
+    uint32_t loss_ppm;   /**< random loss, parts per million */
+    uint32_t reorder_ppm; /**< probability a packet is held back */
+    uint64_t reorder_ns; /**< extra hold for a reordered packet */
+
+    /* runtime state */
+    bool down;           /**< blackhole */
+    uint64_t cross_bps;  /**< cross traffic sharing the bottleneck */
+    uint64_t backlog;    /**< bottleneck queue occupancy (bytes) */
+    uint64_t last_ns;    /**< last backlog update */
+
+    /* stats */
+    uint64_t tx_pkts;
+    uint64_t tx_bytes;
+    uint64_t drop_pkts;
+    uint64_t drop_bytes;
+    uint64_t reorder_pkts;
+};
+
+enum emu_copy
+{
+    EMU_COPY_NONE,    /* not in the class */
+    EMU_COPY_PRIMARY, /* on the best path */
+    EMU_COPY_SECOND   /* on the second best, -R */
+};
+
+/* packet waiting inside the fabric */
+struct emu_event
+{
+    uint64_t due_ns;
+    uint16_t out_port;
+    uint8_t copy;          /**< enum emu_copy */
+    uint8_t gen;           /**< from -G, consumed on release */
+    uint32_t key;          /**< class flow key */
+    uint8_t numbered;      /**< hopa_dp_hdr with its seq_nb after the UDP header */
+    uint64_t in_ns;        /**< entered the fabric */
+    struct rte_mbuf *mbuf;
+};
+
+struct emu_lat
+{
+    uint64_t n;
+    uint64_t max_ns;
+    uint32_t bins[EMU_LAT_BINS];
+};
+
+/* min-heap of emu_event ordered by due_ns */
+struct emu_heap
+{
+    struct emu_event *ev;
+    uint32_t count;
+    uint32_t size;
+};
+
+/* per scenario measurement */
+struct emu_report
+{
+    enum emu_scenario scn;
+    uint8_t victim;        /**< degraded path */
+    uint64_t trigger_ns;   /**< when the path was degraded */
+    uint64_t react_ns;     /**< first repath away from the victim, 0 -> never */
+    uint8_t react_path;    /**< path the CP moved to */
+    uint64_t offered_bytes; /**< victim bytes offered between trigger and reaction */
+    uint64_t lost_bytes;   /**< of those, dropped or later than late_ns */
+};
+
+/* EMU cli parameters */
+struct emu_param
+{
+    uint8_t path_nb;
+    uint16_t base_port;
+    enum emu_scenario scn; /* EMU_SCN_NONE -> run every scenario in turn */
+    uint32_t warmup_s;
+    uint32_t duration_s;
+    uint64_t late_ns;      /* delivery later than this counts as lost goodput */
+    uint64_t class_mask;   /* latency-critical DSCPs, 0 -> none */
+    bool dup;              /* -R: class on two paths, -Q: on one */
+    uint32_t gen_pps;
+    const char *paths_shm; /* sender CP path table, NULL -> repath path and the next */
+    const char *policy_shm; /* sender CP policy table, NULL -> path by dst port */
+    int int_dscp;          /* INT marking towards the receiver, -1 -> none */
+};
+
+/* Function definition */
+/* init */
+static void emu_parse_args(struct emu_param *user_param, int argc, char *argv[]);
+static void emu_usage();
+static int emu_parse_path(const char *arg);
+static inline int emu_port_init(uint16_t port, struct rte_mempool *mbuf_pool);
+
+/* time */
+static inline uint64_t emu_now_ns(void);
+
+/* heap */
+static int emu_heap_push(struct emu_heap *heap, const struct emu_event *ev);
+static struct emu_event *emu_heap_top(struct emu_heap *heap);
+static void emu_heap_pop(struct emu_heap *heap);
+
+/* fabric */
+static int emu_classify(struct rte_mbuf *mbuf, uint8_t *path_id);
+static void emu_watch_repath(struct rte_mbuf *mbuf, uint64_t now_ns);
+static void emu_watch_peer(struct rte_mbuf *mbuf);
+static void emu_enqueue(struct rte_mbuf *mbuf, uint16_t out_port, uint64_t now_ns, const struct hopa_policy *pol);
+static void emu_path_enqueue(struct emu_event *ev, uint8_t path_id, uint64_t now_ns);
+static void emu_int_stamp(struct rte_mbuf *mbuf, uint8_t path_id, uint64_t queue_bytes, uint64_t queue_ns);
+static void emu_release(uint64_t now_ns);
+
+/* latency-critical class */
+static int emu_flow_key(struct rte_mbuf *mbuf, uint32_t *key);
+static int emu_class_key(struct rte_mbuf *mbuf, uint32_t *key);
+static void emu_paths_info(struct rte_mbuf *mbuf, uint64_t now_ns, struct hopa_paths_info *info);
+static int emu_class_paths(struct rte_mbuf *mbuf, uint64_t now_ns, uint8_t path[2]);
+static void emu_class_enqueue(struct emu_event *ev, uint64_t now_ns, const uint8_t path[2], int n);
+static int emu_dp_push(struct rte_mbuf *mbuf, uint32_t seq);
+static uint32_t emu_dp_pop(struct rte_mbuf *mbuf);
+static void emu_policy_batch(struct rte_mbuf **mbufs, uint16_t n, uint64_t now_ns, const struct hopa_policy **pol);
+static void emu_policy_enqueue(struct emu_event *ev, const struct hopa_policy *pol, uint64_t now_ns);
+static int emu_class_deliver(const struct emu_event *ev);
+static struct rte_mbuf *emu_gen_pkt(uint8_t flow);
+static void emu_gen(uint64_t now_ns);
+static void emu_lat_add(struct emu_lat *lat, uint64_t ns);
+static double emu_lat_pct(const struct emu_lat *lat, double q);
+static void emu_class_print(void);
+
+/* scenario */
+static const char *emu_scenario_name(enum emu_scenario scn);
+static void emu_scenario_start(enum emu_scenario scn, uint64_t now_ns);
+static void emu_scenario_tick(uint64_t now_ns);
+static void emu_scenario_stop(void);
+static void emu_report_print(struct emu_report *report);
+
+#endif /* HOPA_EMU_H */
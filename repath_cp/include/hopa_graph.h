@@ -0,0 +1,65 @@
+#ifndef HOPA_GRAPH_H
+#define HOPA_GRAPH_H
+
+#include <rte_graph.h>
+#include <rte_graph_worker.h>
+
+/*
+ * rte_graph pipeline of the main lcore, hopa_cp -g 1.
+ *
+ *   hopa_eth_rx -> hopa_classify -+-> hopa_probe
+ *                                 +-> hopa_dp_ts ------+
+ *                                 +-> hopa_repath -----+-> hopa_tx
+ *                                 +-> hopa_repath_ack  |
+ *                                 +-> hopa_discover ---+
+ *                                 +-> hopa_live        |
+ *                                 +-> hopa_train       |
+ *                                 +-> hopa_report      |
+ *                                 +-> hopa_drop        |
+ *   hopa_out_rx (out rings) -----------------------------+
+ *
+ * Each node gets a vector of mbufs per walk. A new message type is a new
+ * handler node and one more hopa_classify edge.
+ */
+
+#define HOPA_GRAPH_NAME "hopa_cp"
+#define HOPA_GRAPH_PATTERN "hopa_*"
+
+enum hopa_classify_next
+{
+    HOPA_CLASSIFY_NEXT_PROBE,
+    HOPA_CLASSIFY_NEXT_DP_TS,
+    HOPA_CLASSIFY_NEXT_REPATH,
+    HOPA_CLASSIFY_NEXT_REPATH_ACK,
+    HOPA_CLASSIFY_NEXT_DISCOVER,
+    HOPA_CLASSIFY_NEXT_LIVE,
+    HOPA_CLASSIFY_NEXT_TRAIN,
+    HOPA_CLASSIFY_NEXT_REPORT,
+    HOPA_CLASSIFY_NEXT_DROP,
+    HOPA_CLASSIFY_NEXT_MAX
+};
+
+/* handlers and hopa_out_rx have a single edge */
+#define HOPA_NEXT_TX (0)
+
+/* Function definition */
+/* nodes */
+static uint16_t hopa_eth_rx_process(struct rte_graph *graph, struct rte_node *node, void **objs, uint16_t nb_objs);
+static uint16_t hopa_out_rx_process(struct rte_graph *graph, struct rte_node *node, void **objs, uint16_t nb_objs);
+static enum hopa_classify_next hopa_classify(struct rte_mbuf *mbuf);
+static uint16_t hopa_classify_process(struct rte_graph *graph, struct rte_node *node, void **objs, uint16_t nb_objs);
+static uint16_t hopa_probe_process(struct rte_graph *graph, struct rte_node *node, void **objs, uint16_t nb_objs);
+static uint16_t hopa_dp_ts_process(struct rte_graph *graph, struct rte_node *node, void **objs, uint16_t nb_objs);
+static uint16_t hopa_repath_process(struct rte_graph *graph, struct rte_node *node, void **objs, uint16_t nb_objs);
+static uint16_t hopa_repath_ack_process(struct rte_graph *graph, struct rte_node *node, void **objs, uint16_t nb_objs);
+static uint16_t hopa_discover_process(struct rte_graph *graph, struct rte_node *node, void **objs, uint16_t nb_objs);
+static uint16_t hopa_live_process(struct rte_graph *graph, struct rte_node *node, void **objs, uint16_t nb_objs);
+static uint16_t hopa_train_process(struct rte_graph *graph, struct rte_node *node, void **objs, uint16_t nb_objs);
+static uint16_t hopa_report_process(struct rte_graph *graph, struct rte_node *node, void **objs, uint16_t nb_objs);
+static uint16_t hopa_drop_process(struct rte_graph *graph, struct rte_node *node, void **objs, uint16_t nb_objs);
+static uint16_t hopa_tx_process(struct rte_graph *graph, struct rte_node *node, void **objs, uint16_t nb_objs);
+
+/* main lcore */
+static void hopa_graph_main(struct hopa_in_out_ring *in_out_ring, int rx_intr);
+
+#endif /* HOPA_GRAPH_H */
@@ -0,0 +1,217 @@
+#ifndef HOPA_INT_H
+#define HOPA_INT_H
+
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * In-band network telemetry (INT-MD over UDP, INT spec v2.1) of one packet.
+ *
+ * An INT source marks the packet with the INT DSCP and inserts, right after
+ * the UDP header, a shim and an INT-MD header; every INT switch on the way
+ * pushes hop_ml words of metadata on top of the stack, so the stack holds the
+ * last hop first:
+ *
+ *   udp | shim 4 | md hdr 12 | hop n ... hop 1 | original udp payload
+ *
+ *   shim   : type 4 (1 -> INT-MD), npt 2 (0 -> original payload follows),
+ *            r 2 | length 8 (INT words, shim included) | r 8 |
+ *            original dscp 6, r 2
+ *   md hdr : ver 4, d, e, m, r 12, hop_ml 5, remaining hop count 8 |
+ *            instruction bitmap 16, domain id 16 | ds instruction 16, ds flags 16
+ *
+ * hopa_int_parse() takes the hop latency and queue occupancy of each hop at
+ * offsets derived from the instruction bitmap once per packet, then walks a
+ * fixed HOPA_INT_MAX_HOPS hops whatever the packet, no branch on the data.
+ * The strided loads go into one lane per hop first, they stay scalar; the
+ * sum and the maxima over the lanes vectorize (gcc -O3 -march=x86-64-v3,
+ * -fopt-info-vec). Hops past HOPA_INT_MAX_HOPS are not looked at.
+ *
+ * Units are the switch's: occupancy in its cells or bytes, latency in ns.
+ *
+ * No DPDK here.
+ */
+
+#define HOPA_INT_MAX_HOPS (8)
+#define HOPA_INT_SHIM_LEN (4)
+#define HOPA_INT_MD_LEN (12)
+#define HOPA_INT_TYPE_MD (1)
+#define HOPA_INT_VERSION (2)
+#define HOPA_INT_NONE (UINT32_MAX) /* field not in the instruction bitmap */
+#define HOPA_INT_HOP_ML (3)        /* hopa_int_build: node id, hop latency, queue */
+#define HOPA_INT_LEN(hops) (HOPA_INT_SHIM_LEN + HOPA_INT_MD_LEN + (hops) * HOPA_INT_HOP_ML * 4)
+
+/* instruction bitmap, bit 0 is the most significant */
+#define HOPA_INT_INS_NODE_ID (0x8000)
+#define HOPA_INT_INS_L1_IF (0x4000)
+#define HOPA_INT_INS_HOP_LATENCY (0x2000)
+#define HOPA_INT_INS_QUEUE (0x1000)     /* queue id 8 | occupancy 24 */
+#define HOPA_INT_INS_INGRESS_TS (0x0800)
+#define HOPA_INT_INS_EGRESS_TS (0x0400)
+#define HOPA_INT_INS_L2_IF (0x0200)
+#define HOPA_INT_INS_EGRESS_UTIL (0x0100)
+#define HOPA_INT_INS_BUFFER (0x0080)
+#define HOPA_INT_INS_WORDS2 (HOPA_INT_INS_INGRESS_TS | HOPA_INT_INS_EGRESS_TS | HOPA_INT_INS_L2_IF)
+#define HOPA_INT_INS_KNOWN (0xff80)
+
+/* what a receiver keeps of one packet */
+struct hopa_int_sample
+{
+    uint8_t hops;           /* parsed, 0 -> no INT */
+    uint8_t dscp;           /* original, before the INT marking */
+    uint16_t len;           /* INT bytes after the UDP header */
+    uint32_t queue_max;     /* deepest queue of the hops, HOPA_INT_NONE -> not stamped */
+    uint32_t latency_sum;   /* hop latencies, ns, HOPA_INT_NONE -> not stamped */
+    uint32_t node_max;      /* node id of the deepest queue, HOPA_INT_NONE -> not stamped */
+};
+
+/* per path, zeroed with the peer */
+struct hopa_int_est
+{
+    uint64_t pkts;          /* with INT */
+    uint8_t hops;           /* of the last one */
+    uint32_t queue_max;     /* last */
+    uint32_t queue_avg;     /* deepest queue, smoothed */
+    uint32_t latency_avg;   /* sum of hop latencies, smoothed */
+    uint32_t node_max;      /* last */
+};
+
+static inline uint32_t hopa_int_be32(const uint8_t *p)
+{
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+/* Words before field 'ins' in a hop's metadata, the bitmap being 'bitmap'. */
+static inline uint32_t hopa_int_word_off(uint16_t bitmap, uint16_t ins)
+{
+    uint16_t before = bitmap & HOPA_INT_INS_KNOWN & (uint16_t)~((ins << 1) - 1);
+
+    return __builtin_popcount(before) + __builtin_popcount(before & HOPA_INT_INS_WORDS2);
+}
+
+/*
+ * INT of the UDP payload 'p' of 'len' bytes into 's': 0, or -1 if it is not
+ * INT-MD of a version and layout we read (s->hops is 0 then). s->len bytes
+ * are to be stripped to get the original payload back.
+ */
+static inline int hopa_int_parse(const uint8_t *p, uint32_t len, struct hopa_int_sample *s)
+{
+    uint32_t words, hop_ml, hops, lat_off, q_off, node_off, h, i;
+    uint32_t lat[HOPA_INT_MAX_HOPS], q[HOPA_INT_MAX_HOPS], node[HOPA_INT_MAX_HOPS];
+    uint32_t lat_sum = 0, q_max = 0, first = HOPA_INT_MAX_HOPS;
+    uint16_t bitmap;
+    const uint8_t *stack, *hop;
+
+    memset(s, 0, sizeof(*s));
+    if (len < HOPA_INT_SHIM_LEN + HOPA_INT_MD_LEN || p[0] >> 4 != HOPA_INT_TYPE_MD || ((p[0] >> 2) & 3) != 0 || p[4] >> 4 != HOPA_INT_VERSION)
+        return -1;
+
+    words = p[1];
+    hop_ml = p[6] & 0x1f;
+    bitmap = (uint16_t)(p[8] << 8 | p[9]);
+    if (words * 4 > len || words * 4 < HOPA_INT_SHIM_LEN + HOPA_INT_MD_LEN || hop_ml == 0 ||
+        hopa_int_word_off(bitmap, 1) > hop_ml)
+        return -1;
+
+    hops = (words * 4 - HOPA_INT_SHIM_LEN - HOPA_INT_MD_LEN) / (hop_ml * 4);
+    s->len = words * 4;
+    s->dscp = p[3] >> 2;
+    if (hops == 0)
+        return 0;
+    if (hops > HOPA_INT_MAX_HOPS)
+        hops = HOPA_INT_MAX_HOPS;
+
+    /* a field not stamped reads word 0, inside the hop, and is dropped below */
+    lat_off = bitmap & HOPA_INT_INS_HOP_LATENCY ? hopa_int_word_off(bitmap, HOPA_INT_INS_HOP_LATENCY) * 4 : 0;
+    q_off = bitmap & HOPA_INT_INS_QUEUE ? hopa_int_word_off(bitmap, HOPA_INT_INS_QUEUE) * 4 : 0;
+    node_off = bitmap & HOPA_INT_INS_NODE_ID ? hopa_int_word_off(bitmap, HOPA_INT_INS_NODE_ID) * 4 : 0;
+    stack = p + HOPA_INT_SHIM_LEN + HOPA_INT_MD_LEN;
+
+    /* the fields into lanes first, hops past the stack re-read the last one
+     * masked out: the loads are strided, the reductions below are not */
+    for (h = 0; h < HOPA_INT_MAX_HOPS; h++)
+    {
+        i = h < hops ? h : hops - 1;
+        hop = stack + i * hop_ml * 4;
+        lat[h] = h < hops ? hopa_int_be32(hop + lat_off) : 0;
+        q[h] = h < hops ? hopa_int_be32(hop + q_off) & 0xffffff : 0;
+        node[h] = hopa_int_be32(hop + node_off);
+    }
+
+    for (h = 0; h < HOPA_INT_MAX_HOPS; h++)
+    {
+        lat_sum += lat[h];
+        q_max = q[h] > q_max ? q[h] : q_max;
+    }
+
+    /* the first hop at the deepest queue */
+    for (h = 0; h < HOPA_INT_MAX_HOPS; h++)
+    {
+        i = q[h] == q_max ? h : HOPA_INT_MAX_HOPS;
+        first = i < first ? i : first;
+    }
+
+    s->hops = hops;
+    s->latency_sum = bitmap & HOPA_INT_INS_HOP_LATENCY ? lat_sum : HOPA_INT_NONE;
+    s->queue_max = bitmap & HOPA_INT_INS_QUEUE ? q_max : HOPA_INT_NONE;
+    s->node_max = bitmap & HOPA_INT_INS_NODE_ID && bitmap & HOPA_INT_INS_QUEUE ? (q_max ? node[first] : 0) : HOPA_INT_NONE;
+
+    return 0;
+}
+
+/* Sample 's' of a packet of the path into its estimate. */
+static inline void hopa_int_update(struct hopa_int_est *e, const struct hopa_int_sample *s)
+{
+    if (s->hops == 0)
+        return;
+
+    e->hops = s->hops;
+    e->queue_max = s->queue_max;
+    e->node_max = s->node_max;
+    if (s->queue_max != HOPA_INT_NONE)
+        e->queue_avg = e->pkts ? (uint32_t)((3 * (uint64_t)e->queue_avg + s->queue_max) / 4) : s->queue_max;
+    if (s->latency_sum != HOPA_INT_NONE)
+        e->latency_avg = e->pkts ? (uint32_t)((3 * (uint64_t)e->latency_avg + s->latency_sum) / 4) : s->latency_sum;
+    e->pkts++;
+}
+
+static inline void hopa_int_put32(uint8_t *p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+/*
+ * Source side: write the shim and the INT-MD header of 'hops' hops of node
+ * id, hop latency and queue occupancy into 'p', HOPA_INT_LEN(hops) bytes,
+ * hop 0 being the last switch. For a stand-in of INT switches.
+ */
+static inline void hopa_int_build(uint8_t *p, uint8_t dscp, uint32_t hops, const uint32_t *node, const uint32_t *latency_ns,
+                                  const uint32_t *queue)
+{
+    uint16_t bitmap = HOPA_INT_INS_NODE_ID | HOPA_INT_INS_HOP_LATENCY | HOPA_INT_INS_QUEUE;
+    uint8_t *hop;
+    uint32_t h;
+
+    memset(p, 0, HOPA_INT_SHIM_LEN + HOPA_INT_MD_LEN);
+    p[0] = HOPA_INT_TYPE_MD << 4;
+    p[1] = HOPA_INT_LEN(hops) / 4;
+    p[3] = dscp << 2;
+    p[4] = HOPA_INT_VERSION << 4;
+    p[6] = HOPA_INT_HOP_ML;
+    p[7] = 0; /* remaining hop count, all used */
+    p[8] = bitmap >> 8;
+    p[9] = bitmap & 0xff;
+
+    for (h = 0; h < hops; h++)
+    {
+        hop = p + HOPA_INT_SHIM_LEN + HOPA_INT_MD_LEN + h * HOPA_INT_HOP_ML * 4;
+        hopa_int_put32(hop, node[h]);
+        hopa_int_put32(hop + 4, latency_ns[h]);
+        hopa_int_put32(hop + 8, queue[h] > 0xffffff ? 0xffffff : queue[h]);
+    }
+}
+
+#endif /* HOPA_INT_H */
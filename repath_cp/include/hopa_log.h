@@ -8,10 +8,29 @@
 #define COLOR_YELLOW "\x1b[33m"
 #define COLOR_WHITE "\x1b[37m"
 
-#define HOPA_LOG_INFO(...) log_message(COLOR_WHITE, "HOPA_CP_INFO", __FILE__, __LINE__, __VA_ARGS__)
-#define HOPA_LOG_WARN(...) log_message(COLOR_YELLOW, "HOPA_CP_WARN", __FILE__, __LINE__, __VA_ARGS__)
-#define HOPA_LOG_ERROR(...) log_message(COLOR_RED, "HOPA_CP_ERROR", __FILE__, __LINE__, __VA_ARGS__)
-#define HOPA_LOG_TRACE(...) log_message(COLOR_GREEN, "HOPA_CP_TRACE", __FILE__, __LINE__, __VA_ARGS__)
+enum hopa_log_level
+{
+    HOPA_LOG_LEVEL_ERROR,
+    HOPA_LOG_LEVEL_WARN,
+    HOPA_LOG_LEVEL_INFO,
+    HOPA_LOG_LEVEL_TRACE
+};
+
+/* Messages above it are dropped before their arguments are evaluated, so
+ * per packet traces cost one compare when off. */
+static int hopa_log_level = HOPA_LOG_LEVEL_INFO;
+
+#define HOPA_LOG(lvl, color, tag, ...)                                     \
+    do                                                                     \
+    {                                                                      \
+        if ((lvl) <= hopa_log_level)                                       \
+            log_message(color, tag, __FILE__, __LINE__, __VA_ARGS__);      \
+    } while (0)
+
+#define HOPA_LOG_INFO(...) HOPA_LOG(HOPA_LOG_LEVEL_INFO, COLOR_WHITE, "HOPA_CP_INFO", __VA_ARGS__)
+#define HOPA_LOG_WARN(...) HOPA_LOG(HOPA_LOG_LEVEL_WARN, COLOR_YELLOW, "HOPA_CP_WARN", __VA_ARGS__)
+#define HOPA_LOG_ERROR(...) HOPA_LOG(HOPA_LOG_LEVEL_ERROR, COLOR_RED, "HOPA_CP_ERROR", __VA_ARGS__)
+#define HOPA_LOG_TRACE(...) HOPA_LOG(HOPA_LOG_LEVEL_TRACE, COLOR_GREEN, "HOPA_CP_TRACE", __VA_ARGS__)
 
 void log_message(const char *color, const char *level, const char *file, int line, const char *format, ...)
 {
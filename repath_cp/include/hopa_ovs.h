@@ -0,0 +1,96 @@
+#ifndef HOPA_OVS_H
+#define HOPA_OVS_H
+
+#include <signal.h>
+#include <rte_memzone.h>
+
+/*
+ * HOPA CP attached to ovs-vswitchd.
+ *
+ * ovs-vswitchd --hopa-cp-external keeps the HOPA datapath side (PMD sniffing
+ * into the in rings, transmit lane draining the out ring) and leaves the CP
+ * to this process, run as a DPDK secondary process:
+ *
+ *   hopa_cp --proc-type=secondary --file-prefix=<ovs prefix> -- -o 1 -f peers
+ *
+ * Our lcore ids are not known to ovs-vswitchd, so HOPA_CP_MP has no per-lcore
+ * cache in that mode: its PMDs and this process share the pool safely.
+ *
+ * Both sides must be built against the same DPDK. Everything below mirrors
+ * the HOPA CP part of the forks' lib/dpif-netdev.h and must stay in sync.
+ */
+
+#define HOPA_OVS_MP_NAME "HOPA_CP_MP"
+#define HOPA_OVS_IN_RING_FMT "hopa_cp in %d"
+#define HOPA_OVS_OUT_RING_FMT "hopa_cp out %d"
+#define HOPA_OVS_EXPORT_MZ "hopa_cp_export"
+#define HOPA_OVS_EXPORT_MAGIC (0x48435058) /* "HCPX" */
+#define HOPA_OVS_EXPORT_VERSION (1)
+#define HOPA_OVS_EXPORT_MAX_PEERS (1024)
+#define HOPA_OVS_MAX_IN_RINGS (16)
+
+/* HOPA CP header as ovs-vswitchd puts it on the wire */
+struct hopa_ovs_cp_hdr
+{
+    uint8_t flag;          /**< HOPA flag. 0 -> control plane . 1 -> data plane */
+    uint8_t cp_flag;       /**< CP flag. 0 -> probe. 1 -> repath. 2 -> repath_ack. */
+    uint8_t probe_path_id; /**< probe path id */
+    uint8_t repath_id;     /**< repath id */
+    uint8_t rsvd;          /**< reserved field */
+    rte_be64_t seq;
+    rte_be64_t ack;
+    rte_be64_t ts;         /**< timestamp */
+};
+
+/* in ring entry: CP header with the peer that sent it, rte_free when done */
+struct hopa_ovs_msg
+{
+    rte_be32_t src_ip;
+    struct rte_ether_addr src_mac;
+    struct hopa_ovs_cp_hdr hdr;
+};
+
+/* path state of one peer, published for ovs-vswitchd (hopa/peer-show) */
+struct hopa_ovs_export_peer
+{
+    rte_be32_t ip; /* 0 -> free slot */
+    uint8_t best_path_id;
+    uint8_t pad[3];
+    uint64_t all_paths_delay_list[PATH_NB];
+};
+
+/* memzone HOPA_OVS_EXPORT_MZ, filled by ovs-vswitchd */
+struct hopa_ovs_export
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t n_in_rings;
+    uint32_t out_ring;
+    rte_be32_t src_ip;
+    struct rte_ether_addr src_mac;
+    uint16_t src_port;       /* host order */
+    uint16_t dst_port;       /* host order, plus the path id */
+    volatile int32_t cp_pid; /* attached CP, 0 if none */
+    volatile uint32_t n_peers;
+    struct hopa_ovs_export_peer peers[HOPA_OVS_EXPORT_MAX_PEERS];
+};
+
+/* resources looked up in the primary */
+struct hopa_ovs
+{
+    struct hopa_ovs_export *export;
+    struct rte_ring *in_rings[HOPA_OVS_MAX_IN_RINGS];
+    unsigned int n_in_rings;
+    unsigned int in_next; /* fan-in cursor */
+    struct rte_ring *out_ring;
+};
+
+/* Function definition */
+static void ovs_attach(void);
+static struct rte_mbuf *ovs_encode_pkt(const struct hopa_peer *peer, uint8_t cp_flag, uint8_t path_id);
+static void ovs_enqueue(struct rte_mbuf **mbufs, unsigned int n);
+static void ovs_publish(const struct hopa_peer *peer);
+static void ovs_msg_progress(struct hopa_ovs_msg *msg);
+static int lcore_ovs(__rte_unused void *arg);
+
+#endif /* HOPA_OVS_H */
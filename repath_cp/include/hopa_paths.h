@@ -0,0 +1,287 @@
+#ifndef HOPA_PATHS_H
+#define HOPA_PATHS_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*
+ * HOPA path table, client side.
+ *
+ * hopa_cp publishes, for every peer, the best path and the delay of each
+ * path in a POSIX shared memory segment (default HOPA_PATHS_SHM, hopa_cp -m).
+ * Any process on the host maps it read-only and looks a peer up without a
+ * syscall:
+ *
+ *   struct hopa_paths *paths = hopa_paths_open(HOPA_PATHS_SHM);
+ *   struct hopa_paths_info info;
+ *   if (paths && hopa_paths_lookup(paths, peer_ip, &info) == 0)
+ *       udp_dst_port = hopa_paths_port(paths, info.best_path_id);
+ *
+ * A sprayer picks among the live paths only, hopa_paths_live(&info, i): a
+ * path hopa_cp -F detects as failed leaves live_mask on the next lookup,
+ * and a path port hopa_cp -D found on the same network path as another
+ * one is in alias_mask, so only the distinct paths are offered.
+ * quality[i] carries the loss and reordering of path i from the probe
+ * sequence numbers, so a choice can weigh loss and not only delay, and
+ * with hopa_cp -T its bandwidth: hopa_paths_pick() spreads flows over the
+ * live paths in proportion to what each can still absorb. With hopa_cp -I
+ * and INT switches on the way it also has the deepest queue a path's
+ * packets met and the latency of its hops. These are measured where the
+ * probes arrive: a sender's table has delay_ns and quality[] from the
+ * receiver's REPORT.
+ *
+ * Each entry is guarded by a sequence counter (odd while hopa_cp writes it),
+ * readers retry until they copied a stable entry. There is one writer per
+ * segment. The layout is versioned by HOPA_PATHS_VERSION.
+ *
+ * No DPDK here: the header is self-contained on purpose.
+ */
+
+#define HOPA_PATHS_SHM "/hopa_paths"
+#define HOPA_PATHS_MAGIC (0x48505448) /* "HPTH" */
+#define HOPA_PATHS_VERSION (5)
+#define HOPA_PATHS_PATH_NB (4)
+/* open addressing, twice the CP peer table, power of 2 */
+#define HOPA_PATHS_SLOTS (2048)
+#define HOPA_PATHS_DELAY_NONE (INT64_MAX)
+#define HOPA_PATHS_PPM_NONE (UINT32_MAX) /* no numbered probe yet */
+#define HOPA_PATHS_BW_NONE (UINT32_MAX)  /* no probe train yet */
+#define HOPA_PATHS_INT_NONE (UINT32_MAX) /* no INT yet */
+
+enum hopa_paths_state
+{
+    HOPA_PATHS_EMPTY,   /* never used, ends a probe chain */
+    HOPA_PATHS_ACTIVE,
+    HOPA_PATHS_REMOVED  /* peer gone, keeps the probe chain */
+};
+
+/* per path, loss over the last 64 probes, bandwidth over the last trains,
+ * queue and hop latency over the last INT packets */
+struct hopa_paths_quality
+{
+    uint32_t loss_ppm;      /**< probes lost in the window */
+    uint32_t reorder_ppm;   /**< probes late, since the sender (re)started */
+    uint16_t loss_run_max;  /**< longest run of probes lost */
+    uint16_t reorder_max;   /**< furthest a late probe came, in probes */
+    uint32_t avail_mbps;    /**< left by the cross traffic */
+    uint32_t capacity_mbps; /**< bottleneck */
+    uint32_t queue;         /**< deepest per hop queue occupancy, switch units */
+    uint32_t hop_latency_ns; /**< sum over the hops */
+};
+
+/* one peer, three cache lines */
+struct hopa_paths_entry
+{
+    uint32_t seq;          /**< odd -> being written */
+    uint32_t ip;           /**< host order */
+    uint8_t state;         /**< enum hopa_paths_state */
+    uint8_t best_path_id;
+    uint8_t live_mask;     /**< bit i -> path i up */
+    uint8_t alias_mask;    /**< bit i -> path i shares the network path of another, hopa_cp -D */
+    uint8_t pad[4];
+    uint64_t updated_ns;   /**< CLOCK_REALTIME of the last change */
+    int64_t delay_ns[HOPA_PATHS_PATH_NB]; /**< one-way, sender clock offset included, compare only */
+    uint64_t rsvd;
+    struct hopa_paths_quality quality[HOPA_PATHS_PATH_NB];
+} __attribute__((aligned(64)));
+
+struct hopa_paths_hdr
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t n_slots;
+    uint32_t path_nb;
+    uint16_t base_port;    /**< UDP dst port of path 0, path i is base_port + i */
+    uint16_t pad;
+    volatile int32_t writer_pid;
+    uint8_t rsvd[40];
+} __attribute__((aligned(64)));
+
+struct hopa_paths
+{
+    struct hopa_paths_hdr hdr;
+    struct hopa_paths_entry entries[HOPA_PATHS_SLOTS];
+};
+
+/* lookup result */
+struct hopa_paths_info
+{
+    uint8_t best_path_id;
+    uint8_t live_mask;
+    uint8_t alias_mask;
+    uint64_t updated_ns;
+    int64_t delay_ns[HOPA_PATHS_PATH_NB];
+    struct hopa_paths_quality quality[HOPA_PATHS_PATH_NB];
+};
+
+static inline uint32_t hopa_paths_hash(uint32_t ip)
+{
+    return (ip * 2654435761u) >> 21; /* 32 - log2(HOPA_PATHS_SLOTS) */
+}
+
+static inline void hopa_paths_pause(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ volatile("yield");
+#endif
+}
+
+/* Map the segment read-only, NULL if absent or of another layout. */
+static inline struct hopa_paths *hopa_paths_open(const char *name)
+{
+    struct hopa_paths *paths;
+    int fd;
+
+    fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0)
+        return NULL;
+    paths = mmap(NULL, sizeof(*paths), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (paths == MAP_FAILED)
+        return NULL;
+
+    if (paths->hdr.magic != HOPA_PATHS_MAGIC || paths->hdr.version != HOPA_PATHS_VERSION ||
+        paths->hdr.n_slots != HOPA_PATHS_SLOTS)
+    {
+        munmap(paths, sizeof(*paths));
+        return NULL;
+    }
+
+    return paths;
+}
+
+static inline void hopa_paths_close(struct hopa_paths *paths)
+{
+    munmap(paths, sizeof(*paths));
+}
+
+/* Stable copy of 'e' into 'copy'. */
+static inline void hopa_paths_read(const struct hopa_paths_entry *e, struct hopa_paths_entry *copy)
+{
+    uint32_t seq;
+
+    for (;;)
+    {
+        seq = __atomic_load_n(&e->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1)
+        {
+            hopa_paths_pause();
+            continue;
+        }
+        memcpy(copy, e, sizeof(*copy));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&e->seq, __ATOMIC_RELAXED) == seq)
+            return;
+    }
+}
+
+/* Path state of peer 'ip' (host order): 0, or -1 if hopa_cp does not know it. */
+static inline int hopa_paths_lookup(const struct hopa_paths *paths, uint32_t ip, struct hopa_paths_info *info)
+{
+    struct hopa_paths_entry e;
+    uint32_t i, slot;
+
+    slot = hopa_paths_hash(ip);
+    for (i = 0; i < HOPA_PATHS_SLOTS; i++, slot = (slot + 1) & (HOPA_PATHS_SLOTS - 1))
+    {
+        hopa_paths_read(&paths->entries[slot], &e);
+        if (e.state == HOPA_PATHS_EMPTY)
+            return -1;
+        if (e.ip != ip)
+            continue;
+        if (e.state != HOPA_PATHS_ACTIVE)
+            return -1;
+
+        info->best_path_id = e.best_path_id;
+        info->live_mask = e.live_mask;
+        info->alias_mask = e.alias_mask;
+        info->updated_ns = e.updated_ns;
+        memcpy(info->delay_ns, e.delay_ns, sizeof(info->delay_ns));
+        memcpy(info->quality, e.quality, sizeof(info->quality));
+        return 0;
+    }
+
+    return -1;
+}
+
+/* Up, and not an alias of another path. */
+static inline int hopa_paths_live(const struct hopa_paths_info *info, uint8_t path_id)
+{
+    return ((info->live_mask & ~info->alias_mask) >> path_id) & 1;
+}
+
+/*
+ * Path of a flow by its hash, weighted by the available bandwidth of the
+ * live paths; best_path_id while none has an estimate.
+ */
+static inline uint8_t hopa_paths_pick(const struct hopa_paths_info *info, uint32_t hash)
+{
+    uint64_t total = 0, point;
+    uint8_t i;
+
+    for (i = 0; i < HOPA_PATHS_PATH_NB; i++)
+        if (hopa_paths_live(info, i) && info->quality[i].avail_mbps != HOPA_PATHS_BW_NONE)
+            total += info->quality[i].avail_mbps;
+    if (total == 0)
+        return info->best_path_id;
+
+    point = (uint64_t)hash * total >> 32;
+    for (i = 0; i < HOPA_PATHS_PATH_NB; i++)
+    {
+        if (!hopa_paths_live(info, i) || info->quality[i].avail_mbps == HOPA_PATHS_BW_NONE)
+            continue;
+        if (point < info->quality[i].avail_mbps)
+            return i;
+        point -= info->quality[i].avail_mbps;
+    }
+
+    return info->best_path_id;
+}
+
+static inline uint16_t hopa_paths_port(const struct hopa_paths *paths, uint8_t path_id)
+{
+    return paths->hdr.base_port + path_id;
+}
+
+/* Writer side, hopa_cp only: a write is bracketed by begin / end. */
+static inline void hopa_paths_write_begin(struct hopa_paths_entry *e)
+{
+    __atomic_store_n(&e->seq, e->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void hopa_paths_write_end(struct hopa_paths_entry *e)
+{
+    __atomic_store_n(&e->seq, e->seq + 1, __ATOMIC_RELEASE);
+}
+
+/* Slot of 'ip', or where to insert it; -1 if the table is full. */
+static inline int hopa_paths_slot(const struct hopa_paths *paths, uint32_t ip)
+{
+    int reuse = -1;
+    uint32_t i, slot;
+
+    slot = hopa_paths_hash(ip);
+    for (i = 0; i < HOPA_PATHS_SLOTS; i++, slot = (slot + 1) & (HOPA_PATHS_SLOTS - 1))
+    {
+        const struct hopa_paths_entry *e = &paths->entries[slot];
+
+        if (e->state == HOPA_PATHS_EMPTY)
+            return reuse >= 0 ? reuse : (int)slot;
+        if (e->ip == ip)
+            return slot;
+        if (e->state == HOPA_PATHS_REMOVED && reuse < 0)
+            reuse = slot;
+    }
+
+    return reuse;
+}
+
+#endif /* HOPA_PATHS_H */
@@ -0,0 +1,237 @@
+#ifndef HOPA_POLICY_H
+#define HOPA_POLICY_H
+
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "hopa_paths.h"
+
+/*
+ * HOPA path policy table, client side.
+ *
+ * Per tenant (VXLAN VNI) and DSCP, which paths a packet may take, what the
+ * best path means for it (objective) and how its flows use the paths
+ * (spray). hopa_cp -P <file> publishes it next to the path table, in
+ * "<-m name>_policy". The datapath resolves a packet with three direct
+ * indexed loads, no hash:
+ *
+ *   policy = policies[rows[vni_row[vni]][dscp]]
+ *
+ * vni_row maps the 2^24 VNIs onto HOPA_POLICY_ROWS rows, row 0 being every
+ * VNI the file does not name; untouched pages of it are never backed. Non
+ * VXLAN traffic is VNI 0.
+ *
+ *   struct hopa_policy_table *pt = hopa_policy_open("/hopa_paths_policy");
+ *   const struct hopa_policy_set *set = hopa_policy_begin(pt);   per batch
+ *   hopa_policy_lookup_batch(set, vni, tos, n, pol);
+ *   n_paths = hopa_policy_paths(pol[i], &info, flow_hash, path);
+ *
+ * The table holds two sets. hopa_cp fills the one not in use and flips
+ * 'active', so a reader takes the set once per batch and must not keep it
+ * across batches: the old set is rewritten on the next reload.
+ *
+ * No DPDK here.
+ */
+
+#define HOPA_POLICY_MAGIC (0x48504f4c) /* "HPOL" */
+#define HOPA_POLICY_VERSION (1)
+#define HOPA_POLICY_SUFFIX "_policy"
+#define HOPA_POLICY_VNIS (1 << 24)
+#define HOPA_POLICY_ROWS (256)   /* row 0 -> VNIs without rules of their own */
+#define HOPA_POLICY_DSCPS (64)
+#define HOPA_POLICY_MAX (256)    /* distinct policies, 0 -> default */
+
+enum hopa_policy_objective
+{
+    HOPA_POLICY_MIN_DELAY,
+    HOPA_POLICY_MIN_LOSS,
+    HOPA_POLICY_MAX_BW
+};
+
+enum hopa_policy_spray
+{
+    HOPA_POLICY_SINGLE, /* every flow on the best path */
+    HOPA_POLICY_HASH,   /* flows spread over the allowed paths */
+    HOPA_POLICY_DUAL    /* every packet on the two best paths, hopa_dup.h */
+};
+
+struct hopa_policy
+{
+    uint8_t allowed;   /**< bit i -> path i allowed, never 0 */
+    uint8_t objective; /**< enum hopa_policy_objective */
+    uint8_t spray;     /**< enum hopa_policy_spray */
+    uint8_t pad;
+};
+
+struct hopa_policy_set
+{
+    uint32_t n_rows;
+    uint32_t n_policies;
+    uint32_t row_vni[HOPA_POLICY_ROWS];                   /**< VNI of each row, writer side */
+    struct hopa_policy policies[HOPA_POLICY_MAX];
+    uint8_t rows[HOPA_POLICY_ROWS][HOPA_POLICY_DSCPS];   /**< policy index */
+    uint8_t vni_row[HOPA_POLICY_VNIS];
+} __attribute__((aligned(64)));
+
+struct hopa_policy_hdr
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t active;       /**< set in use, 0 or 1 */
+    uint32_t gen;          /**< reloads */
+    volatile int32_t writer_pid;
+    uint8_t rsvd[44];
+} __attribute__((aligned(64)));
+
+struct hopa_policy_table
+{
+    struct hopa_policy_hdr hdr;
+    struct hopa_policy_set sets[2];
+};
+
+/* Map the table read-only, NULL if absent or of another layout. */
+static inline struct hopa_policy_table *hopa_policy_open(const char *name)
+{
+    struct hopa_policy_table *pt;
+    int fd;
+
+    fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0)
+        return NULL;
+    pt = mmap(NULL, sizeof(*pt), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (pt == MAP_FAILED)
+        return NULL;
+
+    if (__atomic_load_n(&pt->hdr.magic, __ATOMIC_ACQUIRE) != HOPA_POLICY_MAGIC || pt->hdr.version != HOPA_POLICY_VERSION)
+    {
+        munmap(pt, sizeof(*pt));
+        return NULL;
+    }
+
+    return pt;
+}
+
+static inline void hopa_policy_close(struct hopa_policy_table *pt)
+{
+    munmap(pt, sizeof(*pt));
+}
+
+/* Set to resolve one batch with. */
+static inline const struct hopa_policy_set *hopa_policy_begin(const struct hopa_policy_table *pt)
+{
+    return &pt->sets[__atomic_load_n(&pt->hdr.active, __ATOMIC_ACQUIRE) & 1];
+}
+
+/* Policy of a packet by VNI and IPv4 TOS / IPv6 traffic class. */
+static inline const struct hopa_policy *hopa_policy_get(const struct hopa_policy_set *set, uint32_t vni, uint8_t tos)
+{
+    return &set->policies[set->rows[set->vni_row[vni & (HOPA_POLICY_VNIS - 1)]][tos >> 2]];
+}
+
+/* Policies of n packets; runs of the same VNI and DSCP are resolved once. */
+static inline void hopa_policy_lookup_batch(const struct hopa_policy_set *set, const uint32_t *vni, const uint8_t *tos, uint16_t n,
+                                            const struct hopa_policy **pol)
+{
+    uint16_t i;
+
+    for (i = 0; i < n; i++)
+    {
+        if (i > 0 && vni[i] == vni[i - 1] && (tos[i] >> 2) == (tos[i - 1] >> 2))
+            pol[i] = pol[i - 1];
+        else
+            pol[i] = hopa_policy_get(set, vni[i], tos[i]);
+    }
+}
+
+/* 1 if path a serves the objective better than path b; delay breaks ties. */
+static inline int hopa_policy_better(uint8_t objective, const struct hopa_paths_info *info, uint8_t a, uint8_t b)
+{
+    const struct hopa_paths_quality *qa = &info->quality[a];
+    const struct hopa_paths_quality *qb = &info->quality[b];
+
+    if (objective == HOPA_POLICY_MIN_LOSS && qa->loss_ppm != qb->loss_ppm)
+        return qa->loss_ppm < qb->loss_ppm; /* unmeasured last */
+    if (objective == HOPA_POLICY_MAX_BW && qa->avail_mbps != qb->avail_mbps)
+        return qb->avail_mbps == HOPA_PATHS_BW_NONE || (qa->avail_mbps != HOPA_PATHS_BW_NONE && qa->avail_mbps > qb->avail_mbps);
+
+    return info->delay_ns[a] < info->delay_ns[b];
+}
+
+/*
+ * Paths of a packet of flow 'hash' under policy 'p': 1, or 2 for a dual
+ * spray with a second path. Candidates are the allowed live paths, or the
+ * allowed ones if none of them is live. The best path for min delay is the
+ * CP's best_path_id when allowed, it carries the hysteresis of hopa_cp -H.
+ * A hash spray weighs by available bandwidth for max bandwidth once every
+ * candidate has an estimate, evenly otherwise.
+ */
+static inline int hopa_policy_paths(const struct hopa_policy *p, const struct hopa_paths_info *info, uint32_t hash, uint8_t path[2])
+{
+    uint8_t cand = p->allowed & info->live_mask & ~info->alias_mask;
+    uint64_t total = 0, point, w;
+    int weighted, n;
+    uint8_t i;
+
+    if (cand == 0)
+        cand = p->allowed;
+    if (cand == 0) /* a set never written */
+        cand = (1 << HOPA_PATHS_PATH_NB) - 1;
+
+    if (p->spray == HOPA_POLICY_HASH)
+    {
+        weighted = p->objective == HOPA_POLICY_MAX_BW;
+        for (i = 0; i < HOPA_PATHS_PATH_NB; i++)
+            if ((cand >> i) & 1)
+            {
+                weighted &= info->quality[i].avail_mbps != HOPA_PATHS_BW_NONE;
+                total += weighted ? info->quality[i].avail_mbps : 1;
+            }
+        if (!weighted)
+            total = __builtin_popcount(cand);
+        point = (uint64_t)hash * total >> 32;
+        for (i = 0; i < HOPA_PATHS_PATH_NB; i++)
+        {
+            if (!((cand >> i) & 1))
+                continue;
+            w = weighted ? info->quality[i].avail_mbps : 1;
+            if (point < w)
+                break;
+            point -= w;
+        }
+        /* all weights 0: the first candidate */
+        path[0] = i < HOPA_PATHS_PATH_NB ? i : (uint8_t)__builtin_ctz(cand);
+        return 1;
+    }
+
+    if (p->objective == HOPA_POLICY_MIN_DELAY && ((cand >> info->best_path_id) & 1))
+        path[0] = info->best_path_id;
+    else
+    {
+        path[0] = __builtin_ctz(cand);
+        for (i = path[0] + 1; i < HOPA_PATHS_PATH_NB; i++)
+            if (((cand >> i) & 1) && hopa_policy_better(p->objective, info, i, path[0]))
+                path[0] = i;
+    }
+    n = 1;
+    if (p->spray != HOPA_POLICY_DUAL)
+        return 1;
+
+    for (i = 0; i < HOPA_PATHS_PATH_NB; i++)
+    {
+        if (!((cand >> i) & 1) || i == path[0])
+            continue;
+        if (n == 1 || hopa_policy_better(p->objective, info, i, path[1]))
+        {
+            path[1] = i;
+            n = 2;
+        }
+    }
+
+    return n;
+}
+
+#endif /* HOPA_POLICY_H */
@@ -0,0 +1,73 @@
+#ifndef HOPA_PROTO_H
+#define HOPA_PROTO_H
+
+#include <stdint.h>
+#include <rte_byteorder.h>
+
+/*
+ * HOPA wire format, shared by the CP and the fabric emulator: the UDP ports
+ * that carry it and the headers that follow the UDP header.
+ */
+
+/* Number of paths */
+#define PATH_NB (4)
+
+/* UDP ports, path i -> DST_PORT_PATH_1 + i */
+#define SRC_PORT (1234)
+#define DST_PORT_PATH_1 (5678)
+
+enum hopa_module
+{
+    HOPA_CP,
+    HOPA_DP
+};
+
+enum hopa_cp_flag
+{
+    PROBE,
+    REPATH,
+    REPATH_ACK,
+    DISCOVER,
+    DISCOVER_ECHO,
+    LIVENESS,
+    TRAIN,
+    REPORT
+};
+
+/* HOPA CP Header */
+struct hopa_cp_hdr
+{
+    uint8_t flag;      /**< HOPA flag. 0 -> control plane . 1 -> data plane */
+    uint8_t cp_flag;   /**< CP flag. 0 -> perbe. 1 -> repath. 2 -> repath_ack. 3 -> discover. 4 -> discover echo. 5 -> liveness. 6 -> train. 7 -> report. */
+    rte_be64_t ts;     /**< timestamp */
+    uint8_t repath_id; /**< repath id. train : packet index */
+    rte_be64_t seq;    /**< probe / hello : per path. train : train id */
+    rte_be64_t ack;    /**< train : sender line rate, Mbps */
+    uint8_t rsvd; /**< reserved field. repath : live paths bitmap, 0 -> unknown. train : length */
+};
+
+/* HOPA DP Header */
+struct hopa_dp_hdr
+{
+    uint8_t flag;      /**< HOPA flag. 0 -> control plane . 1 -> data plane */
+    rte_be64_t ts;     /**< timestamp */
+    uint8_t rsvd;      /**< reserved field */
+    rte_be32_t seq_nb; /**< timestamp */
+    uint8_t seg_end;   /**< reserved field */
+};
+
+/* REPORT : one per path after the CP header, the path table's fields */
+struct hopa_report_path
+{
+    rte_be64_t delay_ns;       /**< one-way; HOPA_PATHS_DELAY_NONE -> none */
+    rte_be32_t loss_ppm;
+    rte_be32_t reorder_ppm;
+    rte_be32_t avail_mbps;
+    rte_be32_t capacity_mbps;
+    rte_be32_t queue;
+    rte_be32_t hop_latency_ns;
+    rte_be16_t loss_run_max;
+    rte_be16_t reorder_max;
+};
+
+#endif /* HOPA_PROTO_H */
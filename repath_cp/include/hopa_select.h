@@ -0,0 +1,211 @@
+#ifndef HOPA_SELECT_H
+#define HOPA_SELECT_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Best path selection with hysteresis and flap damping.
+ *
+ * A plain argmin over the last delay samples flips on every nanosecond of
+ * noise, and every flip reorders the flows moved. A challenger replaces the
+ * current path only when all of these hold:
+ *
+ *   margin  : it is lower by abs_margin_ns, and by rel_margin_pct of the
+ *             current path's excess over the lowest delay ever seen for the
+ *             peer. Probe delays carry the 1 s offset and the clock skew of
+ *             the two hosts, so the excess (queueing) is what a relative
+ *             margin can be taken of.
+ *   dwell   : the current path has been held for min_dwell_ns.
+ *   damping : every flip adds HOPA_SELECT_PENALTY to a figure of merit that
+ *             halves every half_life_ns (RFC 2439 style). Above suppress
+ *             the peer holds its path until the merit decays below reuse.
+ *
+ * A current path without a sample (HOPA_SELECT_UNKNOWN) is left at once,
+ * whatever the margin, dwell or damping state: that is a failover.
+ *
+ * No DPDK here, times are in ns from any monotonic clock.
+ */
+
+#define HOPA_SELECT_UNKNOWN (0xFFFFFFFF) /* delay of a path never measured */
+#define HOPA_SELECT_PENALTY (1000)        /* merit per flip */
+#define HOPA_SELECT_MAX_PATHS (64)
+
+enum hopa_select_reason
+{
+    HOPA_SELECT_STAY,        /* current path is the lowest */
+    HOPA_SELECT_SWITCH,
+    HOPA_SELECT_FAILOVER,    /* current path unknown */
+    HOPA_SELECT_HELD_MARGIN, /* lower, not by the margin */
+    HOPA_SELECT_HELD_DWELL,
+    HOPA_SELECT_HELD_DAMPED,
+    HOPA_SELECT_REASON_MAX
+};
+
+static const char *const hopa_select_reasons[HOPA_SELECT_REASON_MAX] = {
+    "stay", "switch", "failover", "held_margin", "held_dwell", "held_damped",
+};
+
+struct hopa_select_conf
+{
+    uint32_t rel_margin_pct;
+    uint64_t abs_margin_ns;
+    uint64_t min_dwell_ns;
+    uint64_t half_life_ns; /* 0 -> no damping */
+    uint32_t suppress;     /* merit above which flips are held */
+    uint32_t reuse;        /* merit below which they are allowed again */
+    uint32_t max_penalty;
+};
+
+/* per peer, zeroed with it */
+struct hopa_select
+{
+    uint8_t cur;
+    uint8_t suppressed;
+    uint32_t penalty;
+    uint64_t penalty_ns; /* time penalty was last decayed to */
+    uint64_t since_ns;   /* on cur since, 0 -> never switched */
+    uint64_t base;       /* lowest delay seen, 0 -> none */
+    uint64_t flips;
+};
+
+/* one decision, for the log */
+struct hopa_select_decision
+{
+    uint64_t now_ns;
+    uint8_t from;
+    uint8_t to;
+    uint8_t best;
+    uint8_t reason;
+    uint64_t cur_delay;
+    uint64_t best_delay;
+    uint32_t penalty;
+};
+
+/* Defaults, margins against the 2 s probe period of hopa_cp. */
+static inline void hopa_select_conf_default(struct hopa_select_conf *c)
+{
+    c->rel_margin_pct = 10;
+    c->abs_margin_ns = 20000;
+    c->min_dwell_ns = 6000000000ULL;
+    c->half_life_ns = 60000000000ULL;
+    c->suppress = 3 * HOPA_SELECT_PENALTY;
+    c->reuse = HOPA_SELECT_PENALTY * 3 / 4;
+    c->max_penalty = 4 * c->suppress;
+}
+
+/*
+ * Spec "<rel %>[:<abs us>[:<dwell ms>[:<half-life s>]]]", missing fields keep
+ * the defaults. "0:0:0:0" is the plain argmin. 0, or -1 on a bad spec.
+ */
+static inline int hopa_select_conf_parse(struct hopa_select_conf *c, const char *spec)
+{
+    unsigned int rel, abs_us, dwell_ms, half_life_s;
+    char tail;
+    int n;
+
+    hopa_select_conf_default(c);
+    rel = c->rel_margin_pct;
+    abs_us = c->abs_margin_ns / 1000;
+    dwell_ms = c->min_dwell_ns / 1000000;
+    half_life_s = c->half_life_ns / 1000000000;
+
+    n = sscanf(spec, "%u:%u:%u:%u%c", &rel, &abs_us, &dwell_ms, &half_life_s, &tail);
+    if (n < 1 || n > 4)
+        return -1;
+
+    c->rel_margin_pct = rel;
+    c->abs_margin_ns = (uint64_t)abs_us * 1000;
+    c->min_dwell_ns = (uint64_t)dwell_ms * 1000000;
+    c->half_life_ns = (uint64_t)half_life_s * 1000000000;
+
+    return 0;
+}
+
+/* Exponential decay, piecewise linear within a half-life. */
+static inline void hopa_select_decay(const struct hopa_select_conf *c, struct hopa_select *s, uint64_t now_ns)
+{
+    uint64_t dt, halves, rem;
+
+    if (s->penalty == 0 || now_ns <= s->penalty_ns)
+    {
+        s->penalty_ns = now_ns;
+        return;
+    }
+
+    dt = now_ns - s->penalty_ns;
+    halves = dt / c->half_life_ns;
+    rem = dt % c->half_life_ns;
+    s->penalty = halves >= 32 ? 0 : s->penalty >> halves;
+    s->penalty -= (uint64_t)s->penalty * rem / (2 * c->half_life_ns);
+    s->penalty_ns = now_ns;
+
+    if (s->suppressed && s->penalty < c->reuse)
+        s->suppressed = 0;
+}
+
+/* Path to use given the delays of n paths; the decision goes into *d. */
+static inline uint8_t hopa_select_path(const struct hopa_select_conf *c, struct hopa_select *s, const uint64_t *delay, int n,
+                                       uint64_t now_ns, struct hopa_select_decision *d)
+{
+    uint64_t margin, excess;
+    uint8_t best = 0;
+    int i;
+
+    for (i = 1; i < n; i++)
+        if (delay[i] < delay[best])
+            best = i;
+    if (delay[best] < HOPA_SELECT_UNKNOWN && (s->base == 0 || delay[best] < s->base))
+        s->base = delay[best];
+    if (c->half_life_ns)
+        hopa_select_decay(c, s, now_ns);
+
+    d->now_ns = now_ns;
+    d->from = s->cur;
+    d->to = s->cur;
+    d->best = best;
+    d->cur_delay = delay[s->cur];
+    d->best_delay = delay[best];
+
+    if (best == s->cur || delay[best] >= HOPA_SELECT_UNKNOWN)
+        d->reason = HOPA_SELECT_STAY;
+    else if (delay[s->cur] >= HOPA_SELECT_UNKNOWN)
+        d->reason = HOPA_SELECT_FAILOVER;
+    else
+    {
+        excess = s->base && delay[s->cur] > s->base ? delay[s->cur] - s->base : 0;
+        margin = excess * c->rel_margin_pct / 100;
+        if (margin < c->abs_margin_ns)
+            margin = c->abs_margin_ns;
+
+        if (delay[s->cur] - delay[best] <= margin && margin != 0)
+            d->reason = HOPA_SELECT_HELD_MARGIN;
+        else if (s->since_ns && now_ns - s->since_ns < c->min_dwell_ns)
+            d->reason = HOPA_SELECT_HELD_DWELL;
+        else if (s->suppressed)
+            d->reason = HOPA_SELECT_HELD_DAMPED;
+        else
+            d->reason = HOPA_SELECT_SWITCH;
+    }
+
+    if (d->reason == HOPA_SELECT_SWITCH || d->reason == HOPA_SELECT_FAILOVER)
+    {
+        s->cur = best;
+        s->since_ns = now_ns;
+        s->flips++;
+        if (c->half_life_ns)
+        {
+            s->penalty += HOPA_SELECT_PENALTY;
+            if (s->penalty > c->max_penalty)
+                s->penalty = c->max_penalty;
+            if (s->penalty > c->suppress)
+                s->suppressed = 1;
+        }
+        d->to = best;
+    }
+    d->penalty = s->penalty;
+
+    return s->cur;
+}
+
+#endif /* HOPA_SELECT_H */
@@ -0,0 +1,156 @@
+#ifndef HOPA_SEQ_H
+#define HOPA_SEQ_H
+
+#include <stdint.h>
+
+/*
+ * Receiver side sequence tracking of one path: loss, loss runs, duplicates
+ * and reordering from the sequence numbers of probes or hellos.
+ *
+ * A 64 bit window holds which of the last HOPA_SEQ_WINDOW seqs below the
+ * highest one arrived. A seq that leaves the window unreceived is lost, so
+ * a late packet inside the window is reordering, not loss. Seqs start at 1,
+ * 0 is "not numbered" (older senders) and is ignored. A seq a whole window
+ * behind the highest one means the sender restarted; one a whole window
+ * ahead (a path back after an outage) restarts the window on it, the gap
+ * counted lost, so the window loss reads the path from then on.
+ *
+ * No DPDK here.
+ */
+
+#define HOPA_SEQ_WINDOW (64)
+
+enum hopa_seq_result
+{
+    HOPA_SEQ_NEXT,    /* top + 1 */
+    HOPA_SEQ_JUMP,    /* above top + 1, a gap */
+    HOPA_SEQ_LATE,    /* inside the window, after a higher seq */
+    HOPA_SEQ_DUP,
+    HOPA_SEQ_RESTART, /* first seq, or the sender restarted */
+    HOPA_SEQ_NONE     /* seq 0 */
+};
+
+struct hopa_seq
+{
+    uint64_t base;   /* first seq of the window since the (re)start */
+    uint64_t top;    /* highest seq, 0 -> none */
+    uint64_t bits;   /* bit i -> seq top - i arrived */
+    uint32_t in_row; /* seqs in order up to top */
+
+    /* since the (re)start */
+    uint64_t received;
+    uint64_t lost;          /* left the window unreceived */
+    uint64_t dups;
+    uint64_t reordered;     /* HOPA_SEQ_LATE */
+    uint32_t reorder_max;   /* largest top - seq of a late one */
+    uint32_t loss_run;      /* losses in a row, current */
+    uint32_t loss_run_max;
+};
+
+static inline void hopa_seq_lose(struct hopa_seq *s, uint64_t n)
+{
+    s->lost += n;
+    s->loss_run += n;
+    if (s->loss_run > s->loss_run_max)
+        s->loss_run_max = s->loss_run;
+}
+
+/* Seqs top - 63 .. top - 64 + n leave the window, oldest first. */
+static inline void hopa_seq_shift(struct hopa_seq *s, uint64_t n)
+{
+    uint64_t out = n < HOPA_SEQ_WINDOW ? n : HOPA_SEQ_WINDOW;
+
+    for (uint64_t i = 0; i < out; i++)
+    {
+        uint32_t bit = HOPA_SEQ_WINDOW - 1 - i;
+
+        if (s->top < s->base + bit) /* before the first seq */
+            continue;
+        if ((s->bits >> bit) & 1)
+            s->loss_run = 0;
+        else
+            hopa_seq_lose(s, 1);
+    }
+    /* skipped over without ever being in the window */
+    if (n > HOPA_SEQ_WINDOW)
+        hopa_seq_lose(s, n - HOPA_SEQ_WINDOW);
+
+    s->bits = n < HOPA_SEQ_WINDOW ? s->bits << n : 0;
+}
+
+static inline enum hopa_seq_result hopa_seq_update(struct hopa_seq *s, uint64_t seq)
+{
+    uint64_t d;
+
+    if (seq == 0)
+        return HOPA_SEQ_NONE;
+
+    if (s->top == 0 || seq + HOPA_SEQ_WINDOW <= s->top)
+    {
+        *s = (struct hopa_seq){.base = seq, .top = seq, .bits = 1, .in_row = 1, .received = 1};
+        return HOPA_SEQ_RESTART;
+    }
+
+    if (seq > s->top)
+    {
+        d = seq - s->top;
+        hopa_seq_shift(s, d);
+        s->bits |= 1;
+        s->top = seq;
+        if (d >= HOPA_SEQ_WINDOW) /* the rest of the gap, out of the window now */
+        {
+            hopa_seq_lose(s, HOPA_SEQ_WINDOW - 1);
+            s->base = seq;
+        }
+        s->in_row = d == 1 ? s->in_row + 1 : 1;
+        s->received++;
+        return d == 1 ? HOPA_SEQ_NEXT : HOPA_SEQ_JUMP;
+    }
+
+    d = s->top - seq;
+    if ((s->bits >> d) & 1)
+    {
+        s->dups++;
+        return HOPA_SEQ_DUP;
+    }
+    s->bits |= 1ULL << d;
+    s->received++;
+    s->reordered++;
+    if (d > s->reorder_max)
+        s->reorder_max = d;
+
+    return HOPA_SEQ_LATE;
+}
+
+/* Seqs missing from the window, over the seqs seen since the (re)start. */
+static inline uint32_t hopa_seq_window_lost(const struct hopa_seq *s)
+{
+    uint64_t span = s->top - s->base + 1;
+
+    if (s->top == 0)
+        return 0;
+    if (span >= HOPA_SEQ_WINDOW)
+        return HOPA_SEQ_WINDOW - __builtin_popcountll(s->bits);
+
+    return span - __builtin_popcountll(s->bits & ((1ULL << span) - 1));
+}
+
+/* Loss over the window, ppm; what a path choice weighs. */
+static inline uint32_t hopa_seq_loss_ppm(const struct hopa_seq *s)
+{
+    uint64_t span = s->top - s->base + 1;
+
+    if (s->top == 0)
+        return 0;
+    if (span > HOPA_SEQ_WINDOW)
+        span = HOPA_SEQ_WINDOW;
+
+    return (uint64_t)hopa_seq_window_lost(s) * 1000000 / span;
+}
+
+static inline uint32_t hopa_seq_reorder_ppm(const struct hopa_seq *s)
+{
+    return s->received ? s->reordered * 1000000 / s->received : 0;
+}
+
+#endif /* HOPA_SEQ_H */
@@ -0,0 +1,188 @@
+#ifndef HOPA_TRAIN_H
+#define HOPA_TRAIN_H
+
+#include <stdint.h>
+
+/*
+ * Bandwidth of one path from the dispersion of probe trains.
+ *
+ * The sender sends a train of len packets back to back at its line rate
+ * R_in. The bottleneck spaces them out:
+ *
+ *   capacity C  : a pair that crossed the bottleneck with no cross traffic
+ *                 in between leaves it frame / C apart; the smallest gap of
+ *                 a train, median over the last HOPA_TRAIN_HISTORY trains.
+ *   dispersion  : the whole train leaves at R_out = frames / (last - first),
+ *                 C * R_in / (R_in + cross) in a fluid model, so
+ *   available A : C - cross = C - R_in * (C - R_out) / R_out.
+ *
+ * A is smoothed over trains. R_in unknown (0) is taken as C: the sender's
+ * own link is the bottleneck. Trains that lost more than half of their
+ * packets are not estimated.
+ *
+ * Receive times are ticks of any clock at hz; the resolution of the stamps
+ * bounds the rates that can be told apart. Two packets of a train on the
+ * same stamp (stamped per rx burst, not per packet) leave no gap to measure
+ * and bias the dispersion: such a train is not estimated.
+ *
+ * No DPDK here.
+ */
+
+#define HOPA_TRAIN_MAX_LEN (32)
+#define HOPA_TRAIN_MIN_RX (3)          /* packets received for an estimate */
+#define HOPA_TRAIN_HISTORY (8)         /* capacity samples, median */
+#define HOPA_TRAIN_WIRE_OVERHEAD (24)  /* preamble, FCS and inter frame gap */
+
+/* train being received */
+struct hopa_train_rx
+{
+    uint64_t id;           /* train seq, 0 -> none */
+    uint8_t done;          /* estimated, stragglers ignored */
+    uint8_t len;
+    uint8_t n;             /* received */
+    uint8_t first_idx;
+    uint8_t last_idx;      /* highest index received */
+    uint8_t ties;          /* packets on the stamp of the one before */
+    uint32_t wire_len;     /* bytes per packet on the wire */
+    uint32_t rate_in_mbps; /* sender line rate, 0 -> unknown */
+    uint64_t first_tsc;
+    uint64_t last_tsc;
+    uint64_t min_gap;      /* between consecutive indexes, ticks, 0 -> none */
+};
+
+/* per path, zeroed with the peer */
+struct hopa_train_est
+{
+    uint64_t trains;       /* estimated */
+    uint64_t short_trains; /* too few packets */
+    uint64_t collapsed_trains; /* stamps that do not tell packets apart */
+    uint32_t samples[HOPA_TRAIN_HISTORY]; /* capacity, Mbps */
+    uint32_t n_samples;
+    uint32_t capacity_mbps;
+    uint32_t adr_mbps;     /* dispersion rate of the last train */
+    uint32_t avail_mbps;   /* smoothed, valid once trains > 0 */
+    struct hopa_train_rx rx;
+};
+
+/* bytes x gaps over ticks at hz, Mbps */
+static inline uint32_t hopa_train_mbps(uint64_t bytes, uint64_t ticks, uint64_t hz)
+{
+    uint64_t mbps;
+
+    if (ticks == 0)
+        return 0;
+    mbps = bytes * 8 * hz / ticks / 1000000;
+
+    return mbps > UINT32_MAX ? UINT32_MAX : (uint32_t)mbps;
+}
+
+static inline uint32_t hopa_train_median(const uint32_t *v, uint32_t n)
+{
+    uint32_t s[HOPA_TRAIN_HISTORY], t;
+    uint32_t i, j;
+
+    for (i = 0; i < n; i++)
+    {
+        t = v[i];
+        for (j = i; j > 0 && s[j - 1] > t; j--)
+            s[j] = s[j - 1];
+        s[j] = t;
+    }
+
+    return n ? s[n / 2] : 0;
+}
+
+/* Estimate from the train received so far: 1, or 0 if too short. */
+static inline int hopa_train_finish(struct hopa_train_est *e, uint64_t hz)
+{
+    struct hopa_train_rx *rx = &e->rx;
+    uint32_t gaps = rx->last_idx - rx->first_idx;
+    uint64_t c, r_in, r_out, cross, a;
+
+    rx->done = 1;
+    if (rx->n < HOPA_TRAIN_MIN_RX || rx->n * 2 < rx->len || gaps == 0 || rx->last_tsc <= rx->first_tsc)
+    {
+        e->short_trains++;
+        return 0;
+    }
+    if (rx->ties)
+    {
+        e->collapsed_trains++;
+        return 0;
+    }
+
+    if (rx->min_gap)
+    {
+        e->samples[e->trains % HOPA_TRAIN_HISTORY] = hopa_train_mbps(rx->wire_len, rx->min_gap, hz);
+        if (e->n_samples < HOPA_TRAIN_HISTORY)
+            e->n_samples++;
+    }
+    e->adr_mbps = hopa_train_mbps((uint64_t)rx->wire_len * gaps, rx->last_tsc - rx->first_tsc, hz);
+    e->trains++;
+
+    /* the dispersion rate is a lower bound of the capacity */
+    c = hopa_train_median(e->samples, e->n_samples);
+    if (c < e->adr_mbps)
+        c = e->adr_mbps;
+    e->capacity_mbps = c;
+
+    r_out = e->adr_mbps;
+    r_in = rx->rate_in_mbps ? rx->rate_in_mbps : c;
+    if (r_out >= c)
+        a = c;
+    else
+    {
+        cross = r_in * (c - r_out) / r_out;
+        a = cross >= c ? 0 : c - cross;
+    }
+    e->avail_mbps = e->trains > 1 ? (uint32_t)((3 * (uint64_t)e->avail_mbps + a) / 4) : (uint32_t)a;
+
+    return 1;
+}
+
+/*
+ * Packet idx of train id (len packets of wire_len bytes, sent at
+ * rate_in_mbps) received at tsc. 1 when it completed an estimate: the last
+ * packet of a train, or the first of the next one after losses.
+ */
+static inline int hopa_train_update(struct hopa_train_est *e, uint64_t id, uint8_t idx, uint8_t len, uint32_t wire_len,
+                                    uint32_t rate_in_mbps, uint64_t tsc, uint64_t hz)
+{
+    struct hopa_train_rx *rx = &e->rx;
+    int est = 0;
+
+    if (id == 0 || len == 0 || len > HOPA_TRAIN_MAX_LEN || idx >= len)
+        return 0;
+
+    if (id != rx->id)
+    {
+        if (id < rx->id && rx->id - id < HOPA_TRAIN_HISTORY)
+            return 0; /* straggler of an older train */
+        if (rx->id && !rx->done)
+            est = hopa_train_finish(e, hz);
+
+        *rx = (struct hopa_train_rx){.id = id, .len = len, .n = 1, .first_idx = idx, .last_idx = idx,
+                                     .wire_len = wire_len, .rate_in_mbps = rate_in_mbps, .first_tsc = tsc, .last_tsc = tsc};
+    }
+    else
+    {
+        /* late inside the train: no gap to take */
+        if (rx->done || idx <= rx->last_idx)
+            return 0;
+
+        if (tsc <= rx->last_tsc)
+            rx->ties++;
+        else if (idx == rx->last_idx + 1 && (rx->min_gap == 0 || tsc - rx->last_tsc < rx->min_gap))
+            rx->min_gap = tsc - rx->last_tsc;
+        rx->n++;
+        rx->last_idx = idx;
+        rx->last_tsc = tsc;
+    }
+
+    if (idx == len - 1)
+        est |= hopa_train_finish(e, hz);
+
+    return est;
+}
+
+#endif /* HOPA_TRAIN_H */
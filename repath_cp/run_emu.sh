@@ -0,0 +1,29 @@
+#!/bin/bash
+
+# sender CP <-> hopa_emu <-> receiver CP, all on this machine over memif.
+# usage: ./run_emu.sh [hopa_emu options], e.g. ./run_emu.sh -S fail -p 1:30:5:10000:512:0:0
+# HOPA_CP_OPTS=<hopa_cp options> goes to both CPs, e.g. HOPA_CP_OPTS="-H 0:0:0:0" ./run_emu.sh -S drift
+
+SOCK=/tmp/hopa_emu.sock
+
+rm -r build
+make && make emu
+
+rm -f $SOCK
+
+./build/hopa_emu -l 0 --no-pci --file-prefix=emu \
+    --vdev=net_memif0,role=server,id=0,socket=$SOCK \
+    --vdev=net_memif1,role=server,id=1,socket=$SOCK -- "$@" &
+EMU_PID=$!
+sleep 1
+
+./build/hopa_cp -l 1-2 --no-pci --file-prefix=rcv \
+    --vdev=net_memif0,role=client,id=1,socket=$SOCK -- -s 0 -m /hopa_paths_rcv $HOPA_CP_OPTS &
+RCV_PID=$!
+
+./build/hopa_cp -l 3-4 --no-pci --file-prefix=snd \
+    --vdev=net_memif0,role=client,id=0,socket=$SOCK -- -s 1 -m /hopa_paths_snd $HOPA_CP_OPTS &
+SND_PID=$!
+
+wait $EMU_PID
+kill $RCV_PID $SND_PID
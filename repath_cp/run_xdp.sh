@@ -0,0 +1,56 @@
+#!/bin/bash
+
+# hopa_cp over AF_XDP (net_af_xdp vdev), no DPDK-bound NIC needed.
+#
+# usage: ./run_xdp.sh                           sender <-> receiver over a veth pair (CI)
+#        ./run_xdp.sh <iface> [hopa_cp options] one CP on a kernel netdev, e.g. ./run_xdp.sh ens1f1 -s 1
+#
+# XDP_BUSY_BUDGET=<n> turns on preferred busy polling of the socket (DPDK >= 21.05, kernel >= 5.11).
+# Zero-copy is used when the netdev driver supports it, copy mode otherwise.
+
+VETH0=hopa0
+VETH1=hopa1
+
+rm -r build
+make || exit 1
+
+xdp_vdev() {
+    local vdev="net_af_xdp0,iface=$1,start_queue=0,queue_count=1"
+
+    if [ -n "$XDP_BUSY_BUDGET" ]; then
+        vdev="$vdev,busy_budget=$XDP_BUSY_BUDGET"
+    fi
+    echo $vdev
+}
+
+if [ $# -ge 1 ]; then
+    IFACE=$1
+    shift
+
+    # one queue, and HOPA CP packets (UDP src port 1234) on it
+    ethtool -L $IFACE combined 1 2>/dev/null
+    ethtool -N $IFACE flow-type udp4 src-port 1234 action 0 2>/dev/null
+
+    if [ -n "$XDP_BUSY_BUDGET" ]; then
+        echo 2 > /sys/class/net/$IFACE/napi_defer_hard_irqs
+        echo 200000 > /sys/class/net/$IFACE/gro_flush_timeout
+    fi
+
+    ./build/hopa_cp -l 0-1 --no-pci --vdev=$(xdp_vdev $IFACE) -- "$@"
+    exit $?
+fi
+
+ip link del $VETH0 2>/dev/null
+ip link add $VETH0 type veth peer name $VETH1 || exit 1
+ip link set $VETH0 up
+ip link set $VETH1 up
+trap "ip link del $VETH0" EXIT
+
+./build/hopa_cp -l 1-2 --no-pci --file-prefix=rcv --vdev=$(xdp_vdev $VETH1) -- -s 0 -m /hopa_paths_rcv &
+RCV_PID=$!
+
+./build/hopa_cp -l 3-4 --no-pci --file-prefix=snd --vdev=$(xdp_vdev $VETH0) -- -s 1 -m /hopa_paths_snd &
+SND_PID=$!
+
+wait $SND_PID
+kill $RCV_PID
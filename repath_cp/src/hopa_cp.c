@@ -1,12 +1,49 @@
 #include "hopa_cp.h"
+#include "hopa_ovs.h"
+#include "hopa_paths.h"
+#include "hopa_graph.h"
+#include "hopa_ecmp.h"
+#include "hopa_discover.h"
 #include "hopa_log.h"
 
-struct rte_mempool *mbuf_pool = NULL;
+struct rte_mempool *mbuf_pool = NULL;	/* rx */
+struct rte_mempool *cp_mbuf_pool = NULL; /* CP packets we build */
+struct hopa_pool_stats rx_pool_stats;
+struct hopa_pool_stats cp_pool_stats;
 struct hopa_in_out_ring *hopa_in_out_ring_ins = NULL;
-uint64_t all_paths_delay_list[PATH_NB] = {0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF};
-struct cur_path_info *cur_path_info;
-uint8_t opt_path_id = 0;
+struct hopa_peer_table peer_table;
+uint32_t probe_bw_kbps = DEF_PROBE_BW_KBPS;
 struct rte_timer retran_timer;
+struct hopa_tx_stats tx_stats;
+struct hopa_ovs hopa_ovs;
+struct hopa_paths *paths_table = NULL; /* NULL -> not published */
+rte_spinlock_t paths_lock = RTE_SPINLOCK_INITIALIZER;
+struct hopa_policy_table *policy_table = NULL; /* NULL -> no -P */
+char policy_file[PATH_MAX];
+time_t policy_mtime = 0;
+struct hopa_policy_rule policy_rules[POLICY_MAX_RULES];
+uint32_t graph_work = 0; /* mbufs the source nodes fed the last walk */
+struct hopa_ecmp ecmp;   /* lin NULL -> no -e */
+struct hopa_discover *discover_table = NULL; /* by peer slot, NULL -> no -D */
+uint32_t discover_pps = 0;
+struct hopa_select_conf select_conf;
+struct hopa_select_stats select_stats;
+FILE *select_log = NULL; /* NULL -> no -L */
+uint64_t live_interval_tsc = 0; /* 0 -> no -F */
+uint32_t live_mult = DEF_LIVE_MULT;
+struct hopa_live_stats live_stats;
+uint32_t train_kbps = 0; /* 0 -> no -T */
+uint32_t train_len = DEF_TRAIN_LEN;
+uint32_t train_frame = DEF_TRAIN_FRAME;
+uint32_t train_link_mbps = 0; /* sender line rate, 0 -> unknown */
+int train_ts_off = -1;        /* rx stamp dynfield, -1 -> not stamped */
+uint64_t train_ts_rx_flag = 0; /* its rx flag */
+uint64_t train_ts_flag = 0;   /* set by the NIC on the mbufs it stamped, 0 -> TSC stamps at rx burst */
+uint64_t train_ts_hz = 0;     /* of the rx stamps */
+struct hopa_train_stats train_stats;
+int int_dscp = -1;            /* -1 -> no -I */
+int int_off = -1;             /* INT sample dynfield */
+struct hopa_int_stats int_stats;
 
 static struct hopa_in_out_ring *get_ring_instance(void)
 {
@@ -36,6 +73,232 @@ static void parse_args(struct hopa_param *user_param, int argc, char *argv[])
 				exit(EXIT_FAILURE);
 			}
 		}
+		else if (strlen(argv[i]) == 2 && strcmp(argv[i], "-i") == 0)
+		{
+			if (i + 1 < argc)
+			{
+				user_param->rx_intr = strtoull(argv[i + 1], NULL, 10);
+				i++;
+			}
+			else
+			{
+				usage();
+				exit(EXIT_FAILURE);
+			}
+		}
+		else if (strlen(argv[i]) == 2 && strcmp(argv[i], "-c") == 0)
+		{
+			if (i + 1 < argc)
+			{
+				user_param->cp_pool = strtoull(argv[i + 1], NULL, 10);
+				i++;
+			}
+			else
+			{
+				usage();
+				exit(EXIT_FAILURE);
+			}
+		}
+		else if (strlen(argv[i]) == 2 && strcmp(argv[i], "-f") == 0)
+		{
+			if (i + 1 < argc)
+			{
+				user_param->peer_file = argv[i + 1];
+				i++;
+			}
+			else
+			{
+				usage();
+				exit(EXIT_FAILURE);
+			}
+		}
+		else if (strlen(argv[i]) == 2 && strcmp(argv[i], "-B") == 0)
+		{
+			if (i + 1 < argc)
+			{
+				user_param->probe_bw_kbps = strtoull(argv[i + 1], NULL, 10);
+				i++;
+			}
+			else
+			{
+				usage();
+				exit(EXIT_FAILURE);
+			}
+		}
+		else if (strlen(argv[i]) == 2 && strcmp(argv[i], "-o") == 0)
+		{
+			if (i + 1 < argc)
+			{
+				user_param->ovs = strtoull(argv[i + 1], NULL, 10);
+				i++;
+			}
+			else
+			{
+				usage();
+				exit(EXIT_FAILURE);
+			}
+		}
+		else if (strlen(argv[i]) == 2 && strcmp(argv[i], "-m") == 0)
+		{
+			if (i + 1 < argc)
+			{
+				user_param->paths_shm = argv[i + 1];
+				i++;
+			}
+			else
+			{
+				usage();
+				exit(EXIT_FAILURE);
+			}
+		}
+		else if (strlen(argv[i]) == 2 && strcmp(argv[i], "-g") == 0)
+		{
+			if (i + 1 < argc)
+			{
+				user_param->graph = strtoull(argv[i + 1], NULL, 10);
+				i++;
+			}
+			else
+			{
+				usage();
+				exit(EXIT_FAILURE);
+			}
+		}
+		else if (strlen(argv[i]) == 2 && strcmp(argv[i], "-e") == 0)
+		{
+			if (i + 1 < argc)
+			{
+				user_param->ecmp_spec = argv[i + 1];
+				i++;
+			}
+			else
+			{
+				usage();
+				exit(EXIT_FAILURE);
+			}
+		}
+		else if (strlen(argv[i]) == 2 && strcmp(argv[i], "-D") == 0)
+		{
+			if (i + 1 < argc)
+			{
+				user_param->discover_pps = strtoull(argv[i + 1], NULL, 10);
+				i++;
+			}
+			else
+			{
+				usage();
+				exit(EXIT_FAILURE);
+			}
+		}
+		else if (strlen(argv[i]) == 2 && strcmp(argv[i], "-H") == 0)
+		{
+			if (i + 1 < argc)
+			{
+				user_param->select_spec = argv[i + 1];
+				i++;
+			}
+			else
+			{
+				usage();
+				exit(EXIT_FAILURE);
+			}
+		}
+		else if (strlen(argv[i]) == 2 && strcmp(argv[i], "-L") == 0)
+		{
+			if (i + 1 < argc)
+			{
+				user_param->select_log = argv[i + 1];
+				i++;
+			}
+			else
+			{
+				usage();
+				exit(EXIT_FAILURE);
+			}
+		}
+		else if (strlen(argv[i]) == 2 && strcmp(argv[i], "-F") == 0)
+		{
+			if (i + 1 < argc)
+			{
+				if (sscanf(argv[i + 1], "%u:%u", &user_param->live_us, &user_param->live_mult) < 1 || user_param->live_mult == 0)
+				{
+					usage();
+					exit(EXIT_FAILURE);
+				}
+				i++;
+			}
+			else
+			{
+				usage();
+				exit(EXIT_FAILURE);
+			}
+		}
+		else if (strlen(argv[i]) == 2 && strcmp(argv[i], "-T") == 0)
+		{
+			if (i + 1 < argc)
+			{
+				if (sscanf(argv[i + 1], "%u:%u:%u", &user_param->train_kbps, &user_param->train_len, &user_param->train_frame) < 1)
+				{
+					usage();
+					exit(EXIT_FAILURE);
+				}
+				i++;
+			}
+			else
+			{
+				usage();
+				exit(EXIT_FAILURE);
+			}
+		}
+		else if (strlen(argv[i]) == 2 && strcmp(argv[i], "-P") == 0)
+		{
+			if (i + 1 < argc)
+			{
+				user_param->policy_file = argv[i + 1];
+				i++;
+			}
+			else
+			{
+				usage();
+				exit(EXIT_FAILURE);
+			}
+		}
+		else if (strlen(argv[i]) == 2 && strcmp(argv[i], "-I") == 0)
+		{
+			if (i + 1 < argc)
+			{
+				user_param->int_dscp = atoi(argv[i + 1]);
+				if (user_param->int_dscp < 0 || user_param->int_dscp > 63)
+				{
+					usage();
+					exit(EXIT_FAILURE);
+				}
+				i++;
+			}
+			else
+			{
+				usage();
+				exit(EXIT_FAILURE);
+			}
+		}
+		else if (strlen(argv[i]) == 2 && strcmp(argv[i], "-v") == 0)
+		{
+			if (i + 1 < argc)
+			{
+				user_param->log_level = atoi(argv[i + 1]);
+				if (user_param->log_level < HOPA_LOG_LEVEL_ERROR || user_param->log_level > HOPA_LOG_LEVEL_TRACE)
+				{
+					usage();
+					exit(EXIT_FAILURE);
+				}
+				i++;
+			}
+			else
+			{
+				usage();
+				exit(EXIT_FAILURE);
+			}
+		}
 		else if (strlen(argv[i]) == 2 && strcmp(argv[i], "-h") == 0)
 		{
 			usage();
@@ -55,22 +318,80 @@ static void usage()
 	printf("Options:\n");
 	printf(" -h <help>            Help information\n");
 	printf(" -s <sender>          Sender is 1, and Receiver is 0. (default %d)\n", DEF_SENDER);
+	printf(" -f <peer file>       One \"ip mac\" per line, reloaded when it changes. (default the compiled-in DST peer)\n");
+	printf(" -B <kbps>            Aggregate probe bandwidth over all peers. (default %d)\n", DEF_PROBE_BW_KBPS);
+	printf(" -c <cp pool>         CP packets from a %d B data room pool 1, or from the rx pool 0. (default %d)\n", CP_MBUF_DATA_ROOM - RTE_PKTMBUF_HEADROOM, DEF_CP_POOL);
+	printf(" -i <rx interrupt>    Idle main loop sleeps on Rx interrupt 1, or naps %d us 0. (default 0)\n", IDLE_NAP_US);
+	printf(" -o <ovs>             CP of ovs-vswitchd --hopa-cp-external 1, needs --proc-type=secondary. (default 0)\n");
+	printf(" -m <shm name>        Shared memory path table, see hopa_paths.h. (default %s)\n", HOPA_PATHS_SHM);
+	printf(" -g <graph>           Main lcore runs the rte_graph pipeline 1, or the rings loop 0. (default 0)\n");
+	printf(" -e <ecmp hash>       <crc>[:<seed>[:<members>]], path k by a source port hashing to member k, see hopa_ecmp.h. (default dst port only)\n");
+	printf(" -D <pps>             Sender discovers the ECMP paths, probes per second, see hopa_discover.h. (default 0, off)\n");
+	printf(" -H <hysteresis>      <rel %%>[:<abs us>[:<dwell ms>[:<half-life s>]]] best path margins, dwell and flap damping, 0:0:0:0 -> lowest delay. (default 10:20:6000:60)\n");
+	printf(" -L <log file>        Append every best path decision that is not a stay, CSV. (default none)\n");
+	printf(" -F <liveness>        <interval us>[:<multiplier>] hellos on every path, a path is down after <multiplier> missed. (default off, multiplier %d)\n", DEF_LIVE_MULT);
+	printf(" -T <trains>          <kbps>[:<len>[:<bytes>]] probe trains on every path, bandwidth from their dispersion, on both sides. (default off, %d x %d B)\n", DEF_TRAIN_LEN, DEF_TRAIN_FRAME);
+	printf(" -P <policy file>     \"<vni> <dscp> <paths> <delay|loss|bw> <single|hash|dual>\" per line, published in <-m>%s, reloaded when it changes. (default none)\n", HOPA_POLICY_SUFFIX);
+	printf(" -I <dscp>            Receiver reads INT-MD over UDP of packets with this DSCP, per hop queue occupancy and latency into the path table. (default off)\n");
+	printf(" -v <log level>       0 error, 1 warn, 2 info, 3 trace, which logs every probe. (default %d)\n", HOPA_LOG_LEVEL_INFO);
 }
 
 static void print_hopa_param(struct hopa_param *user_param)
 {
 	printf("-s is :        %d \n", user_param->is_sender);
+	printf("-i is :        %d \n", user_param->rx_intr);
+	printf("-c is :        %d \n", user_param->cp_pool);
+	printf("-f is :        %s \n", user_param->peer_file ? user_param->peer_file : "-");
+	printf("-B is :        %u \n", user_param->probe_bw_kbps);
+	printf("-o is :        %d \n", user_param->ovs);
+	printf("-m is :        %s \n", user_param->paths_shm);
+	printf("-g is :        %d \n", user_param->graph);
+	printf("-e is :        %s \n", user_param->ecmp_spec ? user_param->ecmp_spec : "-");
+	printf("-D is :        %u \n", user_param->discover_pps);
+	printf("-H is :        %s \n", user_param->select_spec ? user_param->select_spec : "-");
+	printf("-L is :        %s \n", user_param->select_log ? user_param->select_log : "-");
+	printf("-F is :        %u:%u \n", user_param->live_us, user_param->live_mult);
+	printf("-T is :        %u:%u:%u \n", user_param->train_kbps, user_param->train_len, user_param->train_frame);
+	printf("-P is :        %s \n", user_param->policy_file ? user_param->policy_file : "-");
+	printf("-I is :        %d \n", user_param->int_dscp);
+	printf("-v is :        %d \n", user_param->log_level);
+}
+
+/* Rate of the NIC clock the rx stamps are in, over 100 ms of the TSC; the
+ * TSC stamps at rx burst if it cannot be read. */
+static void train_ts_clock(uint16_t port)
+{
+	uint64_t c0, c1, t0, t1;
+
+	if (rte_eth_read_clock(port, &c0) != 0)
+	{
+		HOPA_LOG_WARN("port %u : rx timestamps on, clock not readable, trains stamped at rx burst", port);
+		return;
+	}
+	t0 = rte_get_timer_cycles();
+	rte_delay_ms(100);
+	if (rte_eth_read_clock(port, &c1) != 0 || c1 <= c0)
+		return;
+	t1 = rte_get_timer_cycles();
+
+	train_ts_hz = (c1 - c0) * rte_get_timer_hz() / (t1 - t0);
+	train_ts_flag = train_ts_rx_flag;
+	HOPA_LOG_INFO("port %u : trains stamped by the NIC, clock %" PRIu64 " Hz", port, train_ts_hz);
 }
 
 static inline int
-port_init(uint16_t port, struct rte_mempool *mbuf_pool)
+port_init(uint16_t port, struct rte_mempool *mbuf_pool, int rx_intr)
 {
 	struct rte_eth_conf port_conf = {
 		.rxmode = {
 			.max_rx_pkt_len = RTE_ETHER_MAX_LEN,
 		},
+		.intr_conf = {
+			.rxq = rx_intr ? 1 : 0,
+		},
 	};
-	const uint16_t rx_rings = 1, tx_rings = 2;
+	const uint16_t rx_rings = 1;
+	uint16_t tx_rings = 2;
 	uint16_t nb_rxd = RX_RING_SIZE;
 	uint16_t nb_txd = TX_RING_SIZE;
 	int retval;
@@ -88,10 +409,18 @@ port_init(uint16_t port, struct rte_mempool *mbuf_pool)
 		return retval;
 	}
 
+	/* net_af_xdp has one queue per bound netdev queue (queue_count) */
+	tx_rings = RTE_MIN(tx_rings, dev_info.max_tx_queues);
+	printf("Port %u driver %s, %u tx queue(s)\n", port, dev_info.driver_name, tx_rings);
+
 	if (dev_info.tx_offload_capa & DEV_TX_OFFLOAD_MBUF_FAST_FREE)
 		port_conf.txmode.offloads |=
 			DEV_TX_OFFLOAD_MBUF_FAST_FREE;
 
+	/* -T receiver : the NIC stamps the trains where it can */
+	if (train_ts_off >= 0 && (dev_info.rx_offload_capa & DEV_RX_OFFLOAD_TIMESTAMP))
+		port_conf.rxmode.offloads |= DEV_RX_OFFLOAD_TIMESTAMP;
+
 	/* Configure the Ethernet device. */
 	retval = rte_eth_dev_configure(port, rx_rings, tx_rings, &port_conf);
 	if (retval != 0)
@@ -126,6 +455,9 @@ port_init(uint16_t port, struct rte_mempool *mbuf_pool)
 	if (retval < 0)
 		return retval;
 
+	if (port_conf.rxmode.offloads & DEV_RX_OFFLOAD_TIMESTAMP)
+		train_ts_clock(port);
+
 	/* Display the port MAC address. */
 	struct rte_ether_addr addr;
 	retval = rte_eth_macaddr_get(port, &addr);
@@ -146,339 +478,2934 @@ port_init(uint16_t port, struct rte_mempool *mbuf_pool)
 	return 0;
 }
 
-static void
-fill_eth_header(struct rte_ether_hdr *eth_hdr)
+/* Called once per loop iteration with the amount of work done. Busy polls while
+ * there is traffic, backs off with rte_pause, and returns true once the loop
+ * has been idle long enough to block on its event. */
+static bool hopa_idle_poll(struct hopa_idle *idle, uint16_t nb_work)
 {
-	eth_hdr->s_addr = (struct rte_ether_addr){SRC_MAC};
-	eth_hdr->d_addr = (struct rte_ether_addr){DST_MAC};
-	eth_hdr->ether_type = rte_cpu_to_be_16(RTE_ETHER_TYPE_IPV4);
+	uint32_t pause;
+
+	if (nb_work)
+	{
+		idle->empty_polls = 0;
+		return false;
+	}
+
+	idle->empty_polls++;
+	if (idle->empty_polls <= IDLE_SPIN_POLLS)
+		return false;
+
+	if (idle->empty_polls <= IDLE_SPIN_POLLS + IDLE_PAUSE_POLLS)
+	{
+		pause = RTE_MIN(idle->empty_polls - IDLE_SPIN_POLLS, (uint32_t)IDLE_PAUSE_MAX);
+		while (pause--)
+			rte_pause();
+		return false;
+	}
+
+	idle->sleeps++;
+	return true;
 }
 
-static void
-fill_ipv4_header(struct rte_ipv4_hdr *ipv4_hdr)
+static int hopa_ring_event_init(struct hopa_ring_event *ev)
 {
-	ipv4_hdr->version_ihl = (4 << 4) + 5;																							  // ipv4 version , length 5 (*4 bytes)
-	ipv4_hdr->type_of_service = 0;																									  // No Diffserv
-	ipv4_hdr->total_length = rte_cpu_to_be_16(sizeof(struct rte_ipv4_hdr) + sizeof(struct rte_udp_hdr) + sizeof(struct hopa_cp_hdr)); // IP 52 bytes
-	ipv4_hdr->packet_id = rte_cpu_to_be_16(5462);																					  // set random
-	ipv4_hdr->fragment_offset = rte_cpu_to_be_16(0);
-	ipv4_hdr->time_to_live = 64;
-	ipv4_hdr->next_proto_id = IPPROTO_UDP;
-	ipv4_hdr->src_addr = rte_cpu_to_be_32(SRC_IP);
-	ipv4_hdr->dst_addr = rte_cpu_to_be_32(DST_IP);
-	ipv4_hdr->hdr_checksum = rte_ipv4_cksum(ipv4_hdr);
+	ev->sleeping = 0;
+	ev->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+	return ev->efd < 0 ? -1 : 0;
 }
 
-static void
-fill_udp_header(struct rte_ipv4_hdr *ipv4_hdr, struct rte_udp_hdr *udp_hdr, uint16_t dst_port)
+/* Enqueue and wake the consumer if it is asleep. The eventfd is only written
+ * on the idle -> busy edge, so a busy ring costs no syscall. Mbufs that do
+ * not fit are freed and counted in drops. */
+static unsigned int hopa_ring_enqueue(struct rte_ring *ring, struct hopa_ring_event *ev, struct rte_mbuf **mbufs, unsigned int n, uint64_t *drops)
 {
-	udp_hdr->src_port = rte_cpu_to_be_16(SRC_PORT);
-	udp_hdr->dst_port = rte_cpu_to_be_16(dst_port);
-	udp_hdr->dgram_len = rte_cpu_to_be_16(sizeof(struct rte_udp_hdr) + sizeof(struct hopa_cp_hdr));
-	udp_hdr->dgram_cksum = rte_ipv4_udptcp_cksum(ipv4_hdr, udp_hdr);
+	unsigned int nb;
+
+	nb = rte_ring_enqueue_burst(ring, (void **)mbufs, n, NULL);
+	if (nb)
+	{
+		rte_smp_mb();
+		if (ev->sleeping)
+			eventfd_write(ev->efd, 1);
+	}
+
+	if (unlikely(nb < n))
+	{
+		rte_pktmbuf_free_bulk(&mbufs[nb], n - nb);
+		*drops += n - nb;
+	}
+
+	return nb;
 }
 
-static struct rte_mbuf *encode_udp_pkt(uint16_t dst_port)
+/* Block until the ring is fed or timeout_us expires. */
+static void hopa_ring_wait(struct rte_ring *ring, struct hopa_ring_event *ev, int timeout_us)
 {
-	struct rte_mbuf *mbuf;
-	struct rte_ether_hdr *eth_hdr;
-	struct rte_ipv4_hdr *ipv4_hdr;
-	struct rte_udp_hdr *udp_hdr;
+	struct pollfd pfd = {.fd = ev->efd, .events = POLLIN};
+	struct timespec timeout = {.tv_sec = timeout_us / 1000000, .tv_nsec = (timeout_us % 1000000) * 1000};
+	eventfd_t val;
+
+	ev->sleeping = 1;
+	rte_smp_mb();
+	if (rte_ring_count(ring) == 0)
+		ppoll(&pfd, 1, &timeout, NULL);
+	ev->sleeping = 0;
 
-	if (!mbuf_pool)
+	eventfd_read(ev->efd, &val);
+}
+
+/* Idle main loop: block on the out rings eventfd and, with rx_intr, on the
+ * Rx interrupt; otherwise nap IDLE_NAP_US so Rx latency stays bounded. */
+static void hopa_main_sleep(struct hopa_in_out_ring *in_out_ring, int rx_intr)
+{
+	struct rte_epoll_event epoll_ev[2];
+	struct pollfd pfd = {.fd = in_out_ring->out_ev.efd, .events = POLLIN};
+	struct timespec timeout = {.tv_sec = 0, .tv_nsec = IDLE_NAP_US * 1000};
+	eventfd_t val;
+
+	in_out_ring->out_ev.sleeping = 1;
+	rte_smp_mb();
+	if (rx_intr)
+		rte_eth_dev_rx_intr_enable(PORT_P0, 0);
+
+	if (rte_ring_count(in_out_ring->hopa_out_ring) == 0 && rte_ring_count(in_out_ring->hopa_out_prio_ring) == 0)
 	{
-		printf("mbuf_pool null\n");
-		return NULL;
+		if (rx_intr)
+			rte_epoll_wait(RTE_EPOLL_PER_THREAD, epoll_ev, RTE_DIM(epoll_ev), IDLE_TIMER_MS);
+		else
+			ppoll(&pfd, 1, &timeout, NULL);
 	}
-	mbuf = rte_pktmbuf_alloc(mbuf_pool);
-	if (!mbuf)
-		rte_exit(EXIT_FAILURE, "Error with rte_pktmbuf_alloc()\n");
 
-	eth_hdr = (struct rte_ether_hdr *)rte_pktmbuf_append(mbuf, sizeof(struct rte_ether_hdr));
-	fill_eth_header(eth_hdr);
+	if (rx_intr)
+		rte_eth_dev_rx_intr_disable(PORT_P0, 0);
+	in_out_ring->out_ev.sleeping = 0;
 
-	ipv4_hdr = (struct rte_ipv4_hdr *)rte_pktmbuf_append(mbuf, sizeof(struct rte_ipv4_hdr));
-	fill_ipv4_header(ipv4_hdr);
+	eventfd_read(in_out_ring->out_ev.efd, &val);
+}
 
-	udp_hdr = (struct rte_udp_hdr *)rte_pktmbuf_append(mbuf, sizeof(struct rte_udp_hdr));
-	fill_udp_header(ipv4_hdr, udp_hdr, dst_port);
+/* Send with a bounded retry budget, so a full TX ring never stalls RX. */
+static uint16_t hopa_tx_burst(uint16_t port, uint16_t queue, struct rte_mbuf **pkts, uint16_t nb_pkts)
+{
+	return hopa_tx_retry(port, queue, pkts, rte_eth_tx_burst(port, queue, pkts, nb_pkts), nb_pkts);
+}
+
+/* Retry pkts[sent..nb_pkts), the only place tx_retries is counted. */
+static uint16_t hopa_tx_retry(uint16_t port, uint16_t queue, struct rte_mbuf **pkts, uint16_t sent, uint16_t nb_pkts)
+{
+	int retry;
+
+	for (retry = 0; sent < nb_pkts && retry < TX_RETRY_BUDGET; retry++)
+	{
+		tx_stats.tx_retries++;
+		sent += rte_eth_tx_burst(port, queue, &pkts[sent], nb_pkts - sent);
+	}
+
+	if (unlikely(sent < nb_pkts))
+	{
+		rte_pktmbuf_free_bulk(&pkts[sent], nb_pkts - sent);
+		tx_stats.tx_drops += nb_pkts - sent;
+	}
+	tx_stats.tx_pkts += sent;
+
+	return sent;
+}
+
+static void hopa_tx_buffer_err_cb(struct rte_mbuf **unsent, uint16_t count, __rte_unused void *userdata)
+{
+	/* the buffered burst already counted its sent part in tx_pkts */
+	hopa_tx_retry(PORT_P0, 0, unsent, 0, count);
+}
+
+static void print_pool_stats(void)
+{
+	HOPA_LOG_INFO("rx pool in use hwm %u / %u, cp pool in use hwm %u / %u",
+				  rx_pool_stats.in_use_hwm, rx_pool_stats.size, cp_pool_stats.in_use_hwm, cp_pool_stats.size);
+}
+
+static void print_tx_stats(void)
+{
+	static uint64_t last_tsc, last_rx, last_tx;
+	uint64_t now = rte_get_timer_cycles();
+	double s = last_tsc ? (double)(now - last_tsc) / rte_get_timer_hz() : 0;
+
+	/* pps since the previous print, to compare port backends */
+	HOPA_LOG_INFO("rx %" PRIu64 " (%.0f pps), tx %" PRIu64 " (%.0f pps, prio %" PRIu64 "), retries %" PRIu64 ", tx drops %" PRIu64 ", in ring drops %" PRIu64 ", out ring drops %" PRIu64 "",
+				  tx_stats.rx_pkts, s > 0 ? (tx_stats.rx_pkts - last_rx) / s : 0,
+				  tx_stats.tx_pkts, s > 0 ? (tx_stats.tx_pkts - last_tx) / s : 0, tx_stats.tx_prio_pkts,
+				  tx_stats.tx_retries, tx_stats.tx_drops, tx_stats.in_ring_drops, tx_stats.out_ring_drops);
+	last_tsc = now;
+	last_rx = tx_stats.rx_pkts;
+	last_tx = tx_stats.tx_pkts;
+}
+
+/* flips and held decisions since the previous print */
+static void print_select_stats(void)
+{
+	static uint64_t last_tsc, last[HOPA_SELECT_REASON_MAX];
+	uint64_t now = rte_get_timer_cycles();
+	double min = last_tsc ? (double)(now - last_tsc) / rte_get_timer_hz() / 60 : 0;
+	uint64_t d[HOPA_SELECT_REASON_MAX];
+	int i;
+
+	for (i = 0; i < HOPA_SELECT_REASON_MAX; i++)
+	{
+		d[i] = select_stats.decisions[i] - last[i];
+		last[i] = select_stats.decisions[i];
+	}
+	last_tsc = now;
+
+	HOPA_LOG_INFO("best path : %" PRIu64 " flips (%.1f /min, failover %" PRIu64 "), held margin %" PRIu64 " dwell %" PRIu64 " damped %" PRIu64 ", stay %" PRIu64 "",
+				  d[HOPA_SELECT_SWITCH] + d[HOPA_SELECT_FAILOVER], min > 0 ? (d[HOPA_SELECT_SWITCH] + d[HOPA_SELECT_FAILOVER]) / min : 0,
+				  d[HOPA_SELECT_FAILOVER], d[HOPA_SELECT_HELD_MARGIN], d[HOPA_SELECT_HELD_DWELL], d[HOPA_SELECT_HELD_DAMPED], d[HOPA_SELECT_STAY]);
+}
+
+/* failures detected by -F, detection and failover times */
+static void print_live_stats(void)
+{
+	if (live_interval_tsc == 0)
+		return;
+
+	HOPA_LOG_INFO("liveness : %" PRIu64 " down (%" PRIu64 " failovers), %" PRIu64 " up, detection avg %" PRIu64 " us max %" PRIu64 " us, out max %" PRIu64 " us",
+				  live_stats.downs, live_stats.failovers, live_stats.ups, live_stats.downs ? live_stats.detect_us_sum / live_stats.downs : 0,
+				  live_stats.detect_us_max, live_stats.publish_us_max);
+}
+
+/* trains of -T since start */
+static void print_train_stats(void)
+{
+	if (train_kbps == 0)
+		return;
+
+	HOPA_LOG_INFO("trains : %" PRIu64 " sent (%" PRIu64 " not whole), %" PRIu64 " estimated, %" PRIu64 " too short, %" PRIu64
+				  " on shared stamps, line rate %u Mbps",
+				  train_stats.tx_trains, train_stats.tx_drops, train_stats.rx_trains, train_stats.short_trains, train_stats.collapsed_trains,
+				  train_link_mbps);
+}
+
+static void print_int_stats(void)
+{
+	if (int_off < 0)
+		return;
+
+	HOPA_LOG_INFO("int : %" PRIu64 " packets with INT-MD, %" PRIu64 " marked but unreadable", int_stats.rx_pkts, int_stats.bad);
+}
+
+static struct rte_mempool *pool_create(const char *name, unsigned int n, unsigned int cache_size, uint16_t data_room, int socket_id, struct hopa_pool_stats *stats)
+{
+	struct rte_mempool *mp;
+
+	mp = rte_pktmbuf_pool_create(name, n, cache_size, 0, data_room, socket_id);
+	if (mp == NULL)
+		return NULL;
+
+	stats->mp = mp;
+	stats->size = n;
+	stats->in_use_hwm = 0;
+
+	HOPA_LOG_INFO("mempool %s : %u mbufs x %u B data room, cache %u, socket %d, %zu KB",
+				  name, n, data_room, cache_size, socket_id, (size_t)n * (sizeof(struct rte_mbuf) + data_room) / 1024);
+
+	return mp;
+}
+
+/* Track the most mbufs ever in use, to size the pools down. */
+static void pool_watch(struct hopa_pool_stats *stats)
+{
+	unsigned int in_use;
+
+	if (stats->mp == NULL)
+		return;
+
+	in_use = rte_mempool_in_use_count(stats->mp);
+	if (in_use > stats->in_use_hwm)
+		stats->in_use_hwm = in_use;
+}
+
+/* Create, or take over, the shared memory path table 'name'. */
+static void paths_init(const char *name)
+{
+	struct hopa_paths *paths;
+	int fd;
+
+	RTE_BUILD_BUG_ON(PATH_NB != HOPA_PATHS_PATH_NB);
+	RTE_BUILD_BUG_ON(HOPA_PATHS_SLOTS < 2 * MAX_PEERS);
+
+	fd = shm_open(name, O_CREAT | O_RDWR, 0644);
+	if (fd < 0 || ftruncate(fd, sizeof(*paths)) < 0)
+	{
+		HOPA_LOG_WARN("path table %s: %s, not published", name, strerror(errno));
+		if (fd >= 0)
+			close(fd);
+		return;
+	}
+	paths = mmap(NULL, sizeof(*paths), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (paths == MAP_FAILED)
+	{
+		HOPA_LOG_WARN("path table %s: %s, not published", name, strerror(errno));
+		return;
+	}
+
+	/* one writer per table, or the sequence counters mean nothing */
+	if (paths->hdr.magic == HOPA_PATHS_MAGIC && paths->hdr.writer_pid != 0 &&
+		paths->hdr.writer_pid != getpid() && kill(paths->hdr.writer_pid, 0) == 0)
+		rte_exit(EXIT_FAILURE, "path table %s is published by pid %d, use -m\n", name, paths->hdr.writer_pid);
+
+	/* through the sequence counters: readers may still map the old table */
+	for (int i = 0; i < HOPA_PATHS_SLOTS; i++)
+	{
+		struct hopa_paths_entry *e = &paths->entries[i];
+
+		hopa_paths_write_begin(e);
+		memset((uint8_t *)e + sizeof(e->seq), 0, sizeof(*e) - sizeof(e->seq));
+		hopa_paths_write_end(e);
+	}
+
+	paths->hdr.version = HOPA_PATHS_VERSION;
+	paths->hdr.n_slots = HOPA_PATHS_SLOTS;
+	paths->hdr.path_nb = PATH_NB;
+	paths->hdr.base_port = DST_PORT_PATH_1;
+	paths->hdr.writer_pid = getpid();
+	__atomic_store_n(&paths->hdr.magic, HOPA_PATHS_MAGIC, __ATOMIC_RELEASE);
+
+	paths_table = paths;
+	HOPA_LOG_INFO("path table published in %s", name);
+}
+
+/* One-way delay of path i as the path table gives it. */
+static int64_t peer_delay_ns(const struct hopa_peer *peer, int i)
+{
+	return peer->all_paths_delay_list[i] == 0xFFFFFFFF ? HOPA_PATHS_DELAY_NONE : (int64_t)(peer->all_paths_delay_list[i] - 1000000000);
+}
+
+/* Loss, bandwidth and telemetry of path i: measured here on a receiver,
+ * from the receiver's REPORT on a sender. */
+static void peer_quality(const struct hopa_peer *peer, int i, struct hopa_paths_quality *q)
+{
+	const struct hopa_seq *seq = &peer->probe_seq[i];
+
+	if (peer->reported)
+	{
+		*q = peer->report[i];
+		return;
+	}
+
+	q->loss_ppm = seq->top ? hopa_seq_loss_ppm(seq) : HOPA_PATHS_PPM_NONE;
+	q->reorder_ppm = seq->top ? hopa_seq_reorder_ppm(seq) : HOPA_PATHS_PPM_NONE;
+	q->loss_run_max = seq->loss_run_max > UINT16_MAX ? UINT16_MAX : seq->loss_run_max;
+	q->reorder_max = seq->reorder_max > UINT16_MAX ? UINT16_MAX : seq->reorder_max;
+	q->avail_mbps = peer->train[i].trains ? peer->train[i].avail_mbps : HOPA_PATHS_BW_NONE;
+	q->capacity_mbps = peer->train[i].trains ? peer->train[i].capacity_mbps : HOPA_PATHS_BW_NONE;
+	q->queue = peer->int_est[i].pkts ? peer->int_est[i].queue_avg : HOPA_PATHS_INT_NONE;
+	q->hop_latency_ns = peer->int_est[i].pkts ? peer->int_est[i].latency_avg : HOPA_PATHS_INT_NONE;
+}
+
+/* Path state of 'peer' into the shared table, from any lcore. */
+static void paths_publish(const struct hopa_peer *peer)
+{
+	struct hopa_paths_entry *e;
+	struct timespec ts;
+	int slot;
+
+	if (paths_table == NULL)
+		return;
+
+	rte_spinlock_lock(&paths_lock);
+
+	slot = hopa_paths_slot(paths_table, peer->ip);
+	if (slot < 0)
+	{
+		HOPA_LOG_WARN("path table full, peer " IPV4_FMT " not published", IPV4_ARGS(peer->ip));
+		goto out;
+	}
+	e = &paths_table->entries[slot];
+	/* a free peer slot that was never published */
+	if (!peer->active && (e->state == HOPA_PATHS_EMPTY || e->ip != peer->ip))
+		goto out;
+
+	clock_gettime(0, &ts);
+
+	hopa_paths_write_begin(e);
+	e->ip = peer->ip;
+	e->state = peer->active ? HOPA_PATHS_ACTIVE : HOPA_PATHS_REMOVED;
+	e->best_path_id = peer->opt_path_id;
+	e->live_mask = peer->live_mask;
+	e->alias_mask = peer->alias_mask;
+	e->updated_ns = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+	for (int i = 0; i < PATH_NB; i++)
+	{
+		e->delay_ns[i] = peer_delay_ns(peer, i);
+		peer_quality(peer, i, &e->quality[i]);
+	}
+	hopa_paths_write_end(e);
+
+out:
+	rte_spinlock_unlock(&paths_lock);
+}
+
+/* Create, or take over, the policy table next to the path table 'paths_name', loaded from 'file'. */
+static void policy_init(const char *paths_name, const char *file)
+{
+	struct hopa_policy_table *pt;
+	char name[NAME_MAX];
+	int fd;
+
+	RTE_BUILD_BUG_ON(PATH_NB != HOPA_PATHS_PATH_NB);
+
+	if (file == NULL)
+		return;
+
+	snprintf(name, sizeof(name), "%s%s", paths_name, HOPA_POLICY_SUFFIX);
+	fd = shm_open(name, O_CREAT | O_RDWR, 0644);
+	if (fd < 0 || ftruncate(fd, sizeof(*pt)) < 0)
+		rte_exit(EXIT_FAILURE, "policy table %s: %s\n", name, strerror(errno));
+	pt = mmap(NULL, sizeof(*pt), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (pt == MAP_FAILED)
+		rte_exit(EXIT_FAILURE, "policy table %s: %s\n", name, strerror(errno));
+
+	if (pt->hdr.magic == HOPA_POLICY_MAGIC && pt->hdr.writer_pid != 0 &&
+		pt->hdr.writer_pid != getpid() && kill(pt->hdr.writer_pid, 0) == 0)
+		rte_exit(EXIT_FAILURE, "policy table %s is published by pid %d, use -m\n", name, pt->hdr.writer_pid);
+
+	/* another layout: start from zeros, the pages stay unbacked */
+	if (pt->hdr.magic != HOPA_POLICY_MAGIC || pt->hdr.version != HOPA_POLICY_VERSION)
+	{
+		if (ftruncate(fd, 0) < 0 || ftruncate(fd, sizeof(*pt)) < 0)
+			rte_exit(EXIT_FAILURE, "policy table %s: %s\n", name, strerror(errno));
+	}
+	close(fd);
+
+	pt->hdr.version = HOPA_POLICY_VERSION;
+	pt->hdr.writer_pid = getpid();
+	policy_table = pt;
+
+	snprintf(policy_file, sizeof(policy_file), "%s", file);
+	if (policy_load() < 0)
+		rte_exit(EXIT_FAILURE, "Cannot load policy file %s\n", file);
+	__atomic_store_n(&pt->hdr.magic, HOPA_POLICY_MAGIC, __ATOMIC_RELEASE);
+
+	HOPA_LOG_INFO("policy table published in %s", name);
+}
+
+/* "*", or "a[-b][,c[-d]...]" with every number below max, into a bit mask. */
+static int policy_parse_set(const char *spec, unsigned int max, uint64_t *mask)
+{
+	unsigned long lo, hi;
+	const char *p = spec;
+	char *end;
+
+	if (strcmp(spec, "*") == 0)
+	{
+		*mask = max == 64 ? UINT64_MAX : (1ULL << max) - 1;
+		return 0;
+	}
+
+	*mask = 0;
+	for (;;)
+	{
+		lo = strtoul(p, &end, 10);
+		if (end == p)
+			return -1;
+		hi = lo;
+		if (*end == '-')
+		{
+			p = end + 1;
+			hi = strtoul(p, &end, 10);
+			if (end == p)
+				return -1;
+		}
+		if (lo > hi || hi >= max)
+			return -1;
+		for (; lo <= hi; lo++)
+			*mask |= 1ULL << lo;
+		if (*end == '\0')
+			return 0;
+		if (*end != ',')
+			return -1;
+		p = end + 1;
+	}
+}
+
+/* "<vni|*> <dscps> <paths> <delay|loss|bw> <single|hash|dual>" */
+static int policy_parse_line(const char *line, struct hopa_policy_rule *rule)
+{
+	char vni[16], dscp[256], paths[64], objective[16], spray[16];
+	uint64_t path_mask;
+	unsigned long v;
+	char *end;
+
+	if (sscanf(line, "%15s %255s %63s %15s %15s", vni, dscp, paths, objective, spray) != 5)
+		return -1;
+
+	memset(rule, 0, sizeof(*rule));
+	if (strcmp(vni, "*") == 0)
+		rule->any_vni = 1;
+	else
+	{
+		v = strtoul(vni, &end, 10);
+		if (*end != '\0' || v >= HOPA_POLICY_VNIS)
+			return -1;
+		rule->vni = v;
+	}
+
+	if (policy_parse_set(dscp, HOPA_POLICY_DSCPS, &rule->dscp_mask) != 0 || policy_parse_set(paths, PATH_NB, &path_mask) != 0)
+		return -1;
+	rule->policy.allowed = path_mask;
+
+	if (strcmp(objective, "delay") == 0)
+		rule->policy.objective = HOPA_POLICY_MIN_DELAY;
+	else if (strcmp(objective, "loss") == 0)
+		rule->policy.objective = HOPA_POLICY_MIN_LOSS;
+	else if (strcmp(objective, "bw") == 0)
+		rule->policy.objective = HOPA_POLICY_MAX_BW;
+	else
+		return -1;
+
+	if (strcmp(spray, "single") == 0)
+		rule->policy.spray = HOPA_POLICY_SINGLE;
+	else if (strcmp(spray, "hash") == 0)
+		rule->policy.spray = HOPA_POLICY_HASH;
+	else if (strcmp(spray, "dual") == 0)
+		rule->policy.spray = HOPA_POLICY_DUAL;
+	else
+		return -1;
+
+	return 0;
+}
+
+/* (Re)load the policy file into the set not in use, then flip to it. Later
+ * lines override earlier ones where they overlap, "*" VNI lines apply to
+ * every tenant. */
+static int policy_load(void)
+{
+	struct hopa_policy_set *set;
+	struct hopa_policy_rule *rule;
+	struct stat st;
+	char line[512];
+	uint32_t next, r, idx;
+	int nb = 0, i, d;
+	FILE *fp;
+
+	fp = fopen(policy_file, "r");
+	if (fp == NULL)
+	{
+		HOPA_LOG_ERROR("open policy file %s failed", policy_file);
+		return -1;
+	}
+	if (fstat(fileno(fp), &st) == 0)
+		policy_mtime = st.st_mtime;
+
+	while (fgets(line, sizeof(line), fp) != NULL)
+	{
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
+		if (nb == POLICY_MAX_RULES)
+		{
+			HOPA_LOG_WARN("policy file %s: more than %d rules, the rest ignored", policy_file, POLICY_MAX_RULES);
+			break;
+		}
+		if (policy_parse_line(line, &policy_rules[nb]) != 0)
+		{
+			HOPA_LOG_WARN("bad policy line: %s", line);
+			continue;
+		}
+		nb++;
+	}
+	fclose(fp);
+
+	next = __atomic_load_n(&policy_table->hdr.active, __ATOMIC_RELAXED) ^ 1;
+	set = &policy_table->sets[next];
+
+	/* forget the tenants of the previous load of this set */
+	for (r = 1; r < set->n_rows; r++)
+		set->vni_row[set->row_vni[r]] = 0;
+	memset(set->rows, 0, sizeof(set->rows));
+	set->policies[0] = (struct hopa_policy){.allowed = LIVE_ALL, .objective = HOPA_POLICY_MIN_DELAY, .spray = HOPA_POLICY_SINGLE};
+	set->n_policies = 1;
+	set->n_rows = 1;
+
+	/* a row per named VNI, before any rule so that "*" lines reach them all */
+	for (i = 0; i < nb; i++)
+	{
+		rule = &policy_rules[i];
+		if (rule->any_vni || set->vni_row[rule->vni] != 0)
+			continue;
+		if (set->n_rows == HOPA_POLICY_ROWS)
+		{
+			HOPA_LOG_WARN("more than %d tenants, VNI %u gets the default rules", HOPA_POLICY_ROWS - 1, rule->vni);
+			continue;
+		}
+		set->row_vni[set->n_rows] = rule->vni;
+		set->vni_row[rule->vni] = set->n_rows++;
+	}
+
+	for (i = 0; i < nb; i++)
+	{
+		rule = &policy_rules[i];
+		if (!rule->any_vni && set->vni_row[rule->vni] == 0)
+			continue;
+
+		for (idx = 0; idx < set->n_policies; idx++)
+			if (memcmp(&set->policies[idx], &rule->policy, sizeof(rule->policy)) == 0)
+				break;
+		if (idx == set->n_policies)
+		{
+			if (idx == HOPA_POLICY_MAX)
+			{
+				HOPA_LOG_WARN("more than %d distinct policies, rule %d ignored", HOPA_POLICY_MAX, i + 1);
+				continue;
+			}
+			set->policies[set->n_policies++] = rule->policy;
+		}
+
+		for (r = rule->any_vni ? 0 : set->vni_row[rule->vni]; r < set->n_rows; r++)
+		{
+			for (d = 0; d < HOPA_POLICY_DSCPS; d++)
+				if ((rule->dscp_mask >> d) & 1)
+					set->rows[r][d] = idx;
+			if (!rule->any_vni)
+				break;
+		}
+	}
+
+	__atomic_store_n(&policy_table->hdr.active, next, __ATOMIC_RELEASE);
+	policy_table->hdr.gen++;
+
+	HOPA_LOG_INFO("policy file %s : %d rules, %u tenants, %u policies", policy_file, nb, set->n_rows - 1, set->n_policies);
+
+	return nb;
+}
+
+/* Called with peer_table_watch, reloads the policy file when it changes. */
+static void policy_watch(void)
+{
+	struct stat st;
+
+	if (policy_table == NULL)
+		return;
+
+	if (stat(policy_file, &st) == 0 && st.st_mtime != policy_mtime)
+		policy_load();
+}
+
+static void peer_table_init(const char *file, bool def_peer)
+{
+	struct rte_hash_parameters hash_params = {
+		.name = "peer_table",
+		.entries = MAX_PEERS,
+		.key_len = sizeof(uint32_t),
+		.hash_func = rte_jhash,
+		.hash_func_init_val = 0,
+		.socket_id = rte_socket_id(),
+		.extra_flag = RTE_HASH_EXTRA_FLAGS_RW_CONCURRENCY | RTE_HASH_EXTRA_FLAGS_MULTI_WRITER_ADD,
+	};
+
+	memset(&peer_table, 0, sizeof(peer_table));
+	rte_spinlock_init(&peer_table.lock);
+
+	peer_table.hash = rte_hash_create(&hash_params);
+	peer_table.peers = rte_zmalloc("peers", sizeof(struct hopa_peer) * MAX_PEERS, RTE_CACHE_LINE_SIZE);
+	if (peer_table.hash == NULL || peer_table.peers == NULL)
+		rte_exit(EXIT_FAILURE, "Cannot create peer table\n");
+
+	if (file == NULL)
+	{
+		if (def_peer)
+			peer_add(DST_IP, &(struct rte_ether_addr){DST_MAC}, 0);
+		return;
+	}
+
+	snprintf(peer_table.file, sizeof(peer_table.file), "%s", file);
+	if (peer_table_load() < 0)
+		rte_exit(EXIT_FAILURE, "Cannot load peer file %s\n", file);
+}
+
+/* "a.b.c.d xx:xx:xx:xx:xx:xx", '#' starts a comment */
+static int peer_parse_line(const char *line, uint32_t *ip, struct rte_ether_addr *mac)
+{
+	unsigned a, b, c, d;
+	unsigned m[RTE_ETHER_ADDR_LEN];
+
+	if (sscanf(line, "%u.%u.%u.%u %x:%x:%x:%x:%x:%x", &a, &b, &c, &d,
+			   &m[0], &m[1], &m[2], &m[3], &m[4], &m[5]) != 10)
+		return -1;
+	if (a > 255 || b > 255 || c > 255 || d > 255)
+		return -1;
+
+	*ip = IPV4_ADDR(a, b, c, d);
+	for (int i = 0; i < RTE_ETHER_ADDR_LEN; i++)
+	{
+		if (m[i] > 0xff)
+			return -1;
+		mac->addr_bytes[i] = m[i];
+	}
+
+	return 0;
+}
+
+static struct hopa_peer *peer_lookup(uint32_t ip)
+{
+	void *data;
+
+	if (rte_hash_lookup_data(peer_table.hash, &ip, &data) < 0)
+		return NULL;
+
+	return (struct hopa_peer *)data;
+}
+
+static struct hopa_peer *peer_add(uint32_t ip, const struct rte_ether_addr *mac, uint8_t learned)
+{
+	struct hopa_peer *peer = NULL;
+	uint64_t now = rte_get_timer_cycles();
+	int i;
+
+	rte_spinlock_lock(&peer_table.lock);
+
+	peer = peer_lookup(ip);
+	if (peer != NULL)
+	{
+		peer->mac = *mac;
+		goto out;
+	}
+
+	for (i = 0; i < MAX_PEERS; i++)
+	{
+		struct hopa_peer *slot = &peer_table.peers[i];
+
+		/* a removed slot may still be read by a lookup that raced the removal */
+		if (!slot->active && (slot->removed_tsc == 0 || now - slot->removed_tsc > rte_get_timer_hz()))
+		{
+			peer = slot;
+			break;
+		}
+	}
+	if (peer == NULL)
+	{
+		HOPA_LOG_WARN("peer table full, drop peer " IPV4_FMT, IPV4_ARGS(ip));
+		goto out;
+	}
+
+	memset(peer, 0, sizeof(*peer));
+	peer->ip = ip;
+	peer->mac = *mac;
+	peer->learned = learned;
+	peer->gen = peer_table.gen;
+	for (i = 0; i < PATH_NB; i++)
+		peer->all_paths_delay_list[i] = 0xFFFFFFFF;
+	peer->path_info.min_dt = UINT64_MAX;
+	peer->next_probe_tsc = now;
+	peer->next_live_tsc = now;
+	peer->live_mask = LIVE_ALL;
+	for (i = 0; i < PATH_NB; i++)
+		peer->live[i].up = 1;
+	peer_ecmp_solve(peer);
+	peer->active = 1;
+
+	if (rte_hash_add_key_data(peer_table.hash, &peer->ip, peer) < 0)
+	{
+		peer->active = 0;
+		peer = NULL;
+		goto out;
+	}
+
+	paths_publish(peer);
+	HOPA_LOG_INFO("add peer " IPV4_FMT "%s", IPV4_ARGS(ip), learned ? " (learned)" : "");
+
+out:
+	rte_spinlock_unlock(&peer_table.lock);
+	return peer;
+}
+
+static void peer_del(struct hopa_peer *peer)
+{
+	rte_spinlock_lock(&peer_table.lock);
+
+	rte_hash_del_key(peer_table.hash, &peer->ip);
+	peer->active = 0;
+	peer->removed_tsc = rte_get_timer_cycles();
+	paths_publish(peer);
+	/* rediscovered if it comes back */
+	if (discover_table != NULL)
+		discover_table[peer - peer_table.peers].ip = 0;
+
+	rte_spinlock_unlock(&peer_table.lock);
+
+	HOPA_LOG_INFO("del peer " IPV4_FMT, IPV4_ARGS(peer->ip));
+}
+
+/* (Re)load the peer file: add new peers, update MACs, drop peers no longer
+ * listed. Path state of kept peers is untouched. */
+static int peer_table_load(void)
+{
+	FILE *fp;
+	char line[256];
+	struct stat st;
+	uint32_t ip;
+	struct rte_ether_addr mac;
+	struct hopa_peer *peer;
+	int nb = 0;
+
+	fp = fopen(peer_table.file, "r");
+	if (fp == NULL)
+	{
+		HOPA_LOG_ERROR("open peer file %s failed", peer_table.file);
+		return -1;
+	}
+	if (fstat(fileno(fp), &st) == 0)
+		peer_table.mtime = st.st_mtime;
+
+	peer_table.gen++;
+	while (fgets(line, sizeof(line), fp) != NULL)
+	{
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
+		if (peer_parse_line(line, &ip, &mac) != 0)
+		{
+			HOPA_LOG_WARN("bad peer line: %s", line);
+			continue;
+		}
+
+		peer = peer_add(ip, &mac, 0);
+		if (peer != NULL)
+		{
+			peer->gen = peer_table.gen;
+			peer->learned = 0;
+			nb++;
+		}
+	}
+	fclose(fp);
+
+	for (int i = 0; i < MAX_PEERS; i++)
+	{
+		peer = &peer_table.peers[i];
+		if (peer->active && !peer->learned && peer->gen != peer_table.gen)
+			peer_del(peer);
+	}
+
+	HOPA_LOG_INFO("peer file %s : %d peers", peer_table.file, nb);
+
+	return nb;
+}
+
+/* Called by the main lcore, reloads the peer file when it changes. */
+static void peer_table_watch(void)
+{
+	struct stat st;
+
+	if (peer_table.file[0] == '\0')
+		return;
+
+	if (stat(peer_table.file, &st) == 0 && st.st_mtime != peer_table.mtime)
+		peer_table_load();
+}
+
+/* Source port per path for this peer, solved once per peer. */
+static void peer_ecmp_solve(struct hopa_peer *peer)
+{
+	uint16_t ports[HOPA_ECMP_MAX_MEMBERS];
+	int i;
+
+	if (ecmp.lin == NULL)
+		return;
+
+	for (i = 0; i < PATH_NB; i++)
+	{
+		uint16_t dst_port = DST_PORT_PATH_1 + i;
+
+		hopa_ecmp_solve(&ecmp, SRC_IP, peer->ip, IPPROTO_UDP, dst_port, ECMP_SPORT_LO, ECMP_SPORT_HI, ports);
+		peer->ecmp_sport[i] = ports[i % ecmp.n_members];
+		if (peer->ecmp_sport[i] == 0)
+			HOPA_LOG_WARN("peer " IPV4_FMT " path %d : no source port on member %u", IPV4_ARGS(peer->ip), i, i % ecmp.n_members);
+	}
+}
+
+/* opt_path_id from the delays of the live paths, through the margins, dwell
+ * and damping of -H. True when it moved, the sender is to be told. */
+static bool peer_select_path(struct hopa_peer *peer)
+{
+	struct hopa_select_decision d;
+	uint64_t delay[PATH_NB];
+	struct timespec ts;
+
+	for (int i = 0; i < PATH_NB; i++)
+		delay[i] = (peer->live_mask >> i) & 1 ? peer->all_paths_delay_list[i] : HOPA_SELECT_UNKNOWN;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	peer->opt_path_id = hopa_select_path(&select_conf, &peer->select, delay, PATH_NB,
+										 (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec, &d);
+	select_stats.decisions[d.reason]++;
+	if (d.reason == HOPA_SELECT_STAY)
+		return false;
+
+	if (d.reason == HOPA_SELECT_SWITCH || d.reason == HOPA_SELECT_FAILOVER)
+		HOPA_LOG_INFO("peer " IPV4_FMT " path %d -> %d (%s), penalty %u", IPV4_ARGS(peer->ip), d.from, d.to, hopa_select_reasons[d.reason], d.penalty);
+
+	/* ns,peer,from,to,best,reason,cur_delay,best_delay,penalty */
+	if (select_log != NULL)
+		fprintf(select_log, "%" PRIu64 "," IPV4_FMT ",%u,%u,%u,%s,%" PRIu64 ",%" PRIu64 ",%u\n", d.now_ns, IPV4_ARGS(peer->ip),
+				d.from, d.to, d.best, hopa_select_reasons[d.reason], d.cur_delay, d.best_delay, d.penalty);
+
+	return d.reason == HOPA_SELECT_SWITCH || d.reason == HOPA_SELECT_FAILOVER;
+}
+
+static uint16_t peer_src_port(const struct hopa_peer *peer, uint16_t dst_port)
+{
+	uint16_t path_id = dst_port - DST_PORT_PATH_1;
+
+	if (path_id < PATH_NB && peer->ecmp_sport[path_id] != 0)
+		return peer->ecmp_sport[path_id];
+
+	return SRC_PORT;
+}
+
+/* SRC_PORT, or a solved source port towards a path port, carrying a whole
+ * HOPA header in the 'len' bytes from the UDP header on */
+static bool hopa_is_cp_udp(const struct rte_udp_hdr *udp_hdr, uint32_t len)
+{
+	const struct hopa_cp_hdr *hopa_cp_hdr = (const struct hopa_cp_hdr *)(udp_hdr + 1);
+
+	if (len < sizeof(struct rte_udp_hdr) + 1 || (rte_be_to_cpu_16(udp_hdr->src_port) != SRC_PORT &&
+												 (uint16_t)(rte_be_to_cpu_16(udp_hdr->dst_port) - DST_PORT_PATH_1) >= PATH_NB))
+		return false;
+
+	if (hopa_cp_hdr->flag == HOPA_DP)
+		return len >= sizeof(struct rte_udp_hdr) + sizeof(struct hopa_dp_hdr);
+	return hopa_cp_hdr->flag == HOPA_CP && len >= sizeof(struct rte_udp_hdr) + sizeof(struct hopa_cp_hdr) && hopa_cp_hdr->cp_flag <= REPORT;
+}
+
+/* Peer that sent this packet. The receive side learns unknown senders. */
+static struct hopa_peer *peer_from_pkt(struct rte_mbuf *mbuf, bool learn)
+{
+	struct rte_ether_hdr *eth_hdr;
+	struct rte_ipv4_hdr *ipv4_hdr;
+	struct hopa_peer *peer;
+	uint32_t ip;
+
+	eth_hdr = rte_pktmbuf_mtod(mbuf, struct rte_ether_hdr *);
+	ipv4_hdr = (struct rte_ipv4_hdr *)(eth_hdr + 1);
+	ip = rte_be_to_cpu_32(ipv4_hdr->src_addr);
+
+	peer = peer_lookup(ip);
+	if (peer == NULL && learn)
+		peer = peer_add(ip, &eth_hdr->s_addr, 1);
+
+	return peer;
+}
+
+static void
+fill_eth_header(struct rte_ether_hdr *eth_hdr, const struct hopa_peer *peer)
+{
+	eth_hdr->s_addr = (struct rte_ether_addr){SRC_MAC};
+	eth_hdr->d_addr = peer->mac;
+	eth_hdr->ether_type = rte_cpu_to_be_16(RTE_ETHER_TYPE_IPV4);
+}
+
+static void
+fill_ipv4_header(struct rte_ipv4_hdr *ipv4_hdr, const struct hopa_peer *peer)
+{
+	ipv4_hdr->version_ihl = (4 << 4) + 5;																							  // ipv4 version , length 5 (*4 bytes)
+	ipv4_hdr->type_of_service = 0;																									  // No Diffserv
+	ipv4_hdr->total_length = rte_cpu_to_be_16(sizeof(struct rte_ipv4_hdr) + sizeof(struct rte_udp_hdr) + sizeof(struct hopa_cp_hdr)); // IP 52 bytes
+	ipv4_hdr->packet_id = rte_cpu_to_be_16(5462);																					  // set random
+	ipv4_hdr->fragment_offset = rte_cpu_to_be_16(0);
+	ipv4_hdr->time_to_live = 64;
+	ipv4_hdr->next_proto_id = IPPROTO_UDP;
+	ipv4_hdr->src_addr = rte_cpu_to_be_32(SRC_IP);
+	ipv4_hdr->dst_addr = rte_cpu_to_be_32(peer->ip);
+	ipv4_hdr->hdr_checksum = rte_ipv4_cksum(ipv4_hdr);
+}
+
+static void
+fill_udp_header(struct rte_ipv4_hdr *ipv4_hdr, struct rte_udp_hdr *udp_hdr, uint16_t src_port, uint16_t dst_port)
+{
+	udp_hdr->src_port = rte_cpu_to_be_16(src_port);
+	udp_hdr->dst_port = rte_cpu_to_be_16(dst_port);
+	udp_hdr->dgram_len = rte_cpu_to_be_16(sizeof(struct rte_udp_hdr) + sizeof(struct hopa_cp_hdr));
+	udp_hdr->dgram_cksum = rte_ipv4_udptcp_cksum(ipv4_hdr, udp_hdr);
+}
+
+static struct rte_mbuf *encode_udp_pkt(const struct hopa_peer *peer, uint16_t dst_port)
+{
+	struct rte_mbuf *mbuf;
+	struct rte_ether_hdr *eth_hdr;
+	struct rte_ipv4_hdr *ipv4_hdr;
+	struct rte_udp_hdr *udp_hdr;
+
+	if (!cp_mbuf_pool)
+	{
+		printf("cp_mbuf_pool null\n");
+		return NULL;
+	}
+	mbuf = rte_pktmbuf_alloc(cp_mbuf_pool);
+	if (!mbuf)
+		rte_exit(EXIT_FAILURE, "Error with rte_pktmbuf_alloc()\n");
+
+	eth_hdr = (struct rte_ether_hdr *)rte_pktmbuf_append(mbuf, sizeof(struct rte_ether_hdr));
+	fill_eth_header(eth_hdr, peer);
+
+	ipv4_hdr = (struct rte_ipv4_hdr *)rte_pktmbuf_append(mbuf, sizeof(struct rte_ipv4_hdr));
+	fill_ipv4_header(ipv4_hdr, peer);
+
+	udp_hdr = (struct rte_udp_hdr *)rte_pktmbuf_append(mbuf, sizeof(struct rte_udp_hdr));
+	fill_udp_header(ipv4_hdr, udp_hdr, peer_src_port(peer, dst_port), dst_port);
+
+	return mbuf;
+}
+
+static struct rte_mbuf *encode_probe_pkt(struct hopa_peer *peer, uint8_t path_id)
+{
+	struct rte_mbuf *mbuf;
+	struct hopa_cp_hdr *hopa_cp_hdr;
+	uint64_t sender_ts;
+
+	mbuf = encode_udp_pkt(peer, DST_PORT_PATH_1 - 1 + path_id);
+
+	hopa_cp_hdr = (struct hopa_cp_hdr *)rte_pktmbuf_append(mbuf, sizeof(struct hopa_cp_hdr));
+
+	hopa_cp_hdr->flag = HOPA_CP;
+	hopa_cp_hdr->cp_flag = PROBE;
+	hopa_cp_hdr->rsvd = 0;
+	hopa_cp_hdr->repath_id = 0;
+	hopa_cp_hdr->seq = rte_cpu_to_be_64(++peer->probe_tx_seq[path_id - 1]); /* per path, from 1 */
+	hopa_cp_hdr->ack = 0;
+
+	struct timespec ts;
+	if (clock_gettime(0, &ts) == 0)
+		sender_ts = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+	else
+		rte_exit(EXIT_FAILURE, "Error with clock_gettime\n");
+	hopa_cp_hdr->ts = rte_cpu_to_be_64(sender_ts);
+
+	return mbuf;
+}
+
+static struct rte_mbuf *encode_repath_pkt(const struct hopa_peer *peer, uint8_t repath_id)
+{
+	struct rte_mbuf *mbuf;
+	struct hopa_cp_hdr *hopa_cp_hdr;
+
+	mbuf = encode_udp_pkt(peer, DST_PORT_PATH_1 - 1 + peer->opt_path_id); // 暂定从最优路径发送
+
+	hopa_cp_hdr = (struct hopa_cp_hdr *)rte_pktmbuf_append(mbuf, sizeof(struct hopa_cp_hdr));
+	hopa_cp_hdr->flag = HOPA_CP;
+	hopa_cp_hdr->cp_flag = REPATH;
+	hopa_cp_hdr->rsvd = peer->live_mask;
+	hopa_cp_hdr->repath_id = repath_id;
+	hopa_cp_hdr->seq = 0; // TODO
+	hopa_cp_hdr->ack = 0;
+
+	return mbuf;
+}
+
+static struct rte_mbuf *encode_repath_ack_pkt(const struct hopa_peer *peer)
+{
+	struct rte_mbuf *mbuf;
+	struct hopa_cp_hdr *hopa_cp_hdr;
+
+	mbuf = encode_udp_pkt(peer, DST_PORT_PATH_1 - 1 + peer->opt_path_id); // 暂定从最优路径发送
+
+	hopa_cp_hdr = (struct hopa_cp_hdr *)rte_pktmbuf_append(mbuf, sizeof(struct hopa_cp_hdr));
+	hopa_cp_hdr->flag = HOPA_CP;
+	hopa_cp_hdr->cp_flag = REPATH_ACK;
+	hopa_cp_hdr->rsvd = 0;
+	hopa_cp_hdr->repath_id = 0;
+	hopa_cp_hdr->seq = 0;
+	hopa_cp_hdr->ack = 0; // TODO
+
+	return mbuf;
+}
+
+/* The receiver's delay, loss and bandwidth of every path, for the sender's
+ * path table. */
+static struct rte_mbuf *encode_report_pkt(const struct hopa_peer *peer)
+{
+	struct rte_mbuf *mbuf;
+	struct rte_ipv4_hdr *ipv4_hdr;
+	struct rte_udp_hdr *udp_hdr;
+	struct hopa_cp_hdr *hopa_cp_hdr;
+	struct hopa_report_path *report;
+	struct hopa_paths_quality q;
+
+	mbuf = encode_udp_pkt(peer, DST_PORT_PATH_1 + peer->opt_path_id);
+
+	hopa_cp_hdr = (struct hopa_cp_hdr *)rte_pktmbuf_append(mbuf, sizeof(struct hopa_cp_hdr));
+	report = (struct hopa_report_path *)rte_pktmbuf_append(mbuf, sizeof(struct hopa_report_path) * PATH_NB);
+	if (hopa_cp_hdr == NULL || report == NULL)
+	{
+		rte_pktmbuf_free(mbuf);
+		return NULL;
+	}
+	hopa_cp_hdr->flag = HOPA_CP;
+	hopa_cp_hdr->cp_flag = REPORT;
+	hopa_cp_hdr->rsvd = peer->live_mask;
+	hopa_cp_hdr->repath_id = peer->opt_path_id;
+	hopa_cp_hdr->seq = 0;
+	hopa_cp_hdr->ack = 0;
+	hopa_cp_hdr->ts = 0;
+	for (int i = 0; i < PATH_NB; i++)
+	{
+		peer_quality(peer, i, &q);
+		report[i].delay_ns = rte_cpu_to_be_64((uint64_t)peer_delay_ns(peer, i));
+		report[i].loss_ppm = rte_cpu_to_be_32(q.loss_ppm);
+		report[i].reorder_ppm = rte_cpu_to_be_32(q.reorder_ppm);
+		report[i].avail_mbps = rte_cpu_to_be_32(q.avail_mbps);
+		report[i].capacity_mbps = rte_cpu_to_be_32(q.capacity_mbps);
+		report[i].queue = rte_cpu_to_be_32(q.queue);
+		report[i].hop_latency_ns = rte_cpu_to_be_32(q.hop_latency_ns);
+		report[i].loss_run_max = rte_cpu_to_be_16(q.loss_run_max);
+		report[i].reorder_max = rte_cpu_to_be_16(q.reorder_max);
+	}
+
+	/* lengths and checksums over the report */
+	ipv4_hdr = rte_pktmbuf_mtod_offset(mbuf, struct rte_ipv4_hdr *, sizeof(struct rte_ether_hdr));
+	udp_hdr = (struct rte_udp_hdr *)(ipv4_hdr + 1);
+	ipv4_hdr->total_length = rte_cpu_to_be_16(rte_pktmbuf_pkt_len(mbuf) - sizeof(struct rte_ether_hdr));
+	ipv4_hdr->hdr_checksum = 0;
+	ipv4_hdr->hdr_checksum = rte_ipv4_cksum(ipv4_hdr);
+	udp_hdr->dgram_len = rte_cpu_to_be_16(rte_pktmbuf_pkt_len(mbuf) - sizeof(struct rte_ether_hdr) - sizeof(struct rte_ipv4_hdr));
+	udp_hdr->dgram_cksum = 0;
+	udp_hdr->dgram_cksum = rte_ipv4_udptcp_cksum(ipv4_hdr, udp_hdr);
+
+	return mbuf;
+}
+
+/* Hello on one path, seq per path. */
+static struct rte_mbuf *encode_live_pkt(struct hopa_peer *peer, uint8_t path_id)
+{
+	struct rte_mbuf *mbuf;
+	struct hopa_cp_hdr *hopa_cp_hdr;
+
+	mbuf = encode_udp_pkt(peer, DST_PORT_PATH_1 + path_id);
+	if (mbuf == NULL)
+		return NULL;
+
+	hopa_cp_hdr = (struct hopa_cp_hdr *)rte_pktmbuf_append(mbuf, sizeof(struct hopa_cp_hdr));
+	hopa_cp_hdr->flag = HOPA_CP;
+	hopa_cp_hdr->cp_flag = LIVENESS;
+	hopa_cp_hdr->rsvd = 0;
+	hopa_cp_hdr->repath_id = 0;
+	hopa_cp_hdr->seq = rte_cpu_to_be_64(++peer->live[path_id].tx_seq);
+	hopa_cp_hdr->ack = 0;
+	hopa_cp_hdr->ts = 0;
+
+	return mbuf;
+}
+
+/* Packet idx of train id on one path, padded to train_frame bytes: from the
+ * rx pool, the CP pool data room is too small. */
+static struct rte_mbuf *encode_train_pkt(const struct hopa_peer *peer, uint8_t path_id, uint64_t id, uint8_t idx)
+{
+	struct rte_mbuf *mbuf;
+	struct rte_ether_hdr *eth_hdr;
+	struct rte_ipv4_hdr *ipv4_hdr;
+	struct rte_udp_hdr *udp_hdr;
+	struct hopa_cp_hdr *hopa_cp_hdr;
+	uint16_t dst_port = DST_PORT_PATH_1 + path_id;
+	uint16_t pad_len;
+	char *pad;
+
+	mbuf = rte_pktmbuf_alloc(mbuf_pool);
+	if (mbuf == NULL)
+		return NULL;
+
+	eth_hdr = (struct rte_ether_hdr *)rte_pktmbuf_append(mbuf, sizeof(struct rte_ether_hdr));
+	fill_eth_header(eth_hdr, peer);
+	ipv4_hdr = (struct rte_ipv4_hdr *)rte_pktmbuf_append(mbuf, sizeof(struct rte_ipv4_hdr));
+	fill_ipv4_header(ipv4_hdr, peer);
+	udp_hdr = (struct rte_udp_hdr *)rte_pktmbuf_append(mbuf, sizeof(struct rte_udp_hdr));
+
+	hopa_cp_hdr = (struct hopa_cp_hdr *)rte_pktmbuf_append(mbuf, sizeof(struct hopa_cp_hdr));
+	hopa_cp_hdr->flag = HOPA_CP;
+	hopa_cp_hdr->cp_flag = TRAIN;
+	hopa_cp_hdr->rsvd = train_len;
+	hopa_cp_hdr->repath_id = idx;
+	hopa_cp_hdr->seq = rte_cpu_to_be_64(id);
+	hopa_cp_hdr->ack = rte_cpu_to_be_64(train_link_mbps);
+	hopa_cp_hdr->ts = 0;
+
+	pad_len = train_frame > rte_pktmbuf_pkt_len(mbuf) ? train_frame - rte_pktmbuf_pkt_len(mbuf) : 0;
+	pad = rte_pktmbuf_append(mbuf, pad_len);
+	if (pad == NULL)
+	{
+		rte_pktmbuf_free(mbuf);
+		return NULL;
+	}
+	memset(pad, 0, pad_len);
+
+	/* lengths and checksums over the padding */
+	ipv4_hdr->total_length = rte_cpu_to_be_16(rte_pktmbuf_pkt_len(mbuf) - sizeof(struct rte_ether_hdr));
+	ipv4_hdr->hdr_checksum = 0;
+	ipv4_hdr->hdr_checksum = rte_ipv4_cksum(ipv4_hdr);
+	udp_hdr->src_port = rte_cpu_to_be_16(peer_src_port(peer, dst_port));
+	udp_hdr->dst_port = rte_cpu_to_be_16(dst_port);
+	udp_hdr->dgram_len = rte_cpu_to_be_16(rte_pktmbuf_pkt_len(mbuf) - sizeof(struct rte_ether_hdr) - sizeof(struct rte_ipv4_hdr));
+	udp_hdr->dgram_cksum = 0;
+	udp_hdr->dgram_cksum = rte_ipv4_udptcp_cksum(ipv4_hdr, udp_hdr);
+
+	return mbuf;
+}
+
+static void timer_cb(__rte_unused struct rte_timer *timer, __rte_unused void *arg)
+{
+	printf("timer out\n");
+	rte_timer_reset(&retran_timer, rte_get_timer_hz() * 0.1, SINGLE, rte_lcore_id(), timer_cb, arg);
+}
+
+static void hopa_cp_probe_pkt_progress(struct rte_mbuf *hopa_cp_mbuf)
+{
+	struct rte_ipv4_hdr *ipv4_hdr;
+	struct rte_udp_hdr *udp_hdr;
+	struct hopa_cp_hdr *hopa_cp_hdr;
+	struct hopa_peer *peer;
+	struct hopa_seq *seq;
+	struct rte_mbuf *repath, *report;
+	uint64_t sender_ts;
+	uint64_t receiver_ts;
+	uint64_t now;
+
+	peer = peer_from_pkt(hopa_cp_mbuf, true);
+	if (peer == NULL)
+		return;
+
+	ipv4_hdr = rte_pktmbuf_mtod_offset(hopa_cp_mbuf, struct rte_ipv4_hdr *, sizeof(struct rte_ether_hdr));
+	udp_hdr = (struct rte_udp_hdr *)(ipv4_hdr + 1);
+	hopa_cp_hdr = (struct hopa_cp_hdr *)(udp_hdr + 1);
+
+	uint8_t path_id = rte_be_to_cpu_16(udp_hdr->dst_port) - DST_PORT_PATH_1;
+	if (path_id >= PATH_NB)
+		return;
+
+	sender_ts = rte_be_to_cpu_64(hopa_cp_hdr->ts);
+
+	struct timespec ts;
+	if (clock_gettime(0, &ts) == 0)
+	{
+		receiver_ts = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+	}
+	else
+		rte_exit(EXIT_FAILURE, "Error with clock_gettime\n");
+
+	peer->all_paths_delay_list[path_id] = receiver_ts - sender_ts + 1000000000;
+
+	// double delay = ((double)all_paths_delay_list[path_id] / 1000.0) / 1000.0;
+
+	HOPA_LOG_TRACE("peer " IPV4_FMT " path id : %d , delay (us) : %" PRIu64 "", IPV4_ARGS(peer->ip), path_id, peer->all_paths_delay_list[path_id]);
+
+	seq = &peer->probe_seq[path_id];
+	if (hopa_seq_update(seq, rte_be_to_cpu_64(hopa_cp_hdr->seq)) == HOPA_SEQ_RESTART && seq->base != 1)
+		HOPA_LOG_INFO("peer " IPV4_FMT " path %d probe seq restarted at %" PRIu64, IPV4_ARGS(peer->ip), path_id, seq->base);
+	HOPA_LOG_TRACE("peer " IPV4_FMT " path %d seq %" PRIu64 " : lost %" PRIu64 " (run max %u), reordered %" PRIu64 " (max %u), dups %" PRIu64,
+				   IPV4_ARGS(peer->ip), path_id, seq->top, seq->lost, seq->loss_run_max, seq->reordered, seq->reorder_max, seq->dups);
+	peer_int_update(peer, path_id, hopa_cp_mbuf);
+
+	/* a switch goes to the sender at once, ahead of the probes */
+	if (peer_select_path(peer))
+	{
+		repath = encode_repath_pkt(peer, peer->opt_path_id);
+		if (repath != NULL)
+			hopa_ring_enqueue(hopa_in_out_ring_ins->hopa_out_prio_ring, &hopa_in_out_ring_ins->out_ev, &repath, 1, &tx_stats.out_ring_drops);
+	}
+	paths_publish(peer);
+
+	/* the sender's path table has no delays of its own */
+	now = rte_get_timer_cycles();
+	if (now - peer->report_tsc >= rte_get_timer_hz() / 1000 * REPORT_PERIOD_MS)
+	{
+		report = encode_report_pkt(peer);
+		if (report != NULL)
+			hopa_ring_enqueue(hopa_in_out_ring_ins->hopa_out_ring, &hopa_in_out_ring_ins->out_ev, &report, 1, &tx_stats.out_ring_drops);
+		peer->report_tsc = now;
+	}
+
+	HOPA_LOG_TRACE("peer " IPV4_FMT " opt_path_id = %d", IPV4_ARGS(peer->ip), peer->opt_path_id);
+}
+
+/* Hello : loss window, and a path down on loss or back up after live_mult in a row. */
+static void hopa_live_pkt_progress(struct rte_mbuf *hopa_cp_mbuf)
+{
+	struct rte_ipv4_hdr *ipv4_hdr;
+	struct rte_udp_hdr *udp_hdr;
+	struct hopa_cp_hdr *hopa_cp_hdr;
+	struct hopa_peer *peer;
+	struct hopa_live *live;
+	uint64_t now = rte_get_timer_cycles();
+	uint32_t lost;
+	uint16_t path_id;
+
+	peer = peer_from_pkt(hopa_cp_mbuf, true);
+	if (peer == NULL)
+		return;
+
+	ipv4_hdr = rte_pktmbuf_mtod_offset(hopa_cp_mbuf, struct rte_ipv4_hdr *, sizeof(struct rte_ether_hdr));
+	udp_hdr = (struct rte_udp_hdr *)(ipv4_hdr + 1);
+	hopa_cp_hdr = (struct hopa_cp_hdr *)(udp_hdr + 1);
+	path_id = rte_be_to_cpu_16(udp_hdr->dst_port) - DST_PORT_PATH_1;
+	if (path_id >= PATH_NB)
+		return;
+
+	live = &peer->live[path_id];
+	if (hopa_seq_update(&live->seq, rte_be_to_cpu_64(hopa_cp_hdr->seq)) == HOPA_SEQ_NONE)
+		return;
+	lost = hopa_seq_window_lost(&live->seq);
+
+	if (!live->up && live->seq.in_row >= live_mult && lost <= LIVE_LOSS_MAX)
+		peer_live_set(peer, path_id, true, now, "hellos");
+	else if (live->up && lost > LIVE_LOSS_MAX)
+		peer_live_set(peer, path_id, false, now, "loss");
+	live->last_rx_tsc = now;
+}
+
+/* Train packet : its rx stamp into the bandwidth estimate of its path. */
+static void hopa_train_pkt_progress(struct rte_mbuf *hopa_cp_mbuf)
+{
+	struct rte_ipv4_hdr *ipv4_hdr;
+	struct rte_udp_hdr *udp_hdr;
+	struct hopa_cp_hdr *hopa_cp_hdr;
+	struct hopa_peer *peer;
+	struct hopa_train_est *est;
+	uint64_t shorts, collapsed;
+	uint16_t path_id;
+
+	/* no -T here, no rx stamps; or the NIC stamps and missed this one */
+	if (train_ts_off < 0 || (train_ts_flag && !(hopa_cp_mbuf->ol_flags & train_ts_flag)))
+		return;
+
+	peer = peer_from_pkt(hopa_cp_mbuf, true);
+	if (peer == NULL)
+		return;
+
+	ipv4_hdr = rte_pktmbuf_mtod_offset(hopa_cp_mbuf, struct rte_ipv4_hdr *, sizeof(struct rte_ether_hdr));
+	udp_hdr = (struct rte_udp_hdr *)(ipv4_hdr + 1);
+	hopa_cp_hdr = (struct hopa_cp_hdr *)(udp_hdr + 1);
+	path_id = rte_be_to_cpu_16(udp_hdr->dst_port) - DST_PORT_PATH_1;
+	if (path_id >= PATH_NB)
+		return;
+
+	est = &peer->train[path_id];
+	shorts = est->short_trains;
+	collapsed = est->collapsed_trains;
+	if (hopa_train_update(est, rte_be_to_cpu_64(hopa_cp_hdr->seq), hopa_cp_hdr->repath_id, hopa_cp_hdr->rsvd,
+						  rte_pktmbuf_pkt_len(hopa_cp_mbuf) + HOPA_TRAIN_WIRE_OVERHEAD, rte_be_to_cpu_64(hopa_cp_hdr->ack),
+						  *RTE_MBUF_DYNFIELD(hopa_cp_mbuf, train_ts_off, rte_mbuf_timestamp_t *), train_ts_hz))
+	{
+		train_stats.rx_trains++;
+		HOPA_LOG_TRACE("peer " IPV4_FMT " path %d : capacity %u Mbps, dispersion %u Mbps, available %u Mbps over %" PRIu64 " trains",
+					   IPV4_ARGS(peer->ip), path_id, est->capacity_mbps, est->adr_mbps, est->avail_mbps, est->trains);
+		paths_publish(peer);
+	}
+	train_stats.short_trains += est->short_trains - shorts;
+	train_stats.collapsed_trains += est->collapsed_trains - collapsed;
+}
+
+/* Sender : the receiver's delays and quality into the path table, for the
+ * datapath's second path and the policies that weigh delay, loss or
+ * bandwidth. */
+static void hopa_report_pkt_progress(struct rte_mbuf *hopa_cp_mbuf)
+{
+	const uint32_t hdr_len = sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv4_hdr) + sizeof(struct rte_udp_hdr) + sizeof(struct hopa_cp_hdr);
+	const struct hopa_report_path *report;
+	struct hopa_paths_quality *q;
+	struct hopa_peer *peer;
+	int64_t delay_ns;
+
+	if (rte_pktmbuf_data_len(hopa_cp_mbuf) < hdr_len + sizeof(struct hopa_report_path) * PATH_NB)
+		return;
+	peer = peer_from_pkt(hopa_cp_mbuf, false);
+	if (peer == NULL)
+		return;
+
+	report = rte_pktmbuf_mtod_offset(hopa_cp_mbuf, const struct hopa_report_path *, hdr_len);
+	for (int i = 0; i < PATH_NB; i++)
+	{
+		delay_ns = (int64_t)rte_be_to_cpu_64(report[i].delay_ns);
+		peer->all_paths_delay_list[i] = delay_ns == HOPA_PATHS_DELAY_NONE ? 0xFFFFFFFF : (uint64_t)(delay_ns + 1000000000);
+
+		q = &peer->report[i];
+		q->loss_ppm = rte_be_to_cpu_32(report[i].loss_ppm);
+		q->reorder_ppm = rte_be_to_cpu_32(report[i].reorder_ppm);
+		q->avail_mbps = rte_be_to_cpu_32(report[i].avail_mbps);
+		q->capacity_mbps = rte_be_to_cpu_32(report[i].capacity_mbps);
+		q->queue = rte_be_to_cpu_32(report[i].queue);
+		q->hop_latency_ns = rte_be_to_cpu_32(report[i].hop_latency_ns);
+		q->loss_run_max = rte_be_to_cpu_16(report[i].loss_run_max);
+		q->reorder_max = rte_be_to_cpu_16(report[i].reorder_max);
+	}
+	peer->reported = 1;
+	paths_publish(peer);
+}
+
+/* Returns the repath_ack to send, or NULL. */
+static struct rte_mbuf *hopa_cp_repath_pkt_progress(struct rte_mbuf *hopa_cp_mbuf)
+{
+	// 1、触发换路(通知数据面 DP)  TODO
+
+	// 2、回复repath_ack
+	struct hopa_peer *peer = peer_from_pkt(hopa_cp_mbuf, false);
+	if (peer == NULL)
+		return NULL;
+
+	/* the path the receiver picked for us, for the path table */
+	struct hopa_cp_hdr *hopa_cp_hdr = rte_pktmbuf_mtod_offset(hopa_cp_mbuf, struct hopa_cp_hdr *,
+															 sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv4_hdr) + sizeof(struct rte_udp_hdr));
+	if (hopa_cp_hdr->repath_id < PATH_NB)
+	{
+		peer->opt_path_id = hopa_cp_hdr->repath_id;
+		if (hopa_cp_hdr->rsvd != 0)
+			peer->live_mask = hopa_cp_hdr->rsvd & LIVE_ALL;
+		paths_publish(peer);
+	}
+
+	struct rte_mbuf *repath_ack_mbuf;
+	repath_ack_mbuf = encode_repath_ack_pkt(peer);
+
+	// 3、启动定时器  TODO   收端初始化定时器
+	rte_timer_reset(&retran_timer, rte_get_timer_hz() * 2, SINGLE, rte_lcore_id(), timer_cb, NULL);
+
+	return repath_ack_mbuf;
+}
+
+static void hopa_cp_repath_ack_pkt_progress(struct rte_mbuf *hopa_cp_mbuf)
+{
+	// TODO   收到ack, 确认上一个repath已经收到, 停止定时器
+	rte_timer_stop(&retran_timer);
+}
+
+/* Returns the repath to send, or NULL. */
+static struct rte_mbuf *hopa_dp_ts_pkt_progress(struct rte_mbuf *hopa_cp_mbuf)
+{
+	struct hopa_peer *peer = peer_from_pkt(hopa_cp_mbuf, false);
+	if (peer == NULL)
+		return NULL;
+
+	/* INT rides data packets too : published with the next probe */
+	struct rte_udp_hdr *udp_hdr = rte_pktmbuf_mtod_offset(hopa_cp_mbuf, struct rte_udp_hdr *, sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv4_hdr));
+	uint16_t path_id = rte_be_to_cpu_16(udp_hdr->dst_port) - DST_PORT_PATH_1;
+	if (path_id < PATH_NB)
+		peer_int_update(peer, path_id, hopa_cp_mbuf);
+
+	uint8_t is_repath = one_path_check(&peer->path_info);
+	if (is_repath)
+		return encode_repath_pkt(peer, peer->opt_path_id);
+
+	return NULL;
+}
+
+static bool one_path_check(struct cur_path_info *cur_path_info)
+{
+	// TODO   随路检测算法 --->  换路时机
+	cur_path_info->delta_t = cur_path_info->cur_ts - cur_path_info->last_ts;
+	if (cur_path_info->delta_t == 0)
+		return false;
+
+	/* 计算 max_dt    min_dt */
+	if (cur_path_info->cur_dt > cur_path_info->max_dt)
+		cur_path_info->max_dt = cur_path_info->cur_dt;
+	if (cur_path_info->cur_dt < cur_path_info->min_dt)
+		cur_path_info->min_dt = cur_path_info->cur_dt;
+
+	/* 计算 绝对取值 */
+	cur_path_info->thres_dt = cur_path_info->min_dt + R * (cur_path_info->max_dt - cur_path_info->min_dt);
+
+	/* 计算 相对取值 */
+	cur_path_info->cur_dt_grad = (cur_path_info->cur_dt - cur_path_info->last_1_dt) / cur_path_info->delta_t;
+
+	bool b2 = 2 * cur_path_info->last_3_dt >= (cur_path_info->thres_dt - cur_path_info->min_dt);
+	bool b3 = cur_path_info->last_1_dt_grad > 0 && cur_path_info->last_2_dt_grad > 0 && cur_path_info->last_3_dt_grad > 0;
+	bool b4 = cur_path_info->cur_dt_grad >= (cur_path_info->thres_dt - cur_path_info->min_dt) / (2 * cur_path_info->delta_t);
+	bool is_try_repath = (b2 && b3) || b4;
+
+	bool is_force_repath = cur_path_info->cur_dt >= cur_path_info->thres_dt;
+
+	return is_try_repath || is_force_repath;
+}
+
+/* Path up / down: out of the selection, into the path table, and to the
+ * sender in a repath so its datapath stops using it too. */
+static void peer_live_set(struct hopa_peer *peer, uint8_t path_id, bool up, uint64_t now, const char *why)
+{
+	const uint64_t tsc_us = rte_get_timer_hz() / US_PER_S;
+	uint64_t detect_us = (now - peer->live[path_id].last_rx_tsc) / tsc_us;
+	uint64_t publish_us;
+	uint8_t from = peer->opt_path_id;
+	struct rte_mbuf *repath;
+
+	peer->live[path_id].up = up;
+	if (up)
+		peer->live_mask |= 1 << path_id;
+	else
+		peer->live_mask &= ~(1 << path_id);
+
+	peer_select_path(peer);
+	paths_publish(peer);
+	repath = encode_repath_pkt(peer, peer->opt_path_id);
+	if (repath != NULL)
+		hopa_ring_enqueue(hopa_in_out_ring_ins->hopa_out_prio_ring, &hopa_in_out_ring_ins->out_ev, &repath, 1, &tx_stats.out_ring_drops);
+	publish_us = (rte_get_timer_cycles() - now) / tsc_us;
+
+	if (up)
+	{
+		live_stats.ups++;
+		HOPA_LOG_INFO("peer " IPV4_FMT " path %d up (%s)", IPV4_ARGS(peer->ip), path_id, why);
+		return;
+	}
+
+	live_stats.downs++;
+	live_stats.failovers += from != peer->opt_path_id;
+	live_stats.detect_us_sum += detect_us;
+	live_stats.detect_us_max = RTE_MAX(live_stats.detect_us_max, detect_us);
+	live_stats.publish_us_max = RTE_MAX(live_stats.publish_us_max, publish_us);
+	HOPA_LOG_WARN("peer " IPV4_FMT " path %d down (%s), %" PRIu64 " us after the last hello, path %d -> %d out in %" PRIu64 " us",
+				  IPV4_ARGS(peer->ip), path_id, why, detect_us, from, peer->opt_path_id, publish_us);
+}
+
+/* Paths whose hellos stopped for live_mult intervals go down. A path never
+ * heard of stays up: the sender may not run -F. */
+static void hopa_live_check(uint64_t now)
+{
+	static uint64_t last_tsc;
+	const uint64_t detect_tsc = live_interval_tsc * live_mult;
+	struct hopa_peer *peer;
+	int slot, i;
+
+	if (live_interval_tsc == 0 || now - last_tsc < live_interval_tsc / 2)
+		return;
+	last_tsc = now;
+
+	for (slot = 0; slot < MAX_PEERS; slot++)
+	{
+		peer = &peer_table.peers[slot];
+		if (!peer->active)
+			continue;
+		for (i = 0; i < PATH_NB; i++)
+			if (peer->live[i].up && peer->live[i].last_rx_tsc != 0 && now - peer->live[i].last_rx_tsc > detect_tsc)
+				peer_live_set(peer, i, false, now, "timeout");
+	}
+}
+
+/* Next train due, one peer and one path, into mbufs; the number of packets.
+ * The line rate rides in every packet: the receiver needs the input rate. */
+static unsigned int train_run(uint64_t now, struct rte_mbuf **mbufs)
+{
+	static int slot;
+	static uint64_t link_tsc;
+	const uint64_t hz = rte_get_timer_hz();
+	struct rte_eth_link link;
+	struct hopa_peer *peer;
+	unsigned int n;
+	uint8_t path_id;
+	int scanned;
+
+	if (now - link_tsc > hz)
+	{
+		/* UINT32_MAX is ETH_SPEED_NUM_UNKNOWN */
+		if (rte_eth_link_get_nowait(PORT_P0, &link) == 0 && link.link_status == ETH_LINK_UP && link.link_speed != UINT32_MAX)
+			train_link_mbps = link.link_speed;
+		else
+			train_link_mbps = 0;
+		link_tsc = now;
+	}
+
+	for (scanned = 0; scanned < MAX_PEERS; scanned++, slot = (slot + 1) % MAX_PEERS)
+	{
+		peer = &peer_table.peers[slot];
+		if (!peer->active || peer->learned || now < peer->next_train_tsc)
+			continue;
+
+		path_id = peer->train_path;
+		for (n = 0; n < train_len; n++)
+			if ((mbufs[n] = encode_train_pkt(peer, path_id, peer->train_tx_seq[path_id] + 1, n)) == NULL)
+				break;
+		if (n < train_len)
+		{
+			/* a partial train measures nothing, try again next tick */
+			rte_pktmbuf_free_bulk(mbufs, n);
+			train_stats.tx_drops++;
+			return 0;
+		}
+
+		peer->train_tx_seq[path_id]++;
+		peer->train_path = (path_id + 1) % PATH_NB;
+		peer->next_train_tsc = now + hz / 1000 * TRAIN_PERIOD_MS / PATH_NB;
+		slot = (slot + 1) % MAX_PEERS;
+		train_stats.tx_trains++;
+		return n;
+	}
+
+	return 0;
+}
+
+/* Rx time into every mbuf of a burst when the NIC does not stamp them: the
+ * handlers run later, on lcore_stats or in another node, and the dispersion
+ * of a train is in the arrival times. One TSC read for the whole burst, so
+ * the packets of a train in one burst share a stamp and the train is not
+ * estimated (hopa_train.h). */
+static void hopa_rx_stamp(struct rte_mbuf **mbufs, uint16_t n)
+{
+	uint64_t now;
+	uint16_t i;
+
+	if (train_ts_off < 0 || train_ts_flag || n == 0)
+		return;
+
+	now = rte_get_timer_cycles();
+	for (i = 0; i < n; i++)
+		*RTE_MBUF_DYNFIELD(mbufs[i], train_ts_off, rte_mbuf_timestamp_t *) = now;
+}
+
+/* -I : INT of the marked packets of a burst into their sample field, and the
+ * INT headers out of them, so the handlers see what the source sent. The
+ * original DSCP goes back into the IPv4 header. */
+static void hopa_int_strip(struct rte_mbuf **mbufs, uint16_t n)
+{
+	const uint16_t hdr_len = sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv4_hdr) + sizeof(struct rte_udp_hdr);
+	struct hopa_int_sample *s;
+	struct rte_ether_hdr *eth_hdr;
+	struct rte_ipv4_hdr *ipv4_hdr;
+	struct rte_udp_hdr *udp_hdr;
+	uint16_t i;
+
+	if (int_off < 0)
+		return;
+
+	for (i = 0; i < n; i++)
+	{
+		s = RTE_MBUF_DYNFIELD(mbufs[i], int_off, struct hopa_int_sample *);
+		s->hops = 0;
+
+		eth_hdr = rte_pktmbuf_mtod(mbufs[i], struct rte_ether_hdr *);
+		ipv4_hdr = (struct rte_ipv4_hdr *)(eth_hdr + 1);
+		if (rte_pktmbuf_data_len(mbufs[i]) < hdr_len || eth_hdr->ether_type != rte_cpu_to_be_16(RTE_ETHER_TYPE_IPV4) ||
+			ipv4_hdr->next_proto_id != IPPROTO_UDP || (ipv4_hdr->type_of_service >> 2) != int_dscp)
+			continue;
+
+		if (hopa_int_parse(rte_pktmbuf_mtod_offset(mbufs[i], const uint8_t *, hdr_len), rte_pktmbuf_data_len(mbufs[i]) - hdr_len, s) != 0)
+		{
+			int_stats.bad++;
+			continue;
+		}
+		int_stats.rx_pkts++;
+
+		udp_hdr = (struct rte_udp_hdr *)(ipv4_hdr + 1);
+		udp_hdr->dgram_len = rte_cpu_to_be_16(rte_be_to_cpu_16(udp_hdr->dgram_len) - s->len);
+		udp_hdr->dgram_cksum = 0;
+		ipv4_hdr->type_of_service = s->dscp << 2 | (ipv4_hdr->type_of_service & 3);
+		ipv4_hdr->total_length = rte_cpu_to_be_16(rte_be_to_cpu_16(ipv4_hdr->total_length) - s->len);
+		ipv4_hdr->hdr_checksum = 0;
+		ipv4_hdr->hdr_checksum = rte_ipv4_cksum(ipv4_hdr);
+
+		memmove(rte_pktmbuf_mtod_offset(mbufs[i], uint8_t *, s->len), eth_hdr, hdr_len);
+		rte_pktmbuf_adj(mbufs[i], s->len);
+	}
+}
+
+/* Telemetry of a packet of the path, next to its delay. */
+static void peer_int_update(struct hopa_peer *peer, uint8_t path_id, struct rte_mbuf *mbuf)
+{
+	const struct hopa_int_sample *s;
+	struct hopa_int_est *est;
+
+	if (int_off < 0)
+		return;
+	s = RTE_MBUF_DYNFIELD(mbuf, int_off, const struct hopa_int_sample *);
+	if (s->hops == 0)
+		return;
+
+	est = &peer->int_est[path_id];
+	hopa_int_update(est, s);
+	HOPA_LOG_TRACE("peer " IPV4_FMT " path %d int : %u hops, deepest queue %u (node %u), avg %u, hop latency %u ns",
+				   IPV4_ARGS(peer->ip), path_id, est->hops, est->queue_max, est->node_max, est->queue_avg, est->latency_avg);
+}
+
+/* Discovery state for every peer slot, sender only. */
+static void discover_init(uint32_t pps)
+{
+	discover_table = rte_zmalloc("discover", sizeof(struct hopa_discover) * MAX_PEERS, RTE_CACHE_LINE_SIZE);
+	if (discover_table == NULL)
+		rte_exit(EXIT_FAILURE, "Cannot allocate discovery table\n");
+	discover_pps = pps;
+}
+
+static void discover_reset(struct hopa_discover *disc, uint32_t ip)
+{
+	memset(disc, 0, sizeof(*disc));
+	disc->ip = ip;
+	disc->state = DISCOVER_SWEEP;
+	for (int i = 0; i < PATH_NB; i++)
+		disc->chosen[i] = DISCOVER_NO_FLOW;
+}
+
+static struct rte_mbuf *encode_discover_pkt(const struct hopa_peer *peer, uint16_t flow, uint8_t ttl)
+{
+	struct rte_mbuf *mbuf;
+	struct rte_ipv4_hdr *ipv4_hdr;
+	struct rte_udp_hdr *udp_hdr;
+	struct hopa_cp_hdr *hopa_cp_hdr;
+	struct timespec ts;
+
+	mbuf = encode_udp_pkt(peer, DISCOVER_DPORT(flow));
+	if (mbuf == NULL)
+		return NULL;
+
+	/* routers quote the IP header back : the TTL goes in the id */
+	ipv4_hdr = rte_pktmbuf_mtod_offset(mbuf, struct rte_ipv4_hdr *, sizeof(struct rte_ether_hdr));
+	ipv4_hdr->time_to_live = ttl;
+	ipv4_hdr->packet_id = rte_cpu_to_be_16(ttl);
+	ipv4_hdr->hdr_checksum = 0;
+	ipv4_hdr->hdr_checksum = rte_ipv4_cksum(ipv4_hdr);
+
+	udp_hdr = (struct rte_udp_hdr *)(ipv4_hdr + 1);
+	udp_hdr->src_port = rte_cpu_to_be_16(DISCOVER_SPORT(flow));
+	udp_hdr->dgram_cksum = 0; /* optional over IPv4 */
+
+	hopa_cp_hdr = (struct hopa_cp_hdr *)rte_pktmbuf_append(mbuf, sizeof(struct hopa_cp_hdr));
+	hopa_cp_hdr->flag = HOPA_CP;
+	hopa_cp_hdr->cp_flag = DISCOVER;
+	hopa_cp_hdr->rsvd = 0;
+	hopa_cp_hdr->repath_id = 0;
+	hopa_cp_hdr->seq = rte_cpu_to_be_64((uint64_t)flow << 8 | ttl);
+	hopa_cp_hdr->ack = 0;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	hopa_cp_hdr->ts = rte_cpu_to_be_64((uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec);
+
+	return mbuf;
+}
+
+/* Advance one peer's discovery, at most budget probes into mbufs. */
+static unsigned int discover_step(struct hopa_peer *peer, struct hopa_discover *disc, uint64_t now, unsigned int budget, struct rte_mbuf **mbufs)
+{
+	const uint64_t hz = rte_get_timer_hz();
+	unsigned int total = (disc->verify ? PATH_NB : DISCOVER_FLOWS) * DISCOVER_TTLS;
+	unsigned int n = 0;
+	uint16_t flow;
+	uint8_t t;
+	int k;
+
+	switch (disc->state)
+	{
+	case DISCOVER_SWEEP:
+		for (; disc->cursor < total && n < budget; disc->cursor++)
+		{
+			flow = disc->cursor / DISCOVER_TTLS;
+			t = disc->cursor % DISCOVER_TTLS;
+			if (disc->verify && (flow = disc->chosen[flow]) == DISCOVER_NO_FLOW)
+				continue;
+			if ((mbufs[n] = encode_discover_pkt(peer, flow, t < DISCOVER_MAX_TTL ? t + 1 : DISCOVER_ECHO_TTL)) != NULL)
+				n++;
+		}
+		if (disc->cursor == total)
+		{
+			disc->state = DISCOVER_WAIT;
+			disc->deadline_tsc = now + hz / 1000 * DISCOVER_WAIT_MS;
+		}
+		break;
+
+	case DISCOVER_WAIT:
+		if (now < disc->deadline_tsc)
+			break;
+		if (!disc->verify)
+			discover_cluster(peer, disc);
+		else if (!discover_verify(disc))
+		{
+			HOPA_LOG_INFO("peer " IPV4_FMT " : paths changed, rediscover", IPV4_ARGS(peer->ip));
+			discover_reset(disc, peer->ip);
+			break;
+		}
+		disc->state = DISCOVER_DONE;
+		disc->deadline_tsc = now + hz * DISCOVER_VERIFY_S;
+		break;
+
+	case DISCOVER_DONE:
+		if (now < disc->deadline_tsc)
+			break;
+		/* trace the chosen flows again, fresh answers only */
+		for (k = 0; k < PATH_NB; k++)
+			if (disc->chosen[k] != DISCOVER_NO_FLOW)
+				memset(&disc->flows[disc->chosen[k]], 0, sizeof(struct hopa_discover_flow));
+		disc->verify = 1;
+		disc->cursor = 0;
+		disc->state = DISCOVER_SWEEP;
+		break;
+	}
+
+	return n;
+}
+
+/* Round robin over the probed peers, like lcore_probe. */
+static unsigned int discover_run(uint64_t now, unsigned int budget, struct rte_mbuf **mbufs)
+{
+	static int slot;
+	struct hopa_peer *peer;
+	struct hopa_discover *disc;
+	unsigned int n = 0;
+	int scanned;
+
+	for (scanned = 0; scanned < MAX_PEERS && n < budget; scanned++, slot = (slot + 1) % MAX_PEERS)
+	{
+		peer = &peer_table.peers[slot];
+		if (!peer->active || peer->learned)
+			continue;
+
+		disc = &discover_table[slot];
+		if (disc->ip != peer->ip)
+			discover_reset(disc, peer->ip);
+		n += discover_step(peer, disc, now, budget - n, &mbufs[n]);
+	}
+
+	return n;
+}
+
+static bool discover_answered(const struct hopa_discover_flow *f)
+{
+	for (int i = 0; i < DISCOVER_MAX_TTL; i++)
+		if (f->hops[i] != 0)
+			return true;
+
+	return f->rtt_ns != 0;
+}
+
+/* Same routers on every hop both flows got an answer for. Routers rate
+ * limit ICMP, so a silent hop is not a difference. No common hop : RTT. */
+static bool discover_same_path(const struct hopa_discover_flow *a, const struct hopa_discover_flow *b)
+{
+	int common = 0;
+
+	for (int i = 0; i < DISCOVER_MAX_TTL; i++)
+	{
+		if (a->hops[i] == 0 || b->hops[i] == 0)
+			continue;
+		if (a->hops[i] != b->hops[i])
+			return false;
+		common++;
+	}
+	if (common)
+		return true;
+
+	if (a->rtt_ns == 0 || b->rtt_ns == 0)
+		return false;
+
+	return (a->rtt_ns > b->rtt_ns ? a->rtt_ns - b->rtt_ns : b->rtt_ns - a->rtt_ns) <= DISCOVER_RTT_TOL_NS;
+}
+
+/* Group the swept flows into paths and give each path port its own one. */
+static void discover_cluster(struct hopa_peer *peer, struct hopa_discover *disc)
+{
+	uint16_t rep[DISCOVER_MAX_PATHS];
+	int8_t cluster[DISCOVER_FLOWS];
+	bool taken[DISCOVER_MAX_PATHS] = {false};
+	uint16_t f, alias;
+	uint8_t n = 0, c, alias_mask = 0;
+	bool shared;
+	int k, j;
+
+	for (f = 0; f < DISCOVER_FLOWS; f++)
+	{
+		cluster[f] = -1;
+		if (!discover_answered(&disc->flows[f]))
+			continue;
+		for (c = 0; c < n; c++)
+			if (discover_same_path(&disc->flows[f], &disc->flows[rep[c]]))
+				break;
+		if (c == n)
+		{
+			if (n == DISCOVER_MAX_PATHS)
+				continue;
+			rep[n++] = f;
+		}
+		cluster[f] = c;
+	}
+
+	/* a path no other port took yet, else share one */
+	for (k = 0; k < PATH_NB; k++)
+	{
+		disc->chosen[k] = DISCOVER_NO_FLOW;
+		alias = DISCOVER_NO_FLOW;
+		for (j = 0; j < DISCOVER_PORTS; j++)
+		{
+			f = k * DISCOVER_PORTS + j;
+			if (cluster[f] < 0)
+				continue;
+			if (alias == DISCOVER_NO_FLOW)
+				alias = f;
+			if (!taken[cluster[f]])
+			{
+				disc->chosen[k] = f;
+				taken[cluster[f]] = true;
+				break;
+			}
+		}
+		shared = disc->chosen[k] == DISCOVER_NO_FLOW;
+		if (shared)
+			disc->chosen[k] = alias;
+		alias_mask |= (shared && alias != DISCOVER_NO_FLOW) << k;
+		if (disc->chosen[k] == DISCOVER_NO_FLOW)
+		{
+			HOPA_LOG_WARN("peer " IPV4_FMT " path %d : no answer on any source port", IPV4_ARGS(peer->ip), k);
+			continue;
+		}
+
+		f = disc->chosen[k];
+		disc->saved[k] = disc->flows[f];
+		peer->ecmp_sport[k] = DISCOVER_SPORT(f);
+		HOPA_LOG_INFO("peer " IPV4_FMT " path %d : source port %u, path %d%s", IPV4_ARGS(peer->ip), k, DISCOVER_SPORT(f), cluster[f], shared ? " (shared)" : "");
+	}
+
+	/* the path table offers the distinct paths only */
+	disc->n_paths = n;
+	peer->alias_mask = alias_mask;
+	paths_publish(peer);
+	HOPA_LOG_INFO("peer " IPV4_FMT " : %u paths discovered, alias mask 0x%x", IPV4_ARGS(peer->ip), n, alias_mask);
+}
+
+/* The chosen flows still answer, over the same paths. A path port that
+ * had no answer at all is looked for again. */
+static bool discover_verify(struct hopa_discover *disc)
+{
+	uint16_t f;
+
+	for (int k = 0; k < PATH_NB; k++)
+	{
+		if ((f = disc->chosen[k]) == DISCOVER_NO_FLOW)
+			return false;
+		if (!discover_same_path(&disc->flows[f], &disc->saved[k]))
+			return false;
+		disc->saved[k] = disc->flows[f];
+	}
+
+	return true;
+}
+
+/* ICMP time exceeded for a discovery probe : router of hop TTL. */
+static void discover_icmp(struct rte_mbuf *mbuf)
+{
+	struct rte_ipv4_hdr *ipv4_hdr, *inner_hdr;
+	struct rte_icmp_hdr *icmp_hdr;
+	struct rte_udp_hdr *udp_hdr;
+	struct hopa_peer *peer;
+	struct hopa_discover *disc;
+	uint16_t sport, dport, ttl;
+	uint32_t len;
+
+	ipv4_hdr = rte_pktmbuf_mtod_offset(mbuf, struct rte_ipv4_hdr *, sizeof(struct rte_ether_hdr));
+	len = sizeof(struct rte_ether_hdr) + (ipv4_hdr->version_ihl & RTE_IPV4_HDR_IHL_MASK) * RTE_IPV4_IHL_MULTIPLIER;
+	icmp_hdr = rte_pktmbuf_mtod_offset(mbuf, struct rte_icmp_hdr *, len);
+	len += sizeof(struct rte_icmp_hdr);
+	if (rte_pktmbuf_data_len(mbuf) < len + sizeof(struct rte_ipv4_hdr) || icmp_hdr->icmp_type != DISCOVER_ICMP_TIME_EXCEEDED)
+		return;
+
+	/* the probe, quoted : its IP header and the first 8 bytes of UDP */
+	inner_hdr = (struct rte_ipv4_hdr *)(icmp_hdr + 1);
+	len += (inner_hdr->version_ihl & RTE_IPV4_HDR_IHL_MASK) * RTE_IPV4_IHL_MULTIPLIER;
+	if (rte_pktmbuf_data_len(mbuf) < len + sizeof(struct rte_udp_hdr) || inner_hdr->next_proto_id != IPPROTO_UDP ||
+		rte_be_to_cpu_32(inner_hdr->src_addr) != SRC_IP)
+		return;
+	udp_hdr = rte_pktmbuf_mtod_offset(mbuf, struct rte_udp_hdr *, len);
+
+	sport = rte_be_to_cpu_16(udp_hdr->src_port) - ECMP_SPORT_LO;
+	dport = rte_be_to_cpu_16(udp_hdr->dst_port) - DST_PORT_PATH_1;
+	ttl = rte_be_to_cpu_16(inner_hdr->packet_id);
+	if (sport >= DISCOVER_PORTS || dport >= PATH_NB || ttl == 0 || ttl > DISCOVER_MAX_TTL)
+		return;
+
+	peer = peer_lookup(rte_be_to_cpu_32(inner_hdr->dst_addr));
+	if (peer == NULL)
+		return;
+	disc = &discover_table[peer - peer_table.peers];
+	if (disc->ip != peer->ip)
+		return;
+
+	disc->flows[dport * DISCOVER_PORTS + sport].hops[ttl - 1] = rte_be_to_cpu_32(ipv4_hdr->src_addr);
+}
+
+/* DISCOVER_ECHO : the flow reached the peer, keep the min RTT. */
+static void discover_echo(struct rte_mbuf *mbuf)
+{
+	struct rte_ipv4_hdr *ipv4_hdr;
+	struct hopa_cp_hdr *hopa_cp_hdr;
+	struct hopa_peer *peer;
+	struct hopa_discover *disc;
+	struct hopa_discover_flow *f;
+	struct timespec ts;
+	uint64_t flow, rtt;
+
+	peer = peer_from_pkt(mbuf, false);
+	if (peer == NULL)
+		return;
+	disc = &discover_table[peer - peer_table.peers];
+	if (disc->ip != peer->ip)
+		return;
+
+	ipv4_hdr = rte_pktmbuf_mtod_offset(mbuf, struct rte_ipv4_hdr *, sizeof(struct rte_ether_hdr));
+	hopa_cp_hdr = (struct hopa_cp_hdr *)((struct rte_udp_hdr *)(ipv4_hdr + 1) + 1);
+	flow = rte_be_to_cpu_64(hopa_cp_hdr->seq) >> 8;
+	if (flow >= DISCOVER_FLOWS)
+		return;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	rtt = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec - rte_be_to_cpu_64(hopa_cp_hdr->ts);
+	if (rtt == 0)
+		rtt = 1;
+	f = &disc->flows[flow];
+	if (f->rtt_ns == 0 || rtt < f->rtt_ns)
+		f->rtt_ns = rtt;
+}
+
+/* ICMP and DISCOVER_ECHO feed the sender's discovery, DISCOVER is echoed
+ * back with its seq and ts. */
+static struct rte_mbuf *hopa_discover_pkt_progress(struct rte_mbuf *mbuf)
+{
+	struct rte_ipv4_hdr *ipv4_hdr;
+	struct hopa_cp_hdr *hopa_cp_hdr, *echo_hdr;
+	struct hopa_peer *peer;
+	struct rte_mbuf *echo;
+
+	ipv4_hdr = rte_pktmbuf_mtod_offset(mbuf, struct rte_ipv4_hdr *, sizeof(struct rte_ether_hdr));
+	if (ipv4_hdr->next_proto_id == IPPROTO_ICMP)
+	{
+		if (discover_table != NULL)
+			discover_icmp(mbuf);
+		return NULL;
+	}
+
+	hopa_cp_hdr = (struct hopa_cp_hdr *)((struct rte_udp_hdr *)(ipv4_hdr + 1) + 1);
+	if (hopa_cp_hdr->cp_flag == DISCOVER_ECHO)
+	{
+		if (discover_table != NULL)
+			discover_echo(mbuf);
+		return NULL;
+	}
+
+	peer = peer_from_pkt(mbuf, true);
+	if (peer == NULL)
+		return NULL;
+
+	echo = encode_udp_pkt(peer, DST_PORT_PATH_1);
+	if (echo == NULL)
+		return NULL;
+	echo_hdr = (struct hopa_cp_hdr *)rte_pktmbuf_append(echo, sizeof(struct hopa_cp_hdr));
+	echo_hdr->flag = HOPA_CP;
+	echo_hdr->cp_flag = DISCOVER_ECHO;
+	echo_hdr->rsvd = 0;
+	echo_hdr->repath_id = 0;
+	echo_hdr->seq = hopa_cp_hdr->seq;
+	echo_hdr->ack = 0;
+	echo_hdr->ts = hopa_cp_hdr->ts;
+
+	return echo;
+}
+
+/* Probe every peer once per PROBE_PERIOD_MS, bounded by a token bucket of
+ * probe_bw_kbps over all peers: with many peers the period stretches
+ * instead of the probe load growing. */
+static int
+lcore_probe(__rte_unused void *arg)
+{
+
+	unsigned i;
+	struct rte_mbuf *mbufs[PATH_NB];
+	struct hopa_peer *peer;
+	const uint64_t hz = rte_get_timer_hz();
+	const uint64_t period = hz / 1000 * PROBE_PERIOD_MS;
+	const uint64_t round_bits = PATH_NB * 8 * (sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv4_hdr) + sizeof(struct rte_udp_hdr) + sizeof(struct hopa_cp_hdr));
+	const uint64_t bucket = round_bits * PROBE_BURST_ROUNDS;
+	uint64_t tokens = bucket;
+	const uint64_t disc_bucket = hz * DISCOVER_BURST;
+	uint64_t disc_tokens = disc_bucket; /* probes x hz */
+	const uint64_t train_bits = (uint64_t)train_len * train_frame * 8;
+	const uint64_t train_bucket = train_bits * TRAIN_BURST;
+	uint64_t train_tokens = train_bucket;
+	struct rte_mbuf *train[HOPA_TRAIN_MAX_LEN];
+	unsigned int nb_train;
+	struct rte_mbuf *bufs[BURST_SIZE];
+	struct rte_mbuf *replies[BURST_SIZE];
+	uint16_t nb_rx;
+	uint16_t nb_reply;
+	unsigned int nb_disc;
+	unsigned int nb_live;
+	unsigned int tick_us = PROBE_TICK_US;
+	uint64_t last_tsc = rte_get_timer_cycles();
+	uint64_t timer_tsc = 0;
+	uint64_t now;
+	int slot = 0;
+	int live_slot = 0;
+	int scanned;
+
+	/* retran_timer, armed by repaths from the receiver */
+	rte_timer_subsystem_init();
+	rte_timer_init(&retran_timer);
+
+	/* hellos go out on time, not on the probe tick */
+	if (live_interval_tsc)
+		tick_us = RTE_MIN((uint64_t)PROBE_TICK_US, live_interval_tsc * US_PER_S / hz);
+
+	while (1)
+	{
+		now = rte_get_timer_cycles();
+		if (now - timer_tsc > hz / 1000 * IDLE_TIMER_MS)
+		{
+			rte_timer_manage();
+			timer_tsc = now;
+		}
+
+		tokens += (now - last_tsc) * probe_bw_kbps * 1000 / hz;
+		if (tokens > bucket)
+			tokens = bucket;
+		disc_tokens += (now - last_tsc) * discover_pps;
+		if (disc_tokens > disc_bucket)
+			disc_tokens = disc_bucket;
+		train_tokens += (now - last_tsc) * train_kbps * 1000 / hz;
+		if (train_tokens > train_bucket)
+			train_tokens = train_bucket;
+		last_tsc = now;
+
+		/* round robin over the slots, resume where the bucket ran dry */
+		for (scanned = 0; scanned < MAX_PEERS && tokens >= round_bits; scanned++, slot = (slot + 1) % MAX_PEERS)
+		{
+			peer = &peer_table.peers[slot];
+			if (!peer->active || peer->learned || now < peer->next_probe_tsc)
+				continue;
+
+			for (i = 0; i < PATH_NB; i++)
+				mbufs[i] = encode_probe_pkt(peer, i + 1);
+
+			hopa_ring_enqueue(hopa_in_out_ring_ins->hopa_out_ring, &hopa_in_out_ring_ins->out_ev, mbufs, PATH_NB, &tx_stats.out_ring_drops);
+
+			peer->next_probe_tsc = now + period;
+			tokens -= round_bits;
+		}
+
+		/* hellos : every path of every peer each interval, outside -B.
+		 * LIVE_BURST per tick keeps the CP pool, more peers stretch it */
+		nb_live = 0;
+		for (scanned = 0; live_interval_tsc && scanned < MAX_PEERS && nb_live + PATH_NB <= LIVE_BURST; scanned++, live_slot = (live_slot + 1) % MAX_PEERS)
+		{
+			peer = &peer_table.peers[live_slot];
+			if (!peer->active || peer->learned || now < peer->next_live_tsc)
+				continue;
+
+			for (i = 0; i < PATH_NB; i++)
+				if ((bufs[nb_live % BURST_SIZE] = encode_live_pkt(peer, i)) != NULL && ++nb_live % BURST_SIZE == 0)
+					hopa_ring_enqueue(hopa_in_out_ring_ins->hopa_out_prio_ring, &hopa_in_out_ring_ins->out_ev, bufs, BURST_SIZE, &tx_stats.out_ring_drops);
+			peer->next_live_tsc = now + live_interval_tsc;
+		}
+		if (nb_live % BURST_SIZE)
+			hopa_ring_enqueue(hopa_in_out_ring_ins->hopa_out_prio_ring, &hopa_in_out_ring_ins->out_ev, bufs, nb_live % BURST_SIZE, &tx_stats.out_ring_drops);
+
+		/* probe trains, -T bits per second : one per tick, so a train leaves
+		 * in one tx burst and never queues behind another at our own NIC */
+		if (train_kbps && train_tokens >= train_bits)
+		{
+			nb_train = train_run(now, train);
+			if (nb_train)
+			{
+				hopa_ring_enqueue(hopa_in_out_ring_ins->hopa_out_prio_ring, &hopa_in_out_ring_ins->out_ev, train, nb_train, &tx_stats.out_ring_drops);
+				train_tokens -= train_bits;
+			}
+		}
+
+		/* path discovery, its own bucket in probes per second */
+		if (discover_table != NULL && disc_tokens >= hz)
+		{
+			nb_disc = discover_run(now, RTE_MIN(disc_tokens / hz, (uint64_t)BURST_SIZE), bufs);
+			if (nb_disc)
+				hopa_ring_enqueue(hopa_in_out_ring_ins->hopa_out_ring, &hopa_in_out_ring_ins->out_ev, bufs, nb_disc, &tx_stats.out_ring_drops);
+			disc_tokens -= nb_disc * hz;
+		}
+
+		/* the sender consumes answers to discovery, repaths and reports, the rest is dropped */
+		do
+		{
+			nb_rx = rte_ring_sc_dequeue_burst(hopa_in_out_ring_ins->hopa_in_ring, (void **)bufs, BURST_SIZE, NULL);
+			nb_reply = 0;
+			for (i = 0; i < nb_rx; i++)
+			{
+				switch (hopa_classify(bufs[i]))
+				{
+				case HOPA_CLASSIFY_NEXT_DISCOVER:
+					replies[nb_reply] = hopa_discover_pkt_progress(bufs[i]);
+					break;
+				case HOPA_CLASSIFY_NEXT_REPATH:
+					replies[nb_reply] = hopa_cp_repath_pkt_progress(bufs[i]);
+					break;
+				case HOPA_CLASSIFY_NEXT_REPORT:
+					hopa_report_pkt_progress(bufs[i]);
+					replies[nb_reply] = NULL;
+					break;
+				default:
+					replies[nb_reply] = NULL;
+					break;
+				}
+				if (replies[nb_reply] != NULL)
+					nb_reply++;
+			}
+			if (nb_reply)
+				hopa_ring_enqueue(hopa_in_out_ring_ins->hopa_out_prio_ring, &hopa_in_out_ring_ins->out_ev, replies, nb_reply, &tx_stats.out_ring_drops);
+			rte_pktmbuf_free_bulk(bufs, nb_rx);
+		} while (nb_rx == BURST_SIZE);
+
+		rte_delay_us_sleep(tick_us);
+	}
+}
+
+static int
+lcore_stats(__rte_unused void *arg)
+{
+	struct rte_mbuf *bufs[BURST_SIZE];
+	struct rte_mbuf *replies[BURST_SIZE];
+	struct hopa_idle idle = {0};
+	uint16_t nb_rx;
+	uint16_t nb_reply;
+	uint16_t i;
+
+	/* timer init */
+	rte_timer_subsystem_init();
+	rte_timer_init(&retran_timer);
+	srand(time(NULL));
+
+	uint64_t prev_tsc = 0, cur_tsc, diff_tsc;
+	uint64_t timer_resolution_cycles = rte_get_timer_hz() * 10 / 1000;
+	const int live_wait_us = live_interval_tsc ? RTE_MIN((uint64_t)IDLE_TIMER_MS * 1000, live_interval_tsc * US_PER_S / rte_get_timer_hz()) : IDLE_TIMER_MS * 1000;
+
+	while (1)
+	{
+		// timer
+		cur_tsc = rte_get_timer_cycles();
+		diff_tsc = cur_tsc - prev_tsc;
+		if (diff_tsc > timer_resolution_cycles)
+		{
+			rte_timer_manage();
+			prev_tsc = cur_tsc;
+		}
+
+		// nb_rx = rte_eth_rx_burst(PORT_P0, 0, bufs, BURST_SIZE);
+		nb_rx = rte_ring_mc_dequeue_burst(hopa_in_out_ring_ins->hopa_in_ring, (void **)bufs, BURST_SIZE, NULL);
+		hopa_live_check(cur_tsc);
+
+		/* a blackholed path brings no packet to wake us : sleep at most an interval */
+		if (hopa_idle_poll(&idle, nb_rx))
+			hopa_ring_wait(hopa_in_out_ring_ins->hopa_in_ring, &hopa_in_out_ring_ins->in_ev, live_wait_us);
+
+		nb_reply = 0;
+		for (i = 0; i < nb_rx; i++)
+		{
+			switch (hopa_classify(bufs[i]))
+			{
+			case HOPA_CLASSIFY_NEXT_PROBE:
+				hopa_cp_probe_pkt_progress(bufs[i]);
+				break;
+			case HOPA_CLASSIFY_NEXT_REPATH:
+				if ((replies[nb_reply] = hopa_cp_repath_pkt_progress(bufs[i])) != NULL)
+					nb_reply++;
+				break;
+			case HOPA_CLASSIFY_NEXT_REPATH_ACK:
+				hopa_cp_repath_ack_pkt_progress(bufs[i]);
+				break;
+			case HOPA_CLASSIFY_NEXT_DISCOVER:
+				if ((replies[nb_reply] = hopa_discover_pkt_progress(bufs[i])) != NULL)
+					nb_reply++;
+				break;
+			case HOPA_CLASSIFY_NEXT_LIVE:
+				hopa_live_pkt_progress(bufs[i]);
+				break;
+			case HOPA_CLASSIFY_NEXT_TRAIN:
+				hopa_train_pkt_progress(bufs[i]);
+				break;
+			case HOPA_CLASSIFY_NEXT_REPORT:
+				hopa_report_pkt_progress(bufs[i]);
+				break;
+			case HOPA_CLASSIFY_NEXT_DP_TS:
+				if ((replies[nb_reply] = hopa_dp_ts_pkt_progress(bufs[i])) != NULL)
+					nb_reply++;
+				break;
+			default:
+				break;
+			}
+		}
+
+		if (nb_reply)
+			hopa_ring_enqueue(hopa_in_out_ring_ins->hopa_out_prio_ring, &hopa_in_out_ring_ins->out_ev, replies, nb_reply, &tx_stats.out_ring_drops);
+
+		for (i = 0; i < nb_rx; i++)
+			rte_pktmbuf_free(bufs[i]);
+	}
+}
+
+/* Attach to the resources ovs-vswitchd --hopa-cp-external exports. */
+static void ovs_attach(void)
+{
+	const struct rte_memzone *mz;
+	struct hopa_ovs_export *x;
+	char name[RTE_RING_NAMESIZE];
+
+	RTE_BUILD_BUG_ON(MAX_PEERS > HOPA_OVS_EXPORT_MAX_PEERS);
+
+	if (rte_eal_process_type() != RTE_PROC_SECONDARY)
+		rte_exit(EXIT_FAILURE, "-o 1 needs --proc-type=secondary and the --file-prefix of ovs-vswitchd\n");
+
+	mz = rte_memzone_lookup(HOPA_OVS_EXPORT_MZ);
+	if (mz == NULL)
+		rte_exit(EXIT_FAILURE, "memzone %s not found, is ovs-vswitchd running with --hopa-cp-external ?\n", HOPA_OVS_EXPORT_MZ);
+	x = mz->addr;
+	if (x->magic != HOPA_OVS_EXPORT_MAGIC || x->version != HOPA_OVS_EXPORT_VERSION)
+		rte_exit(EXIT_FAILURE, "memzone %s: version mismatch with ovs-vswitchd\n", HOPA_OVS_EXPORT_MZ);
+	if (x->cp_pid != 0 && x->cp_pid != getpid() && kill(x->cp_pid, 0) == 0)
+		rte_exit(EXIT_FAILURE, "another CP (pid %d) is attached\n", x->cp_pid);
+
+	/* the in rings are single consumer: us */
+	hopa_ovs.n_in_rings = RTE_MIN(x->n_in_rings, HOPA_OVS_MAX_IN_RINGS);
+	for (unsigned int i = 0; i < hopa_ovs.n_in_rings; i++)
+	{
+		snprintf(name, sizeof(name), HOPA_OVS_IN_RING_FMT, i);
+		hopa_ovs.in_rings[i] = rte_ring_lookup(name);
+		if (hopa_ovs.in_rings[i] == NULL)
+			rte_exit(EXIT_FAILURE, "ring %s not found\n", name);
+	}
+	snprintf(name, sizeof(name), HOPA_OVS_OUT_RING_FMT, x->out_ring);
+	hopa_ovs.out_ring = rte_ring_lookup(name);
+	if (hopa_ovs.out_ring == NULL)
+		rte_exit(EXIT_FAILURE, "ring %s not found\n", name);
+
+	/* mbufs are dp_packets there, initialized by ovs-vswitchd */
+	cp_mbuf_pool = rte_mempool_lookup(HOPA_OVS_MP_NAME);
+	if (cp_mbuf_pool == NULL)
+		rte_exit(EXIT_FAILURE, "mempool %s not found\n", HOPA_OVS_MP_NAME);
+	cp_pool_stats.mp = cp_mbuf_pool;
+	cp_pool_stats.size = cp_mbuf_pool->size;
+
+	memset(x->peers, 0, sizeof(x->peers));
+	x->n_peers = 0;
+	x->cp_pid = getpid();
+	hopa_ovs.export = x;
+
+	HOPA_LOG_INFO("attached to ovs-vswitchd : %u in rings, out ring %u", hopa_ovs.n_in_rings, x->out_ring);
+}
+
+/* Same packet as ovs-vswitchd's own CP builds, from the addresses it exports. */
+static struct rte_mbuf *ovs_encode_pkt(const struct hopa_peer *peer, uint8_t cp_flag, uint8_t path_id)
+{
+	const struct hopa_ovs_export *x = hopa_ovs.export;
+	struct rte_mbuf *mbuf;
+	struct rte_ipv4_hdr *ipv4_hdr;
+	struct rte_udp_hdr *udp_hdr;
+	struct hopa_ovs_cp_hdr *hopa_cp_hdr;
+	struct timespec ts;
+	uint8_t *eth;
+
+	mbuf = rte_pktmbuf_alloc(cp_mbuf_pool);
+	if (mbuf == NULL)
+	{
+		tx_stats.out_ring_drops++;
+		return NULL;
+	}
+
+	/* by offset: the ether header field names differ between DPDK releases */
+	eth = (uint8_t *)rte_pktmbuf_append(mbuf, sizeof(struct rte_ether_hdr));
+	rte_memcpy(eth, &peer->mac, RTE_ETHER_ADDR_LEN);
+	rte_memcpy(eth + RTE_ETHER_ADDR_LEN, &x->src_mac, RTE_ETHER_ADDR_LEN);
+	*(rte_be16_t *)(eth + 2 * RTE_ETHER_ADDR_LEN) = rte_cpu_to_be_16(RTE_ETHER_TYPE_IPV4);
+
+	ipv4_hdr = (struct rte_ipv4_hdr *)rte_pktmbuf_append(mbuf, sizeof(struct rte_ipv4_hdr));
+	ipv4_hdr->version_ihl = (4 << 4) + 5;
+	ipv4_hdr->type_of_service = 0;
+	ipv4_hdr->total_length = rte_cpu_to_be_16(sizeof(struct rte_ipv4_hdr) + sizeof(struct rte_udp_hdr) + sizeof(struct hopa_ovs_cp_hdr));
+	ipv4_hdr->packet_id = rte_cpu_to_be_16(5462);
+	ipv4_hdr->fragment_offset = rte_cpu_to_be_16(0);
+	ipv4_hdr->time_to_live = 64;
+	ipv4_hdr->next_proto_id = IPPROTO_UDP;
+	ipv4_hdr->src_addr = x->src_ip;
+	ipv4_hdr->dst_addr = rte_cpu_to_be_32(peer->ip);
+	ipv4_hdr->hdr_checksum = 0;
+	ipv4_hdr->hdr_checksum = rte_ipv4_cksum(ipv4_hdr);
+
+	udp_hdr = (struct rte_udp_hdr *)rte_pktmbuf_append(mbuf, sizeof(struct rte_udp_hdr));
+	udp_hdr->src_port = rte_cpu_to_be_16(x->src_port);
+	udp_hdr->dst_port = rte_cpu_to_be_16(x->dst_port + path_id);
+	udp_hdr->dgram_len = rte_cpu_to_be_16(sizeof(struct rte_udp_hdr) + sizeof(struct hopa_ovs_cp_hdr));
+	udp_hdr->dgram_cksum = 0;
+
+	hopa_cp_hdr = (struct hopa_ovs_cp_hdr *)rte_pktmbuf_append(mbuf, sizeof(struct hopa_ovs_cp_hdr));
+	hopa_cp_hdr->flag = HOPA_CP;
+	hopa_cp_hdr->cp_flag = cp_flag;
+	hopa_cp_hdr->probe_path_id = cp_flag == PROBE ? path_id : 0;
+	hopa_cp_hdr->repath_id = cp_flag != PROBE ? path_id : 0;
+	hopa_cp_hdr->rsvd = 0;
+	hopa_cp_hdr->seq = 0;
+	hopa_cp_hdr->ack = 0;
+	clock_gettime(0, &ts);
+	hopa_cp_hdr->ts = rte_cpu_to_be_64((uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec);
 
 	return mbuf;
 }
 
-static struct rte_mbuf *encode_probe_pkt(uint8_t path_id)
+/* Out ring to the PMD transmit lane of ovs-vswitchd, we are its producer. */
+static void ovs_enqueue(struct rte_mbuf **mbufs, unsigned int n)
 {
-	struct rte_mbuf *mbuf;
-	struct hopa_cp_hdr *hopa_cp_hdr;
-	uint64_t sender_ts;
+	unsigned int count;
 
-	mbuf = encode_udp_pkt(DST_PORT_PATH_1 - 1 + path_id);
+	count = rte_ring_sp_enqueue_burst(hopa_ovs.out_ring, (void **)mbufs, n, NULL);
+	if (count < n)
+	{
+		tx_stats.out_ring_drops += n - count;
+		rte_pktmbuf_free_bulk(&mbufs[count], n - count);
+	}
+	tx_stats.tx_pkts += count;
+}
 
-	hopa_cp_hdr = (struct hopa_cp_hdr *)rte_pktmbuf_append(mbuf, sizeof(struct hopa_cp_hdr));
+/* Path state of 'peer' into its slot of the export memzone. */
+static void ovs_publish(const struct hopa_peer *peer)
+{
+	struct hopa_ovs_export *x = hopa_ovs.export;
+	uint32_t slot = peer - peer_table.peers;
+	struct hopa_ovs_export_peer *xp = &x->peers[slot];
 
-	hopa_cp_hdr->flag = HOPA_CP;
-	hopa_cp_hdr->cp_flag = PROBE;
-	hopa_cp_hdr->rsvd = 0;
-	hopa_cp_hdr->repath_id = 0;
-	hopa_cp_hdr->seq = 0;
-	hopa_cp_hdr->ack = 0;
+	xp->ip = peer->active ? rte_cpu_to_be_32(peer->ip) : 0;
+	xp->best_path_id = peer->opt_path_id;
+	memcpy(xp->all_paths_delay_list, peer->all_paths_delay_list, sizeof(xp->all_paths_delay_list));
+	if (slot >= x->n_peers)
+		x->n_peers = slot + 1;
+
+	paths_publish(peer);
+}
 
+/* hopa_cp_progress of ovs-vswitchd, for one in ring entry. A new choice of
+ * path goes to the sender in a repath, a repath is acked. */
+static void ovs_msg_progress(struct hopa_ovs_msg *msg)
+{
+	uint32_t ip = rte_be_to_cpu_32(msg->src_ip);
+	struct hopa_peer *peer;
+	struct rte_mbuf *mbuf = NULL;
 	struct timespec ts;
-	if (clock_gettime(0, &ts) == 0)
+	uint64_t receiver_ts;
+	uint8_t from;
+
+	/* unknown senders are learned, so a receiver needs no peer list */
+	peer = peer_lookup(ip);
+	if (peer == NULL)
+		peer = peer_add(ip, &msg->src_mac, 1);
+	if (peer == NULL || msg->hdr.flag != HOPA_CP)
+		return;
+
+	switch (msg->hdr.cp_flag)
 	{
-		sender_ts = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
-		printf("current ts (ns) : %" PRIu64 "\n", sender_ts);
+	case PROBE:
+		if (msg->hdr.probe_path_id >= PATH_NB)
+			return;
+		clock_gettime(0, &ts);
+		receiver_ts = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+		peer->all_paths_delay_list[msg->hdr.probe_path_id] = receiver_ts - rte_be_to_cpu_64(msg->hdr.ts) + 1000000000;
+		from = peer->opt_path_id;
+		peer_select_path(peer);
+		if (peer->opt_path_id != from)
+			mbuf = ovs_encode_pkt(peer, REPATH, peer->opt_path_id);
+		HOPA_LOG_TRACE("peer " IPV4_FMT " path id : %d , opt_path_id = %d", IPV4_ARGS(peer->ip), msg->hdr.probe_path_id, peer->opt_path_id);
+		break;
+
+	case REPATH:
+		if (msg->hdr.repath_id >= PATH_NB)
+			return;
+		peer->opt_path_id = msg->hdr.repath_id;
+		mbuf = ovs_encode_pkt(peer, REPATH_ACK, peer->opt_path_id);
+		HOPA_LOG_INFO("peer " IPV4_FMT " repath %d", IPV4_ARGS(peer->ip), peer->opt_path_id);
+		break;
+
+	case REPATH_ACK:
+		HOPA_LOG_TRACE("peer " IPV4_FMT " repath %d acked", IPV4_ARGS(peer->ip), msg->hdr.repath_id);
+		return;
+
+	default:
+		return;
 	}
-	else
-		rte_exit(EXIT_FAILURE, "Error with clock_gettime\n");
-	hopa_cp_hdr->ts = rte_cpu_to_be_64(sender_ts);
 
-	return mbuf;
+	if (mbuf != NULL)
+		ovs_enqueue(&mbuf, 1);
+	ovs_publish(peer);
 }
 
-static struct rte_mbuf *encode_repath_pkt(uint8_t repath_id)
+/* CP loop of the -o mode, on the main lcore: in rings, probes, peer file. */
+static int
+lcore_ovs(__rte_unused void *arg)
 {
-	struct rte_mbuf *mbuf;
-	struct hopa_cp_hdr *hopa_cp_hdr;
+	struct hopa_ovs_msg *msgs[BURST_SIZE];
+	struct rte_mbuf *mbufs[BURST_SIZE];
+	struct hopa_idle idle = {0};
+	struct hopa_peer *peer;
+	const uint64_t hz = rte_get_timer_hz();
+	const uint64_t period = hz / 1000 * PROBE_PERIOD_MS;
+	const uint64_t round_bits = PATH_NB * 8 * (sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv4_hdr) + sizeof(struct rte_udp_hdr) + sizeof(struct hopa_ovs_cp_hdr));
+	const uint64_t bucket = round_bits * PROBE_BURST_ROUNDS;
+	uint64_t tokens = bucket;
+	uint64_t last_tsc = rte_get_timer_cycles();
+	uint64_t peer_tsc = last_tsc;
+	uint64_t stats_tsc = last_tsc;
+	uint64_t now;
+	unsigned int nb_rx, nb_tx;
+	unsigned int i;
+	int slot = 0;
+	int scanned;
 
-	mbuf = encode_udp_pkt(DST_PORT_PATH_1 - 1 + opt_path_id); // 暂定从最优路径发送
+	while (1)
+	{
+		/* in : round robin over the PMD rings */
+		nb_rx = 0;
+		for (i = 0; i < hopa_ovs.n_in_rings && nb_rx < BURST_SIZE; i++)
+		{
+			hopa_ovs.in_next = (hopa_ovs.in_next + 1) % hopa_ovs.n_in_rings;
+			nb_rx += rte_ring_sc_dequeue_burst(hopa_ovs.in_rings[hopa_ovs.in_next], (void **)&msgs[nb_rx], BURST_SIZE - nb_rx, NULL);
+		}
+		for (i = 0; i < nb_rx; i++)
+		{
+			ovs_msg_progress(msgs[i]);
+			rte_free(msgs[i]);
+		}
 
-	hopa_cp_hdr = (struct hopa_cp_hdr *)rte_pktmbuf_append(mbuf, sizeof(struct hopa_cp_hdr));
-	hopa_cp_hdr->flag = HOPA_CP;
-	hopa_cp_hdr->cp_flag = REPATH;
-	hopa_cp_hdr->rsvd = 0;
-	hopa_cp_hdr->repath_id = repath_id;
-	hopa_cp_hdr->seq = 0; // TODO
-	hopa_cp_hdr->ack = 0;
+		/* probes : same scheduler as lcore_probe */
+		now = rte_get_timer_cycles();
+		tokens += (now - last_tsc) * probe_bw_kbps * 1000 / hz;
+		if (tokens > bucket)
+			tokens = bucket;
+		last_tsc = now;
 
-	return mbuf;
+		nb_tx = 0;
+		for (scanned = 0; scanned < MAX_PEERS && tokens >= round_bits && nb_tx + PATH_NB <= BURST_SIZE; scanned++, slot = (slot + 1) % MAX_PEERS)
+		{
+			peer = &peer_table.peers[slot];
+			if (!peer->active || peer->learned || now < peer->next_probe_tsc)
+				continue;
+
+			for (i = 0; i < PATH_NB; i++)
+				if ((mbufs[nb_tx] = ovs_encode_pkt(peer, PROBE, i)) != NULL)
+					nb_tx++;
+
+			peer->next_probe_tsc = now + period;
+			tokens -= round_bits;
+		}
+		if (nb_tx)
+			ovs_enqueue(mbufs, nb_tx);
+
+		if (now - peer_tsc > hz * PEER_RELOAD_S)
+		{
+			peer_table_watch();
+			policy_watch();
+			for (slot = 0; slot < MAX_PEERS; slot++)
+				ovs_publish(&peer_table.peers[slot]);
+			slot = 0;
+			peer_tsc = now;
+		}
+
+		if (now - stats_tsc > hz * STATS_PERIOD_S)
+		{
+			pool_watch(&cp_pool_stats);
+			print_tx_stats();
+			print_select_stats();
+			print_live_stats();
+			print_train_stats();
+			print_int_stats();
+			print_pool_stats();
+			stats_tsc = now;
+		}
+
+		/* no eventfd across processes : nap */
+		if (hopa_idle_poll(&idle, nb_rx + nb_tx))
+			rte_delay_us_sleep(IDLE_NAP_US);
+	}
+
+	return 0;
 }
 
-static struct rte_mbuf *encode_repath_ack_pkt()
+/* eth-rx : P0 queue 0 into the classifier */
+static uint16_t hopa_eth_rx_process(struct rte_graph *graph, struct rte_node *node, __rte_unused void **objs, __rte_unused uint16_t nb_objs)
 {
-	struct rte_mbuf *mbuf;
-	struct hopa_cp_hdr *hopa_cp_hdr;
+	uint16_t count;
 
-	mbuf = encode_udp_pkt(DST_PORT_PATH_1 - 1 + opt_path_id); // 暂定从最优路径发送
+	count = rte_eth_rx_burst(PORT_P0, 0, (struct rte_mbuf **)node->objs, RTE_GRAPH_BURST_SIZE);
+	if (count == 0)
+		return 0;
+	hopa_rx_stamp((struct rte_mbuf **)node->objs, count);
+	hopa_int_strip((struct rte_mbuf **)node->objs, count);
 
-	hopa_cp_hdr = (struct hopa_cp_hdr *)rte_pktmbuf_append(mbuf, sizeof(struct hopa_cp_hdr));
-	hopa_cp_hdr->flag = HOPA_CP;
-	hopa_cp_hdr->cp_flag = REPATH_ACK;
-	hopa_cp_hdr->rsvd = 0;
-	hopa_cp_hdr->repath_id = 0;
-	hopa_cp_hdr->seq = 0;
-	hopa_cp_hdr->ack = 0; // TODO
+	node->idx = count;
+	rte_node_next_stream_move(graph, node, 0);
+	tx_stats.rx_pkts += count;
+	graph_work += count;
 
-	return mbuf;
+	return count;
 }
 
-static void timer_cb(__rte_unused struct rte_timer *timer, __rte_unused void *arg)
+/* probes of lcore_probe, repath / repath_ack first */
+static uint16_t hopa_out_rx_process(struct rte_graph *graph, struct rte_node *node, __rte_unused void **objs, __rte_unused uint16_t nb_objs)
 {
-	printf("timer out\n");
-	rte_timer_reset(&retran_timer, rte_get_timer_hz() * 0.1, SINGLE, rte_lcore_id(), timer_cb, arg);
+	struct hopa_in_out_ring *in_out_ring = hopa_in_out_ring_ins;
+	uint16_t prio, count;
+
+	prio = rte_ring_sc_dequeue_burst(in_out_ring->hopa_out_prio_ring, node->objs, RTE_GRAPH_BURST_SIZE, NULL);
+	count = prio + rte_ring_sc_dequeue_burst(in_out_ring->hopa_out_ring, &node->objs[prio], RTE_GRAPH_BURST_SIZE - prio, NULL);
+	if (count == 0)
+		return 0;
+
+	tx_stats.tx_prio_pkts += prio;
+	node->idx = count;
+	rte_node_next_stream_move(graph, node, HOPA_NEXT_TX);
+	graph_work += count;
+
+	return count;
 }
 
-static void hopa_cp_probe_pkt_progress(struct rte_mbuf *hopa_cp_mbuf)
+/* Handlers read the headers in place : everything up to the HOPA header
+ * must be in the first segment, IPv4 without options. */
+static enum hopa_classify_next hopa_classify(struct rte_mbuf *mbuf)
 {
+	const uint32_t udp_off = sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv4_hdr);
+	uint32_t len = rte_pktmbuf_data_len(mbuf);
+	struct rte_ether_hdr *eth_hdr;
 	struct rte_ipv4_hdr *ipv4_hdr;
 	struct rte_udp_hdr *udp_hdr;
 	struct hopa_cp_hdr *hopa_cp_hdr;
-	uint64_t sender_ts;
-	uint64_t receiver_ts;
 
-	ipv4_hdr = rte_pktmbuf_mtod_offset(hopa_cp_mbuf, struct rte_ipv4_hdr *, sizeof(struct rte_ether_hdr));
-	udp_hdr = (struct rte_udp_hdr *)(ipv4_hdr + 1);
-	hopa_cp_hdr = (struct hopa_cp_hdr *)(udp_hdr + 1);
+	eth_hdr = rte_pktmbuf_mtod(mbuf, struct rte_ether_hdr *);
+	if (len < sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv4_hdr) || eth_hdr->ether_type != rte_cpu_to_be_16(RTE_ETHER_TYPE_IPV4))
+		return HOPA_CLASSIFY_NEXT_DROP;
 
-	uint8_t path_id = rte_be_to_cpu_16(udp_hdr->dst_port) - DST_PORT_PATH_1;
+	/* discover_icmp() checks the lengths of its own */
+	ipv4_hdr = (struct rte_ipv4_hdr *)(eth_hdr + 1);
+	if (ipv4_hdr->next_proto_id == IPPROTO_ICMP)
+		return HOPA_CLASSIFY_NEXT_DISCOVER;
+	if (ipv4_hdr->next_proto_id != IPPROTO_UDP || ipv4_hdr->version_ihl != RTE_IPV4_VHL_DEF)
+		return HOPA_CLASSIFY_NEXT_DROP;
 
-	sender_ts = rte_be_to_cpu_64(hopa_cp_hdr->ts);
+	udp_hdr = (struct rte_udp_hdr *)(ipv4_hdr + 1);
+	if (!hopa_is_cp_udp(udp_hdr, len - udp_off))
+		return HOPA_CLASSIFY_NEXT_DROP;
 
-	struct timespec ts;
-	if (clock_gettime(0, &ts) == 0)
+	hopa_cp_hdr = (struct hopa_cp_hdr *)(udp_hdr + 1);
+	if (hopa_cp_hdr->flag == HOPA_DP)
+		return HOPA_CLASSIFY_NEXT_DP_TS;
+
+	switch (hopa_cp_hdr->cp_flag)
 	{
-		receiver_ts = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+	case PROBE:
+		return HOPA_CLASSIFY_NEXT_PROBE;
+	case REPATH:
+		return HOPA_CLASSIFY_NEXT_REPATH;
+	case REPATH_ACK:
+		return HOPA_CLASSIFY_NEXT_REPATH_ACK;
+	case DISCOVER:
+	case DISCOVER_ECHO:
+		return HOPA_CLASSIFY_NEXT_DISCOVER;
+	case LIVENESS:
+		return HOPA_CLASSIFY_NEXT_LIVE;
+	case TRAIN:
+		return HOPA_CLASSIFY_NEXT_TRAIN;
+	case REPORT:
+		return HOPA_CLASSIFY_NEXT_REPORT;
+	default:
+		return HOPA_CLASSIFY_NEXT_DROP;
 	}
-	else
-		rte_exit(EXIT_FAILURE, "Error with clock_gettime\n");
+}
 
-	all_paths_delay_list[path_id] = receiver_ts - sender_ts + 1000000000;
+static uint16_t hopa_classify_process(struct rte_graph *graph, struct rte_node *node, void **objs, uint16_t nb_objs)
+{
+	uint16_t i;
 
-	// double delay = ((double)all_paths_delay_list[path_id] / 1000.0) / 1000.0;
+	for (i = 0; i < nb_objs; i++)
+		rte_node_enqueue_x1(graph, node, hopa_classify(objs[i]), objs[i]);
 
-	HOPA_LOG_TRACE("path id : %d , delay (us) : %" PRIu64 "", path_id, all_paths_delay_list[path_id]);
+	return nb_objs;
+}
+
+static uint16_t hopa_probe_process(__rte_unused struct rte_graph *graph, __rte_unused struct rte_node *node, void **objs, uint16_t nb_objs)
+{
+	uint16_t i;
 
-	opt_path_id = get_min_delay_path_id(all_paths_delay_list, PATH_NB);
+	for (i = 0; i < nb_objs; i++)
+		hopa_cp_probe_pkt_progress(objs[i]);
+	rte_pktmbuf_free_bulk((struct rte_mbuf **)objs, nb_objs);
 
-	HOPA_LOG_INFO("opt_path_id = %d", opt_path_id);
+	return nb_objs;
 }
 
-static void hopa_cp_repath_pkt_progress(struct rte_mbuf *hopa_cp_mbuf)
+static uint16_t hopa_dp_ts_process(struct rte_graph *graph, struct rte_node *node, void **objs, uint16_t nb_objs)
 {
-	// 1、触发换路(通知数据面 DP)  TODO
+	struct rte_mbuf *reply;
+	uint16_t i;
 
-	// 2、回复repath_ack
-	struct rte_mbuf *repath_ack_mbuf;
-	repath_ack_mbuf = encode_repath_ack_pkt();
-	rte_ring_mp_enqueue_burst(hopa_in_out_ring_ins->hopa_out_ring, (void **)&repath_ack_mbuf, 1, NULL);
+	for (i = 0; i < nb_objs; i++)
+		if ((reply = hopa_dp_ts_pkt_progress(objs[i])) != NULL)
+			rte_node_enqueue_x1(graph, node, HOPA_NEXT_TX, reply);
+	rte_pktmbuf_free_bulk((struct rte_mbuf **)objs, nb_objs);
 
-	// 3、启动定时器  TODO   收端初始化定时器
-	rte_timer_reset(&retran_timer, rte_get_timer_hz() * 2, SINGLE, rte_lcore_id(), timer_cb, NULL);
+	return nb_objs;
 }
 
-static void hopa_cp_repath_ack_pkt_progress(struct rte_mbuf *hopa_cp_mbuf)
+static uint16_t hopa_repath_process(struct rte_graph *graph, struct rte_node *node, void **objs, uint16_t nb_objs)
 {
-	// TODO   收到ack, 确认上一个repath已经收到, 停止定时器
-	rte_timer_stop(&retran_timer);
+	struct rte_mbuf *reply;
+	uint16_t i;
+
+	for (i = 0; i < nb_objs; i++)
+		if ((reply = hopa_cp_repath_pkt_progress(objs[i])) != NULL)
+			rte_node_enqueue_x1(graph, node, HOPA_NEXT_TX, reply);
+	rte_pktmbuf_free_bulk((struct rte_mbuf **)objs, nb_objs);
+
+	return nb_objs;
 }
 
-static void hopa_dp_ts_pkt_progress(struct rte_mbuf *hopa_cp_mbuf)
+static uint16_t hopa_repath_ack_process(__rte_unused struct rte_graph *graph, __rte_unused struct rte_node *node, void **objs, uint16_t nb_objs)
 {
-	uint8_t is_repath = one_path_check(1);
-	if (is_repath)
-	{
-		struct rte_mbuf *repath_mbuf;
-		repath_mbuf = encode_repath_pkt((uint8_t)opt_path_id);
-		rte_ring_mp_enqueue_burst(hopa_in_out_ring_ins->hopa_out_ring, (void **)&repath_mbuf, 1, NULL);
-	}
+	uint16_t i;
+
+	for (i = 0; i < nb_objs; i++)
+		hopa_cp_repath_ack_pkt_progress(objs[i]);
+	rte_pktmbuf_free_bulk((struct rte_mbuf **)objs, nb_objs);
+
+	return nb_objs;
 }
 
-static bool one_path_check()
+static uint16_t hopa_discover_process(struct rte_graph *graph, struct rte_node *node, void **objs, uint16_t nb_objs)
 {
-	// TODO   随路检测算法 --->  换路时机
-	cur_path_info->delta_t = cur_path_info->cur_ts - cur_path_info->last_ts;
+	struct rte_mbuf *reply;
+	uint16_t i;
 
-	/* 计算 max_dt    min_dt */
-	if (cur_path_info->cur_dt > cur_path_info->max_dt)
-		cur_path_info->max_dt = cur_path_info->cur_dt;
-	if (cur_path_info->cur_dt < cur_path_info->min_dt)
-		cur_path_info->min_dt = cur_path_info->cur_dt;
+	/* lcore_probe owns the discovery state of a -D sender : answers go to it
+	 * through the in ring, as without -g */
+	if (discover_table != NULL)
+	{
+		hopa_ring_enqueue(hopa_in_out_ring_ins->hopa_in_ring, &hopa_in_out_ring_ins->in_ev, (struct rte_mbuf **)objs, nb_objs,
+						  &tx_stats.in_ring_drops);
+		return nb_objs;
+	}
 
-	/* 计算 绝对取值 */
-	cur_path_info->thres_dt = cur_path_info->min_dt + R * (cur_path_info->max_dt - cur_path_info->min_dt);
+	for (i = 0; i < nb_objs; i++)
+		if ((reply = hopa_discover_pkt_progress(objs[i])) != NULL)
+			rte_node_enqueue_x1(graph, node, HOPA_NEXT_TX, reply);
+	rte_pktmbuf_free_bulk((struct rte_mbuf **)objs, nb_objs);
 
-	/* 计算 相对取值 */
-	cur_path_info->cur_dt_grad = (cur_path_info->cur_dt - cur_path_info->last_1_dt) / cur_path_info->delta_t;
+	return nb_objs;
+}
 
-	bool b2 = 2 * cur_path_info->last_3_dt >= (cur_path_info->thres_dt - cur_path_info->min_dt);
-	bool b3 = cur_path_info->last_1_dt_grad > 0 && cur_path_info->last_2_dt_grad > 0 && cur_path_info->last_3_dt_grad > 0;
-	bool b4 = cur_path_info->cur_dt_grad >= (cur_path_info->thres_dt - cur_path_info->min_dt) / (2 * cur_path_info->delta_t);
-	bool is_try_repath = (b2 && b3) || b4;
+static uint16_t hopa_live_process(__rte_unused struct rte_graph *graph, __rte_unused struct rte_node *node, void **objs, uint16_t nb_objs)
+{
+	uint16_t i;
 
-	bool is_force_repath = cur_path_info->cur_dt >= cur_path_info->thres_dt;
+	for (i = 0; i < nb_objs; i++)
+		hopa_live_pkt_progress(objs[i]);
+	rte_pktmbuf_free_bulk((struct rte_mbuf **)objs, nb_objs);
 
-	return is_try_repath || is_force_repath;
+	return nb_objs;
 }
 
-static uint8_t get_min_delay_path_id(uint64_t *all_paths_delay_list, int length)
+static uint16_t hopa_train_process(__rte_unused struct rte_graph *graph, __rte_unused struct rte_node *node, void **objs, uint16_t nb_objs)
 {
-	uint8_t path_id = 0;
+	uint16_t i;
 
-	for (int i = 1; i < length; i++)
-	{
-		if (all_paths_delay_list[i] < all_paths_delay_list[path_id])
-		{
-			path_id = i;
-		}
-	}
+	for (i = 0; i < nb_objs; i++)
+		hopa_train_pkt_progress(objs[i]);
+	rte_pktmbuf_free_bulk((struct rte_mbuf **)objs, nb_objs);
 
-	return path_id;
+	return nb_objs;
 }
 
-static int
-lcore_probe(__rte_unused void *arg)
+static uint16_t hopa_report_process(__rte_unused struct rte_graph *graph, __rte_unused struct rte_node *node, void **objs, uint16_t nb_objs)
 {
+	uint16_t i;
 
-	unsigned i;
-	struct rte_mbuf *mbufs[PATH_NB];
+	for (i = 0; i < nb_objs; i++)
+		hopa_report_pkt_progress(objs[i]);
+	rte_pktmbuf_free_bulk((struct rte_mbuf **)objs, nb_objs);
 
-	while (1)
-	{
-		for (i = 0; i < PATH_NB; i++)
-			mbufs[i] = encode_probe_pkt(i + 1);
+	return nb_objs;
+}
 
-		rte_ring_mp_enqueue_burst(hopa_in_out_ring_ins->hopa_out_ring, (void **)&mbufs, PATH_NB, NULL);
+static uint16_t hopa_drop_process(__rte_unused struct rte_graph *graph, __rte_unused struct rte_node *node, void **objs, uint16_t nb_objs)
+{
+	rte_pktmbuf_free_bulk((struct rte_mbuf **)objs, nb_objs);
 
-		// usleep(PROBE_GAP * 1000);
-		sleep(2); // for test
-	}
+	return nb_objs;
 }
 
-static int
-lcore_stats(__rte_unused void *arg)
+/* tx : P0 queue 0, no buffering, the vector is the burst */
+static uint16_t hopa_tx_process(__rte_unused struct rte_graph *graph, __rte_unused struct rte_node *node, void **objs, uint16_t nb_objs)
 {
-	struct rte_mbuf *bufs[BURST_SIZE];
-	uint16_t nb_rx;
-	uint16_t i;
+	hopa_tx_burst(PORT_P0, 0, (struct rte_mbuf **)objs, nb_objs);
 
-	/* timer init */
+	return nb_objs;
+}
+
+static struct rte_node_register hopa_eth_rx_node = {
+	.process = hopa_eth_rx_process,
+	.flags = RTE_NODE_SOURCE_F,
+	.name = "hopa_eth_rx",
+	.nb_edges = 1,
+	.next_nodes = {"hopa_classify"},
+};
+RTE_NODE_REGISTER(hopa_eth_rx_node);
+
+static struct rte_node_register hopa_out_rx_node = {
+	.process = hopa_out_rx_process,
+	.flags = RTE_NODE_SOURCE_F,
+	.name = "hopa_out_rx",
+	.nb_edges = 1,
+	.next_nodes = {[HOPA_NEXT_TX] = "hopa_tx"},
+};
+RTE_NODE_REGISTER(hopa_out_rx_node);
+
+static struct rte_node_register hopa_classify_node = {
+	.process = hopa_classify_process,
+	.name = "hopa_classify",
+	.nb_edges = HOPA_CLASSIFY_NEXT_MAX,
+	.next_nodes = {
+		[HOPA_CLASSIFY_NEXT_PROBE] = "hopa_probe",
+		[HOPA_CLASSIFY_NEXT_DP_TS] = "hopa_dp_ts",
+		[HOPA_CLASSIFY_NEXT_REPATH] = "hopa_repath",
+		[HOPA_CLASSIFY_NEXT_REPATH_ACK] = "hopa_repath_ack",
+		[HOPA_CLASSIFY_NEXT_DISCOVER] = "hopa_discover",
+		[HOPA_CLASSIFY_NEXT_LIVE] = "hopa_live",
+		[HOPA_CLASSIFY_NEXT_TRAIN] = "hopa_train",
+		[HOPA_CLASSIFY_NEXT_REPORT] = "hopa_report",
+		[HOPA_CLASSIFY_NEXT_DROP] = "hopa_drop",
+	},
+};
+RTE_NODE_REGISTER(hopa_classify_node);
+
+static struct rte_node_register hopa_probe_node = {
+	.process = hopa_probe_process,
+	.name = "hopa_probe",
+};
+RTE_NODE_REGISTER(hopa_probe_node);
+
+static struct rte_node_register hopa_dp_ts_node = {
+	.process = hopa_dp_ts_process,
+	.name = "hopa_dp_ts",
+	.nb_edges = 1,
+	.next_nodes = {[HOPA_NEXT_TX] = "hopa_tx"},
+};
+RTE_NODE_REGISTER(hopa_dp_ts_node);
+
+static struct rte_node_register hopa_repath_node = {
+	.process = hopa_repath_process,
+	.name = "hopa_repath",
+	.nb_edges = 1,
+	.next_nodes = {[HOPA_NEXT_TX] = "hopa_tx"},
+};
+RTE_NODE_REGISTER(hopa_repath_node);
+
+static struct rte_node_register hopa_repath_ack_node = {
+	.process = hopa_repath_ack_process,
+	.name = "hopa_repath_ack",
+};
+RTE_NODE_REGISTER(hopa_repath_ack_node);
+
+static struct rte_node_register hopa_discover_node = {
+	.process = hopa_discover_process,
+	.name = "hopa_discover",
+	.nb_edges = 1,
+	.next_nodes = {[HOPA_NEXT_TX] = "hopa_tx"},
+};
+RTE_NODE_REGISTER(hopa_discover_node);
+
+static struct rte_node_register hopa_live_node = {
+	.process = hopa_live_process,
+	.name = "hopa_live",
+};
+RTE_NODE_REGISTER(hopa_live_node);
+
+static struct rte_node_register hopa_train_node = {
+	.process = hopa_train_process,
+	.name = "hopa_train",
+};
+RTE_NODE_REGISTER(hopa_train_node);
+
+static struct rte_node_register hopa_report_node = {
+	.process = hopa_report_process,
+	.name = "hopa_report",
+};
+RTE_NODE_REGISTER(hopa_report_node);
+
+static struct rte_node_register hopa_drop_node = {
+	.process = hopa_drop_process,
+	.name = "hopa_drop",
+};
+RTE_NODE_REGISTER(hopa_drop_node);
+
+static struct rte_node_register hopa_tx_node = {
+	.process = hopa_tx_process,
+	.name = "hopa_tx",
+};
+RTE_NODE_REGISTER(hopa_tx_node);
+
+/* Main lcore loop of -g 1 : one graph walk per iteration instead of the rings. */
+static void hopa_graph_main(struct hopa_in_out_ring *in_out_ring, int rx_intr)
+{
+	const char *patterns[] = {HOPA_GRAPH_PATTERN};
+	struct rte_graph_param graph_conf = {
+		.socket_id = rte_socket_id(),
+		.nb_node_patterns = RTE_DIM(patterns),
+		.node_patterns = patterns,
+	};
+	struct rte_graph_cluster_stats_param stats_conf = {
+		.socket_id = rte_socket_id(),
+		.f = stdout,
+		.nb_graph_patterns = RTE_DIM(patterns),
+		.graph_patterns = patterns,
+	};
+	struct rte_graph_cluster_stats *graph_stats;
+	struct rte_graph *graph;
+	struct hopa_idle idle = {0};
+	uint64_t cur_tsc;
+	uint64_t watch_tsc = 0;
+	uint64_t stats_tsc = 0;
+	uint64_t peer_tsc = 0;
+	const uint64_t watch_period = (rte_get_tsc_hz() + US_PER_S - 1) / US_PER_S * TX_FLUSH_US;
+
+	if (rte_graph_create(HOPA_GRAPH_NAME, &graph_conf) == RTE_GRAPH_ID_INVALID)
+		rte_exit(EXIT_FAILURE, "Cannot create graph %s: %s\n", HOPA_GRAPH_NAME, rte_strerror(rte_errno));
+	graph = rte_graph_lookup(HOPA_GRAPH_NAME);
+	graph_stats = rte_graph_cluster_stats_create(&stats_conf);
+	if (graph == NULL || graph_stats == NULL)
+		rte_exit(EXIT_FAILURE, "Cannot look up graph %s\n", HOPA_GRAPH_NAME);
+
+	/* retran_timer is armed by hopa_repath on this lcore */
 	rte_timer_subsystem_init();
 	rte_timer_init(&retran_timer);
-	srand(time(NULL));
-
-	cur_path_info = (struct cur_path_info *)malloc(sizeof(struct cur_path_info));
-
-	// struct rte_ether_hdr *eth_hdr;
-	struct rte_ipv4_hdr *ipv4_hdr;
-	struct rte_udp_hdr *udp_hdr;
-	struct hopa_cp_hdr *hopa_cp_hdr;
-
-	uint64_t prev_tsc = 0, cur_tsc, diff_tsc;
-	uint64_t timer_resolution_cycles = rte_get_timer_hz() * 10 / 1000;
 
 	while (1)
 	{
-		// timer
-		cur_tsc = rte_get_timer_cycles();
-		diff_tsc = cur_tsc - prev_tsc;
-		if (diff_tsc > timer_resolution_cycles)
+		rte_timer_manage();
+
+		graph_work = 0;
+		rte_graph_walk(graph);
+
+		cur_tsc = rte_rdtsc();
+		hopa_live_check(cur_tsc);
+		if (cur_tsc - watch_tsc > watch_period)
 		{
-			rte_timer_manage();
-			prev_tsc = cur_tsc;
+			pool_watch(&rx_pool_stats);
+			pool_watch(&cp_pool_stats);
+			watch_tsc = cur_tsc;
 		}
 
-		// nb_rx = rte_eth_rx_burst(PORT_P0, 0, bufs, BURST_SIZE);
-		nb_rx = rte_ring_mc_dequeue_burst(hopa_in_out_ring_ins->hopa_in_ring, (void **)bufs, BURST_SIZE, NULL);
-
-		for (i = 0; i < nb_rx; i++)
+		/* per node calls, objs and cycles */
+		if (cur_tsc - stats_tsc > rte_get_tsc_hz() * STATS_PERIOD_S)
 		{
-			// eth_hdr = rte_pktmbuf_mtod_offset(bufs[i], struct rte_ether_hdr *, 0);
-			ipv4_hdr = rte_pktmbuf_mtod_offset(bufs[i], struct rte_ipv4_hdr *, sizeof(struct rte_ether_hdr));
-			if (ipv4_hdr->next_proto_id == IPPROTO_UDP)
-			{
-				udp_hdr = (struct rte_udp_hdr *)(ipv4_hdr + 1);
+			rte_graph_cluster_stats_get(graph_stats, 0);
+			print_tx_stats();
+			print_select_stats();
+			print_live_stats();
+			print_train_stats();
+			print_int_stats();
+			print_pool_stats();
+			stats_tsc = cur_tsc;
+		}
 
-				if (rte_be_to_cpu_16(udp_hdr->src_port) == SRC_PORT) // HOPA
-				{
-					hopa_cp_hdr = (struct hopa_cp_hdr *)(udp_hdr + 1);
-
-					if (hopa_cp_hdr->flag == HOPA_CP)
-					{
-						switch (hopa_cp_hdr->cp_flag)
-						{
-						case PROBE:
-							hopa_cp_probe_pkt_progress(bufs[i]);
-							break;
-						case REPATH:
-							hopa_cp_repath_pkt_progress(bufs[i]);
-							break;
-						case REPATH_ACK:
-							hopa_cp_repath_ack_pkt_progress(bufs[i]);
-							break;
-
-						default:
-							printf("hopa_cp_flag unknow error.\n");
-							break;
-						}
-					}
-					else if (hopa_cp_hdr->flag == HOPA_DP)
-						hopa_dp_ts_pkt_progress(bufs[i]);
-				}
-			}
+		if (cur_tsc - peer_tsc > rte_get_tsc_hz() * PEER_RELOAD_S)
+		{
+			peer_table_watch();
+			policy_watch();
+			peer_tsc = cur_tsc;
 		}
 
-		for (i = 0; i < nb_rx; i++)
-			rte_pktmbuf_free(bufs[i]);
+		if (hopa_idle_poll(&idle, graph_work))
+			hopa_main_sleep(in_out_ring, rx_intr);
 	}
 }
 
@@ -487,9 +3414,14 @@ int main(int argc, char *argv[])
 	struct hopa_in_out_ring *m_hopa_in_out_ring;
 	struct rte_mbuf *recv_mbuf[BURST_SIZE] = {NULL};
 	struct rte_mbuf *send_mbuf[BURST_SIZE] = {NULL};
+	struct hopa_idle idle = {0};
+	struct rte_epoll_event out_epoll_ev = {0};
+	struct rte_eth_dev_tx_buffer *tx_buffer;
 
 	unsigned nb_ports;
-	uint16_t portid;
+	unsigned nb_mbufs;
+	unsigned int out_flags;
+	int socket_id;
 
 	int ret = rte_eal_init(argc, argv);
 	if (ret < 0)
@@ -499,8 +3431,47 @@ int main(int argc, char *argv[])
 	argv += ret;
 
 	struct hopa_param hopa_param = {0};
+	hopa_param.cp_pool = DEF_CP_POOL;
+	hopa_param.probe_bw_kbps = DEF_PROBE_BW_KBPS;
+	hopa_param.paths_shm = HOPA_PATHS_SHM;
+	hopa_param.live_mult = DEF_LIVE_MULT;
+	hopa_param.train_len = DEF_TRAIN_LEN;
+	hopa_param.train_frame = DEF_TRAIN_FRAME;
+	hopa_param.int_dscp = -1;
+	hopa_param.log_level = HOPA_LOG_LEVEL_INFO;
 	parse_args(&hopa_param, argc, argv);
 	print_hopa_param(&hopa_param);
+	hopa_log_level = hopa_param.log_level;
+	probe_bw_kbps = hopa_param.probe_bw_kbps;
+
+	live_interval_tsc = rte_get_timer_hz() / US_PER_S * hopa_param.live_us;
+	live_mult = hopa_param.live_mult;
+
+	/* best path selection, both the standalone and the -o CP */
+	hopa_select_conf_default(&select_conf);
+	if (hopa_param.select_spec != NULL && hopa_select_conf_parse(&select_conf, hopa_param.select_spec) < 0)
+		rte_exit(EXIT_FAILURE, "Bad hysteresis %s\n", hopa_param.select_spec);
+	if (hopa_param.select_log != NULL)
+	{
+		select_log = fopen(hopa_param.select_log, "a");
+		if (select_log == NULL)
+			rte_exit(EXIT_FAILURE, "Cannot open decision log %s\n", hopa_param.select_log);
+		setvbuf(select_log, NULL, _IOLBF, 0);
+	}
+
+	/* no port, no pool, no ring of our own: all of them are ovs-vswitchd's */
+	if (hopa_param.ovs)
+	{
+		printf("-----------------ovs-vswitchd CP-----------------\n");
+		/* the compiled-in DST peer is not on the OVS fabric, learn instead */
+		paths_init(hopa_param.paths_shm);
+		policy_init(hopa_param.paths_shm, hopa_param.policy_file);
+		peer_table_init(hopa_param.peer_file, false);
+		ovs_attach();
+		lcore_ovs(NULL);
+		rte_eal_cleanup();
+		return 0;
+	}
 
 	/* Check that there is an even number of ports to send/receive on. */
 	nb_ports = rte_eth_dev_count_avail();
@@ -508,24 +3479,123 @@ int main(int argc, char *argv[])
 
 	nb_ports = 1; // one port (p0) !!!
 
-	/* Creates a new mempool in memory to hold the mbufs. */
-	mbuf_pool = rte_pktmbuf_pool_create("MBUF_POOL", NUM_MBUFS * nb_ports,
-										MBUF_CACHE_SIZE, 0, RTE_MBUF_DEFAULT_BUF_SIZE, rte_socket_id());
+	/* Pools live on the NIC's NUMA socket. */
+	socket_id = rte_eth_dev_socket_id(PORT_P0);
+	if (socket_id == SOCKET_ID_ANY)
+		socket_id = rte_socket_id();
+
+	/* probe trains : the sender's budget and shape, the receiver stamps rx */
+	if (hopa_param.train_kbps)
+	{
+		if (hopa_param.train_len < 2 || hopa_param.train_len > HOPA_TRAIN_MAX_LEN || hopa_param.train_frame > RTE_ETHER_MAX_LEN - RTE_ETHER_CRC_LEN ||
+			hopa_param.train_frame < sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv4_hdr) + sizeof(struct rte_udp_hdr) + sizeof(struct hopa_cp_hdr))
+			rte_exit(EXIT_FAILURE, "Bad probe train %u:%u:%u\n", hopa_param.train_kbps, hopa_param.train_len, hopa_param.train_frame);
+		train_kbps = hopa_param.train_kbps;
+		train_len = hopa_param.train_len;
+		train_frame = hopa_param.train_frame;
+		if (!hopa_param.is_sender && rte_mbuf_dyn_rx_timestamp_register(&train_ts_off, &train_ts_rx_flag) < 0)
+			rte_exit(EXIT_FAILURE, "Cannot register the rx timestamp field: %s\n", rte_strerror(rte_errno));
+		train_ts_hz = rte_get_timer_hz();
+	}
+
+	/* switch telemetry : the receiver strips INT at rx, the handlers read it from the mbuf */
+	if (hopa_param.int_dscp >= 0 && !hopa_param.is_sender)
+	{
+		static const struct rte_mbuf_dynfield int_desc = {
+			.name = "hopa_int_sample",
+			.size = sizeof(struct hopa_int_sample),
+			.align = __alignof__(struct hopa_int_sample),
+		};
+
+		int_dscp = hopa_param.int_dscp;
+		int_off = rte_mbuf_dynfield_register(&int_desc);
+		if (int_off < 0)
+			rte_exit(EXIT_FAILURE, "Cannot register the INT field: %s\n", rte_strerror(rte_errno));
+	}
+
+	/* Rx pool: rx descriptors + in ring + bursts in flight + per-lcore caches, + trains of the sender. */
+	nb_mbufs = rte_align32pow2(nb_ports * (RX_RING_SIZE + RX_RING_SIZE + 2 * BURST_SIZE) + MBUF_CACHE_SIZE * rte_lcore_count() +
+							   (hopa_param.is_sender && train_kbps ? TRAIN_BURST * HOPA_TRAIN_MAX_LEN : 0)) - 1;
+	mbuf_pool = pool_create("MBUF_POOL", nb_mbufs, MBUF_CACHE_SIZE, RTE_MBUF_DEFAULT_BUF_SIZE, socket_id, &rx_pool_stats);
 
 	if (mbuf_pool == NULL)
 		rte_exit(EXIT_FAILURE, "Cannot create mbuf pool\n");
 
+	/* CP pool: small data room, burst sized cache. */
+	if (hopa_param.cp_pool)
+	{
+		cp_mbuf_pool = pool_create("CP_MBUF_POOL", CP_NUM_MBUFS, CP_MBUF_CACHE_SIZE, CP_MBUF_DATA_ROOM, socket_id, &cp_pool_stats);
+		if (cp_mbuf_pool == NULL)
+			rte_exit(EXIT_FAILURE, "Cannot create cp mbuf pool\n");
+	}
+	else
+		cp_mbuf_pool = mbuf_pool;
+
 	/* Initialize P0 port. */
-	if (port_init(PORT_P0, mbuf_pool) != 0)
-		rte_exit(EXIT_FAILURE, "Cannot init port %" PRIu16 "\n", portid);
+	if (port_init(PORT_P0, mbuf_pool, hopa_param.rx_intr) != 0)
+		rte_exit(EXIT_FAILURE, "Cannot init port %" PRIu16 "\n", PORT_P0);
 
 	/* ring buf */
 	m_hopa_in_out_ring = get_ring_instance();
 	if (m_hopa_in_out_ring == NULL)
 		rte_exit(EXIT_FAILURE, "ring buffer init failed\n");
 
+	/* a sender's graph queues repaths and reports next to lcore_probe */
+	out_flags = hopa_param.graph && hopa_param.is_sender ? RING_F_SC_DEQ : RING_F_SP_ENQ | RING_F_SC_DEQ;
 	m_hopa_in_out_ring->hopa_in_ring = rte_ring_create("in ring", RX_RING_SIZE, rte_socket_id(), RING_F_SP_ENQ | RING_F_SC_DEQ);
-	m_hopa_in_out_ring->hopa_out_ring = rte_ring_create("out ring", TX_RING_SIZE, rte_socket_id(), RING_F_SP_ENQ | RING_F_SC_DEQ);
+	m_hopa_in_out_ring->hopa_out_ring = rte_ring_create("out ring", TX_RING_SIZE, rte_socket_id(), out_flags);
+	m_hopa_in_out_ring->hopa_out_prio_ring = rte_ring_create("out prio ring", TX_RING_SIZE, rte_socket_id(), out_flags);
+	if (m_hopa_in_out_ring->hopa_in_ring == NULL || m_hopa_in_out_ring->hopa_out_ring == NULL || m_hopa_in_out_ring->hopa_out_prio_ring == NULL)
+		rte_exit(EXIT_FAILURE, "ring create failed\n");
+
+	/* tx buffer for probes, flushed every TX_FLUSH_US */
+	tx_buffer = rte_zmalloc_socket("tx_buffer", RTE_ETH_TX_BUFFER_SIZE(BURST_SIZE), 0, rte_eth_dev_socket_id(PORT_P0));
+	if (tx_buffer == NULL)
+		rte_exit(EXIT_FAILURE, "Cannot allocate tx buffer\n");
+	rte_eth_tx_buffer_init(tx_buffer, BURST_SIZE);
+	if (rte_eth_tx_buffer_set_err_callback(tx_buffer, hopa_tx_buffer_err_cb, NULL) != 0)
+		rte_exit(EXIT_FAILURE, "Cannot set tx buffer error callback\n");
+
+	if (hopa_ring_event_init(&m_hopa_in_out_ring->in_ev) != 0 || hopa_ring_event_init(&m_hopa_in_out_ring->out_ev) != 0)
+		rte_exit(EXIT_FAILURE, "ring eventfd init failed\n");
+
+	/* idle main loop: wake on Rx interrupt or on the out ring eventfd */
+	if (hopa_param.rx_intr)
+	{
+		if (rte_eth_dev_rx_intr_ctl_q(PORT_P0, 0, RTE_EPOLL_PER_THREAD, RTE_INTR_EVENT_ADD, NULL) != 0)
+		{
+			HOPA_LOG_WARN("port %d has no Rx interrupt, fall back to %d us nap", PORT_P0, IDLE_NAP_US);
+			hopa_param.rx_intr = 0;
+		}
+		else
+		{
+			out_epoll_ev.epdata.event = EPOLLIN;
+			rte_epoll_ctl(RTE_EPOLL_PER_THREAD, EPOLL_CTL_ADD, m_hopa_in_out_ring->out_ev.efd, &out_epoll_ev);
+		}
+	}
+
+	/* before the peers: they are solved when added */
+	if (hopa_param.ecmp_spec != NULL)
+	{
+		if (hopa_ecmp_init(&ecmp, hopa_param.ecmp_spec, PATH_NB) < 0)
+			rte_exit(EXIT_FAILURE, "Bad ECMP hash %s\n", hopa_param.ecmp_spec);
+		if (ecmp.n_members < PATH_NB)
+			HOPA_LOG_WARN("%u ECMP members for %d paths, path k uses member k %% %u", ecmp.n_members, PATH_NB, ecmp.n_members);
+	}
+
+	/* discovery overrides the solved ports once a peer is traced */
+	if (hopa_param.discover_pps)
+	{
+		if (hopa_param.is_sender)
+			discover_init(hopa_param.discover_pps);
+		else
+			HOPA_LOG_WARN("-D is for the sender, the receiver only echoes");
+	}
+
+	/* peers */
+	paths_init(hopa_param.paths_shm);
+	policy_init(hopa_param.paths_shm, hopa_param.policy_file);
+	peer_table_init(hopa_param.peer_file, true);
 
 	/* TODO */
 	if (hopa_param.is_sender)
@@ -533,38 +3603,85 @@ int main(int argc, char *argv[])
 		printf("-----------------sender-----------------\n");
 		rte_eal_remote_launch(lcore_probe, NULL, 1);
 	}
-	else
+	else if (!hopa_param.graph)
 	{
 		printf("-----------------receiver-----------------\n");
 		rte_eal_remote_launch(lcore_stats, NULL, 1);
 	}
 
-	int rx_num;
-	int total_num;
-	int offset;
-	int tx_num;
+	/* the handlers run on the main lcore, in the graph */
+	if (hopa_param.graph)
+	{
+		printf("-----------------graph-----------------\n");
+		hopa_graph_main(m_hopa_in_out_ring, hopa_param.rx_intr);
+		rte_eal_cleanup();
+		return 0;
+	}
+
+	uint16_t rx_num;
+	uint16_t prio_num;
+	uint16_t total_num;
+	uint16_t i;
+	uint64_t cur_tsc;
+	uint64_t flush_tsc = 0;
+	uint64_t stats_tsc = 0;
+	uint64_t peer_tsc = 0;
+	const uint64_t drain_tsc = (rte_get_tsc_hz() + US_PER_S - 1) / US_PER_S * TX_FLUSH_US;
 
 	while (1)
 	{
 		rte_timer_manage();
 		// rx
 		rx_num = rte_eth_rx_burst(PORT_P0, 0, recv_mbuf, BURST_SIZE);
+		tx_stats.rx_pkts += rx_num;
+		hopa_rx_stamp(recv_mbuf, rx_num);
+		hopa_int_strip(recv_mbuf, rx_num);
 		if (rx_num > 0)
-			rte_ring_sp_enqueue_burst(m_hopa_in_out_ring->hopa_in_ring, (void **)recv_mbuf, rx_num, NULL);
+			hopa_ring_enqueue(m_hopa_in_out_ring->hopa_in_ring, &m_hopa_in_out_ring->in_ev, recv_mbuf, rx_num, &tx_stats.in_ring_drops);
 
-		// tx
+		// tx : repath / repath_ack first, bypassing the buffer
+		prio_num = rte_ring_sc_dequeue_burst(m_hopa_in_out_ring->hopa_out_prio_ring, (void **)send_mbuf, BURST_SIZE, NULL);
+		if (prio_num > 0)
+			tx_stats.tx_prio_pkts += hopa_tx_burst(PORT_P0, 0, send_mbuf, prio_num);
+
+		// tx : probes
 		total_num = rte_ring_sc_dequeue_burst(m_hopa_in_out_ring->hopa_out_ring, (void **)send_mbuf, BURST_SIZE, NULL);
-		if (total_num > 0)
+		for (i = 0; i < total_num; i++)
+			tx_stats.tx_pkts += rte_eth_tx_buffer(PORT_P0, 0, tx_buffer, send_mbuf[i]);
+
+		cur_tsc = rte_rdtsc();
+		if (cur_tsc - flush_tsc > drain_tsc)
 		{
-			offset = 0;
-			while (offset < total_num)
-			{
-				tx_num = rte_eth_tx_burst(PORT_P0, 0, &send_mbuf[offset], total_num - offset);
-				if (tx_num > 0)
-				{
-					offset += tx_num;
-				}
-			}
+			tx_stats.tx_pkts += rte_eth_tx_buffer_flush(PORT_P0, 0, tx_buffer);
+			flush_tsc = cur_tsc;
+
+			pool_watch(&rx_pool_stats);
+			pool_watch(&cp_pool_stats);
+		}
+
+		if (cur_tsc - stats_tsc > rte_get_tsc_hz() * STATS_PERIOD_S)
+		{
+			print_tx_stats();
+			print_select_stats();
+			print_live_stats();
+			print_train_stats();
+			print_int_stats();
+			print_pool_stats();
+			stats_tsc = cur_tsc;
+		}
+
+		if (cur_tsc - peer_tsc > rte_get_tsc_hz() * PEER_RELOAD_S)
+		{
+			peer_table_watch();
+			policy_watch();
+			peer_tsc = cur_tsc;
+		}
+
+		// idle
+		if (hopa_idle_poll(&idle, rx_num + prio_num + total_num))
+		{
+			tx_stats.tx_pkts += rte_eth_tx_buffer_flush(PORT_P0, 0, tx_buffer);
+			hopa_main_sleep(m_hopa_in_out_ring, hopa_param.rx_intr);
 		}
 	}
 
@@ -0,0 +1,210 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+#include "hopa_ecmp.h"
+
+/*
+ * Offline ECMP solver: UDP source ports per member for (src, dst) pairs.
+ *
+ *   hopa_ecmp -e crc32:0:4 -S 192.168.200.2 -D 192.168.200.1 [-D ...] [-f peers] [-p dport] [-r lo-hi]
+ *
+ * Prints "src dst dport member sport", each port checked against a direct
+ * CRC of its tuple. -b <pairs> times the solver against one CRC per
+ * candidate port instead.
+ */
+
+#define ECMP_DEF_DPORT (5678)   /* DST_PORT_PATH_1 */
+#define ECMP_DEF_LO (49152)
+#define ECMP_DEF_HI (65535)
+#define ECMP_DEF_MEMBERS (4)    /* PATH_NB */
+#define ECMP_MAX_DSTS (1024)
+#define ECMP_PROTO_UDP (17)
+
+static uint32_t dsts[ECMP_MAX_DSTS];
+static uint32_t n_dsts;
+
+static void usage(void)
+{
+	printf("Options:\n");
+	printf(" -e <hash>            <crc>[:<seed>[:<members>]], crc16 | crc16_ccitt | crc32 | crc32c. (members default %d)\n", ECMP_DEF_MEMBERS);
+	printf(" -S <src ip>          Local address.\n");
+	printf(" -D <dst ip>          Peer address, repeatable.\n");
+	printf(" -f <peer file>       Peers from a hopa_cp peer file.\n");
+	printf(" -p <dport>           UDP destination port. (default %d)\n", ECMP_DEF_DPORT);
+	printf(" -r <lo-hi>           Source port range. (default %d-%d)\n", ECMP_DEF_LO, ECMP_DEF_HI);
+	printf(" -b <pairs>           Time the solver over random pairs instead.\n");
+}
+
+static int parse_ip(const char *s, uint32_t *ip)
+{
+	struct in_addr addr;
+
+	if (inet_pton(AF_INET, s, &addr) != 1)
+		return -1;
+	*ip = ntohl(addr.s_addr);
+	return 0;
+}
+
+/* first column of a hopa_cp peer file */
+static int load_peers(const char *file)
+{
+	char line[256], ip[64];
+	FILE *f = fopen(file, "r");
+
+	if (f == NULL)
+		return -1;
+	while (fgets(line, sizeof(line), f) != NULL && n_dsts < ECMP_MAX_DSTS)
+	{
+		if (line[0] == '#' || sscanf(line, "%63s", ip) != 1)
+			continue;
+		if (parse_ip(ip, &dsts[n_dsts]) == 0)
+			n_dsts++;
+	}
+	fclose(f);
+
+	return 0;
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* the trial and error it replaces */
+static uint32_t solve_naive(const struct hopa_ecmp *e, uint32_t src, uint32_t dst, uint16_t dport, uint16_t lo, uint16_t hi, uint16_t *ports)
+{
+	uint32_t found = 0;
+
+	memset(ports, 0, e->n_members * sizeof(*ports));
+	for (uint32_t sport = lo; sport <= hi && found < e->n_members; sport++)
+	{
+		uint32_t m = hopa_ecmp_member(e, src, dst, ECMP_PROTO_UDP, sport, dport);
+
+		if (ports[m] == 0)
+		{
+			ports[m] = sport;
+			found++;
+		}
+	}
+
+	return found;
+}
+
+static void bench(const struct hopa_ecmp *e, uint32_t src, uint16_t dport, uint16_t lo, uint16_t hi, uint32_t pairs)
+{
+	uint16_t ports[HOPA_ECMP_MAX_MEMBERS], naive[HOPA_ECMP_MAX_MEMBERS];
+	uint64_t t, t_solve = 0, t_naive = 0;
+	uint32_t mismatch = 0;
+
+	srand(1);
+	for (uint32_t i = 0; i < pairs; i++)
+	{
+		uint32_t dst = ((uint32_t)rand() << 16) ^ rand();
+
+		t = now_ns();
+		hopa_ecmp_solve(e, src, dst, ECMP_PROTO_UDP, dport, lo, hi, ports);
+		t_solve += now_ns() - t;
+
+		t = now_ns();
+		solve_naive(e, src, dst, dport, lo, hi, naive);
+		t_naive += now_ns() - t;
+
+		mismatch += memcmp(ports, naive, e->n_members * sizeof(*ports)) != 0;
+	}
+
+	printf("%u pairs, %u members : solve %.0f ns/pair, one CRC per port %.0f ns/pair, %u mismatch\n",
+		   pairs, e->n_members, (double)t_solve / pairs, (double)t_naive / pairs, mismatch);
+}
+
+int main(int argc, char *argv[])
+{
+	struct hopa_ecmp e;
+	const char *spec = NULL;
+	uint16_t ports[HOPA_ECMP_MAX_MEMBERS];
+	uint32_t src = 0, pairs = 0;
+	unsigned int lo = ECMP_DEF_LO, hi = ECMP_DEF_HI, dport = ECMP_DEF_DPORT;
+	char s[INET_ADDRSTRLEN], d[INET_ADDRSTRLEN];
+	int bad = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "e:S:D:f:p:r:b:h")) != -1)
+	{
+		switch (opt)
+		{
+		case 'e':
+			spec = optarg;
+			break;
+		case 'S':
+			bad |= parse_ip(optarg, &src);
+			break;
+		case 'D':
+			if (n_dsts < ECMP_MAX_DSTS)
+				bad |= parse_ip(optarg, &dsts[n_dsts++]);
+			break;
+		case 'f':
+			bad |= load_peers(optarg);
+			break;
+		case 'p':
+			dport = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			bad |= sscanf(optarg, "%u-%u", &lo, &hi) != 2;
+			break;
+		case 'b':
+			pairs = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage();
+			return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+	if (bad || spec == NULL || lo == 0 || lo > hi || hi > 65535 || dport > 65535 || (n_dsts == 0 && pairs == 0))
+	{
+		usage();
+		return EXIT_FAILURE;
+	}
+	if (hopa_ecmp_init(&e, spec, ECMP_DEF_MEMBERS) < 0)
+	{
+		printf("bad hash spec %s\n", spec);
+		return EXIT_FAILURE;
+	}
+
+	if (pairs)
+	{
+		bench(&e, src, dport, lo, hi, pairs);
+		hopa_ecmp_fini(&e);
+		return EXIT_SUCCESS;
+	}
+
+	inet_ntop(AF_INET, &(uint32_t){htonl(src)}, s, sizeof(s));
+	for (uint32_t i = 0; i < n_dsts; i++)
+	{
+		inet_ntop(AF_INET, &(uint32_t){htonl(dsts[i])}, d, sizeof(d));
+		hopa_ecmp_solve(&e, src, dsts[i], ECMP_PROTO_UDP, dport, lo, hi, ports);
+		for (uint32_t m = 0; m < e.n_members; m++)
+		{
+			if (ports[m] == 0)
+			{
+				printf("%s %s %u %u -\n", s, d, dport, m);
+				continue;
+			}
+			/* cross-check the linear shortcut */
+			if (hopa_ecmp_member(&e, src, dsts[i], ECMP_PROTO_UDP, ports[m], dport) != m)
+				bad++;
+			printf("%s %s %u %u %u\n", s, d, dport, m, ports[m]);
+		}
+	}
+
+	hopa_ecmp_fini(&e);
+	if (bad)
+		printf("%d port(s) failed the direct CRC check\n", bad);
+
+	return bad ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,1140 @@
+#include "hopa_emu.h"
+#include "hopa_log.h"
+
+struct rte_mempool *emu_mbuf_pool = NULL;
+struct emu_path emu_paths[EMU_MAX_PATHS];
+struct emu_path emu_saved_path; /* victim model before the scenario touched it */
+struct emu_heap emu_heap;
+struct emu_param emu_param;
+struct emu_report emu_report;
+bool emu_scn_active = false;
+uint8_t emu_cur_path = 0; /* last path announced by a repath */
+uint64_t emu_last_tick_ns = 0;
+uint64_t emu_fabric_drops = 0; /* inflight limit / tx ring full */
+uint64_t emu_int_pkts = 0;     /* stamped by -I */
+
+/* latency-critical class, -R / -Q */
+struct hopa_dup_tx emu_dup_tx;
+struct hopa_dup_rx emu_dup_rx;
+struct emu_lat emu_lat_first;   /* first copy delivered */
+struct emu_lat emu_lat_primary; /* best path copy alone, what one path gives */
+uint64_t emu_class_offered = 0;
+struct hopa_paths *emu_paths_tbl = NULL;
+uint64_t emu_paths_retry_ns = 0;
+rte_be32_t emu_peer_src = 0;    /* CP addresses, learned from the sender's packets */
+rte_be32_t emu_peer_dst = 0;
+uint64_t emu_gen_next_ns = 0;
+
+/* tenant / DSCP path policy, -P */
+struct hopa_policy_table *emu_policy_tbl = NULL;
+uint64_t emu_policy_retry_ns = 0;
+
+static void emu_parse_args(struct emu_param *user_param, int argc, char *argv[])
+{
+	for (int i = 1; i < argc; ++i)
+	{
+		if (i + 1 >= argc && strcmp(argv[i], "-h") != 0)
+		{
+			emu_usage();
+			exit(EXIT_FAILURE);
+		}
+
+		if (strcmp(argv[i], "-n") == 0)
+		{
+			user_param->path_nb = strtoul(argv[++i], NULL, 10);
+			if (user_param->path_nb == 0 || user_param->path_nb > EMU_MAX_PATHS)
+			{
+				printf("path number must be 1..%d\n", EMU_MAX_PATHS);
+				exit(EXIT_FAILURE);
+			}
+		}
+		else if (strcmp(argv[i], "-b") == 0)
+			user_param->base_port = strtoul(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "-p") == 0)
+		{
+			if (emu_parse_path(argv[++i]) != 0)
+			{
+				printf("invalid path spec: %s\n", argv[i]);
+				emu_usage();
+				exit(EXIT_FAILURE);
+			}
+		}
+		else if (strcmp(argv[i], "-S") == 0)
+		{
+			i++;
+			if (strcmp(argv[i], "incast") == 0)
+				user_param->scn = EMU_SCN_INCAST;
+			else if (strcmp(argv[i], "fail") == 0)
+				user_param->scn = EMU_SCN_PATH_FAIL;
+			else if (strcmp(argv[i], "drift") == 0)
+				user_param->scn = EMU_SCN_DRIFT;
+			else if (strcmp(argv[i], "all") == 0)
+				user_param->scn = EMU_SCN_NONE;
+			else
+			{
+				printf("invalid scenario: %s\n", argv[i]);
+				emu_usage();
+				exit(EXIT_FAILURE);
+			}
+		}
+		else if (strcmp(argv[i], "-w") == 0)
+			user_param->warmup_s = strtoul(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "-d") == 0)
+			user_param->duration_s = strtoul(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "-l") == 0)
+			user_param->late_ns = strtoull(argv[++i], NULL, 10) * 1000;
+		else if (strcmp(argv[i], "-R") == 0 || strcmp(argv[i], "-Q") == 0)
+		{
+			user_param->dup = argv[i][1] == 'R';
+			if (hopa_dup_class_parse(&user_param->class_mask, argv[++i]) != 0)
+			{
+				printf("invalid dscp list: %s\n", argv[i]);
+				emu_usage();
+				exit(EXIT_FAILURE);
+			}
+		}
+		else if (strcmp(argv[i], "-G") == 0)
+			user_param->gen_pps = strtoul(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "-m") == 0)
+			user_param->paths_shm = argv[++i];
+		else if (strcmp(argv[i], "-P") == 0)
+			user_param->policy_shm = argv[++i];
+		else if (strcmp(argv[i], "-I") == 0)
+		{
+			user_param->int_dscp = atoi(argv[++i]);
+			if (user_param->int_dscp < 0 || user_param->int_dscp > 63)
+			{
+				emu_usage();
+				exit(EXIT_FAILURE);
+			}
+		}
+		else if (strcmp(argv[i], "-h") == 0)
+		{
+			emu_usage();
+			exit(EXIT_SUCCESS);
+		}
+		else
+		{
+			printf("invalid option: %s\n", argv[i]);
+			emu_usage();
+			exit(EXIT_FAILURE);
+		}
+	}
+}
+
+static void emu_usage()
+{
+	printf("Options:\n");
+	printf(" -h <help>            Help information\n");
+	printf(" -n <paths>           Number of emulated paths. (default %d)\n", EMU_DEF_PATH_NB);
+	printf(" -b <port>            UDP dst port of path 0. (default %d)\n", EMU_DEF_BASE_PORT);
+	printf(" -p <spec>            Path model id:delay_us:jitter_us:rate_mbps:qlimit_kb:loss_ppm:reorder_ppm\n");
+	printf("                      (default %d us delay, %d Mbps, %d KB queue, no loss)\n", EMU_DEF_DELAY_US, EMU_DEF_RATE_MBPS, EMU_DEF_QLIMIT_KB);
+	printf(" -S <scenario>        incast | fail | drift | all. (default all)\n");
+	printf(" -w <sec>             Warm-up before each scenario. (default %d)\n", EMU_DEF_WARMUP_S);
+	printf(" -d <sec>             Scenario duration. (default %d)\n", EMU_DEF_DURATION_S);
+	printf(" -l <us>              Delivery later than this is lost goodput. (default 2 x path delay)\n");
+	printf(" -R <dscp,...>        Latency-critical class, duplicated over the two best paths\n");
+	printf(" -Q <dscp,...>        Latency-critical class, on the best path only (baseline of -R)\n");
+	printf(" -G <pps>             Generate class packets (lowest dscp of -R / -Q), consumed by the emulator\n");
+	printf(" -m <name>            Sender CP path table for the two best paths. (default repath path and the next)\n");
+	printf(" -P <name>            Sender CP policy table, paths of the other traffic by VNI and DSCP. (default path by dst port)\n");
+	printf(" -I <dscp>            INT-MD over UDP on the UDP packets to the receiver, marked with this DSCP, as %d INT switches would. (default off)\n", EMU_INT_HOPS);
+}
+
+static int emu_parse_path(const char *arg)
+{
+	unsigned id;
+	uint64_t delay_us, jitter_us, rate_mbps, qlimit_kb;
+	uint32_t loss_ppm, reorder_ppm;
+
+	if (sscanf(arg, "%u:%" SCNu64 ":%" SCNu64 ":%" SCNu64 ":%" SCNu64 ":%" SCNu32 ":%" SCNu32,
+			   &id, &delay_us, &jitter_us, &rate_mbps, &qlimit_kb, &loss_ppm, &reorder_ppm) != 7)
+		return -1;
+	if (id >= EMU_MAX_PATHS || loss_ppm > 1000000 || reorder_ppm > 1000000)
+		return -1;
+
+	emu_paths[id].delay_ns = delay_us * 1000;
+	emu_paths[id].jitter_ns = jitter_us * 1000;
+	emu_paths[id].rate_bps = rate_mbps * 1000000;
+	emu_paths[id].qlimit = qlimit_kb * 1024;
+	emu_paths[id].loss_ppm = loss_ppm;
+	emu_paths[id].reorder_ppm = reorder_ppm;
+	emu_paths[id].reorder_ns = emu_paths[id].delay_ns + emu_paths[id].jitter_ns;
+
+	return 0;
+}
+
+static inline int
+emu_port_init(uint16_t port, struct rte_mempool *mbuf_pool)
+{
+	struct rte_eth_conf port_conf = {0};
+	uint16_t nb_rxd = EMU_RX_RING_SIZE;
+	uint16_t nb_txd = EMU_TX_RING_SIZE;
+	int retval;
+
+	if (!rte_eth_dev_is_valid_port(port))
+		return -1;
+
+	retval = rte_eth_dev_configure(port, 1, 1, &port_conf);
+	if (retval != 0)
+		return retval;
+
+	retval = rte_eth_dev_adjust_nb_rx_tx_desc(port, &nb_rxd, &nb_txd);
+	if (retval != 0)
+		return retval;
+
+	retval = rte_eth_rx_queue_setup(port, 0, nb_rxd, rte_eth_dev_socket_id(port), NULL, mbuf_pool);
+	if (retval < 0)
+		return retval;
+
+	retval = rte_eth_tx_queue_setup(port, 0, nb_txd, rte_eth_dev_socket_id(port), NULL);
+	if (retval < 0)
+		return retval;
+
+	retval = rte_eth_dev_start(port);
+	if (retval < 0)
+		return retval;
+
+	return rte_eth_promiscuous_enable(port);
+}
+
+static inline uint64_t emu_now_ns(void)
+{
+	uint64_t cycles = rte_get_timer_cycles();
+	uint64_t hz = rte_get_timer_hz();
+
+	return (cycles / hz) * NS_PER_S + (cycles % hz) * NS_PER_S / hz;
+}
+
+static int emu_heap_push(struct emu_heap *heap, const struct emu_event *ev)
+{
+	uint32_t i, parent;
+
+	if (heap->count == heap->size)
+		return -1;
+
+	i = heap->count++;
+	while (i > 0)
+	{
+		parent = (i - 1) / 2;
+		if (heap->ev[parent].due_ns <= ev->due_ns)
+			break;
+		heap->ev[i] = heap->ev[parent];
+		i = parent;
+	}
+	heap->ev[i] = *ev;
+
+	return 0;
+}
+
+static struct emu_event *emu_heap_top(struct emu_heap *heap)
+{
+	return heap->count ? &heap->ev[0] : NULL;
+}
+
+static void emu_heap_pop(struct emu_heap *heap)
+{
+	struct emu_event last;
+	uint32_t i = 0, child;
+
+	if (heap->count == 0)
+		return;
+
+	last = heap->ev[--heap->count];
+	while ((child = 2 * i + 1) < heap->count)
+	{
+		if (child + 1 < heap->count && heap->ev[child + 1].due_ns < heap->ev[child].due_ns)
+			child++;
+		if (last.due_ns <= heap->ev[child].due_ns)
+			break;
+		heap->ev[i] = heap->ev[child];
+		i = child;
+	}
+	heap->ev[i] = last;
+}
+
+/* Map a packet onto a path by UDP dst port. Non HOPA traffic uses path 0. */
+static int emu_classify(struct rte_mbuf *mbuf, uint8_t *path_id)
+{
+	struct rte_ether_hdr *eth_hdr;
+	struct rte_ipv4_hdr *ipv4_hdr;
+	struct rte_udp_hdr *udp_hdr;
+	uint16_t dst_port;
+
+	*path_id = 0;
+
+	if (rte_pktmbuf_data_len(mbuf) < sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv4_hdr) + sizeof(struct rte_udp_hdr))
+		return -1;
+
+	eth_hdr = rte_pktmbuf_mtod(mbuf, struct rte_ether_hdr *);
+	if (eth_hdr->ether_type != rte_cpu_to_be_16(RTE_ETHER_TYPE_IPV4))
+		return -1;
+
+	ipv4_hdr = (struct rte_ipv4_hdr *)(eth_hdr + 1);
+	if (ipv4_hdr->next_proto_id != IPPROTO_UDP)
+		return -1;
+
+	udp_hdr = (struct rte_udp_hdr *)(ipv4_hdr + 1);
+	dst_port = rte_be_to_cpu_16(udp_hdr->dst_port);
+	if (dst_port < emu_param.base_port || dst_port >= emu_param.base_port + emu_param.path_nb)
+		return -1;
+
+	*path_id = dst_port - emu_param.base_port;
+
+	return 0;
+}
+
+/* Reaction time is measured on the repath the receiver CP sends back. */
+static void emu_watch_repath(struct rte_mbuf *mbuf, uint64_t now_ns)
+{
+	struct rte_ipv4_hdr *ipv4_hdr;
+	struct rte_udp_hdr *udp_hdr;
+	struct hopa_cp_hdr *hopa_cp_hdr;
+
+	if (rte_pktmbuf_data_len(mbuf) < sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv4_hdr) + sizeof(struct rte_udp_hdr) + sizeof(struct hopa_cp_hdr))
+		return;
+
+	ipv4_hdr = rte_pktmbuf_mtod_offset(mbuf, struct rte_ipv4_hdr *, sizeof(struct rte_ether_hdr));
+	udp_hdr = (struct rte_udp_hdr *)(ipv4_hdr + 1);
+	if (rte_be_to_cpu_16(udp_hdr->src_port) != SRC_PORT)
+		return;
+
+	hopa_cp_hdr = (struct hopa_cp_hdr *)(udp_hdr + 1);
+	if (hopa_cp_hdr->flag != HOPA_CP || hopa_cp_hdr->cp_flag != REPATH)
+		return;
+
+	emu_cur_path = hopa_cp_hdr->repath_id;
+
+	if (emu_scn_active && emu_report.react_ns == 0 && emu_cur_path != emu_report.victim)
+	{
+		emu_report.react_ns = now_ns;
+		emu_report.react_path = emu_cur_path;
+		HOPA_LOG_INFO("repath %d -> %d after %" PRIu64 " us", emu_report.victim, emu_cur_path, (now_ns - emu_report.trigger_ns) / 1000);
+	}
+}
+
+/* The class path lookup needs the peer address the sender CP knows. */
+static void emu_watch_peer(struct rte_mbuf *mbuf)
+{
+	struct rte_ipv4_hdr *ipv4_hdr;
+	struct rte_udp_hdr *udp_hdr;
+	uint8_t path_id;
+
+	if (emu_classify(mbuf, &path_id) != 0)
+		return;
+
+	ipv4_hdr = rte_pktmbuf_mtod_offset(mbuf, struct rte_ipv4_hdr *, sizeof(struct rte_ether_hdr));
+	udp_hdr = (struct rte_udp_hdr *)(ipv4_hdr + 1);
+	if (rte_be_to_cpu_16(udp_hdr->src_port) != SRC_PORT)
+		return;
+
+	emu_peer_src = ipv4_hdr->src_addr;
+	emu_peer_dst = ipv4_hdr->dst_addr;
+}
+
+static void emu_enqueue(struct rte_mbuf *mbuf, uint16_t out_port, uint64_t now_ns, const struct hopa_policy *pol)
+{
+	struct emu_event ev = {.out_port = out_port, .mbuf = mbuf, .in_ns = now_ns};
+	uint8_t path_id, path[2];
+	int n;
+
+	emu_watch_repath(mbuf, now_ns);
+	if (out_port == EMU_PORT_RECEIVER && emu_param.class_mask)
+	{
+		if (emu_peer_dst == 0)
+			emu_watch_peer(mbuf);
+		if (emu_class_key(mbuf, &ev.key) == 0)
+		{
+			n = emu_class_paths(mbuf, now_ns, path);
+			emu_class_enqueue(&ev, now_ns, path, emu_param.dup ? n : 1);
+			return;
+		}
+	}
+	if (pol != NULL)
+	{
+		emu_policy_enqueue(&ev, pol, now_ns);
+		return;
+	}
+
+	emu_classify(mbuf, &path_id);
+	emu_path_enqueue(&ev, path_id, now_ns);
+}
+
+static void emu_path_enqueue(struct emu_event *ev, uint8_t path_id, uint64_t now_ns)
+{
+	struct rte_mbuf *mbuf = ev->mbuf;
+	uint16_t out_port = ev->out_port;
+	struct emu_path *path = &emu_paths[path_id];
+	uint32_t len = rte_pktmbuf_pkt_len(mbuf);
+	uint64_t due_ns, queue_bytes = 0, queue_ns = 0;
+	bool lost = false;
+	bool watch;
+
+	/* goodput only counts sender -> receiver on the victim while the CP has not reacted */
+	watch = emu_scn_active && emu_report.react_ns == 0 && out_port == EMU_PORT_RECEIVER && path_id == emu_report.victim;
+	if (watch)
+		emu_report.offered_bytes += len;
+
+	/* fluid bottleneck: the queue drains at rate_bps and fills with cross traffic */
+	if (path->rate_bps)
+	{
+		double elapsed = (double)(now_ns - path->last_ns) / NS_PER_S;
+		double backlog = (double)path->backlog + (double)(path->cross_bps - (double)path->rate_bps) * elapsed / 8;
+
+		if (backlog < 0)
+			backlog = 0;
+		if (backlog > path->qlimit)
+			backlog = path->qlimit;
+		path->backlog = (uint64_t)backlog;
+		path->last_ns = now_ns;
+	}
+
+	if (path->down || (path->loss_ppm && rte_rand() % 1000000 < path->loss_ppm) || (path->rate_bps && path->backlog + len > path->qlimit))
+	{
+		path->drop_pkts++;
+		path->drop_bytes += len;
+		if (watch)
+			emu_report.lost_bytes += len;
+		rte_pktmbuf_free(mbuf);
+		return;
+	}
+
+	due_ns = now_ns + path->delay_ns;
+	if (path->jitter_ns)
+		due_ns += rte_rand() % path->jitter_ns;
+	if (path->rate_bps)
+	{
+		queue_bytes = path->backlog;
+		path->backlog += len;
+		queue_ns = path->backlog * 8 * NS_PER_S / path->rate_bps;
+		due_ns += queue_ns;
+	}
+	if (path->reorder_ppm && rte_rand() % 1000000 < path->reorder_ppm)
+	{
+		due_ns += path->reorder_ns;
+		path->reorder_pkts++;
+	}
+
+	if (watch && due_ns - now_ns > emu_param.late_ns)
+		lost = true;
+
+	if (out_port == EMU_PORT_RECEIVER && emu_param.int_dscp >= 0 && !ev->gen)
+		emu_int_stamp(mbuf, path_id, queue_bytes, queue_ns);
+
+	ev->due_ns = due_ns;
+	if (emu_heap_push(&emu_heap, ev) != 0)
+	{
+		emu_fabric_drops++;
+		lost = watch;
+		rte_pktmbuf_free(mbuf);
+	}
+	else
+	{
+		path->tx_pkts++;
+		path->tx_bytes += len;
+	}
+
+	if (lost)
+		emu_report.lost_bytes += len;
+}
+
+/*
+ * -I: stand-in for P4 INT switches. The packet leaves the sender's leaf,
+ * crosses the spine of its path, where the path's bottleneck queue is, and
+ * the receiver's leaf; each pushes node id, hop latency and queue occupancy
+ * (bytes) after the UDP header. The original DSCP is kept in the shim.
+ */
+static void emu_int_stamp(struct rte_mbuf *mbuf, uint8_t path_id, uint64_t queue_bytes, uint64_t queue_ns)
+{
+	const uint16_t hdr_len = sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv4_hdr) + sizeof(struct rte_udp_hdr);
+	const uint16_t int_len = HOPA_INT_LEN(EMU_INT_HOPS);
+	uint32_t node[EMU_INT_HOPS], latency[EMU_INT_HOPS], queue[EMU_INT_HOPS];
+	struct rte_ether_hdr *eth_hdr;
+	struct rte_ipv4_hdr *ipv4_hdr;
+	struct rte_udp_hdr *udp_hdr;
+	uint8_t dscp;
+
+	if (rte_pktmbuf_data_len(mbuf) < hdr_len)
+		return;
+	eth_hdr = rte_pktmbuf_mtod(mbuf, struct rte_ether_hdr *);
+	ipv4_hdr = (struct rte_ipv4_hdr *)(eth_hdr + 1);
+	if (eth_hdr->ether_type != rte_cpu_to_be_16(RTE_ETHER_TYPE_IPV4) || ipv4_hdr->next_proto_id != IPPROTO_UDP ||
+		(ipv4_hdr->type_of_service >> 2) == emu_param.int_dscp)
+		return;
+
+	eth_hdr = (struct rte_ether_hdr *)rte_pktmbuf_prepend(mbuf, int_len);
+	if (eth_hdr == NULL)
+		return; /* no headroom, goes unstamped */
+	memmove(eth_hdr, (uint8_t *)eth_hdr + int_len, hdr_len);
+	ipv4_hdr = (struct rte_ipv4_hdr *)(eth_hdr + 1);
+	udp_hdr = (struct rte_udp_hdr *)(ipv4_hdr + 1);
+
+	/* the stack holds the last hop first */
+	node[0] = EMU_INT_NODE_LEAF + 1;
+	latency[0] = EMU_INT_HOP_NS;
+	queue[0] = 0;
+	node[1] = EMU_INT_NODE_SPINE + path_id;
+	latency[1] = EMU_INT_HOP_NS + RTE_MIN(queue_ns, (uint64_t)UINT32_MAX - EMU_INT_HOP_NS);
+	queue[1] = RTE_MIN(queue_bytes, (uint64_t)UINT32_MAX);
+	node[2] = EMU_INT_NODE_LEAF;
+	latency[2] = EMU_INT_HOP_NS;
+	queue[2] = 0;
+
+	dscp = ipv4_hdr->type_of_service >> 2;
+	hopa_int_build((uint8_t *)(udp_hdr + 1), dscp, EMU_INT_HOPS, node, latency, queue);
+	udp_hdr->dgram_len = rte_cpu_to_be_16(rte_be_to_cpu_16(udp_hdr->dgram_len) + int_len);
+	udp_hdr->dgram_cksum = 0;
+	ipv4_hdr->type_of_service = emu_param.int_dscp << 2 | (ipv4_hdr->type_of_service & 3);
+	ipv4_hdr->total_length = rte_cpu_to_be_16(rte_be_to_cpu_16(ipv4_hdr->total_length) + int_len);
+	ipv4_hdr->hdr_checksum = 0;
+	ipv4_hdr->hdr_checksum = rte_ipv4_cksum(ipv4_hdr);
+	emu_int_pkts++;
+}
+
+static void emu_release(uint64_t now_ns)
+{
+	struct rte_mbuf *tx_mbuf[EMU_PORT_NB][EMU_BURST_SIZE];
+	uint16_t nb_tx[EMU_PORT_NB] = {0};
+	struct emu_event *ev;
+	struct rte_mbuf *mbuf;
+	uint16_t port, sent;
+	int consumed;
+
+	while ((ev = emu_heap_top(&emu_heap)) != NULL && ev->due_ns <= now_ns)
+	{
+		port = ev->out_port;
+		mbuf = ev->mbuf;
+		consumed = ev->copy != EMU_COPY_NONE && emu_class_deliver(ev);
+		emu_heap_pop(&emu_heap);
+		if (consumed)
+		{
+			rte_pktmbuf_free(mbuf);
+			continue;
+		}
+		tx_mbuf[port][nb_tx[port]++] = mbuf;
+
+		if (nb_tx[port] == EMU_BURST_SIZE)
+			break;
+	}
+
+	for (port = 0; port < EMU_PORT_NB; port++)
+	{
+		if (nb_tx[port] == 0)
+			continue;
+
+		sent = rte_eth_tx_burst(port, 0, tx_mbuf[port], nb_tx[port]);
+		if (sent < nb_tx[port])
+		{
+			emu_fabric_drops += nb_tx[port] - sent;
+			rte_pktmbuf_free_bulk(&tx_mbuf[port][sent], nb_tx[port] - sent);
+		}
+	}
+}
+
+/* Key of an IPv4 packet's flow, -1 if the packet is not IPv4. */
+static int emu_flow_key(struct rte_mbuf *mbuf, uint32_t *key)
+{
+	struct rte_ether_hdr *eth_hdr;
+	struct rte_ipv4_hdr *ipv4_hdr;
+	struct rte_udp_hdr *udp_hdr;
+	uint16_t src_port = 0, dst_port = 0;
+
+	if (rte_pktmbuf_data_len(mbuf) < sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv4_hdr) + sizeof(struct rte_udp_hdr))
+		return -1;
+
+	eth_hdr = rte_pktmbuf_mtod(mbuf, struct rte_ether_hdr *);
+	if (eth_hdr->ether_type != rte_cpu_to_be_16(RTE_ETHER_TYPE_IPV4))
+		return -1;
+
+	ipv4_hdr = (struct rte_ipv4_hdr *)(eth_hdr + 1);
+
+	/* udp and tcp have the ports at the same place */
+	if (ipv4_hdr->next_proto_id == IPPROTO_UDP || ipv4_hdr->next_proto_id == IPPROTO_TCP)
+	{
+		udp_hdr = (struct rte_udp_hdr *)(ipv4_hdr + 1);
+		src_port = rte_be_to_cpu_16(udp_hdr->src_port);
+		dst_port = rte_be_to_cpu_16(udp_hdr->dst_port);
+	}
+	*key = hopa_dup_flow_key(rte_be_to_cpu_32(ipv4_hdr->src_addr), rte_be_to_cpu_32(ipv4_hdr->dst_addr), src_port, dst_port,
+							 ipv4_hdr->next_proto_id);
+
+	return 0;
+}
+
+/* Key of a class packet, -1 if the packet is not in the class. */
+static int emu_class_key(struct rte_mbuf *mbuf, uint32_t *key)
+{
+	struct rte_ipv4_hdr *ipv4_hdr;
+
+	if (emu_flow_key(mbuf, key) != 0)
+		return -1;
+
+	ipv4_hdr = rte_pktmbuf_mtod_offset(mbuf, struct rte_ipv4_hdr *, sizeof(struct rte_ether_hdr));
+
+	return hopa_dup_match(emu_param.class_mask, ipv4_hdr->type_of_service) ? 0 : -1;
+}
+
+/*
+ * Path state of the packet's peer from the sender CP path table, or made
+ * up without one: the repath path first, then the next ones in turn.
+ */
+static void emu_paths_info(struct rte_mbuf *mbuf, uint64_t now_ns, struct hopa_paths_info *info)
+{
+	struct rte_ipv4_hdr *ipv4_hdr;
+	uint8_t path_nb = RTE_MIN(emu_param.path_nb, HOPA_PATHS_PATH_NB);
+	uint8_t cur = emu_cur_path < path_nb ? emu_cur_path : 0;
+	uint8_t i;
+
+	if (emu_paths_tbl == NULL && emu_param.paths_shm && now_ns >= emu_paths_retry_ns)
+	{
+		emu_paths_tbl = hopa_paths_open(emu_param.paths_shm);
+		emu_paths_retry_ns = now_ns + EMU_PATHS_RETRY_NS;
+		if (emu_paths_tbl)
+			HOPA_LOG_INFO("class paths from path table %s", emu_param.paths_shm);
+	}
+
+	ipv4_hdr = rte_pktmbuf_mtod_offset(mbuf, struct rte_ipv4_hdr *, sizeof(struct rte_ether_hdr));
+	if (emu_paths_tbl && hopa_paths_lookup(emu_paths_tbl, rte_be_to_cpu_32(ipv4_hdr->dst_addr), info) == 0)
+		return;
+
+	memset(info, 0, sizeof(*info));
+	info->best_path_id = cur;
+	info->live_mask = (1 << path_nb) - 1;
+	for (i = 0; i < HOPA_PATHS_PATH_NB; i++)
+	{
+		info->delay_ns[i] = i < path_nb ? (i + path_nb - cur) % path_nb : HOPA_PATHS_DELAY_NONE;
+		info->quality[i].loss_ppm = HOPA_PATHS_PPM_NONE;
+		info->quality[i].reorder_ppm = HOPA_PATHS_PPM_NONE;
+		info->quality[i].avail_mbps = HOPA_PATHS_BW_NONE;
+		info->quality[i].capacity_mbps = HOPA_PATHS_BW_NONE;
+		info->quality[i].queue = HOPA_PATHS_INT_NONE;
+		info->quality[i].hop_latency_ns = HOPA_PATHS_INT_NONE;
+	}
+}
+
+/* Best and second best path of the packet's peer. */
+static int emu_class_paths(struct rte_mbuf *mbuf, uint64_t now_ns, uint8_t path[2])
+{
+	struct hopa_paths_info info;
+	int n;
+
+	emu_paths_info(mbuf, now_ns, &info);
+	n = hopa_dup_paths(&info, path);
+	if (path[0] >= emu_param.path_nb)
+		path[0] = 0;
+	if (n == 2 && path[1] >= emu_param.path_nb)
+		n = 1;
+
+	return n;
+}
+
+/*
+ * Sender datapath of the class: hopa_dp_hdr numbered 'seq' after the UDP
+ * header, the copies carry it on the wire. 0, or -1 if the packet is not
+ * UDP or has no headroom.
+ */
+static int emu_dp_push(struct rte_mbuf *mbuf, uint32_t seq)
+{
+	const uint16_t hdr_len = sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv4_hdr) + sizeof(struct rte_udp_hdr);
+	const uint16_t dp_len = sizeof(struct hopa_dp_hdr);
+	struct rte_ether_hdr *eth_hdr;
+	struct rte_ipv4_hdr *ipv4_hdr;
+	struct rte_udp_hdr *udp_hdr;
+	struct hopa_dp_hdr *dp_hdr;
+
+	if (rte_pktmbuf_data_len(mbuf) < hdr_len)
+		return -1;
+	ipv4_hdr = rte_pktmbuf_mtod_offset(mbuf, struct rte_ipv4_hdr *, sizeof(struct rte_ether_hdr));
+	if (ipv4_hdr->next_proto_id != IPPROTO_UDP)
+		return -1;
+
+	eth_hdr = (struct rte_ether_hdr *)rte_pktmbuf_prepend(mbuf, dp_len);
+	if (eth_hdr == NULL)
+		return -1;
+	memmove(eth_hdr, (uint8_t *)eth_hdr + dp_len, hdr_len);
+	ipv4_hdr = (struct rte_ipv4_hdr *)(eth_hdr + 1);
+	udp_hdr = (struct rte_udp_hdr *)(ipv4_hdr + 1);
+
+	dp_hdr = (struct hopa_dp_hdr *)(udp_hdr + 1);
+	memset(dp_hdr, 0, dp_len);
+	dp_hdr->flag = HOPA_DP;
+	dp_hdr->seq_nb = rte_cpu_to_be_32(seq);
+	udp_hdr->dgram_len = rte_cpu_to_be_16(rte_be_to_cpu_16(udp_hdr->dgram_len) + dp_len);
+	udp_hdr->dgram_cksum = 0;
+	ipv4_hdr->total_length = rte_cpu_to_be_16(rte_be_to_cpu_16(ipv4_hdr->total_length) + dp_len);
+	ipv4_hdr->hdr_checksum = 0;
+	ipv4_hdr->hdr_checksum = rte_ipv4_cksum(ipv4_hdr);
+
+	return 0;
+}
+
+/* Receiver datapath: seq_nb of a numbered packet, read under the INT stack
+ * -I pushed on top of it, and the hopa_dp_hdr out. 0 -> not numbered. */
+static uint32_t emu_dp_pop(struct rte_mbuf *mbuf)
+{
+	const uint16_t hdr_len = sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv4_hdr) + sizeof(struct rte_udp_hdr);
+	const uint16_t dp_len = sizeof(struct hopa_dp_hdr);
+	struct hopa_int_sample s;
+	struct rte_ether_hdr *eth_hdr;
+	struct rte_ipv4_hdr *ipv4_hdr;
+	struct rte_udp_hdr *udp_hdr;
+	struct hopa_dp_hdr *dp_hdr;
+	uint32_t off = hdr_len, seq;
+
+	if (rte_pktmbuf_data_len(mbuf) < hdr_len)
+		return 0;
+	ipv4_hdr = rte_pktmbuf_mtod_offset(mbuf, struct rte_ipv4_hdr *, sizeof(struct rte_ether_hdr));
+	if (emu_param.int_dscp >= 0 && (ipv4_hdr->type_of_service >> 2) == emu_param.int_dscp &&
+		hopa_int_parse(rte_pktmbuf_mtod_offset(mbuf, const uint8_t *, hdr_len), rte_pktmbuf_data_len(mbuf) - hdr_len, &s) == 0)
+		off += s.len;
+	if (rte_pktmbuf_data_len(mbuf) < off + dp_len)
+		return 0;
+	dp_hdr = rte_pktmbuf_mtod_offset(mbuf, struct hopa_dp_hdr *, off);
+	if (dp_hdr->flag != HOPA_DP)
+		return 0;
+	seq = rte_be_to_cpu_32(dp_hdr->seq_nb);
+
+	eth_hdr = rte_pktmbuf_mtod(mbuf, struct rte_ether_hdr *);
+	memmove((uint8_t *)eth_hdr + dp_len, eth_hdr, off);
+	eth_hdr = (struct rte_ether_hdr *)rte_pktmbuf_adj(mbuf, dp_len);
+	ipv4_hdr = (struct rte_ipv4_hdr *)(eth_hdr + 1);
+	udp_hdr = (struct rte_udp_hdr *)(ipv4_hdr + 1);
+	udp_hdr->dgram_len = rte_cpu_to_be_16(rte_be_to_cpu_16(udp_hdr->dgram_len) - dp_len);
+	udp_hdr->dgram_cksum = 0;
+	ipv4_hdr->total_length = rte_cpu_to_be_16(rte_be_to_cpu_16(ipv4_hdr->total_length) - dp_len);
+	ipv4_hdr->hdr_checksum = 0;
+	ipv4_hdr->hdr_checksum = rte_ipv4_cksum(ipv4_hdr);
+
+	return seq;
+}
+
+/* Sender datapath of the class: number the packet, send it on n of 'path'.
+ * One that cannot carry the number goes on the first path only. */
+static void emu_class_enqueue(struct emu_event *ev, uint64_t now_ns, const uint8_t path[2], int n)
+{
+	struct emu_event second;
+
+	ev->numbered = emu_dp_push(ev->mbuf, hopa_dup_next_seq(&emu_dup_tx, ev->key)) == 0;
+	if (!ev->numbered)
+		n = 1;
+	emu_class_offered++;
+
+	if (n == 2)
+	{
+		second = *ev;
+		second.copy = EMU_COPY_SECOND;
+		second.mbuf = rte_pktmbuf_copy(ev->mbuf, emu_mbuf_pool, 0, UINT32_MAX);
+		if (second.mbuf)
+			emu_path_enqueue(&second, path[1], now_ns);
+		else
+			emu_fabric_drops++;
+	}
+	ev->copy = EMU_COPY_PRIMARY;
+	emu_path_enqueue(ev, path[0], now_ns);
+}
+
+/* Policies of a burst from the sender, one set for the whole burst; NULL
+ * for HOPA CP packets and without -P. */
+static void emu_policy_batch(struct rte_mbuf **mbufs, uint16_t n, uint64_t now_ns, const struct hopa_policy **pol)
+{
+	const struct hopa_policy_set *set;
+	struct rte_ether_hdr *eth_hdr;
+	struct rte_ipv4_hdr *ipv4_hdr;
+	struct rte_udp_hdr *udp_hdr;
+	uint32_t vni[EMU_BURST_SIZE];
+	uint8_t tos[EMU_BURST_SIZE], cp[EMU_BURST_SIZE];
+	const uint8_t *vxlan;
+	uint16_t i;
+
+	if (emu_policy_tbl == NULL && emu_param.policy_shm && now_ns >= emu_policy_retry_ns)
+	{
+		emu_policy_tbl = hopa_policy_open(emu_param.policy_shm);
+		emu_policy_retry_ns = now_ns + EMU_PATHS_RETRY_NS;
+		if (emu_policy_tbl)
+			HOPA_LOG_INFO("paths by policy table %s", emu_param.policy_shm);
+	}
+	if (emu_policy_tbl == NULL)
+	{
+		memset(pol, 0, sizeof(*pol) * n);
+		return;
+	}
+
+	for (i = 0; i < n; i++)
+	{
+		vni[i] = 0;
+		tos[i] = 0;
+		cp[i] = 1;
+		eth_hdr = rte_pktmbuf_mtod(mbufs[i], struct rte_ether_hdr *);
+		if (rte_pktmbuf_data_len(mbufs[i]) < sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv4_hdr) + sizeof(struct rte_udp_hdr) ||
+			eth_hdr->ether_type != rte_cpu_to_be_16(RTE_ETHER_TYPE_IPV4))
+			continue;
+
+		ipv4_hdr = (struct rte_ipv4_hdr *)(eth_hdr + 1);
+		udp_hdr = (struct rte_udp_hdr *)(ipv4_hdr + 1);
+		tos[i] = ipv4_hdr->type_of_service;
+		cp[i] = ipv4_hdr->next_proto_id == IPPROTO_UDP && udp_hdr->src_port == rte_cpu_to_be_16(SRC_PORT);
+		if (ipv4_hdr->next_proto_id == IPPROTO_UDP && udp_hdr->dst_port == rte_cpu_to_be_16(EMU_VXLAN_PORT) &&
+			rte_pktmbuf_data_len(mbufs[i]) >= sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv4_hdr) + sizeof(struct rte_udp_hdr) + EMU_VXLAN_HDR_LEN)
+		{
+			vxlan = (const uint8_t *)(udp_hdr + 1);
+			vni[i] = vxlan[4] << 16 | vxlan[5] << 8 | vxlan[6];
+		}
+	}
+
+	set = hopa_policy_begin(emu_policy_tbl);
+	hopa_policy_lookup_batch(set, vni, tos, n, pol);
+
+	/* CP packets and non IPv4 keep the path by dst port */
+	for (i = 0; i < n; i++)
+		if (cp[i])
+			pol[i] = NULL;
+}
+
+/* Sender datapath under a policy: one path, or both copies of a dual spray. */
+static void emu_policy_enqueue(struct emu_event *ev, const struct hopa_policy *pol, uint64_t now_ns)
+{
+	struct hopa_paths_info info;
+	uint8_t path[2];
+	uint32_t key = 0;
+	int n;
+
+	emu_flow_key(ev->mbuf, &key);
+	emu_paths_info(ev->mbuf, now_ns, &info);
+	n = hopa_policy_paths(pol, &info, key, path);
+	if (path[0] >= emu_param.path_nb)
+		path[0] = 0;
+	if (n == 2 && path[1] >= emu_param.path_nb)
+		n = 1;
+
+	if (pol->spray == HOPA_POLICY_DUAL && key != 0)
+	{
+		ev->key = key;
+		emu_class_enqueue(ev, now_ns, path, n);
+	}
+	else
+		emu_path_enqueue(ev, path[0], now_ns);
+}
+
+/* Receiver datapath of the class: 1 if the packet goes no further. */
+static int emu_class_deliver(const struct emu_event *ev)
+{
+	uint64_t lat_ns = ev->due_ns - ev->in_ns;
+
+	if (ev->copy == EMU_COPY_PRIMARY)
+		emu_lat_add(&emu_lat_primary, lat_ns);
+	if (hopa_dup_check(&emu_dup_rx, ev->key, ev->numbered ? emu_dp_pop(ev->mbuf) : 0) == HOPA_DUP_COPY)
+		return 1;
+	emu_lat_add(&emu_lat_first, lat_ns);
+
+	return ev->gen;
+}
+
+static struct rte_mbuf *emu_gen_pkt(uint8_t flow)
+{
+	struct rte_mbuf *mbuf;
+	struct rte_ether_hdr *eth_hdr;
+	struct rte_ipv4_hdr *ipv4_hdr;
+	struct rte_udp_hdr *udp_hdr;
+	uint16_t ip_len = EMU_GEN_PKT_LEN - sizeof(struct rte_ether_hdr);
+
+	mbuf = rte_pktmbuf_alloc(emu_mbuf_pool);
+	if (mbuf == NULL)
+		return NULL;
+	eth_hdr = (struct rte_ether_hdr *)rte_pktmbuf_append(mbuf, EMU_GEN_PKT_LEN);
+	memset(eth_hdr, 0, EMU_GEN_PKT_LEN);
+	eth_hdr->ether_type = rte_cpu_to_be_16(RTE_ETHER_TYPE_IPV4);
+
+	ipv4_hdr = (struct rte_ipv4_hdr *)(eth_hdr + 1);
+	ipv4_hdr->version_ihl = (4 << 4) + 5;
+	ipv4_hdr->type_of_service = __builtin_ctzll(emu_param.class_mask) << 2;
+	ipv4_hdr->total_length = rte_cpu_to_be_16(ip_len);
+	ipv4_hdr->time_to_live = 64;
+	ipv4_hdr->next_proto_id = IPPROTO_UDP;
+	ipv4_hdr->src_addr = emu_peer_src;
+	ipv4_hdr->dst_addr = emu_peer_dst;
+	ipv4_hdr->hdr_checksum = rte_ipv4_cksum(ipv4_hdr);
+
+	udp_hdr = (struct rte_udp_hdr *)(ipv4_hdr + 1);
+	udp_hdr->src_port = rte_cpu_to_be_16(EMU_GEN_SPORT + flow);
+	udp_hdr->dst_port = rte_cpu_to_be_16(EMU_GEN_SPORT);
+	udp_hdr->dgram_len = rte_cpu_to_be_16(ip_len - sizeof(struct rte_ipv4_hdr));
+
+	return mbuf;
+}
+
+/* -G: class packets at gen_pps round robin over EMU_GEN_FLOWS flows */
+static void emu_gen(uint64_t now_ns)
+{
+	static uint8_t flow;
+	struct emu_event ev;
+	uint8_t path[2];
+	int n = 0, n_paths;
+
+	if (emu_gen_next_ns + NS_PER_S < now_ns)
+		emu_gen_next_ns = now_ns; /* no catching up after a stall */
+
+	while (emu_gen_next_ns <= now_ns && n++ < EMU_BURST_SIZE)
+	{
+		ev = (struct emu_event){.out_port = EMU_PORT_RECEIVER, .gen = 1, .in_ns = now_ns};
+		ev.mbuf = emu_gen_pkt(flow);
+		if (ev.mbuf == NULL)
+			break;
+		emu_class_key(ev.mbuf, &ev.key);
+		n_paths = emu_class_paths(ev.mbuf, now_ns, path);
+		emu_class_enqueue(&ev, now_ns, path, emu_param.dup ? n_paths : 1);
+
+		flow = (flow + 1) % EMU_GEN_FLOWS;
+		emu_gen_next_ns += NS_PER_S / emu_param.gen_pps;
+	}
+}
+
+static void emu_lat_add(struct emu_lat *lat, uint64_t ns)
+{
+	uint64_t bin = ns / 1000;
+
+	lat->bins[bin < EMU_LAT_BINS ? bin : EMU_LAT_BINS - 1]++;
+	lat->n++;
+	if (ns > lat->max_ns)
+		lat->max_ns = ns;
+}
+
+/* Quantile q of the latencies, us, upper edge of the bin. */
+static double emu_lat_pct(const struct emu_lat *lat, double q)
+{
+	uint64_t rank, seen = 0;
+	uint32_t i;
+
+	if (lat->n == 0)
+		return 0;
+
+	rank = (uint64_t)(q * lat->n);
+	if (rank == 0)
+		rank = 1;
+	for (i = 0; i < EMU_LAT_BINS - 1; i++)
+	{
+		seen += lat->bins[i];
+		if (seen >= rank)
+			return i + 1;
+	}
+
+	return lat->max_ns / 1000.0;
+}
+
+static void emu_class_print(void)
+{
+	printf("class (%s) : offered %" PRIu64 " pkts, delivered %" PRIu64 ", copies dropped %" PRIu64 ", stale %" PRIu64 "\n",
+		   emu_param.dup ? "dual path" : "one path", emu_class_offered, emu_lat_first.n, emu_dup_rx.copies, emu_dup_rx.stale);
+	printf("latency (us)       : p50 %.0f  p99 %.0f  p99.9 %.0f  max %.1f\n", emu_lat_pct(&emu_lat_first, 0.5),
+		   emu_lat_pct(&emu_lat_first, 0.99), emu_lat_pct(&emu_lat_first, 0.999), emu_lat_first.max_ns / 1000.0);
+	if (emu_param.dup)
+		printf("best path copy (us): p50 %.0f  p99 %.0f  p99.9 %.0f  max %.1f, delivered %" PRIu64 "\n",
+			   emu_lat_pct(&emu_lat_primary, 0.5), emu_lat_pct(&emu_lat_primary, 0.99), emu_lat_pct(&emu_lat_primary, 0.999),
+			   emu_lat_primary.max_ns / 1000.0, emu_lat_primary.n);
+}
+
+static const char *emu_scenario_name(enum emu_scenario scn)
+{
+	switch (scn)
+	{
+	case EMU_SCN_INCAST:
+		return "incast";
+	case EMU_SCN_PATH_FAIL:
+		return "path failure";
+	case EMU_SCN_DRIFT:
+		return "slow drift";
+	default:
+		return "none";
+	}
+}
+
+static void emu_scenario_start(enum emu_scenario scn, uint64_t now_ns)
+{
+	struct emu_path *victim;
+
+	memset(&emu_report, 0, sizeof(emu_report));
+	emu_report.scn = scn;
+	emu_report.victim = emu_cur_path < emu_param.path_nb ? emu_cur_path : 0;
+	emu_report.trigger_ns = now_ns;
+
+	victim = &emu_paths[emu_report.victim];
+	emu_saved_path = *victim;
+
+	memset(&emu_lat_first, 0, sizeof(emu_lat_first));
+	memset(&emu_lat_primary, 0, sizeof(emu_lat_primary));
+	emu_class_offered = 0;
+	emu_dup_rx.first = emu_dup_rx.copies = emu_dup_rx.stale = emu_dup_rx.evicted = 0;
+
+	switch (scn)
+	{
+	case EMU_SCN_INCAST:
+		if (victim->rate_bps == 0)
+			victim->rate_bps = (uint64_t)EMU_DEF_RATE_MBPS * 1000000;
+		victim->cross_bps = victim->rate_bps * EMU_INCAST_LOAD / 100;
+		victim->last_ns = now_ns;
+		break;
+	case EMU_SCN_PATH_FAIL:
+		victim->down = true;
+		break;
+	case EMU_SCN_DRIFT:
+	default:
+		break;
+	}
+
+	emu_scn_active = true;
+	emu_last_tick_ns = now_ns;
+
+	HOPA_LOG_WARN("scenario [%s] start, victim path %d", emu_scenario_name(scn), emu_report.victim);
+}
+
+static void emu_scenario_tick(uint64_t now_ns)
+{
+	if (now_ns - emu_last_tick_ns < NS_PER_S)
+		return;
+	emu_last_tick_ns = now_ns;
+
+	if (emu_report.scn == EMU_SCN_DRIFT)
+		emu_paths[emu_report.victim].delay_ns += EMU_DRIFT_US_PER_S * 1000;
+}
+
+static void emu_scenario_stop(void)
+{
+	struct emu_path *victim = &emu_paths[emu_report.victim];
+
+	/* restore the model, keep the counters */
+	victim->delay_ns = emu_saved_path.delay_ns;
+	victim->rate_bps = emu_saved_path.rate_bps;
+	victim->down = false;
+	victim->cross_bps = 0;
+	victim->backlog = 0;
+
+	emu_scn_active = false;
+	emu_report_print(&emu_report);
+}
+
+static void emu_report_print(struct emu_report *report)
+{
+	printf("================ scenario [%s] ================\n", emu_scenario_name(report->scn));
+	printf("victim path        : %d\n", report->victim);
+	if (report->react_ns)
+	{
+		printf("reaction time (us) : %" PRIu64 "\n", (report->react_ns - report->trigger_ns) / 1000);
+		printf("moved to path      : %d\n", report->react_path);
+	}
+	else
+		printf("reaction time (us) : no repath within %u s\n", emu_param.duration_s);
+	printf("offered (bytes)    : %" PRIu64 "\n", report->offered_bytes);
+	printf("lost (bytes)       : %" PRIu64 "\n", report->lost_bytes);
+	printf("goodput loss       : %.2f %%\n", report->offered_bytes ? 100.0 * report->lost_bytes / report->offered_bytes : 0.0);
+
+	for (int i = 0; i < emu_param.path_nb; i++)
+		printf("path %2d : tx %" PRIu64 " pkts, drop %" PRIu64 " pkts, reorder %" PRIu64 " pkts\n",
+			   i, emu_paths[i].tx_pkts, emu_paths[i].drop_pkts, emu_paths[i].reorder_pkts);
+	printf("fabric drops       : %" PRIu64 "\n", emu_fabric_drops);
+	if (emu_param.int_dscp >= 0)
+		printf("INT stamped        : %" PRIu64 "\n", emu_int_pkts);
+	if (emu_param.class_mask)
+		emu_class_print();
+}
+
+int main(int argc, char *argv[])
+{
+	struct rte_mbuf *recv_mbuf[EMU_BURST_SIZE];
+	const struct hopa_policy *pol[EMU_BURST_SIZE];
+	enum emu_scenario scn_list[] = {EMU_SCN_INCAST, EMU_SCN_PATH_FAIL, EMU_SCN_DRIFT};
+	int scn_nb, scn_idx = 0;
+	uint64_t now_ns, phase_ns;
+	uint16_t port, nb_rx;
+	int i;
+
+	int ret = rte_eal_init(argc, argv);
+	if (ret < 0)
+		rte_exit(EXIT_FAILURE, "Error with EAL initialization\n");
+
+	argc -= ret;
+	argv += ret;
+
+	for (i = 0; i < EMU_MAX_PATHS; i++)
+	{
+		emu_paths[i].delay_ns = EMU_DEF_DELAY_US * 1000;
+		emu_paths[i].rate_bps = (uint64_t)EMU_DEF_RATE_MBPS * 1000000;
+		emu_paths[i].qlimit = EMU_DEF_QLIMIT_KB * 1024;
+		emu_paths[i].reorder_ns = emu_paths[i].delay_ns;
+	}
+
+	emu_param.path_nb = EMU_DEF_PATH_NB;
+	emu_param.base_port = EMU_DEF_BASE_PORT;
+	emu_param.scn = EMU_SCN_NONE;
+	emu_param.warmup_s = EMU_DEF_WARMUP_S;
+	emu_param.duration_s = EMU_DEF_DURATION_S;
+	emu_param.int_dscp = -1;
+	emu_parse_args(&emu_param, argc, argv);
+	if (emu_param.late_ns == 0)
+		emu_param.late_ns = 2 * emu_paths[0].delay_ns;
+	if (emu_param.gen_pps && emu_param.class_mask == 0)
+		rte_exit(EXIT_FAILURE, "-G needs the class, -R or -Q\n");
+
+	if (rte_eth_dev_count_avail() < EMU_PORT_NB)
+		rte_exit(EXIT_FAILURE, "need %d ports (e.g. two net_memif vdevs)\n", EMU_PORT_NB);
+
+	emu_mbuf_pool = rte_pktmbuf_pool_create("EMU_MBUF_POOL", EMU_NUM_MBUFS, EMU_MBUF_CACHE_SIZE, 0,
+											RTE_MBUF_DEFAULT_BUF_SIZE, rte_socket_id());
+	if (emu_mbuf_pool == NULL)
+		rte_exit(EXIT_FAILURE, "Cannot create mbuf pool\n");
+
+	for (port = 0; port < EMU_PORT_NB; port++)
+		if (emu_port_init(port, emu_mbuf_pool) != 0)
+			rte_exit(EXIT_FAILURE, "Cannot init port %" PRIu16 "\n", port);
+
+	emu_heap.size = EMU_MAX_INFLIGHT;
+	emu_heap.ev = rte_zmalloc("emu heap", sizeof(struct emu_event) * EMU_MAX_INFLIGHT, 0);
+	if (emu_heap.ev == NULL)
+		rte_exit(EXIT_FAILURE, "Cannot alloc emu heap\n");
+
+	scn_nb = emu_param.scn == EMU_SCN_NONE ? RTE_DIM(scn_list) : 1;
+	if (emu_param.scn != EMU_SCN_NONE)
+		scn_list[0] = emu_param.scn;
+
+	HOPA_LOG_INFO("emulating %d paths from udp port %d, %d scenario(s)", emu_param.path_nb, emu_param.base_port, scn_nb);
+
+	phase_ns = emu_now_ns();
+	while (scn_idx < scn_nb)
+	{
+		now_ns = emu_now_ns();
+
+		/* scenario clock: warm-up, then degrade for duration_s */
+		if (!emu_scn_active && now_ns - phase_ns >= (uint64_t)emu_param.warmup_s * NS_PER_S)
+		{
+			emu_scenario_start(scn_list[scn_idx], now_ns);
+			phase_ns = now_ns;
+		}
+		else if (emu_scn_active)
+		{
+			emu_scenario_tick(now_ns);
+			if (now_ns - phase_ns >= (uint64_t)emu_param.duration_s * NS_PER_S)
+			{
+				emu_scenario_stop();
+				phase_ns = now_ns;
+				scn_idx++;
+			}
+		}
+
+		for (port = 0; port < EMU_PORT_NB; port++)
+		{
+			nb_rx = rte_eth_rx_burst(port, 0, recv_mbuf, EMU_BURST_SIZE);
+			if (port == EMU_PORT_SENDER)
+				emu_policy_batch(recv_mbuf, nb_rx, now_ns, pol);
+			for (i = 0; i < nb_rx; i++)
+				emu_enqueue(recv_mbuf[i], port == EMU_PORT_SENDER ? EMU_PORT_RECEIVER : EMU_PORT_SENDER, now_ns,
+							port == EMU_PORT_SENDER ? pol[i] : NULL);
+		}
+
+		if (emu_param.gen_pps)
+			emu_gen(now_ns);
+		emu_release(now_ns);
+	}
+
+	rte_eal_cleanup();
+
+	return 0;
+}
@@ -0,0 +1,260 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/syscall.h>
+
+#include "hopa_paths.h"
+
+/*
+ * Lookup cost of the HOPA path table, as an application sees it.
+ *
+ *   hopa_paths_bench [-m <shm name>] [-n peers] [-w updates/s] [-N lookups]
+ *
+ * With -m the table of a running hopa_cp is read. Without, a private table
+ * of -n peers is built here and a writer thread updates it -w times per
+ * second, so readers race a writer as they would against hopa_cp.
+ */
+
+#define BENCH_DEF_PEERS (256)
+#define BENCH_DEF_UPDATES (100000)
+#define BENCH_DEF_LOOKUPS (10000000)
+#define BENCH_BATCH (1024)
+
+static struct hopa_paths *paths;
+static uint32_t *ips;
+static uint32_t n_ips;
+static volatile bool stop;
+static uint64_t n_updates;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void usage(void)
+{
+	printf("Options:\n");
+	printf(" -m <shm name>        Read the table of a running hopa_cp. (default a private table)\n");
+	printf(" -n <peers>           Peers of the private table. (default %d)\n", BENCH_DEF_PEERS);
+	printf(" -w <updates/s>       Writer rate on the private table, 0 for none. (default %d)\n", BENCH_DEF_UPDATES);
+	printf(" -N <lookups>         Lookups per measure. (default %d)\n", BENCH_DEF_LOOKUPS);
+}
+
+/* hopa_cp's paths_publish, without DPDK */
+static void bench_publish(uint32_t ip, uint8_t best, int64_t base)
+{
+	struct hopa_paths_entry *e;
+	int slot;
+
+	slot = hopa_paths_slot(paths, ip);
+	if (slot < 0)
+		return;
+	e = &paths->entries[slot];
+
+	hopa_paths_write_begin(e);
+	e->ip = ip;
+	e->state = HOPA_PATHS_ACTIVE;
+	e->best_path_id = best;
+	e->live_mask = (1 << HOPA_PATHS_PATH_NB) - 1;
+	e->updated_ns = now_ns();
+	for (int i = 0; i < HOPA_PATHS_PATH_NB; i++)
+	{
+		e->delay_ns[i] = base + i * 1000;
+		e->quality[i].loss_ppm = 0;
+		e->quality[i].reorder_ppm = 0;
+		e->quality[i].avail_mbps = 1000 * (i + 1);
+		e->quality[i].capacity_mbps = 10000;
+		e->quality[i].queue = 0;
+		e->quality[i].hop_latency_ns = 0;
+	}
+	hopa_paths_write_end(e);
+}
+
+static void *bench_writer(void *arg)
+{
+	uint64_t rate = *(uint64_t *)arg;
+	uint64_t gap = 1000000000 / rate;
+	uint64_t next = now_ns();
+	uint32_t i = 0;
+
+	while (!stop)
+	{
+		if (now_ns() < next)
+		{
+			hopa_paths_pause();
+			continue;
+		}
+		bench_publish(ips[i], i % HOPA_PATHS_PATH_NB, n_updates);
+		i = (i + 1) % n_ips;
+		n_updates++;
+		next += gap;
+	}
+
+	return NULL;
+}
+
+static struct hopa_paths *bench_private(uint32_t n)
+{
+	struct hopa_paths *p;
+
+	p = mmap(NULL, sizeof(*p), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED)
+		return NULL;
+	p->hdr.magic = HOPA_PATHS_MAGIC;
+	p->hdr.version = HOPA_PATHS_VERSION;
+	p->hdr.n_slots = HOPA_PATHS_SLOTS;
+	p->hdr.path_nb = HOPA_PATHS_PATH_NB;
+	p->hdr.base_port = 5678;
+	paths = p;
+
+	ips = calloc(n, sizeof(*ips));
+	for (uint32_t i = 0; i < n; i++)
+	{
+		ips[i] = (10u << 24) | (1u << 16) | (i + 1); /* 10.1.x.y */
+		bench_publish(ips[i], 0, 0);
+	}
+	n_ips = n;
+
+	return p;
+}
+
+/* the active peers of a live table */
+static void bench_collect(void)
+{
+	struct hopa_paths_entry e;
+
+	ips = calloc(HOPA_PATHS_SLOTS, sizeof(*ips));
+	for (int i = 0; i < HOPA_PATHS_SLOTS; i++)
+	{
+		hopa_paths_read(&paths->entries[i], &e);
+		if (e.state == HOPA_PATHS_ACTIVE)
+			ips[n_ips++] = e.ip;
+	}
+}
+
+/* ns per call over 'n' calls, min batch average in *best */
+static double bench_lookups(uint64_t n, bool hit, double *best, uint64_t *found)
+{
+	struct hopa_paths_info info;
+	uint64_t start, t, total = 0;
+	uint32_t k = 0;
+
+	*best = 1e9;
+	*found = 0;
+	for (uint64_t done = 0; done < n; done += BENCH_BATCH)
+	{
+		start = now_ns();
+		for (int i = 0; i < BENCH_BATCH; i++)
+		{
+			/* misses: 192.0.2.0/24, never a peer */
+			uint32_t ip = hit ? ips[k] : (0xC0000200u | (k & 0xff));
+
+			*found += hopa_paths_lookup(paths, ip, &info) == 0;
+			k = k + 1 == n_ips ? 0 : k + 1;
+		}
+		t = now_ns() - start;
+		total += t;
+		if ((double)t / BENCH_BATCH < *best)
+			*best = (double)t / BENCH_BATCH;
+	}
+
+	return (double)total / (n / BENCH_BATCH * BENCH_BATCH);
+}
+
+static double bench_syscall(uint64_t n)
+{
+	uint64_t start = now_ns();
+
+	for (uint64_t i = 0; i < n; i++)
+		syscall(SYS_getppid);
+
+	return (double)(now_ns() - start) / n;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *name = NULL;
+	uint32_t n_peers = BENCH_DEF_PEERS;
+	uint64_t rate = BENCH_DEF_UPDATES;
+	uint64_t n = BENCH_DEF_LOOKUPS;
+	pthread_t writer;
+	double avg, best;
+	uint64_t found;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "m:n:w:N:h")) != -1)
+	{
+		switch (opt)
+		{
+		case 'm':
+			name = optarg;
+			break;
+		case 'n':
+			n_peers = strtoul(optarg, NULL, 10);
+			break;
+		case 'w':
+			rate = strtoull(optarg, NULL, 10);
+			break;
+		case 'N':
+			n = strtoull(optarg, NULL, 10);
+			break;
+		default:
+			usage();
+			return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+	if (n < BENCH_BATCH)
+		n = BENCH_BATCH;
+
+	if (name != NULL)
+	{
+		paths = hopa_paths_open(name);
+		if (paths == NULL)
+		{
+			printf("cannot map path table %s\n", name);
+			return EXIT_FAILURE;
+		}
+		bench_collect();
+		rate = 0;
+	}
+	else if (n_peers == 0 || n_peers > HOPA_PATHS_SLOTS / 2 || bench_private(n_peers) == NULL)
+	{
+		printf("cannot build a table of %u peers\n", n_peers);
+		return EXIT_FAILURE;
+	}
+	if (n_ips == 0)
+	{
+		printf("no peer in the path table\n");
+		return EXIT_FAILURE;
+	}
+
+	if (rate && pthread_create(&writer, NULL, bench_writer, &rate) != 0)
+	{
+		printf("cannot start the writer\n");
+		return EXIT_FAILURE;
+	}
+
+	printf("%s table, %u peers, writer %" PRIu64 " updates/s, %" PRIu64 " lookups\n",
+		   name ? name : "private", n_ips, rate, n);
+
+	avg = bench_lookups(n, true, &best, &found);
+	printf("lookup hit  : %6.1f ns avg, %6.1f ns best batch, %" PRIu64 " found\n", avg, best, found);
+	avg = bench_lookups(n, false, &best, &found);
+	printf("lookup miss : %6.1f ns avg, %6.1f ns best batch, %" PRIu64 " found\n", avg, best, found);
+	printf("syscall     : %6.1f ns avg (getppid, for comparison)\n", bench_syscall(n / 10));
+
+	if (rate)
+	{
+		stop = true;
+		pthread_join(writer, NULL);
+		printf("writer      : %" PRIu64 " updates\n", n_updates);
+	}
+
+	return EXIT_SUCCESS;
+}